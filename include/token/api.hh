@@ -1,7 +1,10 @@
 #ifndef __TOKEN_API_HH_
 #define __TOKEN_API_HH_
 
+#include "token/api/bulk.hh"
+#include "token/api/inventory.hh"
 #include "token/api/manager.hh"
+#include "token/api/sweeper.hh"
 #include "token/crypto.hh"
 
 namespace token {
@@ -0,0 +1,135 @@
+
+#ifndef __TOKENIZATION_BULK_HH__
+#define __TOKENIZATION_BULK_HH__
+
+#include "token/api/manager.hh"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace token {
+  namespace api {
+
+    /**
+     * Bulk file tokenizer, streams a CSV or newline delimited JSON (NDJSON) file and tokenizes the
+     * selected CSV columns / JSON pointers, each mapped to a vault.
+     *
+     * Records flow through bounded queues between the pipeline stages:
+     *   read -> parse, hash & encrypt (worker pool) -> batched insert -> ordered write-out
+     * The output preserves the input record order.  Repeated values for durable vaults are
+     * resolved once within a sliding window, avoiding repeated lookups and insert conflicts; the
+     * others are looked up with a single query per batch and vault.
+     */
+    class BulkTokenizer {
+     public:
+      enum Format {
+        CSV_FORMAT,   /**< Comma (or delimiter) separated values    */
+        NDJSON_FORMAT /**< One JSON document per line               */
+      };
+
+      /**
+       * Field to vault mapping
+       */
+      struct Field {
+        std::string source; /**< CSV column name (or index without header), or JSON pointer */
+        std::string vault;  /**< Destination vault name                                        */
+      };
+
+      /**
+       * Pipeline options
+       */
+      struct Options {
+        Format               format       = CSV_FORMAT; /**< Input/output record format           */
+        char                 delimiter    = ',';        /**< CSV field delimiter                  */
+        bool                 header       = true;       /**< CSV input starts with a header row   */
+        std::vector< Field > fields;                    /**< Field to vault mappings              */
+        size_t               workers      = 4;          /**< Parse & crypto worker threads        */
+        size_t               batchSize    = 1000;       /**< Records per pipeline batch           */
+        size_t               queueDepth   = 4;          /**< Batches buffered between stages      */
+        size_t               dedupeWindow = 100000;     /**< Durable values remembered per vault  */
+        size_t               readSize     = 1 << 20;    /**< Buffered read size (non-mapped input) */
+      };
+
+      /**
+       * Pipeline counters
+       */
+      struct Stats {
+        size_t records      = 0; /**< Records processed                                   */
+        size_t values       = 0; /**< Values tokenized                                    */
+        size_t created      = 0; /**< New tokens inserted                                 */
+        size_t existing     = 0; /**< Durable values already present in the vault        */
+        size_t deduplicated = 0; /**< Durable values resolved from the dedupe window      */
+        size_t fallbacks    = 0; /**< Values re-tokenized singly after a failed batch     */
+        size_t derived      = 0; /**< Vaultless tokens derived without storage            */
+      };
+
+      /**
+       * @brief Create a bulk tokenizer
+       * @param _manager token manager used for vault access, generation and cryptography
+       * @param _options pipeline options
+       * @throws TokenNoVaultError if a mapped vault does not exist
+       */
+      BulkTokenizer( TokenManager &_manager, Options _options );
+
+      /**
+       * @brief Tokenize a file; regular files are memory mapped, anything else (or "-" for
+       * stdin) is read through large buffered reads
+       * @param path input file path
+       * @param output tokenized record destination
+       * @return pipeline counters
+       */
+      Stats run( const std::string &path, std::ostream &output );
+
+      /**
+       * @brief Tokenize a stream through large buffered reads
+       * @param input record source
+       * @param output tokenized record destination
+       * @return pipeline counters
+       */
+      Stats run( std::istream &input, std::ostream &output );
+
+     private:
+      struct Source;
+      struct Batch;
+      struct Context;
+
+      /**
+       * @brief Execute the pipeline over a record source
+       * @param source record source
+       * @param output tokenized record destination
+       * @return pipeline counters
+       */
+      Stats run( Source &source, std::ostream &output );
+
+      /**
+       * @brief Parse, hash and encrypt the values of a batch (worker stage)
+       * @param batch record batch
+       * @param context pipeline run state
+       */
+      void prepare( Batch &batch, Context &context );
+
+      /**
+       * @brief Resolve duplicates, look up the durable values already tokenized and store the new
+       * tokens of a batch (insert stage)
+       * @param batch record batch
+       * @param context pipeline run state
+       */
+      void store( Batch &batch, Context &context );
+
+      /**
+       * @brief Write the records of a batch with the values replaced by their tokens
+       * @param batch record batch
+       * @param context pipeline run state
+       * @param output record destination
+       */
+      void write( Batch &batch, Context &context, std::ostream &output );
+
+      TokenManager &                   manager; /**< Token manager                          */
+      Options                          options; /**< Pipeline options                       */
+      std::vector< core::SharedVault > vaults;  /**< Vault per field mapping                */
+      std::vector< size_t >            columns; /**< Resolved CSV column per field mapping  */
+    };
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_BULK_HH__
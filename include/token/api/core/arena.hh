@@ -0,0 +1,142 @@
+
+#ifndef __TOKENIZATION_ARENA_HH__
+#define __TOKENIZATION_ARENA_HH__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Per-thread monotonic memory region for the transient buffers of a request
+       *
+       * A request opens an Arena::Scope; while one is open, ArenaAllocator allocations on the
+       * thread are carved from the region and their deallocation is a no-op.  When the outermost
+       * scope closes, the region is wiped (it holds plaintext: value fragments, generated
+       * tokens) and rewound, keeping its chunks for the next request.  Outside of a scope,
+       * ArenaAllocator falls back to the heap, so arena-typed buffers are safe anywhere; they
+       * must not outlive the scope they were allocated in.
+       */
+      class Arena {
+       public:
+        /**
+         * Request scope: the region is reset when the outermost scope of the thread closes
+         */
+        class Scope {
+         public:
+          Scope( );
+          ~Scope( );
+
+          Scope( const Scope & ) = delete;
+          Scope &operator=( const Scope & ) = delete;
+        };
+
+        /**
+         * @brief Get the arena of the thread, if a scope is open
+         * @return thread arena, nullptr outside of a scope
+         */
+        static Arena *current( );
+
+        /**
+         * @brief Allocate from the thread arena (inside a scope) or the heap
+         * @param size number of bytes
+         * @return allocated memory, aligned for any scalar type
+         */
+        static void *allocate( size_t size );
+
+        /**
+         * @brief Release memory from allocate (nothing for arena memory)
+         * @param pointer allocated memory
+         */
+        static void deallocate( void *pointer );
+
+        /**
+         * @brief Get the number of bytes allocated in the region since the last reset
+         * @return bytes in use
+         */
+        size_t used( ) const;
+
+        static const size_t CHUNK_SIZE = 16384; /**< Size of the region chunks */
+
+       private:
+        /**
+         * Region chunk
+         */
+        struct Chunk {
+          std::unique_ptr< char[] > data;     /**< Chunk bytes     */
+          size_t                    size = 0; /**< Chunk size      */
+          size_t                    used = 0; /**< Bytes allocated */
+        };
+
+        /**
+         * @brief Get the arena of the thread
+         * @return thread arena
+         */
+        static Arena &local( );
+
+        /**
+         * @brief Allocate from the region
+         * @param size number of bytes
+         * @return allocated memory
+         */
+        void *carve( size_t size );
+
+        /**
+         * @brief Check whether memory belongs to the region
+         * @param pointer memory
+         * @return true if in one of the chunks
+         */
+        bool owns( const void *pointer ) const;
+
+        /**
+         * @brief Wipe and rewind the region
+         */
+        void reset( );
+
+        std::vector< Chunk > chunks;     /**< Region chunks                   */
+        size_t               active = 0; /**< Chunk receiving the allocations */
+        size_t               depth  = 0; /**< Number of open scopes           */
+      };
+
+      /**
+       * STL allocator over the thread arena (see Arena)
+       */
+      template < typename T >
+      struct ArenaAllocator {
+        using value_type = T;
+
+        ArenaAllocator( ) = default;
+
+        template < typename U >
+        ArenaAllocator( const ArenaAllocator< U > & ) {}
+
+        T *allocate( size_t count ) { return static_cast< T * >( Arena::allocate( count * sizeof( T ) ) ); }
+
+        void deallocate( T *pointer, size_t ) { Arena::deallocate( pointer ); }
+
+        template < typename U >
+        struct rebind {
+          using other = ArenaAllocator< U >;
+        };
+      };
+
+      template < typename T, typename U >
+      bool operator==( const ArenaAllocator< T > &, const ArenaAllocator< U > & ) {
+        return true;
+      }
+
+      template < typename T, typename U >
+      bool operator!=( const ArenaAllocator< T > &, const ArenaAllocator< U > & ) {
+        return false;
+      }
+
+      /** String allocated from the thread arena */
+      using ArenaString = std::basic_string< char, std::char_traits< char >, ArenaAllocator< char > >;
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_ARENA_HH__
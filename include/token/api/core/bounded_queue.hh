@@ -0,0 +1,119 @@
+
+#ifndef __TOKENIZATION_BOUNDED_QUEUE_HH__
+#define __TOKENIZATION_BOUNDED_QUEUE_HH__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Bounded, closable multi-producer/multi-consumer queue.
+       *
+       * Producers block while the queue is full, providing backpressure between pipeline stages;
+       * consumers block while it is empty until the queue is closed and drained.
+       */
+      template < typename T >
+      class BoundedQueue {
+       public:
+        /**
+         * @brief Create a queue
+         * @param _capacity maximum number of queued items (minimum 1)
+         */
+        explicit BoundedQueue( size_t _capacity )
+          : capacity( _capacity > 0 ? _capacity : 1 ) {}
+
+        /**
+         * @brief Add an item, waiting for space
+         * @param item item to queue
+         * @return true on success, false if the queue was closed
+         */
+        bool push( T item ) {
+          std::unique_lock< std::mutex > guard( lock );
+
+          notFull.wait( guard, [ this ]( ) { return closed || ( items.size( ) < capacity ); } );
+
+          if ( closed ) {
+            return false;
+          }
+
+          items.emplace_back( std::move( item ) );
+          notEmpty.notify_one( );
+
+          return true;
+        }
+
+        /**
+         * @brief Add an item without waiting
+         * @param item item to queue
+         * @return true on success, false if the queue is full or closed
+         */
+        bool tryPush( T &item ) {
+          std::lock_guard< std::mutex > guard( lock );
+
+          if ( ( closed ) || ( items.size( ) >= capacity ) ) {
+            return false;
+          }
+
+          items.emplace_back( std::move( item ) );
+          notEmpty.notify_one( );
+
+          return true;
+        }
+
+        /**
+         * @brief Remove an item, waiting for one to become available
+         * @param item output item
+         * @return true on success, false when the queue is closed and empty
+         */
+        bool pop( T &item ) {
+          std::unique_lock< std::mutex > guard( lock );
+
+          notEmpty.wait( guard, [ this ]( ) { return closed || !items.empty( ); } );
+
+          if ( items.empty( ) ) {
+            return false;
+          }
+
+          item = std::move( items.front( ) );
+          items.pop_front( );
+          notFull.notify_one( );
+
+          return true;
+        }
+
+        /**
+         * @brief Close the queue; waiting producers fail, consumers drain the remaining items
+         */
+        void close( ) {
+          std::lock_guard< std::mutex > guard( lock );
+
+          closed = true;
+          notEmpty.notify_all( );
+          notFull.notify_all( );
+        }
+
+        /**
+         * @brief Number of queued items
+         * @return queue depth
+         */
+        size_t size( ) {
+          std::lock_guard< std::mutex > guard( lock );
+          return items.size( );
+        }
+
+       private:
+        const size_t            capacity;       /**< Maximum queue depth       */
+        bool                    closed = false; /**< Queue has been closed     */
+        std::deque< T >         items;          /**< Queued items              */
+        std::mutex              lock;           /**< Queue lock                */
+        std::condition_variable notEmpty;       /**< Consumer wait condition   */
+        std::condition_variable notFull;        /**< Producer wait condition   */
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_BOUNDED_QUEUE_HH__
@@ -2,12 +2,19 @@
 #ifndef __TOKENIZATION_DATABASE_HH__
 #define __TOKENIZATION_DATABASE_HH__
 
+#include "token/api/core/schema.hh"
 #include "token/api/core/vaultinfo.hh"
+#include "token/api/result.hh"
+#include "token/api/token_entries.hh"
 #include "token/api/token_entry.hh"
 #include <boost/thread/lock_guard.hpp>
+#include <atomic>
 #include <boost/thread/shared_mutex.hpp>
+#include <chrono>
 #include <dbc++/dbcpp.hh>
+#include <exception>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <uri/uri.hh>
 
@@ -53,10 +60,85 @@ namespace token {
          * @param cnxCount number of connections
          */
         TokenDB( std::string uri, size_t cxnCount )
-          : dbPool( std::move( uri ), cxnCount ) {
+          : dbPool( uri, cxnCount )
+          , dbUri( std::move( uri ) ) {
           dbPool.setAutoCommit( false );
         }
 
+        virtual ~TokenDB( ) = default;
+
+        /**
+         * Group commit configuration
+         *
+         * When enabled, concurrent inserts into the same table are coalesced into a single
+         * transaction: the first caller leads, collecting followers until the batch reaches
+         * maxBatch or the (adaptive) collection window elapses.  The window never drops below
+         * minWindow, so inserts close in time coalesce from an idle start; it widens while inserts
+         * queue up behind a commit.  Every row is inserted under its own savepoint, so a unique
+         * violation only fails the caller that owns the row.
+         */
+        struct GroupCommit {
+          bool                      enabled   = false; /**< Group commit active                  */
+          size_t                    maxBatch  = 64;    /**< Maximum rows per transaction          */
+          std::chrono::microseconds minWindow = std::chrono::microseconds( 100 );  /**< Minimum wait */
+          std::chrono::microseconds maxWindow = std::chrono::microseconds( 2000 ); /**< Maximum wait */
+        };
+
+        /**
+         * @brief Configure group commit for inserts
+         * @param options group commit configuration
+         */
+        void groupCommit( const GroupCommit &options ) {
+          std::lock_guard< std::mutex > guard( groupLock );
+          groupOptions = options;
+        }
+
+        /**
+         * @brief Get the number of transactions of the group commits
+         * @return group commit transactions
+         */
+        size_t groupCommits( ) const { return groupTransactions.load( std::memory_order_relaxed ); }
+
+        /**
+         * Storage layout of a vault table, from the vault format
+         */
+        struct Layout {
+          size_t                                      prefix  = 0;     /**< Hmac prefix (VaultInfo::hmacPrefix) */
+          bool                                        numeric = false; /**< Numeric tokens (VaultInfo::numeric) */
+          std::shared_ptr< const PropertyDictionary > names;           /**< Property names (propertyNames)      */
+
+          Layout( ) = default;
+          explicit Layout( const VaultInfo &vault )
+            : prefix( vault.hmacPrefix( ) )
+            , numeric( vault.numeric( ) ) {}
+        };
+
+        /**
+         * @brief Configure the tables created for new vaults
+         * @param options vault table options
+         */
+        void schema( const Schema::Options &options ) {
+          std::lock_guard< std::mutex > guard( vaultLock );
+          schemaOptions = options;
+        }
+
+        /**
+         * @brief Set the property names dictionary of a vault: the properties named in the
+         * dictionary are stored as their index (see PropertyDictionary).  The names are kept in
+         * the {table}_properties table, read when the vault is loaded: other processes see names
+         * appended once they load the vault again, so set them before storing properties with them
+         * @param vault vault name
+         * @param names property names, in index order, starting with the names already stored
+         * @throws TokenRangeError if the names do not extend the names stored for the vault
+         */
+        void propertyNames( const std::string &vault, std::vector< std::string > names );
+
+        /**
+         * @brief Create the vaults table, if it does not exist
+         * @throws TokenSQLError if the database has no vault schema
+         */
+        void createVaults( );
+
         /* -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*-
          * Note: The following methods are intended for internal use only; do not call
          * these methods directly
@@ -72,18 +154,28 @@ namespace token {
           SharedVault                   vault;
 
           if ( !( vault = vaults[ name ].lock( ) ) ) {
-            auto connection = dbPool.getConnection( );
-            auto statement  = connection << "SELECT * FROM vaults WHERE ? IN ( alias, tablename )"
-                                        << name;
-            auto rs = statement.executeQuery( );
-
-            if ( rs.next( ) ) {
-              WeakVault weakPtr = vault;
-              auto      cleanup = std::bind( &TokenDB::cleanupCacheEntry, this, weakPtr, name );
-              vault             = std::make_shared< VaultInfo >( rs, cleanup );
-              vaults[ name ]    = weakPtr;
-            } else {
-              throw exceptions::TokenNoVaultError( "'" + name + "': vault not defined" );
+            {
+              auto connection = dbPool.getConnection( );
+              auto statement  = connection << ( std::string( "SELECT " ) + VaultInfo::columns( ) +
+                                                " FROM vaults WHERE ? IN ( alias, tablename )" )
+                                          << name;
+              auto rs = statement.executeQuery( );
+
+              if ( rs.next( ) ) {
+                WeakVault weakPtr = vault;
+                auto      cleanup = std::bind( &TokenDB::cleanupCacheEntry, this, weakPtr, name );
+                vault             = std::make_shared< VaultInfo >( rs, cleanup );
+                vaults[ name ]    = weakPtr;
+
+                layouts[ vault->table ] = Layout( *vault );
+              } else {
+                throw exceptions::TokenNoVaultError( "'" + name + "': vault not defined" );
+              }
+            }
+
+            /* Read once per table: names appended later are picked up by reloadPropertyNames */
+            if ( dictionaries.find( vault->table ) == dictionaries.end( ) ) {
+              dictionaries[ vault->table ] = readPropertyNames( vault->table );
             }
           }
 
@@ -91,11 +183,12 @@ namespace token {
         }
 
         /**
-         * @brief Vault creation
+         * @brief Vault creation: the vault tables and indexes (see Schema), and the vaults entry
          * @param vault creation information
          * @return true on success, false on failure
+         * @throws TokenRangeError if the configured partitioning does not fit the vault
          */
-        virtual bool createVault( const VaultInfo &vault ) { return false; }
+        virtual bool createVault( const VaultInfo &vault );
 
         /**
          * @brief Get a token entry
@@ -105,13 +198,29 @@ namespace token {
          */
         virtual TokenEntry get( const std::string &tableName, const std::string &token );
 
+        /**
+         * @brief Get a token entry into a caller owned entry
+         * @param tableName token vault table name
+         * @param token token value
+         * @param entry [out] token entry (cleared if not found)
+         * @param columns columns to read (the others are left cleared)
+         * @return true if found, false if not
+         */
+        virtual bool get( const std::string &        tableName,
+                          const std::string &        token,
+                          TokenEntry &               entry,
+                          const TokenEntry::Columns &columns = TokenEntry::Columns::all( ) );
+
         /**
          * @brief Get a token entry by the HMAC (hashed value)
          * @param tableName token vault table name
          * @param hmac hashed value
+         * @param columns columns to read (the others are left cleared)
          * @return token entry
          */
-        virtual std::vector< TokenEntry > get( const std::string &tableName, const bytea &hmac );
+        virtual std::vector< TokenEntry > get( const std::string &        tableName,
+                                               const bytea &              hmac,
+                                               const TokenEntry::Columns &columns = TokenEntry::Columns::all( ) );
 
         /**
          * @brief Insert a new token entry
@@ -120,6 +229,51 @@ namespace token {
          */
         virtual void insert( const std::string &tableName, const TokenEntry &entry );
 
+        /**
+         * @brief Insert a batch of token entries within a single transaction
+         * @note Any failure rolls back the whole batch before the exception is propagated
+         * @param tableName token vault table name
+         * @param entries token entries
+         */
+        virtual void insert( const std::string &tableName, const std::vector< TokenEntry > &entries );
+
+        /**
+         * @brief Insert a new token entry, reporting failures as a result code
+         * @param tableName token vault table name
+         * @param entry token entry
+         * @param error [out] failure raised by the database (may be nullptr)
+         * @return OK, DUPLICATE_TOKEN/DUPLICATE_HMAC/DUPLICATE, INVALID (a token the table can not
+         * store), TRANSIENT or FAILED
+         */
+        Result tryInsert( const std::string & tableName,
+                          const TokenEntry &  entry,
+                          std::exception_ptr *error = nullptr ) noexcept;
+
+        /**
+         * @brief Get a token entry into a caller owned entry, reporting failures as a result code
+         * @param tableName token vault table name
+         * @param token token value
+         * @param entry [out] token entry (cleared if not found)
+         * @return OK, NOT_FOUND, TRANSIENT or FAILED
+         */
+        Result tryGet( const std::string &tableName, const std::string &token, TokenEntry &entry ) noexcept;
+
+        /**
+         * @brief Classify a database failure
+         *
+         * The default matches the driver messages of the unique constraints created for a vault
+         * (the token and hmac columns, or their {table}_pkey/_tran_tok_key/_hmac_key names).  The
+         * transient failures are told by the SQLSTATE of the message (see transient), or by the
+         * complete message of the transient error codes (SQLITE_BUSY, SQLITE_LOCKED, and the
+         * PostgreSQL messages of the transient SQLSTATEs); backends with native error codes
+         * override.
+         * @param tableName token vault table name
+         * @param error failure raised by the database (or TokenRangeError, for a token the table can
+         * not store)
+         * @return DUPLICATE_TOKEN/DUPLICATE_HMAC/DUPLICATE, INVALID, TRANSIENT or FAILED
+         */
+        virtual Result classify( const std::string &tableName, const std::exception &error ) noexcept;
+
         /**
          * @brief Remove a token entry
          * @param tableName token vault table name
@@ -190,6 +344,80 @@ namespace token {
                                                  size_t                              limit,
                                                  size_t *                            recordCount );
 
+        /**
+         * @brief Perform a search on a vault, appending the matching records to a compact result
+         * set (see query above for the search criteria)
+         * @param tableName table name of the vault
+         * @param tokens collection of tokens to find
+         * @param hmacs collection of hashed values to find
+         * @param expirations collection of expiration dates to find
+         * @param sortField field to sort on (default: creation_date)
+         * @param sortAsc sort ascending (true), or sort descending (false)
+         * @param offset starting point for the record search (capture offset)
+         * @param limit maximum number of records to retrieve
+         * @param entries [out] result set the records are appended to
+         * @param recordCount output field representing the overall count of records matching the
+         * criteria
+         */
+        virtual void query( const std::string &                 tableName,
+                            const std::vector< std::string > &  tokens,
+                            const std::vector< bytea > &        hmacs,
+                            const std::vector< dbcpp::DBTime > &expirations,
+                            std::string                         sortField,
+                            bool                                sortAsc,
+                            size_t                              offset,
+                            size_t                              limit,
+                            TokenEntries &                      entries,
+                            size_t *                            recordCount );
+
+        /**
+         * @brief Find which of a set of tokens are in use, with a single query
+         * @param tableName token vault table name
+         * @param tokens tokens to check
+         * @return tokens present in the vault
+         */
+        virtual std::vector< std::string > used( const std::string &tableName, const std::vector< std::string > &tokens );
+
+        /**
+         * @brief Find which of a set of hashed values are tokenized, with a single query per
+         * few hundred hashes
+         * @param tableName token vault table name
+         * @param hmacs hashed values to check
+         * @return entries of the hashed values present in the vault (token and hmac only)
+         */
+        virtual std::vector< TokenEntry > existing( const std::string &tableName, const std::vector< bytea > &hmacs );
+
+        /**
+         * @brief Reserve values of a persisted counter (atomically advancing it)
+         * @note Counters live in the vault's counters table ({tableName}_counters, with a scope
+         * key and a counter value), created along with the vault; a scope's row is added on its
+         * first reservation
+         * @param tableName token vault table name
+         * @param scope counter scope
+         * @param count number of values to reserve
+         * @return first value reserved
+         */
+        virtual uint64_t reserve( const std::string &tableName, const std::string &scope, uint64_t count );
+
+        /**
+         * @brief Get the next value of a persisted counter, without advancing it
+         * @param tableName token vault table name
+         * @param scope counter scope
+         * @return number of values reserved so far
+         */
+        virtual uint64_t counter( const std::string &tableName, const std::string &scope );
+
+        /**
+         * @brief Remove a bounded batch of expired entries, earliest expiration first, within a
+         * single short transaction
+         * @note Entries without an expiration are never removed
+         * @param tableName token vault table name
+         * @param before expiration cut-off (entries expiring before this time are removed)
+         * @param limit maximum number of entries to remove
+         * @return number of entries removed
+         */
+        virtual size_t purgeExpired( const std::string &tableName, const dbcpp::DBTime &before, size_t limit );
+
         /**
          * @brief Update the encryption key associated with a vault
          * @note This operation does not re-key existing entries
@@ -230,9 +458,108 @@ namespace token {
         }
 
        protected:
-        std::map< std::string, WeakVault > vaults;    /**< Vault info cache */
-        std::mutex                         vaultLock; /**< Vault cache lock */
-        dbcpp::Pool                        dbPool;    /**< Database pool    */
+        struct CommitGroup;
+
+        /**
+         * @brief Check whether a SQLSTATE reports a transient failure: connection exceptions
+         * (class 08), serialization failures (40001), deadlocks (40P01), lock timeouts (55P03),
+         * cancellations (57014) and administrator shutdowns (57P01)
+         * @param state SQLSTATE
+         * @return true if the operation may succeed when retried
+         */
+        static bool transient( const std::string &state ) noexcept;
+
+        /** Row handler of a search (see select) */
+        using row_f = std::function< void( dbcpp::ResultSet &, Layout & ) >;
+
+        /**
+         * @brief Perform a search on a vault, passing each matching row to a handler (see query)
+         * @param tableName table name of the vault
+         * @param tokens collection of tokens to find
+         * @param hmacs collection of hashed values to find
+         * @param expirations collection of expiration dates to find
+         * @param sortField field to sort on (default: creation_date)
+         * @param sortAsc sort ascending (true), or sort descending (false)
+         * @param offset starting point for the record search (capture offset)
+         * @param limit maximum number of records to retrieve
+         * @param row row handler
+         * @param recordCount output field representing the overall count of records matching the
+         * criteria
+         */
+        void select( const std::string &                 tableName,
+                     const std::vector< std::string > &  tokens,
+                     const std::vector< bytea > &        hmacs,
+                     const std::vector< dbcpp::DBTime > &expirations,
+                     std::string                         sortField,
+                     bool                                sortAsc,
+                     size_t                              offset,
+                     size_t                              limit,
+                     const row_f &                       row,
+                     size_t *                            recordCount );
+
+        /**
+         * @brief Insert a token entry as part of a group commit
+         * @param tableName token vault table name
+         * @param entry token entry
+         * @param options group commit configuration
+         */
+        void groupInsert( const std::string &tableName, const TokenEntry &entry, const GroupCommit &options );
+
+        /**
+         * @brief Read the property names dictionary of a vault table
+         * @param tableName token vault table name
+         * @return property names dictionary, nullptr if no names are stored
+         */
+        std::shared_ptr< const PropertyDictionary > readPropertyNames( const std::string &tableName );
+
+        /**
+         * @brief Reload the property names dictionary of a vault table, after a row used a name
+         * index it does not hold (names appended by another instance)
+         * @param tableName token vault table name
+         * @return property names dictionary (the current one, unless more names are stored)
+         */
+        std::shared_ptr< const PropertyDictionary > reloadPropertyNames( const std::string &tableName );
+
+        /**
+         * @brief Make loaded properties decode, reloading the dictionary of the table once if
+         * they use a name index it does not hold
+         * @param tableName token vault table name
+         * @param table table layout the properties were loaded with, updated on a reload
+         * @param properties loaded properties
+         */
+        void resolve( const std::string &tableName, Layout &table, Properties &properties );
+
+        /**
+         * @brief Get the storage layout of a vault table
+         * @param tableName token vault table name
+         * @return table layout, the defaults (text tokens, full hmac) for an unknown table
+         */
+        Layout layout( const std::string &tableName ) {
+          std::lock_guard< std::mutex > guard( vaultLock );
+          auto                          iter = layouts.find( tableName );
+          auto                          rc   = ( iter != layouts.end( ) ) ? iter->second : Layout( );
+          auto                          dict = dictionaries.find( tableName );
+
+          if ( dict != dictionaries.end( ) ) {
+            rc.names = dict->second;
+          }
+
+          return rc;
+        }
+
+        std::map< std::string, WeakVault > vaults;        /**< Vault info cache      */
+        std::map< std::string, Layout >    layouts;       /**< Layout by table       */
+
+        std::map< std::string, std::shared_ptr< const PropertyDictionary > > dictionaries; /**< Property names by table, read once (see reloadPropertyNames) */
+        std::mutex                         vaultLock;     /**< Vault cache lock      */
+        dbcpp::Pool                        dbPool;        /**< Database pool         */
+        std::string                        dbUri;         /**< Database uri          */
+        Schema::Options                    schemaOptions; /**< Vault table options   */
+
+        std::map< std::string, std::shared_ptr< CommitGroup > > groups;       /**< Commit groups by table */
+        GroupCommit                                             groupOptions; /**< Group commit options   */
+        std::mutex                                              groupLock;    /**< Commit group lock      */
+        std::atomic< size_t >                                   groupTransactions{ 0 }; /**< Group commits */
       };
 
     } // namespace core
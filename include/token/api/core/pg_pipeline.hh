@@ -0,0 +1,174 @@
+
+#ifndef __TOKENIZATION_PG_PIPELINE_HH__
+#define __TOKENIZATION_PG_PIPELINE_HH__
+
+#include "token/api/core/database.hh"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * PostgreSQL token vault storage with pipelined, non-blocking token reads and writes
+       *
+       * The hot path (token and hmac lookups, single inserts) bypasses the connection pool: the
+       * calls are queued to an event loop thread owning a few libpq connections in non-blocking
+       * pipeline mode.  The loop spreads the calls over the connections, with up to depth
+       * statements in flight on each, and completes them as their results arrive (epoll), so the
+       * number of concurrent calls is no longer capped by the number of connections.  Every
+       * statement is followed by its own sync point: it runs as its own transaction, and a failure
+       * does not abort the statements pipelined behind it.
+       *
+       * The other operations (vault management, searches, batches, updates, group commit) use the
+       * connection pool of TokenDB.
+       */
+      class PgPipelineDB : public TokenDB {
+       public:
+        /**
+         * Pipeline configuration
+         */
+        struct Options {
+          size_t                    connections = 2;   /**< Pipelined connections               */
+          size_t                    depth       = 128; /**< Statements in flight per connection */
+          std::chrono::milliseconds retry = std::chrono::milliseconds( 1000 ); /**< Reconnection delay */
+        };
+
+        /**
+         * @brief Create a pipelined token database layer
+         * @param uri stringified uri (psql://, pgsql://, postgres:// or postgresql://)
+         * @param cxnCount number of pooled connections (operations not pipelined)
+         */
+        PgPipelineDB( std::string uri, size_t cxnCount )
+          : PgPipelineDB( std::move( uri ), cxnCount, Options( ) ) {}
+
+        /**
+         * @brief Create a pipelined token database layer
+         * @param uri stringified uri (psql://, pgsql://, postgres:// or postgresql://)
+         * @param cxnCount number of pooled connections (operations not pipelined)
+         * @param options pipeline configuration
+         * @throws TokenSQLError if the event loop cannot be set up
+         */
+        PgPipelineDB( std::string uri, size_t cxnCount, Options options );
+
+        /**
+         * @brief Stop the event loop, once the calls in flight are done
+         */
+        ~PgPipelineDB( ) override;
+
+        PgPipelineDB( const PgPipelineDB & ) = delete;
+        PgPipelineDB &operator=( const PgPipelineDB & ) = delete;
+
+        bool get( const std::string &        tableName,
+                  const std::string &        token,
+                  TokenEntry &               entry,
+                  const TokenEntry::Columns &columns = TokenEntry::Columns::all( ) ) override;
+
+        std::vector< TokenEntry > get( const std::string &        tableName,
+                                       const bytea &              hmac,
+                                       const TokenEntry::Columns &columns = TokenEntry::Columns::all( ) ) override;
+
+        using TokenDB::get;
+
+        void insert( const std::string &tableName, const TokenEntry &entry ) override;
+
+        using TokenDB::insert;
+
+        /**
+         * @brief Classify a database failure, from the SQLSTATE and constraint name of the
+         * pipelined calls (TokenSQLStateError); the other failures are left to TokenDB
+         * @param tableName token vault table name
+         * @param error failure raised by the database
+         * @return DUPLICATE_TOKEN/DUPLICATE_HMAC/DUPLICATE, INVALID, TRANSIENT or FAILED
+         */
+        Result classify( const std::string &tableName, const std::exception &error ) noexcept override;
+
+       protected:
+        struct Request;
+        struct Session;
+
+        /**
+         * @brief Queue a statement to the event loop and wait for its result
+         * @param request statement, completed by the loop
+         * @throws TokenSQLStateError if the statement or its connection fails
+         */
+        void execute( Request &request );
+
+       private:
+        /**
+         * @brief Event loop thread
+         */
+        void run( );
+
+        /**
+         * @brief Start connecting a session
+         * @param session session
+         */
+        void connect( Session &session );
+
+        /**
+         * @brief Set the events a session waits for
+         * @param session session
+         * @param events epoll events
+         */
+        void watch( Session &session, uint32_t events );
+
+        /**
+         * @brief Handle the events of a session's socket
+         * @param session session
+         * @param events epoll events
+         */
+        void service( Session &session, uint32_t events );
+
+        /**
+         * @brief Send the buffered statements of a session
+         * @param session session
+         */
+        void flush( Session &session );
+
+        /**
+         * @brief Read the available results of a session, completing its statements
+         * @param session session
+         */
+        void receive( Session &session );
+
+        /**
+         * @brief Pipeline the queued statements over the sessions with room for them
+         */
+        void dispatch( );
+
+        /**
+         * @brief Close a failed session, failing its statements in flight
+         * @param session session
+         * @param message failure
+         */
+        void drop( Session &session, const std::string &message );
+
+        /**
+         * @brief Complete a statement, waking its caller
+         * @param request statement
+         */
+        static void complete( Request &request );
+
+        Options                                   options;          /**< Pipeline configuration  */
+        std::string                               conninfo;         /**< libpq connection uri    */
+        std::vector< std::unique_ptr< Session > > sessions;         /**< Pipelined connections   */
+        std::deque< Request * >                   queue;            /**< Statements to pipeline  */
+        std::string                               lastError;        /**< Last connection failure */
+        bool                                      stopping = false; /**< Event loop stopping     */
+        std::mutex                                lock;             /**< Queue lock              */
+        int                                       pollFd = -1;      /**< epoll descriptor        */
+        int                                       wakeFd = -1;      /**< Queue eventfd           */
+        std::thread                               loop;             /**< Event loop thread       */
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_PG_PIPELINE_HH__
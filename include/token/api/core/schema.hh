@@ -0,0 +1,100 @@
+
+#ifndef __TOKENIZATION_SCHEMA_HH__
+#define __TOKENIZATION_SCHEMA_HH__
+
+#include "token/api/core/vaultinfo.hh"
+#include <string>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Vault schema (DDL) generation
+       *
+       * Every vault table keeps the unique constraints its tokenization relies on: the token (the
+       * collision check of generated tokens) and, for durable vaults, the hmac (one token per
+       * value).  Vaultless vaults need either one, for their metadata rows.  PostgreSQL requires
+       * the partition key in each unique constraint of a partitioned table, so a partitioning is
+       * only accepted for the vaults whose constraints it can keep: TOKEN_HASH for transactional
+       * vaults, HMAC_HASH for durable permuted or vaultless vaults, CREATED_RANGE for transactional
+       * permuted vaults.  The tokens of permuted vaults are unique by construction: their unique
+       * constraint is kept unless the partitioning cannot keep it.
+       *
+       * Vaults with an hmac prefix (TokenManager::HmacIndex) index the prefix (hkey column) in
+       * place of the hmac; durable vaults then need a prefix of at least 16 bytes to keep it unique.
+       * Vaults with numeric tokens (TokenManager::NUMERIC_TOKENS) store the token as an integer.
+       */
+      class Schema {
+       public:
+        /**
+         * Database dialects
+         */
+        enum Dialect {
+          SQLITE,    /**< SQLite 3 (sqlite://)                   */
+          POSTGRESQL /**< PostgreSQL (psql://, postgresql://)    */
+        };
+
+        /**
+         * Vault table partitioning (PostgreSQL)
+         */
+        enum Partitioning {
+          UNPARTITIONED, /**< Single table                                       */
+          TOKEN_HASH,    /**< Hash partitions on the token                       */
+          HMAC_HASH,     /**< Hash partitions on the hmac                        */
+          CREATED_RANGE  /**< Monthly range partitions on the creation time      */
+        };
+
+        /**
+         * Vault table options
+         */
+        struct Options {
+          bool         tokenHash       = true;          /**< Hash index on the token (PostgreSQL)          */
+          bool         hmacIndex       = true;          /**< B-tree index on the hmac/hkey (not unique)    */
+          bool         expirationIndex = true;          /**< B-tree index on the expiration                */
+          Partitioning partitioning    = UNPARTITIONED; /**< Table partitioning (PostgreSQL)               */
+          size_t       partitions      = 16;            /**< Hash partitions, or monthly range partitions  */
+          unsigned     fillfactor      = 90;            /**< Heap fillfactor (0: server default)           */
+          double       vacuumScale     = 0.05;          /**< autovacuum_vacuum_scale_factor (0: default)   */
+          double       analyzeScale    = 0.02;          /**< autovacuum_analyze_scale_factor (0: default)  */
+          double       insertScale     = 0;             /**< autovacuum_vacuum_insert_scale_factor, 13+    */
+        };
+
+        /**
+         * @brief Get the dialect of a database uri
+         * @param uri database uri
+         * @return dialect
+         * @throws TokenSQLError if the uri scheme is not supported
+         */
+        static Dialect dialect( const std::string &uri );
+
+        /**
+         * @brief Get the statements creating the vaults table
+         * @param dialect database dialect
+         * @return DDL statements
+         */
+        static std::vector< std::string > vaults( Dialect dialect );
+
+        /**
+         * @brief Get the statements creating the tables and indexes of a vault
+         * @param dialect database dialect
+         * @param vault vault information
+         * @param options table options
+         * @return DDL statements
+         * @throws TokenRangeError if the partitioning does not keep the vault's unique constraints
+         */
+        static std::vector< std::string > vault( Dialect dialect, const VaultInfo &vault, const Options &options );
+
+        /**
+         * @brief Get the statements creating the property names table of a vault, if it does not
+         * exist (vaults created by earlier releases have none)
+         * @param table vault table name
+         * @return DDL statements
+         */
+        static std::vector< std::string > properties( const std::string &table );
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_SCHEMA_HH__
@@ -0,0 +1,89 @@
+
+#ifndef __TOKENIZATION_STRING_POOL_HH__
+#define __TOKENIZATION_STRING_POOL_HH__
+
+#include <boost/utility/string_view.hpp>
+#include <memory>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Append-only string storage: strings are copied into large chunks and referenced by
+       * view, so a set of strings sharing a lifetime costs a few allocations rather than one
+       * each.  Views remain valid until the pool is cleared or destroyed (moving the pool keeps
+       * them valid); the bytes are wiped on both, as the pool may hold plaintext.
+       */
+      class StringPool {
+       public:
+        /**
+         * @brief Create a string pool
+         * @param _chunkSize size of the chunks allocated
+         */
+        explicit StringPool( size_t _chunkSize = 16384 )
+          : chunkSize( _chunkSize ) {}
+
+        /**
+         * @brief Take over the chunks of a pool, leaving it empty
+         * @param other pool
+         */
+        StringPool( StringPool &&other ) noexcept;
+
+        /**
+         * @brief Wipe and release the chunks of this pool, then take over those of another
+         * @param other pool, left empty
+         * @return this pool
+         */
+        StringPool &operator=( StringPool &&other ) noexcept;
+
+        StringPool( const StringPool & ) = delete;
+        StringPool &operator=( const StringPool & ) = delete;
+
+        ~StringPool( ) { clear( ); }
+
+        /**
+         * @brief Copy a string into the pool
+         * @param data string bytes
+         * @param size string length
+         * @return view of the pooled copy
+         */
+        boost::string_view store( const void *data, size_t size );
+
+        /**
+         * @brief Copy a string into the pool
+         * @param string string
+         * @return view of the pooled copy
+         */
+        boost::string_view store( boost::string_view string ) { return store( string.data( ), string.size( ) ); }
+
+        /**
+         * @brief Wipe and release all strings, retaining the chunks for reuse
+         */
+        void clear( );
+
+        /**
+         * @brief Get the number of bytes stored
+         * @return bytes stored
+         */
+        size_t used( ) const;
+
+       private:
+        /**
+         * Storage chunk
+         */
+        struct Chunk {
+          std::unique_ptr< char[] > data;     /**< Chunk bytes  */
+          size_t                    size = 0; /**< Chunk size   */
+          size_t                    used = 0; /**< Bytes stored */
+        };
+
+        std::vector< Chunk > chunks;      /**< Allocated chunks                 */
+        size_t               current = 0; /**< Chunk receiving the next strings */
+        size_t               chunkSize;   /**< Default chunk size               */
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_STRING_POOL_HH__
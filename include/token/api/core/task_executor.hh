@@ -0,0 +1,89 @@
+
+#ifndef __TOKENIZATION_TASK_EXECUTOR_HH__
+#define __TOKENIZATION_TASK_EXECUTOR_HH__
+
+#include "token/api/core/bounded_queue.hh"
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Bounded task executor running the asynchronous operations of a TokenManager
+       *
+       * A fixed set of workers runs the tasks of a bounded queue: callers may have up to maxQueue
+       * operations in flight with only the workers blocked on database and crypto I/O, and wait
+       * (backpressure) once the queue is full.
+       */
+      class TaskExecutor {
+       public:
+        /**
+         * Executor configuration
+         */
+        struct Options {
+          size_t workers  = 8;    /**< Worker threads (concurrent operations)            */
+          size_t maxQueue = 4096; /**< Operations queued before submitters wait          */
+        };
+
+        using task_f = std::function< void( ) >;
+
+        /**
+         * @brief Create an executor with the default configuration
+         */
+        TaskExecutor( )
+          : TaskExecutor( Options( ) ) {}
+
+        /**
+         * @brief Create an executor
+         * @param options executor configuration
+         */
+        explicit TaskExecutor( Options options );
+
+        /**
+         * @brief Stop the executor, once the queued tasks are done
+         */
+        ~TaskExecutor( );
+
+        TaskExecutor( const TaskExecutor & ) = delete;
+        TaskExecutor &operator=( const TaskExecutor & ) = delete;
+
+        /**
+         * @brief Queue a task, waiting while the queue is full
+         *
+         * A worker of the executor never waits: a task submitted from a running task (e.g. an
+         * operation started by a completion) is run in place when the queue is full, as the
+         * workers waiting on their own queue would never drain it.
+         * @param task task
+         * @return true on success, false if the executor is stopping
+         */
+        bool submit( task_f task );
+
+        /**
+         * @brief Queue a task without waiting
+         * @param task task (left untouched on failure)
+         * @return true on success, false if the queue is full or the executor is stopping
+         */
+        bool trySubmit( task_f &task ) { return tasks.tryPush( task ); }
+
+        /**
+         * @brief Get the number of queued tasks
+         * @return queue depth
+         */
+        size_t queued( ) { return tasks.size( ); }
+
+       private:
+        /**
+         * @brief Worker thread
+         */
+        void run( );
+
+        BoundedQueue< task_f >     tasks;   /**< Queued tasks   */
+        std::vector< std::thread > workers; /**< Worker threads */
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_TASK_EXECUTOR_HH__
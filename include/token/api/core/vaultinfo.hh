@@ -16,6 +16,24 @@ namespace token {
       struct VaultInfo final : public std::enable_shared_from_this< VaultInfo > {
         using cleanup_f = std::function< void( ) >;
 
+        /** Format bits holding the vault mode (see TokenManager::Mode) */
+        static constexpr size_t MODE_MASK = 0xff00;
+        /** Mode bits of the vaultless modes (TokenManager::FF1_MODE, TokenManager::FF3_1_MODE) */
+        static constexpr size_t VAULTLESS_MASK = 0x0300;
+        /** Mode bit of durable vaults deriving tokens from the value hash (TokenManager::DERIVED_MODE) */
+        static constexpr size_t DERIVED_BIT = 0x0400;
+        /** Mode bit of vaults generating card tokens from a keyed permutation (TokenManager::PERMUTED_MODE) */
+        static constexpr size_t PERMUTED_BIT = 0x0800;
+
+        /** Format bits selecting the hmac lookup prefix (see TokenManager::HmacIndex) */
+        static constexpr size_t PREFIX_MASK = 0x30000;
+        /** Format bit of vaults storing tokens as packed integers (TokenManager::NUMERIC_TOKENS) */
+        static constexpr size_t NUMERIC_BIT = 0x40000;
+        /** Format bit of vaultless vaults reading stored metadata (TokenManager::VAULTLESS_METADATA) */
+        static constexpr size_t METADATA_BIT = 0x80000;
+        /** Format bit of vaultless vaults storing every token (TokenManager::VAULTLESS_REVOCATION) */
+        static constexpr size_t REVOCATION_BIT = 0x100000;
+
         cleanup_f             cleanup;    /**< Cleanup handler                 */
         size_t                format;     /**< Vault token format              */
         std::string           alias;      /**< Vault name                      */
@@ -24,27 +42,97 @@ namespace token {
         std::string           macKeyName; /**< HMAC key name                   */
         token::crypto::EncKey encKey;     /**< Encryption key                  */
         token::crypto::MacKey macKey;     /**< HMAC key                        */
+        token::crypto::FpeKey fpeKey;     /**< FPE key (vaultless vaults)      */
         bool                  durable;    /**< Vault has durable tokens        */
         size_t                length;     /**< Value length: only for creation */
 
+        /**
+         * @brief Get the select list of the vaults table read by load
+         * @return comma separated column names, in load order
+         */
+        static const char *columns( ) { return "format, alias, tablename, enckey, mackey, durable"; }
+
         /**
          * @brief Load the vault information from a result set
-         * @param results result set
+         * @param results result set, selecting columns( )
          */
         void load( const dbcpp::ResultSet &results ) {
-          format     = results.get< size_t >( "FORMAT" );
-          alias      = results.get< std::string >( "ALIAS" );
-          table      = results.get< std::string >( "TABLENAME" );
-          encKeyName = results.get< std::string >( "ENCKEY" );
-          macKeyName = results.get< std::string >( "MACKEY" );
-          durable    = results.get< bool >( "DURABLE" );
+          format     = results.get< size_t >( 0 );
+          alias      = results.get< std::string >( 1 );
+          table      = results.get< std::string >( 2 );
+          encKeyName = results.get< std::string >( 3 );
+          macKeyName = results.get< std::string >( 4 );
+          durable    = results.get< bool >( 5 );
+        }
+
+        /**
+         * @brief Vault mode (format bits above the token format)
+         * @return vault mode, 0 for a vaulted (stored) vault
+         */
+        size_t mode( ) const { return format & MODE_MASK; }
+
+        /**
+         * @brief Token format, without the vault mode
+         * @return token format
+         */
+        size_t tokenFormat( ) const {
+          return format & ~( MODE_MASK | PREFIX_MASK | NUMERIC_BIT | METADATA_BIT | REVOCATION_BIT );
         }
 
+        /**
+         * @brief Identify if tokens are derived from the values (format preserving encryption)
+         * rather than stored
+         * @return true if vaultless, false if not
+         */
+        bool vaultless( ) const { return ( format & VAULTLESS_MASK ) != 0; }
+
+        /**
+         * @brief Identify if a vaultless vault stores every token, refusing the tokens without a
+         * live entry
+         * @return true if revocable, false if not
+         */
+        bool revocable( ) const { return ( format & REVOCATION_BIT ) != 0; }
+
+        /**
+         * @brief Identify if the detokenization of a vaultless vault reads the stored entry
+         * @return true if the entry is read, false if the token is derived only
+         */
+        bool readsEntry( ) const { return ( format & ( METADATA_BIT | REVOCATION_BIT ) ) != 0; }
+
+        /**
+         * @brief Identify if tokens are generated deterministically from the value hash
+         * @return true if derived, false if not
+         */
+        bool derived( ) const { return ( format & DERIVED_BIT ) != 0; }
+
+        /**
+         * @brief Identify if card tokens are generated by walking a keyed permutation
+         * @return true if permuted, false if not
+         */
+        bool permuted( ) const { return ( format & PERMUTED_BIT ) != 0; }
+
+        /**
+         * @brief Length of the hmac prefix stored and indexed as the lookup key (hkey column)
+         * @return prefix length in bytes, 0 if the full hmac is indexed
+         */
+        size_t hmacPrefix( ) const {
+          static const size_t lengths[] = { 0, 8, 16, 32 };
+          return lengths[ ( format & PREFIX_MASK ) >> 16 ];
+        }
+
+        /**
+         * @brief Identify if the tokens are stored as packed integers (TokenEntry::pack)
+         * @return true if numeric, false if stored as text
+         */
+        bool numeric( ) const { return ( format & NUMERIC_BIT ) != 0; }
+
         /**
          * @brief Identify if the encryption keys have been loaded
          * @return true if loaded, false if not
          */
-        bool hasKeys( ) { return ( encKey != nullptr ) && ( macKey != nullptr ); }
+        bool hasKeys( ) {
+          return ( vaultless( ) ? ( fpeKey != nullptr ) : ( encKey != nullptr ) ) && ( macKey != nullptr );
+        }
 
         /**
          * @brief Load the encryption keys
@@ -53,7 +141,11 @@ namespace token {
          */
         VaultInfo &loadKeys( crypto::Provider *provider ) {
           if ( ( provider != nullptr ) && ( !hasKeys( ) ) ) {
-            if ( !( encKey = provider->getEncKey( encKeyName ) ) ) {
+            if ( vaultless( ) ) {
+              if ( !( fpeKey = provider->getFpeKey( encKeyName ) ) ) {
+                throw exceptions::TokenCryptographyError( "Error acquiring key: " + encKeyName );
+              }
+            } else if ( !( encKey = provider->getEncKey( encKeyName ) ) ) {
               throw exceptions::TokenCryptographyError( "Error acquiring key: " + encKeyName );
             }
 
@@ -0,0 +1,88 @@
+
+#ifndef __TOKENIZATION_WORK_POOL_HH__
+#define __TOKENIZATION_WORK_POOL_HH__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /**
+       * Work-stealing thread pool for data parallel stages (e.g. decrypting a large result set)
+       *
+       * Each worker owns a task deque: run() spreads its tasks across the deques, a worker takes
+       * from the back of its own and steals from the front of the others once it runs dry.  The
+       * calling thread helps until its tasks are done, so several callers may share a pool.
+       */
+      class WorkPool {
+       public:
+        /**
+         * @brief Create a pool
+         * @param threads number of worker threads (0: tasks run on the calling thread)
+         */
+        explicit WorkPool( size_t threads );
+
+        /**
+         * @brief Stop the pool, once the queued tasks are done
+         */
+        ~WorkPool( );
+
+        WorkPool( const WorkPool & ) = delete;
+        WorkPool &operator=( const WorkPool & ) = delete;
+
+        /**
+         * @brief Run tasks across the pool, waiting for them all
+         * @param count number of tasks
+         * @param task task, called with the index of each task (0 to count - 1)
+         * @throws the first exception raised by a task, once all are done
+         */
+        void run( size_t count, const std::function< void( size_t ) > &task );
+
+        /**
+         * @brief Get the number of worker threads
+         * @return worker threads
+         */
+        size_t size( ) const { return threads.size( ); }
+
+       private:
+        /**
+         * Task deque of a worker
+         */
+        struct Queue {
+          std::mutex                             lock;  /**< Deque lock */
+          std::deque< std::function< void( ) > > tasks; /**< Tasks      */
+        };
+
+        /**
+         * @brief Take a task: from the back of a worker's own deque, else from the front of another
+         * @param self worker index (the size of the pool for a calling thread, owning no deque)
+         * @param task [out] task
+         * @return true if a task was taken, false if all deques are empty
+         */
+        bool take( size_t self, std::function< void( ) > &task );
+
+        /**
+         * @brief Worker thread
+         * @param self worker index
+         */
+        void work( size_t self );
+
+        std::vector< std::unique_ptr< Queue > > queues;          /**< Task deque per worker      */
+        std::vector< std::thread >              threads;         /**< Worker threads             */
+        size_t                                  next    = 0;     /**< Next deque to fill         */
+        size_t                                  pending = 0;     /**< Tasks queued               */
+        bool                                    stopped = false; /**< Pool stopping              */
+        std::mutex                              lock;            /**< Pool lock                  */
+        std::condition_variable                 ready;           /**< Signalled when tasks queue */
+      };
+    } // namespace core
+  }   // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_WORK_POOL_HH__
@@ -0,0 +1,172 @@
+
+#ifndef __TOKENIZATION_INVENTORY_HH__
+#define __TOKENIZATION_INVENTORY_HH__
+
+#include "token/api/core/vaultinfo.hh"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace token {
+  namespace api {
+    class TokenManager;
+
+    /**
+     * Token inventory, pre-generates candidate tokens in the background.
+     *
+     * Candidates are kept per vault and token shape: the preserved prefix, suffix and length for
+     * card number formats, or the character classes of the value for the other formats (the only
+     * parts of a value a generator looks at).  A background thread generates candidates and
+     * verifies them unused with a single storage query per batch, so a foreground tokenization
+     * pops a known free token instead of entering the generate/insert/retry loop.  When a shape
+     * drops below its low-water mark it is queued for refill; a shape seen for the first time
+     * misses, and is generated the usual way while its candidates are prepared.
+     *
+     * Candidates are free when verified: another process sharing the vault may still take one,
+     * in which case the insert fails and the usual retry applies.
+     *
+     * Only vaults generating random tokens use the inventory (not the vaultless, derived or
+     * permuted modes).  A TokenManager uses an inventory set with TokenManager::inventory.
+     */
+    class TokenInventory {
+     public:
+      /**
+       * Inventory configuration
+       */
+      struct Options {
+        size_t               lowWater  = 32;   /**< Candidates per shape below which a refill is queued */
+        size_t               highWater = 128;  /**< Candidates per shape after a refill                 */
+        size_t               batchSize = 64;   /**< Candidates verified per storage query               */
+        size_t               maxShapes = 4096; /**< Shapes tracked (others always miss)                 */
+        std::chrono::seconds report{ 0 };      /**< Interval between metrics log lines (0: never)       */
+      };
+
+      /**
+       * Inventory counters
+       */
+      struct Metrics {
+        size_t hits      = 0; /**< Tokens taken from the inventory                  */
+        size_t misses    = 0; /**< Tokenizations without a candidate available      */
+        size_t generated = 0; /**< Candidates generated                             */
+        size_t used      = 0; /**< Candidates discarded, found in use when verified */
+        size_t refills   = 0; /**< Refills performed                                */
+        size_t available = 0; /**< Candidates currently held                        */
+        size_t shapes    = 0; /**< Shapes currently tracked                         */
+      };
+
+      /**
+       * @brief Create an inventory with the default configuration
+       * @param _manager token manager generating and verifying the candidates
+       */
+      explicit TokenInventory( TokenManager &_manager )
+        : manager( _manager ) {}
+
+      /**
+       * @brief Create an inventory
+       * @param _manager token manager generating and verifying the candidates
+       * @param _options inventory configuration
+       */
+      TokenInventory( TokenManager &_manager, Options _options )
+        : manager( _manager )
+        , options( _options ) {}
+
+      TokenInventory( const TokenInventory & ) = delete;
+      TokenInventory &operator=( const TokenInventory & ) = delete;
+
+      ~TokenInventory( ) { stop( ); }
+
+      /**
+       * @brief Take a candidate token for a value
+       * @param vault vault information
+       * @param value value to tokenize
+       * @param token [out] token
+       * @param mask [out] masked value (may be nullptr)
+       * @return true if a candidate was taken, false on a miss
+       */
+      bool take( core::SharedVault vault, const std::string &value, std::string &token, std::string *mask );
+
+      /**
+       * @brief Fill the candidates of a value's shape up to the high-water mark, on the calling
+       * thread (e.g. to warm up before traffic)
+       * @param vault token vault
+       * @param value a value of the shape
+       */
+      void refill( const std::string &vault, const std::string &value );
+
+      /**
+       * @brief Start the background refill thread
+       */
+      void start( );
+
+      /**
+       * @brief Stop the background refill thread, after the refill in progress
+       */
+      void stop( );
+
+      /**
+       * @brief Get the inventory counters
+       * @return counters
+       */
+      Metrics metrics( );
+
+     private:
+      /**
+       * Candidates of one vault and token shape
+       */
+      struct Shape {
+        core::SharedVault                                   vault;          /**< Vault information  */
+        std::string                                         sample;         /**< Value of the shape */
+        std::deque< std::pair< std::string, std::string > > candidates;     /**< Tokens and masks   */
+        std::unordered_set< std::string >                   tokens;         /**< Tokens held        */
+        bool                                                queued = false; /**< Queued for refill  */
+      };
+
+      /**
+       * @brief Get the shape of a value: the value with each generated character replaced by a
+       * representative of its class
+       * @param vault vault information
+       * @param value value
+       * @return shape sample
+       */
+      static std::string shape( const core::VaultInfo &vault, const std::string &value );
+
+      /**
+       * @brief Track a shape, queueing its first refill
+       * @param vault vault information
+       * @param sample shape sample
+       * @return shape key, empty if the inventory is full
+       */
+      std::string track( core::SharedVault vault, const std::string &sample );
+
+      /**
+       * @brief Generate, verify and add candidates to a shape
+       * @param key shape key
+       * @return false if the shape is no longer tracked
+       */
+      bool fill( const std::string &key );
+
+      /**
+       * @brief Background refill loop
+       */
+      void run( );
+
+      TokenManager &                           manager;          /**< Token manager              */
+      Options                                  options;          /**< Inventory configuration    */
+      std::unordered_map< std::string, Shape > shapes;           /**< Candidates by shape key    */
+      std::deque< std::string >                pending;          /**< Shapes queued for refill   */
+      Metrics                                  counters;         /**< Inventory counters         */
+      std::mutex                               lock;             /**< Inventory lock             */
+      std::condition_variable                  wakeup;           /**< Refill queued/stop signal  */
+      std::thread                              thread;           /**< Background refill thread   */
+      bool                                     running  = false; /**< Background refill active   */
+      bool                                     stopping = false; /**< Background refill stopping */
+    };
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_INVENTORY_HH__
@@ -3,14 +3,20 @@
 #define __TOKENIZATION_MANAGER_HH__
 
 #include "token/api/core/database.hh"
+#include "token/api/core/task_executor.hh"
+#include "token/api/core/work_pool.hh"
+#include "token/api/result.hh"
 #include "token/api/status.hh"
 #include "token/api/token_entry.hh"
 #include "token/crypto.hh"
+#include <boost/utility/string_view.hpp>
 #include <functional>
+#include <future>
 #include <memory>
 
 namespace token {
   namespace api {
+    class TokenInventory;
 
     /**
      * Token manager, provides methods of interfacing with the token vault by way of the cryptographic
@@ -20,6 +26,8 @@ namespace token {
      public:
       using RandBytes = std::function< void( void *data, size_t length ) >;
       using Generator = std::function< std::string( RandBytes, std::string, std::string * ) >;
+      /** Completion of an asynchronous operation: the result code and the entry */
+      using Completion = std::function< void( Result result, TokenEntry &entry ) >;
 
       /**
        * @brief Construct token manager instance
@@ -39,6 +47,16 @@ namespace token {
        */
       TokenEntry tokenize( const std::string &vault, const std::string &value, TokenEntry *data );
 
+      /**
+       * @brief Generate a token for the specified value, filling a caller owned entry
+       * @note The entry's token (when not empty), expiration and properties are taken as input; all
+       * other fields are overwritten in place, so a reused entry retains its storage between calls
+       * @param vault token vault to store the entry
+       * @param value raw value to tokenize
+       * @param entry [in/out] token entry representing the stored data
+       */
+      void tokenize( boost::string_view vault, boost::string_view value, TokenEntry &entry );
+
       /**
        * @brief Get the stored values for the specified token
        * @param vault token vault in which the token resides
@@ -47,6 +65,66 @@ namespace token {
        */
       TokenEntry detokenize( const std::string &vault, const std::string &token );
 
+      /**
+       * @brief Get the stored values for the specified token, filling a caller owned entry
+       * @note The value is decrypted directly into the entry's value storage
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @param entry [out] token entry representing the stored data (cleared if not found)
+       * @return true if found, false if not
+       */
+      bool detokenize( boost::string_view vault, boost::string_view token, TokenEntry &entry );
+
+      /**
+       * @brief Generate a token for the specified value, reporting failures as a result code
+       * @note Token collisions are retried without raising exceptions; see tokenize
+       * @param vault token vault to store the entry
+       * @param value raw value to tokenize
+       * @param entry [in/out] token entry representing the stored data
+       * @return OK, NO_VAULT, INVALID, DUPLICATE_TOKEN (retries exhausted), DUPLICATE_HMAC,
+       * TRANSIENT, CRYPTO or FAILED
+       */
+      Result tryTokenize( boost::string_view vault, boost::string_view value, TokenEntry &entry ) noexcept;
+
+      /**
+       * @brief Get the stored values for the specified token, reporting failures as a result code
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @param entry [out] token entry representing the stored data (cleared if not found)
+       * @return OK, NOT_FOUND, NO_VAULT, TRANSIENT, CRYPTO or FAILED
+       */
+      Result tryDetokenize( boost::string_view vault, boost::string_view token, TokenEntry &entry ) noexcept;
+
+      /**
+       * @brief Get the token of an already tokenized value (token-only lookup): only the token is
+       * read, nothing is decrypted and no token is generated
+       * @param vault token vault in which the value resides
+       * @param value raw value
+       * @param token [out] token (cleared if not found)
+       * @return true if found, false if not
+       */
+      bool lookup( boost::string_view vault, boost::string_view value, std::string &token );
+
+      /**
+       * @brief Get the masked value of a token (mask-only detokenization): only the mask is read,
+       * nothing is decrypted
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @param mask [out] raw value masked (cleared if not found)
+       * @return true if found, false if not
+       */
+      bool mask( boost::string_view vault, boost::string_view token, std::string &mask );
+
+      /**
+       * @brief Get the metadata of a token (metadata-only lookup): only the token, expiration and
+       * properties are read, nothing is decrypted
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @param entry [out] token entry holding the metadata (cleared if not found)
+       * @return true if found, false if not (including vaultless tokens without stored metadata)
+       */
+      bool metadata( boost::string_view vault, boost::string_view token, TokenEntry &entry );
+
       /**
        * @brief Get the stored values for the specified value
        * @param vault token vault in which the value resides
@@ -95,6 +173,104 @@ namespace token {
                                        size_t                              limit,
                                        size_t *                            recordCount );
 
+      /**
+       * @brief Perform a search on a vault, appending the records to a compact result set (see
+       * query above for the search criteria)
+       * @note The values are decrypted on first access (TokenEntries::value, TokenEntries::decrypt),
+       * through this manager: the result set must not outlive it
+       * @param vault name of the vault
+       * @param tokens collection of tokens to find
+       * @param values collection of raw values to find
+       * @param expirations collection of expiration dates to find
+       * @param offset starting point for the record search (capture offset)
+       * @param limit maximum number of records to retrieve
+       * @param entries [out] result set the records are appended to
+       * @param recordCount output field representing the overall count of records matching the
+       * criteria
+       */
+      void query( const std::string &                 vault,
+                  const std::vector< std::string > &  tokens,
+                  const std::vector< std::string > &  values,
+                  const std::vector< dbcpp::DBTime > &expirations,
+                  const std::string &                 sortField,
+                  bool                                sortAsc,
+                  size_t                              offset,
+                  size_t                              limit,
+                  TokenEntries &                      entries,
+                  size_t *                            recordCount );
+
+      /**
+       * @brief Generate a token asynchronously (see tokenize)
+       * @note The asynchronous operations run on the task executor of the manager (see
+       * asyncExecutor), waiting while its queue is full (started from a completion, they run in
+       * place instead); the manager must outlive them
+       * @param vault token vault to store the entry
+       * @param value raw value to tokenize
+       * @param entry token entry containing additional data
+       * @return future token entry, holding the exception of a failure
+       */
+      std::future< TokenEntry > tokenizeAsync( std::string vault, std::string value, TokenEntry entry = TokenEntry( ) );
+
+      /**
+       * @brief Generate a token asynchronously, reporting to a completion (see tryTokenize)
+       * @param vault token vault to store the entry
+       * @param value raw value to tokenize
+       * @param entry token entry containing additional data
+       * @param done completion, called on an executor thread
+       */
+      void tokenizeAsync( std::string vault, std::string value, TokenEntry entry, Completion done );
+
+      /**
+       * @brief Get the stored values for a token asynchronously (see detokenize)
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @return future token entry (empty if not found), holding the exception of a failure
+       */
+      std::future< TokenEntry > detokenizeAsync( std::string vault, std::string token );
+
+      /**
+       * @brief Get the stored values for a token asynchronously, reporting to a completion (see
+       * tryDetokenize)
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @param done completion, called on an executor thread
+       */
+      void detokenizeAsync( std::string vault, std::string token, Completion done );
+
+      /**
+       * @brief Get the stored values for a value asynchronously (see retrieve)
+       * @param vault token vault in which the value resides
+       * @param value raw value
+       * @return future token entries, holding the exception of a failure
+       */
+      std::future< std::vector< TokenEntry > > retrieveAsync( std::string vault, std::string value );
+
+      /**
+       * @brief Remove a token asynchronously (see remove)
+       * @param vault token vault in which the token resides
+       * @param token tokenized value
+       * @return future removed token entry, holding the exception of a failure
+       */
+      std::future< TokenEntry > removeAsync( std::string vault, std::string token );
+
+      /**
+       * @brief Update the values associated with a token asynchronously (see update)
+       * @param vault token vault in which the token resides
+       * @param entry token values
+       * @return future updated token entry, holding the exception of a failure
+       */
+      std::future< TokenEntry > updateAsync( std::string vault, TokenEntry entry );
+
+      /**
+       * @brief Use a task executor for the asynchronous operations
+       * @note Set before the first asynchronous operation, otherwise an executor with the default
+       * configuration is created by it; an executor may be shared by several managers
+       * @param executor task executor
+       */
+      void asyncExecutor( std::shared_ptr< core::TaskExecutor > executor ) {
+        std::atomic_store( &asyncTasks, std::move( executor ) );
+      }
+
       /**
        * Get the general operational status of the service
        * @return operational status
@@ -112,10 +288,11 @@ namespace token {
        * @param alias vault name
        * @param encKey encryption key name
        * @param macKey hash key name
-       * @param format token format
+       * @param format token format, with the vault mode and storage options (see Mode, HmacIndex, Storage)
        * @param value_len length of the value
-       * @param durable vault is durable
+       * @param durable vault is durable (always true for DERIVED_MODE)
        * @param tableName name of the table (empty: construct from alias, len, format and durability flag)
+       * @throws TokenRangeError if NUMERIC_TOKENS is not applicable to the format or length
        */
       bool createVault( const std::string &alias,
                         const std::string &encKey,
@@ -208,6 +385,7 @@ namespace token {
          * @brief Tokenization format of a randomized card number
          * failing a LUHN check where the last 4 are the same as
          * the original value
+         * @note The NOLUHN formats refuse some values in the vaultless modes (see FF1_MODE)
          */
         L4_NOLUHN_FORMAT,
         /**
@@ -230,16 +408,246 @@ namespace token {
         F6L4_NOLUHN_FORMAT,
       };
 
+      /**
+       * Vault modes, combined with the token format (format | mode) when creating a vault
+       */
+      enum Mode {
+        /**
+         * @brief Tokens are random, and stored with the encrypted value
+         */
+        VAULTED_MODE = 0x000,
+        /**
+         * @brief Tokens are derived from the values by FF1 format preserving encryption (NIST
+         * SP 800-38G), the encryption key naming a block cipher key (provider getFpeKey).
+         * Tokenization and detokenization are computed without storage; only entries with
+         * properties or an expiration are stored, and returned by retrieve and query (see
+         * VaultlessEntries to read them on detokenization)
+         * @note Card number tokens keep the Luhn residue class of their value, the NOLUHN formats
+         * shifting it by 5: values of residue 5 (about 1 in 10 arbitrary numbers, never a valid
+         * card number) would pass a Luhn check, and are refused (TokenRangeError).  The 9 classes
+         * of tokens failing a Luhn check can not hold the 10 classes of values, so no walk avoids it.
+         */
+        FF1_MODE = 0x100,
+        /**
+         * @brief Tokens are derived from the values by FF3-1 format preserving encryption (NIST
+         * SP 800-38G Rev. 1), as with FF1_MODE
+         */
+        FF3_1_MODE = 0x200,
+        /**
+         * @brief Durable vault whose tokens are generated from the value HMAC: the format generator
+         * draws from an HMAC_DRBG seeded by the HMAC (and a collision counter), so concurrent
+         * tokenizations of a value produce the same token without a lookup before the insert
+         */
+        DERIVED_MODE = 0x400,
+        /**
+         * @brief Card number formats only: tokens are generated by walking a keyed pseudorandom
+         * permutation of the free digits, one persisted counter per preserved prefix and suffix,
+         * so every token is new without unique violation retries (see keyspace)
+         */
+        PERMUTED_MODE = 0x800,
+      };
+
+      /**
+       * Compact hmac lookup keys, combined with the token format and vault mode when creating a
+       * vault: the rows also store a prefix of the hmac, which replaces the hmac in the lookup
+       * index (and in the unique constraint of durable vaults); the full hmac is still compared
+       */
+      enum HmacIndex {
+        HMAC_INDEX_8  = 0x10000, /**< 8 byte prefix (transactional vaults only)  */
+        HMAC_INDEX_16 = 0x20000, /**< 16 byte prefix                             */
+        HMAC_INDEX_32 = 0x30000, /**< 32 byte prefix                             */
+      };
+
+      /**
+       * Token storage, combined with the token format when creating a vault
+       */
+      enum Storage {
+        /**
+         * @brief Card number formats (L4_FORMAT to F6L4_NOLUHN_FORMAT), and DATE_FORMAT outside of
+         * the vaultless modes, of up to 18 digits only: tokens are stored as packed integers
+         * (TokenEntry::pack) rather than text, shrinking the token index and its comparisons.
+         * Tokens that are not 1 to 18 digits can not be stored (TokenRangeError), and are never
+         * found
+         */
+        NUMERIC_TOKENS = 0x40000,
+      };
+
+      /**
+       * Stored entries of the vaultless modes (FF1_MODE, FF3_1_MODE), combined with the token
+       * format and vault mode when creating a vault: the stored entries keep the token, value
+       * HMAC, mask and metadata, never the value
+       */
+      enum VaultlessEntries {
+        /**
+         * @brief Detokenization reads the stored entry of the token, if any: its mask and
+         * metadata are returned, and an expired token is refused
+         */
+        VAULTLESS_METADATA = 0x80000,
+        /**
+         * @brief Every tokenization stores the token entry, and detokenization refuses the tokens
+         * without a live entry: removed, expired and never issued tokens.  Value lookups
+         * (lookup, retrieve) read the stored entries only
+         */
+        VAULTLESS_REVOCATION = 0x100000,
+      };
+
+      /**
+       * Keyspace usage of a permuted vault, for one preserved prefix and suffix
+       */
+      struct Keyspace {
+        uint64_t used = 0; /**< Tokens generated (counter values consumed) */
+        uint64_t size = 0; /**< Tokens available in total                  */
+      };
+
+      /**
+       * @brief Get the keyspace usage of a permuted vault (PERMUTED_MODE)
+       * @param vault name or alias of the vault
+       * @param value a value (or token) sharing the preserved prefix and suffix
+       * @return keyspace usage
+       * @throws InvalidTokenFormat if the vault is not a permuted card number vault
+       */
+      Keyspace keyspace( const std::string &vault, const std::string &value );
+
+      /**
+       * @brief Use a token inventory for the random token vaults
+       * @note Set before tokenizing; the inventory must outlive its use by this manager
+       * @param inventory pre-generated token inventory (nullptr: generate every token)
+       */
+      void inventory( std::shared_ptr< TokenInventory > inventory ) { candidates = std::move( inventory ); }
+
+      /**
+       * @brief Decrypt large result sets (query, TokenEntries::decrypt) across a work pool
+       * @note Set before querying; the rows are decrypted in batches per key, smaller result sets
+       * stay on the calling thread
+       * @param pool work pool (nullptr: decrypt on the calling thread)
+       * @param threshold minimum number of rows decrypted in parallel
+       */
+      void parallelDecrypt( std::shared_ptr< core::WorkPool > pool, size_t threshold = 1024 ) {
+        decryptPool      = std::move( pool );
+        decryptThreshold = threshold;
+      }
+
      protected:
+      /**
+       * @brief Get the task executor of the asynchronous operations, creating the default one
+       * @return task executor
+       */
+      std::shared_ptr< core::TaskExecutor > executor( );
+
       /**
        * @brief Generate a token for the supplied value
        * @param vault vault information
        * @param value value to tokenize
        * @param mask masked value
+       * @param rand random byte source (nullptr: the provider)
        * @return generated token
        * @throws InvalidTokenFormat if the format specified does not have a generator
        */
-      std::string generate( core::SharedVault vault, const std::string &value, std::string *mask );
+      std::string generate( core::SharedVault vault, const std::string &value, std::string *mask, RandBytes rand = nullptr );
+
+      /**
+       * @brief Generate the token of a value for a derived (DERIVED_MODE) vault
+       * @param vault vault information
+       * @param value value to tokenize
+       * @param hmac value hash
+       * @param counter collision counter (0 for the first candidate token)
+       * @param mask masked value
+       * @return generated token, the same for every call with the same hash and counter
+       */
+      std::string generate( core::SharedVault    vault,
+                            const std::string &  value,
+                            const bytea &        hmac,
+                            uint64_t             counter,
+                            std::string *        mask );
+
+      /**
+       * @brief Derive the token of a value, or the value of a token, for a vaultless vault
+       * @param vault vault information
+       * @param input value (encrypt) or token (decrypt)
+       * @param encrypt true to derive the token, false to derive the value
+       * @param mask masked value (may be nullptr)
+       * @return token or value
+       * @throws InvalidTokenFormat if the format is not supported by the vault mode
+       * @throws TokenRangeError if the input does not fit the format
+       */
+      std::string derive( core::SharedVault vault, boost::string_view input, bool encrypt, std::string *mask );
+
+      /**
+       * @brief Mask a token of a vaultless vault without deciphering it: the characters left in the
+       * clear are preserved between the value and its token
+       * @param vault vault information
+       * @param token token
+       * @return raw value masked
+       * @throws InvalidTokenFormat if the format is not supported by the vault mode
+       * @throws TokenRangeError if the token does not fit the format
+       */
+      std::string deriveMask( core::SharedVault vault, boost::string_view token );
+
+      /**
+       * @brief Generate a token for a permuted vault (PERMUTED_MODE), reserving the next counter
+       * value of the value's prefix and suffix
+       * @param vault vault information
+       * @param value value to tokenize
+       * @param mask masked value
+       * @return generated token
+       * @throws TokenRangeError if the keyspace is exhausted
+       */
+      std::string permute( core::SharedVault vault, const std::string &value, std::string *mask );
+
+      /**
+       * @brief Fill in a new token entry: generate the token (unless one is supplied), then hash
+       * (unless already hashed) and encrypt the value
+       * @param vault vault information
+       * @param value value to tokenize
+       * @param entry token entry to complete
+       */
+      void prepare( core::SharedVault vault, boost::string_view value, TokenEntry &entry );
+
+      /**
+       * @brief Tokenize a value, reporting storage failures as a result code
+       * @param vault vault information
+       * @param value raw value to tokenize
+       * @param entry [in/out] token entry representing the stored data
+       * @param error [out] storage failure behind a result other than OK (may be nullptr)
+       * @return OK, or the result of the failed insert
+       */
+      Result tokenize( core::SharedVault vault, boost::string_view value, TokenEntry &entry, std::exception_ptr *error );
+
+      /**
+       * @brief Fill in a set of new token entries from their values (entry.value), batching the
+       * hashing and encryption; tokens are generated for entries without one, and entries already
+       * hashed are not hashed again
+       * @param vault vault information
+       * @param entries token entries to complete
+       */
+      void prepare( core::SharedVault vault, const std::vector< TokenEntry * > &entries );
+
+      /**
+       * @brief Decrypt the values of a set of entries, batching the entries sharing a key
+       * @param vault vault information
+       * @param entries token entries
+       */
+      void decrypt( core::SharedVault vault, std::vector< TokenEntry > &entries );
+
+      /**
+       * @brief Decrypt values, resolving each distinct key once, in batches per key (across the
+       * decryption pool above its threshold, see parallelDecrypt)
+       * @param vault vault information
+       * @param keys encryption key name of each value (empty: the vault key)
+       * @param crypts encrypted values (empty ones are skipped)
+       * @return decrypted values, in the order of the encrypted values
+       */
+      std::vector< bytea > decrypt( core::SharedVault                        vault,
+                                    const std::vector< boost::string_view > &keys,
+                                    const std::vector< crypto::bytes_view > &crypts );
+
+      /**
+       * @brief Decrypt the values of entries of a compact result set, a batch per key
+       * @param vault vault information
+       * @param entries result set
+       * @param rows entries to decrypt
+       */
+      void decrypt( core::SharedVault vault, TokenEntries &entries, const std::vector< size_t > &rows );
 
       /**
        * @brief Get the vault information, and keys
@@ -253,6 +661,9 @@ namespace token {
       }
 
      private:
+      friend class BulkTokenizer;
+      friend class TokenInventory;
+
       using GeneratorMap = std::map< size_t, Generator >;
 
       /** RWLock for the token generators */
@@ -263,6 +674,14 @@ namespace token {
       std::shared_ptr< crypto::Provider > provider;
       /** Storage provider */
       std::shared_ptr< core::TokenDB > storage;
+      /** Pre-generated token inventory (optional) */
+      std::shared_ptr< TokenInventory > candidates;
+      /** Parallel decryption pool (optional) */
+      std::shared_ptr< core::WorkPool > decryptPool;
+      /** Rows decrypted in parallel, at least */
+      size_t decryptThreshold = 0;
+      /** Asynchronous operations executor (last: stopped first, while the manager is whole) */
+      std::shared_ptr< core::TaskExecutor > asyncTasks;
     };
   } // namespace api
 } // namespace token
@@ -0,0 +1,220 @@
+
+#ifndef __TOKENIZATION_PROPERTIES_HH__
+#define __TOKENIZATION_PROPERTIES_HH__
+
+#include "token/crypto.hh"
+#include <atomic>
+#include <boost/utility/string_view.hpp>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace token {
+  namespace api {
+    using bytea = crypto::bytea;
+
+    /**
+     * Property name dictionary of a vault: names found in the dictionary are stored as their
+     * index rather than their text.  Rows only decode with the dictionary they were written
+     * with, so a dictionary may be extended (names appended) but never reordered or shortened.
+     */
+    class PropertyDictionary {
+     public:
+      /**
+       * @brief Create a dictionary
+       * @param _names property names, in index order
+       */
+      explicit PropertyDictionary( std::vector< std::string > _names );
+
+      /**
+       * @brief Get the index of a property name
+       * @param name property name
+       * @return name index, npos if the name is not in the dictionary
+       */
+      size_t index( const std::string &name ) const {
+        auto iter = indexes.find( name );
+        return ( iter != indexes.end( ) ) ? iter->second : npos;
+      }
+
+      /**
+       * @brief Get the property name at an index
+       * @param index name index
+       * @return property name, nullptr if out of range
+       */
+      const std::string *name( size_t index ) const { return index < names.size( ) ? &names[ index ] : nullptr; }
+
+      size_t size( ) const { return names.size( ); }
+
+      static constexpr size_t npos = static_cast< size_t >( -1 ); /**< Name not in the dictionary */
+
+     private:
+      std::vector< std::string >                names;   /**< Names by index */
+      std::unordered_map< std::string, size_t > indexes; /**< Index by name  */
+    };
+
+    /**
+     * Token entry properties: a name/value map, decoded from its stored form on first access
+     *
+     * Stored properties use a length-prefixed binary encoding (optionally naming the properties
+     * through a PropertyDictionary); rows written as CBOR by earlier releases are still read.
+     * get() looks a single property up in the stored form without decoding the others.  The
+     * const accessors may be called concurrently: the first of them to need the map decodes it
+     * under a lock.
+     */
+    class Properties {
+     public:
+      using map_type       = std::map< std::string, std::string >;
+      using value_type     = map_type::value_type;
+      using iterator       = map_type::iterator;
+      using const_iterator = map_type::const_iterator;
+
+      Properties( ) = default;
+      Properties( std::initializer_list< value_type > init )
+        : values( init ) {}
+      Properties( map_type map )
+        : values( std::move( map ) ) {}
+
+      Properties( const Properties &other );
+      Properties( Properties &&other ) noexcept;
+      Properties &operator=( const Properties &other );
+      Properties &operator=( Properties &&other ) noexcept;
+
+      Properties &operator=( std::initializer_list< value_type > init ) {
+        reset( );
+        values = init;
+        return *this;
+      }
+
+      /**
+       * @brief Set the properties from their stored form, decoded on first access
+       * @param bytes stored properties
+       * @param dictionary property names dictionary the properties were stored with
+       */
+      void assign( bytea bytes, std::shared_ptr< const PropertyDictionary > dictionary = nullptr );
+
+      /**
+       * @brief Get the stored form of the properties
+       * @param dictionary property names dictionary (nullptr: names stored as text)
+       * @return stored properties
+       */
+      bytea encode( const std::shared_ptr< const PropertyDictionary > &dictionary = nullptr ) const;
+
+      /**
+       * @brief Walk the properties of a stored form, without building a map
+       * @param bytes stored properties
+       * @param dictionary property names dictionary the properties were stored with
+       * @param visit called with the name and value of each property (views into bytes, or
+       * into the dictionary, for the binary encoding)
+       */
+      static void each( const bytea &                                               bytes,
+                        const std::shared_ptr< const PropertyDictionary > &         dictionary,
+                        const std::function< void( boost::string_view, boost::string_view ) > &visit );
+
+      /**
+       * @brief Check that a dictionary holds every name index of a stored form, without
+       * decoding the values
+       * @param bytes stored properties
+       * @param dictionary property names dictionary
+       * @return false if a name index is not in the dictionary (names appended to the vault
+       * dictionary since it was read)
+       */
+      static bool resolves( const bytea &bytes, const std::shared_ptr< const PropertyDictionary > &dictionary );
+
+      /**
+       * @brief Check that the dictionary of the stored form holds all of its name indexes
+       * @return true if the properties decode
+       */
+      bool resolved( ) const { return ( !pending ) || ( resolves( stored, names ) ); }
+
+      /**
+       * @brief Replace the dictionary of a stored form not decoded yet
+       * @param dictionary property names dictionary, extending the one assigned
+       */
+      void rebind( std::shared_ptr< const PropertyDictionary > dictionary ) {
+        if ( pending ) {
+          names = std::move( dictionary );
+        }
+      }
+
+      /**
+       * @brief Look a property up, without decoding the other properties
+       * @param name property name
+       * @param value property value, set when found
+       * @return true if found, false if not
+       */
+      bool get( const std::string &name, std::string &value ) const;
+
+      /**
+       * @brief Check for properties, without decoding them
+       * @return true if there are no properties
+       */
+      bool empty( ) const;
+
+      size_t size( ) const { return map( ).size( ); }
+
+      iterator       begin( ) { return decoded( ).begin( ); }
+      iterator       end( ) { return decoded( ).end( ); }
+      const_iterator begin( ) const { return map( ).begin( ); }
+      const_iterator end( ) const { return map( ).end( ); }
+
+      iterator       find( const std::string &name ) { return decoded( ).find( name ); }
+      const_iterator find( const std::string &name ) const { return map( ).find( name ); }
+      size_t         count( const std::string &name ) const { return map( ).count( name ); }
+
+      std::string &      operator[]( const std::string &name ) { return decoded( )[ name ]; }
+      const std::string &at( const std::string &name ) const { return map( ).at( name ); }
+
+      size_t erase( const std::string &name ) { return decoded( ).erase( name ); }
+
+      /**
+       * @brief Remove all properties, retaining any storage already allocated for reuse
+       */
+      void clear( ) {
+        reset( );
+        values.clear( );
+      }
+
+      /**
+       * @brief Get the (decoded) properties map
+       * @return properties map
+       */
+      const map_type &map( ) const;
+
+      operator const map_type &( ) const { return map( ); }
+
+      bool operator==( const Properties &other ) const { return map( ) == other.map( ); }
+      bool operator!=( const Properties &other ) const { return map( ) != other.map( ); }
+
+     private:
+      /**
+       * @brief Get the properties map for modification, dropping the stored form
+       * @return properties map
+       */
+      map_type &decoded( ) {
+        map( );
+        reset( );
+        return values;
+      }
+
+      /**
+       * @brief Drop the stored form (the decoded map is left as is)
+       */
+      void reset( ) {
+        pending.store( false, std::memory_order_relaxed );
+        stored.clear( );
+        names.reset( );
+      }
+
+      mutable map_type                                    values;           /**< Decoded properties            */
+      mutable bytea                                       stored;           /**< Stored form, if unmodified    */
+      mutable std::shared_ptr< const PropertyDictionary > names;            /**< Dictionary of the stored form */
+      mutable std::atomic< bool >                         pending{ false }; /**< Stored form not decoded yet   */
+    };
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_PROPERTIES_HH__
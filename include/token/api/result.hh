@@ -0,0 +1,67 @@
+#ifndef __TOKENIZATION_RESULT_HH__
+#define __TOKENIZATION_RESULT_HH__
+
+namespace token {
+  namespace api {
+    /**
+     * Operation result codes, reported by the non-throwing (try*) variants of the TokenManager
+     * and TokenDB operations
+     */
+    enum class Result {
+      OK,              /**< Success                                                        */
+      NOT_FOUND,       /**< No entry for the token                                         */
+      NO_VAULT,        /**< Vault not defined                                              */
+      DUPLICATE,       /**< Unique violation, constraint not identified                    */
+      DUPLICATE_TOKEN, /**< Unique violation on the token                                  */
+      DUPLICATE_HMAC,  /**< Unique violation on the value hash                             */
+      INVALID,         /**< Value or token does not fit the vault format                   */
+      TRANSIENT,       /**< Transient storage failure (busy, deadlock, connection), retry  */
+      CRYPTO,          /**< Cryptography failure                                           */
+      FAILED           /**< Other failure                                                  */
+    };
+
+    /**
+     * @brief Get the description of a result code
+     * @param result result code
+     * @return result description
+     */
+    inline const char *describe( Result result ) noexcept {
+      switch ( result ) {
+        case Result::OK:
+          return "Success";
+        case Result::NOT_FOUND:
+          return "Entry not found";
+        case Result::NO_VAULT:
+          return "Vault not defined";
+        case Result::DUPLICATE:
+          return "Unique constraint violation";
+        case Result::DUPLICATE_TOKEN:
+          return "Token already in use";
+        case Result::DUPLICATE_HMAC:
+          return "Value already tokenized";
+        case Result::INVALID:
+          return "Invalid value for the vault format";
+        case Result::TRANSIENT:
+          return "Transient storage failure";
+        case Result::CRYPTO:
+          return "Cryptography failure";
+        case Result::FAILED:
+          break;
+      }
+
+      return "Operation failed";
+    }
+
+    /**
+     * @brief Check whether a result code reports a unique violation
+     * @param result result code
+     * @return true for DUPLICATE, DUPLICATE_TOKEN and DUPLICATE_HMAC
+     */
+    inline bool duplicate( Result result ) noexcept {
+      return ( result == Result::DUPLICATE ) || ( result == Result::DUPLICATE_TOKEN ) ||
+             ( result == Result::DUPLICATE_HMAC );
+    }
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_RESULT_HH__
@@ -0,0 +1,130 @@
+
+#ifndef __TOKENIZATION_SWEEPER_HH__
+#define __TOKENIZATION_SWEEPER_HH__
+
+#include "token/api/core/database.hh"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace token {
+  namespace api {
+
+    /**
+     * Expiration sweeper, removes expired tokens from their vaults in the background.
+     *
+     * Each scheduled vault is swept at its own interval; entries are removed in bounded batches
+     * (earliest expiration first), each within its own short transaction, throttled to the
+     * configured rate so the sweep never holds long locks or starves foreground traffic.
+     */
+    class ExpirationSweeper {
+     public:
+      using Clock = std::chrono::steady_clock;
+
+      /**
+       * Vault sweep schedule
+       */
+      struct Schedule {
+        std::chrono::seconds interval  = std::chrono::seconds( 3600 ); /**< Time between sweeps          */
+        size_t               batchSize = 1000;                         /**< Rows removed per transaction */
+        size_t               rate      = 0; /**< Maximum rows removed per second (0: unlimited)          */
+      };
+
+      /**
+       * @brief Create a sweeper
+       * @param _storage token storage
+       */
+      explicit ExpirationSweeper( std::shared_ptr< core::TokenDB > _storage )
+        : storage( std::move( _storage ) ) {}
+
+      ExpirationSweeper( const ExpirationSweeper & ) = delete;
+      ExpirationSweeper &operator=( const ExpirationSweeper & ) = delete;
+
+      ~ExpirationSweeper( ) { stop( ); }
+
+      /**
+       * @brief Add (or replace) the sweep schedule of a vault; the first sweep is immediate
+       * @param vault vault name or table name
+       * @param schedule sweep schedule
+       */
+      void schedule( const std::string &vault, Schedule schedule );
+
+      /**
+       * @brief Remove the sweep schedule of a vault
+       * @param vault vault name or table name
+       */
+      void unschedule( const std::string &vault );
+
+      /**
+       * @brief Sweep a vault immediately, on the calling thread
+       * @param vault vault name or table name
+       * @param schedule batch size and rate limit to apply
+       * @return number of expired entries removed
+       */
+      size_t sweep( const std::string &vault, const Schedule &schedule );
+
+      /**
+       * @brief Start the background sweep thread
+       */
+      void start( );
+
+      /**
+       * @brief Stop the background sweep thread, interrupting any sweep in progress after its
+       * current batch
+       */
+      void stop( );
+
+      /**
+       * @brief Total number of expired entries removed
+       * @return entries removed
+       */
+      size_t purged( ) const { return total; }
+
+      /**
+       * @brief Number of expired entries removed from a vault
+       * @param vault vault name or table name, as scheduled
+       * @return entries removed
+       */
+      size_t purged( const std::string &vault );
+
+     private:
+      /**
+       * Scheduled vault state
+       */
+      struct Entry {
+        Schedule          schedule;   /**< Sweep schedule           */
+        Clock::time_point next;       /**< Next sweep time          */
+        size_t            purged = 0; /**< Entries removed          */
+      };
+
+      /**
+       * @brief Background sweep loop
+       */
+      void run( );
+
+      /**
+       * @brief Wait for the specified time, or until stopped
+       * @param guard held sweeper lock
+       * @param until wake up time
+       * @return true if still running, false if stopping
+       */
+      bool waitUntil( std::unique_lock< std::mutex > &guard, Clock::time_point until );
+
+      std::shared_ptr< core::TokenDB > storage;          /**< Token storage                 */
+      std::map< std::string, Entry >   vaults;           /**< Scheduled vaults              */
+      std::mutex                       lock;             /**< Schedule lock                 */
+      std::condition_variable          wakeup;           /**< Schedule change/stop signal   */
+      std::thread                      thread;           /**< Background sweep thread       */
+      bool                             running  = false; /**< Background sweep active       */
+      bool                             stopping = false; /**< Background sweep stopping     */
+      std::atomic< size_t >            total{ 0 };       /**< Total entries removed         */
+    };
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_SWEEPER_HH__
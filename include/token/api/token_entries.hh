@@ -0,0 +1,183 @@
+
+#ifndef __TOKENIZATION_TOKEN_ENTRIES_HH__
+#define __TOKENIZATION_TOKEN_ENTRIES_HH__
+
+#include "token/api/core/string_pool.hh"
+#include "token/api/properties.hh"
+#include "token/api/token_entry.hh"
+#include <array>
+#include <boost/utility/string_view.hpp>
+#include <dbc++/dbcpp.hh>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace token {
+  namespace api {
+    /**
+     * Compact token entry, a row of a TokenEntries result set: the strings are views into the
+     * result set's pool, and the hmac is held inline
+     */
+    struct CompactEntry {
+      static constexpr size_t HMAC_CAPACITY = 64; /**< Largest hmac held (HMAC-SHA512) */
+
+      boost::string_view                   encKey;                /**< Encryption key name         */
+      boost::string_view                   token;                 /**< Token                       */
+      boost::string_view                   crypt;                 /**< Encrypted data              */
+      boost::string_view                   mask;                  /**< Raw value masked            */
+      boost::string_view                   value;                 /**< Raw value (once decrypted)  */
+      dbcpp::DBTime                        expiration;            /**< Expiration date             */
+      uint32_t                             firstProperty = 0;     /**< First property (flat index) */
+      uint32_t                             propertyCount = 0;     /**< Number of properties        */
+      uint8_t                              hmacSize      = 0;     /**< HMAC length                 */
+      bool                                 decrypted     = false; /**< Value is set                */
+      std::array< uint8_t, HMAC_CAPACITY > hmacBytes;             /**< HMAC (lookup hash)          */
+
+      /**
+       * @brief Get the hmac
+       * @return view of the hmac
+       */
+      crypto::bytes_view hmac( ) const { return crypto::bytes_view( hmacBytes.data( ), hmacSize ); }
+    };
+
+    /**
+     * Compact query result set: the rows share one string pool, and their properties one flat
+     * vector (sorted by name within each row), so a result costs a few allocations however
+     * many rows it holds.  TokenEntry remains the convenience type (see expand).
+     *
+     * Values may be decrypted lazily (see TokenManager::query): value() decrypts an entry on
+     * first access and decrypt() a batch of entries, both memoized and safe to call from
+     * several threads (appending is not).  The pool holds the decrypted values: it is wiped
+     * when the result set is cleared or destroyed.
+     */
+    class TokenEntries {
+     public:
+      using Property       = std::pair< boost::string_view, boost::string_view >;
+      using const_iterator = std::vector< CompactEntry >::const_iterator;
+
+      /** Decrypt entries of a result set, storing their values (see assign) */
+      using decrypt_f = std::function< void( TokenEntries &entries, const std::vector< size_t > &rows ) >;
+
+      size_t size( ) const { return rows.size( ); }
+      bool   empty( ) const { return rows.empty( ); }
+
+      const CompactEntry &operator[]( size_t index ) const { return rows[ index ]; }
+      const_iterator      begin( ) const { return rows.begin( ); }
+      const_iterator      end( ) const { return rows.end( ); }
+
+      /**
+       * @brief Get the properties of an entry
+       * @param entry entry of this result set
+       * @return first and last (exclusive) property, sorted by name
+       */
+      std::pair< const Property *, const Property * > properties( const CompactEntry &entry ) const {
+        auto first = flat.data( ) + entry.firstProperty;
+        return std::make_pair( first, first + entry.propertyCount );
+      }
+
+      /**
+       * @brief Look a property of an entry up
+       * @param entry entry of this result set
+       * @param name property name
+       * @param value [out] property value
+       * @return true if found, false if not
+       */
+      bool property( const CompactEntry &entry, boost::string_view name, boost::string_view &value ) const;
+
+      /**
+       * @brief Get the raw value of an entry, decrypting it on first access
+       * @param entry entry of this result set
+       * @return raw value
+       */
+      boost::string_view value( const CompactEntry &entry );
+
+      /**
+       * @brief Decrypt the values of a range of entries, in batches
+       * @param first first entry
+       * @param count number of entries (limited to the end of the result set)
+       */
+      void decrypt( size_t first, size_t count );
+
+      /**
+       * @brief Decrypt the values of entries, in batches
+       * @param indexes entry indexes
+       */
+      void decrypt( const std::vector< size_t > &indexes );
+
+      /**
+       * @brief Convert an entry into a (self-contained) token entry, decrypting its value
+       * @param entry entry of this result set
+       * @return token entry
+       */
+      TokenEntry expand( const CompactEntry &entry );
+
+      /**
+       * @brief Remove all entries, wiping the pool and retaining the storage for reuse
+       */
+      void clear( ) {
+        rows.clear( );
+        flat.clear( );
+        pool.clear( );
+        pending.reset( );
+      }
+
+      /* -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*-
+       * Note: The following methods are intended for internal use only (TokenDB, TokenManager)
+       * -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*/
+
+      /**
+       * @brief Append the current row of a result set
+       * @param results result set
+       * @param numeric tokens are stored packed (see TokenEntry::pack)
+       * @param names property names dictionary of the vault
+       * @param columns select list of the results (all the columns)
+       * @return false if the properties use a name index not in names (nothing appended)
+       */
+      bool append( dbcpp::ResultSet &                                  results,
+                   bool                                                numeric,
+                   const std::shared_ptr< const PropertyDictionary > &names,
+                   const TokenEntry::Columns &                         columns = TokenEntry::Columns::all( ) );
+
+      /**
+       * @brief Set the (decrypted) value of an entry
+       * @param index entry index
+       * @param value raw value
+       */
+      void assign( size_t index, boost::string_view value ) {
+        rows[ index ].value     = pool.store( value );
+        rows[ index ].decrypted = true;
+      }
+
+      /**
+       * @brief Defer the decryption of the entries appended from an index on
+       * @param first first entry
+       * @param decryptor batch decryption, called on first access
+       */
+      void defer( size_t first, decrypt_f decryptor );
+
+     private:
+      /**
+       * Deferred decryption state
+       */
+      struct Pending {
+        std::mutex                                    lock;     /**< Decryption lock               */
+        std::vector< std::pair< size_t, decrypt_f > > segments; /**< Decryptors, by first entry    */
+      };
+
+      /**
+       * @brief Decrypt the pending entries of a list (lock held)
+       * @param indexes entry indexes
+       */
+      void decryptPending( const std::vector< size_t > &indexes );
+
+      core::StringPool            pool;    /**< Strings of all rows      */
+      std::vector< CompactEntry > rows;    /**< Entries                  */
+      std::vector< Property >     flat;    /**< Properties of all rows   */
+      std::unique_ptr< Pending >  pending; /**< Deferred decryption      */
+    };
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_TOKEN_ENTRIES_HH__
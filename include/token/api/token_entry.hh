@@ -2,7 +2,11 @@
 #ifndef __TOKENIZATION_TOKEN_ENTRY_HH__
 #define __TOKENIZATION_TOKEN_ENTRY_HH__
 
+#include "token/api/properties.hh"
 #include "token/crypto.hh"
+#include <array>
+#include <cstdint>
+#include <initializer_list>
 #include <dbc++/dbcpp.hh>
 #include <map>
 #include <string>
@@ -15,6 +19,54 @@ namespace token {
      * Token Vault Entry (Token Details)
      */
     struct TokenEntry final {
+      /**
+       * Select list of the vault table columns read into a token entry, with the ordinal of each
+       * column in it: resolved once per statement shape, so the rows are read by position
+       */
+      class Columns {
+       public:
+        /** Vault table columns read into a token entry */
+        enum Column : size_t { ENCKEY, TOKEN, HMAC, CRYPT, MASK, EXPIRATION, PROPERTIES, COUNT };
+
+        static constexpr size_t npos = static_cast< size_t >( -1 ); /**< Ordinal of an unselected column */
+
+        /**
+         * @brief Build the select list of the columns
+         * @param columns columns, in select order
+         */
+        explicit Columns( std::initializer_list< Column > columns );
+
+        /**
+         * @brief Get the select list of all the columns
+         * @return columns
+         */
+        static const Columns &all( );
+
+        /**
+         * @brief Get the select list
+         * @return comma separated column names
+         */
+        const std::string &list( ) const { return select; }
+
+        /**
+         * @brief Get the ordinal of a column in the select list
+         * @param column column
+         * @return ordinal, npos if not selected
+         */
+        size_t operator[]( Column column ) const { return ordinals[ column ]; }
+
+        /**
+         * @brief Check whether a column is selected
+         * @param column column
+         * @return true if selected, false if not
+         */
+        bool has( Column column ) const { return ordinals[ column ] != npos; }
+
+       private:
+        std::string                 select;   /**< Select list        */
+        std::array< size_t, COUNT > ordinals; /**< Ordinal per column */
+      };
+
       std::string                          encKey;     /**< Encryption key name      */
       std::string                          token;      /**< Token                    */
       bytea                                hmac;       /**< HMAC (lookup hash)       */
@@ -22,7 +74,7 @@ namespace token {
       std::string                          mask;       /**< Raw value masked         */
       std::string                          value;      /**< Raw value                */
       dbcpp::DBTime                        expiration; /**< Expiration date          */
-      std::map< std::string, std::string > properties; /**< Miscellaneous properties */
+      Properties                           properties; /**< Miscellaneous properties */
 
       /**
        * @brief Convert a byte array of serialized name/value pairs into a properties map
@@ -39,24 +91,60 @@ namespace token {
       static bytea serialize( const std::map< std::string, std::string > &map );
 
       /**
-       * @brief Load the token entry from the selected results
+       * @brief Pack an all-digit token into an integer (numeric token storage): the digits follow
+       * a leading 1, which keeps the length and any leading zeros
+       * @param token token
+       * @return packed token, 0 if the token is not 1 to 18 digits
+       */
+      static uint64_t pack( const std::string &token );
+
+      /**
+       * @brief Convert a packed token back into its digits
+       * @param packed packed token
+       * @return token, empty for 0
+       */
+      static std::string unpack( uint64_t packed );
+
+      /**
+       * @brief Load the token entry from the selected results (the columns not selected are left
+       * cleared)
        * @param results result set
+       * @param numeric tokens are stored packed (see pack)
+       * @param names property names dictionary of the vault
+       * @param columns select list of the results
        */
-      void load( dbcpp::ResultSet &results ) {
-        encKey     = results.get< std::string >( "ENCKEY" );
-        token      = results.get< std::string >( "TOKEN" );
-        hmac       = results.get< bytea >( "HMAC" );
-        crypt      = results.get< bytea >( "CRYPT" );
-        mask       = results.get< std::string >( "MASK" );
-        expiration = results.get< dbcpp::DBTime >( "EXPIRATION" );
-        properties = deserialize( results.get< bytea >( "PROPERTIES" ) );
+      void load( dbcpp::ResultSet &                                  results,
+                 bool                                                numeric = false,
+                 const std::shared_ptr< const PropertyDictionary > &names   = nullptr,
+                 const Columns &                                     columns = Columns::all( ) );
+
+      /**
+       * @brief Reset all fields, retaining any storage already allocated for reuse
+       */
+      void clear( ) {
+        encKey.clear( );
+        token.clear( );
+        hmac.clear( );
+        crypt.clear( );
+        mask.clear( );
+        value.clear( );
+        expiration = dbcpp::DBTime( );
+        properties.clear( );
       }
 
       /**
        * @brief Loading constructor, fill the structure from a table record
        * @param results result set
+       * @param numeric tokens are stored packed (see pack)
+       * @param names property names dictionary of the vault
+       * @param columns select list of the results
        */
-      explicit TokenEntry( dbcpp::ResultSet &results ) { load( results ); }
+      explicit TokenEntry( dbcpp::ResultSet &                                  results,
+                           bool                                                numeric = false,
+                           const std::shared_ptr< const PropertyDictionary > &names   = nullptr,
+                           const Columns &                                     columns = Columns::all( ) ) {
+        load( results, numeric, names, columns );
+      }
       TokenEntry( ) = default;
     };
   } // namespace api
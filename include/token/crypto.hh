@@ -3,7 +3,11 @@
 #define __TOKENIZATION_CRYPTO_HH__
 
 #include "token/crypto/encryption_key.hh"
+#include "token/crypto/executor.hh"
+#include "token/crypto/fpe_key.hh"
 #include "token/crypto/hmac_key.hh"
+#include "token/crypto/openssl.hh"
 #include "token/crypto/provider.hh"
+#include "token/crypto/simulated.hh"
 
 #endif //__TOKENIZATION_CRYPTO_HH__
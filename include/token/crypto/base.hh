@@ -2,13 +2,39 @@
 #ifndef __TOKENIZATION_BASE_HH__
 #define __TOKENIZATION_BASE_HH__
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 namespace token {
   namespace crypto {
     /** Alias definition for byte arrays */
     using bytea = std::vector< std::uint8_t >;
+
+    /**
+     * Non-owning view of a byte sequence
+     */
+    struct bytes_view {
+      const std::uint8_t *data; /**< First byte      */
+      std::size_t         size; /**< Number of bytes */
+
+      bytes_view( )
+        : data( nullptr )
+        , size( 0 ) {}
+
+      bytes_view( const std::uint8_t *_data, std::size_t _size )
+        : data( _data )
+        , size( _size ) {}
+
+      bytes_view( const bytea &bytes )
+        : data( bytes.data( ) )
+        , size( bytes.size( ) ) {}
+
+      bytes_view( const std::string &string )
+        : data( reinterpret_cast< const std::uint8_t * >( string.data( ) ) )
+        , size( string.size( ) ) {}
+    };
   } // namespace crypto
 } // namespace token
 
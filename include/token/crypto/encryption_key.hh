@@ -4,14 +4,22 @@
 
 #include "token/crypto/base.hh"
 #include "base.hh"
+#include <algorithm>
 #include <memory>
 #include <string>
 
 namespace token {
   namespace crypto {
     namespace interface {
-      /** Encryption key interface */
+      /**
+       * Encryption key interface
+       *
+       * Implementations override either the pointer/length methods (preferred, allowing callers
+       * to supply their own output storage) or the byte sequence methods; each family is
+       * implemented in terms of the other, so at least one must be overridden.
+       */
       struct EncKey {
+        virtual ~EncKey( ) = default;
 
         /**
          * @brief Encrypt a string
@@ -19,8 +27,7 @@ namespace token {
          * @return encrypted byte array
          */
         bytea encrypt( const std::string &data ) const {
-          bytea bytes{data.begin( ), data.end( )};
-          return encrypt( bytes );
+          return encrypt( reinterpret_cast< const std::uint8_t * >( data.data( ) ), data.size( ) );
         }
 
         /**
@@ -29,23 +36,124 @@ namespace token {
          * @return decrypted byte array
          */
         bytea decrypt( const std::string &data ) const {
-          bytea bytes{data.begin( ), data.end( )};
-          return decrypt( bytes );
+          return decrypt( reinterpret_cast< const std::uint8_t * >( data.data( ) ), data.size( ) );
         }
 
         /**
          * @brief Encrypt a sequence of bytes
          * @param data bytes to encrypt
+         * @param length number of bytes
          * @return encrypted byte sequence
          */
-        virtual bytea encrypt( const bytea data ) const = 0;
+        bytea encrypt( const std::uint8_t *data, size_t length ) const {
+          /* Unknown output size: a byte sequence key (one call), or sized by the key (see below) */
+          if ( encryptedLength( length ) == 0 ) {
+            return encrypt( bytea( data, data + length ) );
+          }
+
+          return encryptInto( data, length );
+        }
 
         /**
          * @brief Decrypt a sequence of bytes
          * @param data bytes to decrypt
+         * @param length number of bytes
          * @return decrypted byte sequence
          */
-        virtual bytea decrypt( const bytea data ) const = 0;
+        bytea decrypt( const std::uint8_t *data, size_t length ) const {
+          /* Unknown output size: a byte sequence key (one call), or sized by the key (see below) */
+          if ( decryptedLength( length ) == 0 ) {
+            return decrypt( bytea( data, data + length ) );
+          }
+
+          return decryptInto( data, length );
+        }
+
+        /**
+         * @brief Encrypt a sequence of bytes into a caller supplied buffer
+         * @note When the output buffer is too small nothing is written, and the required size is
+         * returned; callers compare the result against outLength
+         * @param data bytes to encrypt
+         * @param length number of bytes
+         * @param out output buffer (may be null when outLength is 0)
+         * @param outLength output buffer size
+         * @return number of bytes written, or required if larger than outLength
+         */
+        virtual size_t encrypt( const std::uint8_t *data, size_t length, std::uint8_t *out, size_t outLength ) const {
+          return copyOut( encrypt( bytea( data, data + length ) ), out, outLength );
+        }
+
+        /**
+         * @brief Decrypt a sequence of bytes into a caller supplied buffer
+         * @note When the output buffer is too small nothing is written, and the required size is
+         * returned; callers compare the result against outLength
+         * @param data bytes to decrypt
+         * @param length number of bytes
+         * @param out output buffer (may be null when outLength is 0)
+         * @param outLength output buffer size
+         * @return number of bytes written, or required if larger than outLength
+         */
+        virtual size_t decrypt( const std::uint8_t *data, size_t length, std::uint8_t *out, size_t outLength ) const {
+          return copyOut( decrypt( bytea( data, data + length ) ), out, outLength );
+        }
+
+        /**
+         * @brief Encrypt a set of independent values
+         * @note The default implementation encrypts each value in turn; implementations may
+         * override it to process the values together
+         * @param inputs values to encrypt
+         * @param outputs [out] encrypted values, one per input
+         */
+        virtual void encryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const {
+          outputs.resize( inputs.size( ) );
+
+          for ( size_t num = 0; num < inputs.size( ); ++num ) {
+            outputs[ num ] = encrypt( inputs[ num ].data, inputs[ num ].size );
+          }
+        }
+
+        /**
+         * @brief Decrypt a set of independent values
+         * @note The default implementation decrypts each value in turn; implementations may
+         * override it to process the values together
+         * @param inputs values to decrypt
+         * @param outputs [out] decrypted values, one per input
+         */
+        virtual void decryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const {
+          outputs.resize( inputs.size( ) );
+
+          for ( size_t num = 0; num < inputs.size( ); ++num ) {
+            outputs[ num ] = decrypt( inputs[ num ].data, inputs[ num ].size );
+          }
+        }
+
+        /**
+         * @brief Upper bound of the encrypted size of a plaintext
+         * @param length plaintext length
+         * @return encrypted size upper bound, or 0 if unknown
+         */
+        virtual size_t encryptedLength( size_t length ) const { return 0; }
+
+        /**
+         * @brief Upper bound of the decrypted size of a ciphertext
+         * @param length ciphertext length
+         * @return decrypted size upper bound, or 0 if unknown
+         */
+        virtual size_t decryptedLength( size_t length ) const { return 0; }
+
+        /**
+         * @brief Encrypt a sequence of bytes
+         * @param data bytes to encrypt
+         * @return encrypted byte sequence
+         */
+        virtual bytea encrypt( const bytea data ) const { return encryptInto( data.data( ), data.size( ) ); }
+
+        /**
+         * @brief Decrypt a sequence of bytes
+         * @param data bytes to decrypt
+         * @return decrypted byte sequence
+         */
+        virtual bytea decrypt( const bytea data ) const { return decryptInto( data.data( ), data.size( ) ); }
 
         /**
          * @brief String representation of the key (e.g. key name)
@@ -59,6 +167,62 @@ namespace token {
          * @return false
          */
         virtual bool isVersioned( ) const { return false; }
+
+       protected:
+        /**
+         * @brief Encrypt through the pointer/length method, into a buffer of encryptedLength (or
+         * sized by a first call, when the length is unknown)
+         * @param data bytes to encrypt
+         * @param length number of bytes
+         * @return encrypted byte sequence
+         */
+        bytea encryptInto( const std::uint8_t *data, size_t length ) const {
+          bytea  output( encryptedLength( length ) );
+          size_t required = encrypt( data, length, output.data( ), output.size( ) );
+
+          if ( required > output.size( ) ) {
+            output.resize( required );
+            required = encrypt( data, length, output.data( ), output.size( ) );
+          }
+
+          output.resize( required );
+          return output;
+        }
+
+        /**
+         * @brief Decrypt through the pointer/length method, into a buffer of decryptedLength (or
+         * sized by a first call, when the length is unknown)
+         * @param data bytes to decrypt
+         * @param length number of bytes
+         * @return decrypted byte sequence
+         */
+        bytea decryptInto( const std::uint8_t *data, size_t length ) const {
+          bytea  output( decryptedLength( length ) );
+          size_t required = decrypt( data, length, output.data( ), output.size( ) );
+
+          if ( required > output.size( ) ) {
+            output.resize( required );
+            required = decrypt( data, length, output.data( ), output.size( ) );
+          }
+
+          output.resize( required );
+          return output;
+        }
+
+        /**
+         * @brief Copy a result into a caller supplied buffer, if it fits
+         * @param result result bytes
+         * @param out output buffer
+         * @param outLength output buffer size
+         * @return result size
+         */
+        static size_t copyOut( const bytea &result, std::uint8_t *out, size_t outLength ) {
+          if ( result.size( ) <= outLength ) {
+            std::copy( result.begin( ), result.end( ), out );
+          }
+
+          return result.size( );
+        }
       };
     } // namespace internal
 
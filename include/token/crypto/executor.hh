@@ -0,0 +1,130 @@
+
+#ifndef __TOKENIZATION_EXECUTOR_HH__
+#define __TOKENIZATION_EXECUTOR_HH__
+
+#include "token/crypto/provider.hh"
+#include <memory>
+#include <string>
+
+namespace token {
+  namespace crypto {
+    /**
+     * Crypto offload executor
+     *
+     * Wraps a provider whose operations are slow round trips (e.g. an HSM), so the calls made by
+     * many concurrent requests are pipelined across a bounded pool of workers.  Each key returned
+     * by the executor submits its operations to a queue per key and operation, and waits for the
+     * result; a free worker takes everything queued for a key (up to maxBatch values) and passes
+     * it to the wrapped key's batch method in a single call.  While the workers are busy, new
+     * requests accumulate and are coalesced into the next batch.
+     *
+     * Random requests are coalesced the same way, into one provider call covering all of them.
+     *
+     * A TokenManager uses the executor by being constructed with it in place of the provider.
+     */
+    class ExecutorProvider : public Provider {
+     public:
+      /**
+       * Executor configuration
+       */
+      struct Options {
+        size_t workers  = 4;    /**< Concurrent provider calls (e.g. HSM sessions)       */
+        size_t maxBatch = 64;   /**< Values passed to a single provider call             */
+        size_t maxQueue = 4096; /**< Values queued before submitters wait (backpressure) */
+      };
+
+      /**
+       * @brief Create an executor over a provider
+       * @param _provider wrapped provider
+       */
+      explicit ExecutorProvider( std::shared_ptr< Provider > _provider )
+        : ExecutorProvider( std::move( _provider ), Options( ) ) {}
+
+      /**
+       * @brief Create an executor over a provider
+       * @param _provider wrapped provider
+       * @param options executor configuration
+       */
+      ExecutorProvider( std::shared_ptr< Provider > _provider, Options options );
+
+      /**
+       * @brief Stop the executor; queued operations are completed first, and keys obtained from
+       * the executor remain usable (executing on the caller's thread)
+       */
+      ~ExecutorProvider( );
+
+      /**
+       * @brief Get the encryption key
+       * @param name encryption key name
+       * @return encryption key executing through the executor, or nullptr
+       */
+      EncKey getEncKey( std::string name ) override;
+
+      /**
+       * @brief Get the hashing key
+       * @param name hashing key name
+       * @return hash key executing through the executor, or nullptr
+       */
+      MacKey getMacKey( std::string name ) override;
+
+      /**
+       * @brief Create and get an encryption key
+       * @param name key name
+       * @param parameters encryption key parameters
+       * @return encryption key executing through the executor, or nullptr
+       */
+      EncKey createEncKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Create and get a hash key
+       * @param name key name
+       * @param parameters hash key parameters
+       * @return hash key executing through the executor, or nullptr
+       */
+      MacKey createMacKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Get the format preserving encryption key
+       * @note Returned unwrapped: format preserving encryption makes a short chain of dependent
+       * block operations per value, which gains nothing from the queues
+       * @param name key name
+       * @return format preserving encryption key of the wrapped provider, or nullptr
+       */
+      FpeKey getFpeKey( std::string name ) override;
+
+      /**
+       * @brief Create and get a format preserving encryption key
+       * @param name key name
+       * @param parameters key parameters
+       * @return format preserving encryption key of the wrapped provider, or nullptr
+       */
+      FpeKey createFpeKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Fill the block up to length with random bytes
+       * @param block memory block to fill
+       * @param length number of bytes to fill
+       */
+      void random( void *block, size_t length ) override;
+
+      /**
+       * @brief Set the command line options (those of the wrapped provider)
+       * @param encOptions encryption options
+       * @param macOptions hmac options
+       */
+      void cmdArgs( boost::program_options::options_description &encOptions,
+                    boost::program_options::options_description &macOptions ) override;
+
+      explicit operator std::string( ) override { return "Executor(" + std::string( *provider ) + ")"; }
+
+      /** Executor queues and workers (shared with the keys handed out) */
+      struct Core;
+
+     private:
+      std::shared_ptr< Provider > provider; /**< Wrapped provider */
+      std::shared_ptr< Core >     core;     /**< Queues, workers  */
+    };
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_EXECUTOR_HH__
@@ -0,0 +1,42 @@
+
+#ifndef __TOKENIZATION_FPE_KEY_HH__
+#define __TOKENIZATION_FPE_KEY_HH__
+
+#include "token/crypto/base.hh"
+#include <memory>
+#include <string>
+
+namespace token {
+  namespace crypto {
+    namespace interface {
+      /**
+       * Format preserving encryption key
+       *
+       * The AES block cipher keyed for NIST SP 800-38G FF1 and FF3-1, which only use its forward
+       * direction; the modes themselves are implemented by the library.  For FF3-1 the key is the
+       * block cipher key (the FF3-1 key, as the standard defines it, is its byte reversal).
+       */
+      struct FpeKey {
+        virtual ~FpeKey( ) = default;
+
+        /**
+         * @brief Encrypt whole 16 byte blocks, each independently (ECB)
+         * @param data input blocks
+         * @param out output blocks (may be the same as the input)
+         * @param blocks number of blocks
+         */
+        virtual void encryptBlocks( const std::uint8_t *data, std::uint8_t *out, size_t blocks ) const = 0;
+
+        /**
+         * @brief String representation of the key (e.g. key name)
+         * @return string representation
+         */
+        virtual explicit operator std::string( ) { return ""; };
+      };
+    } // namespace interface
+
+    using FpeKey = std::shared_ptr< interface::FpeKey >;
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_FPE_KEY_HH__
@@ -3,30 +3,94 @@
 #define __TOKENIZATION_HMAC_KEY_HH__
 
 #include "token/crypto/base.hh"
+#include <algorithm>
 #include <memory>
 #include <string>
 
 namespace token {
   namespace crypto {
     namespace interface {
-      /** HMAC key interface */
+      /**
+       * HMAC key interface
+       *
+       * Implementations override either the pointer/length hash method (preferred, allowing
+       * callers to supply their own output storage) or the byte sequence method; each is
+       * implemented in terms of the other, so at least one must be overridden.
+       */
       struct MacKey {
+        virtual ~MacKey( ) = default;
+
         /**
          * @brief Hash a string
          * @param data string to hash
          * @return hash byte sequence
          */
         bytea hash( const std::string &data ) const {
-          bytea bytes{ data.begin( ), data.end( ) };
-          return hash( bytes );
+          return hash( reinterpret_cast< const std::uint8_t * >( data.data( ) ), data.size( ) );
         }
 
+        /**
+         * @brief Hash a sequence of bytes
+         * @param data bytes to hash
+         * @param length number of bytes
+         * @return hash byte sequence
+         */
+        bytea hash( const std::uint8_t *data, size_t length ) const {
+          /* Unknown hash size: a byte sequence key (one call), or sized by the key (see below) */
+          if ( hashLength( ) == 0 ) {
+            return hash( bytea( data, data + length ) );
+          }
+
+          return hashInto( data, length );
+        }
+
+        /**
+         * @brief Hash a sequence of bytes into a caller supplied buffer
+         * @note When the output buffer is too small nothing is written, and the required size is
+         * returned; callers compare the result against outLength
+         * @param data bytes to hash
+         * @param length number of bytes
+         * @param out output buffer (may be null when outLength is 0)
+         * @param outLength output buffer size
+         * @return number of bytes written, or required if larger than outLength
+         */
+        virtual size_t hash( const std::uint8_t *data, size_t length, std::uint8_t *out, size_t outLength ) const {
+          auto result = hash( bytea( data, data + length ) );
+
+          if ( result.size( ) <= outLength ) {
+            std::copy( result.begin( ), result.end( ), out );
+          }
+
+          return result.size( );
+        }
+
+        /**
+         * @brief Hash a set of independent values
+         * @note The default implementation hashes each value in turn; implementations may override
+         * it to process the values together
+         * @param inputs values to hash
+         * @param outputs [out] hashes, one per input
+         */
+        virtual void hashBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const {
+          outputs.resize( inputs.size( ) );
+
+          for ( size_t num = 0; num < inputs.size( ); ++num ) {
+            outputs[ num ] = hash( inputs[ num ].data, inputs[ num ].size );
+          }
+        }
+
+        /**
+         * @brief Size of the hashes produced by this key
+         * @return hash size, or 0 if unknown
+         */
+        virtual size_t hashLength( ) const { return 0; }
+
         /**
          * @brief Hash a sequence of bytes
          * @param data byte sequence
          * @return hash byte sequence
          */
-        virtual bytea hash( const bytea &data ) const = 0;
+        virtual bytea hash( const bytea &data ) const { return hashInto( data.data( ), data.size( ) ); }
 
         /**
          * @brief Verify the hash
@@ -49,6 +113,27 @@ namespace token {
          * @return string representation
          */
         virtual explicit operator std::string( ) { return ""; };
+
+       protected:
+        /**
+         * @brief Hash through the pointer/length method, into a buffer of hashLength (or sized by a
+         * first call, when the length is unknown)
+         * @param data bytes to hash
+         * @param length number of bytes
+         * @return hash byte sequence
+         */
+        bytea hashInto( const std::uint8_t *data, size_t length ) const {
+          bytea  output( hashLength( ) );
+          size_t required = hash( data, length, output.data( ), output.size( ) );
+
+          if ( required > output.size( ) ) {
+            output.resize( required );
+            required = hash( data, length, output.data( ), output.size( ) );
+          }
+
+          output.resize( required );
+          return output;
+        }
       };
     } // namespace interface
 
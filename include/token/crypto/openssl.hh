@@ -0,0 +1,134 @@
+
+#ifndef __TOKENIZATION_OPENSSL_HH__
+#define __TOKENIZATION_OPENSSL_HH__
+
+#include "token/crypto/provider.hh"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace token {
+  namespace crypto {
+    /**
+     * OpenSSL cryptographic provider
+     *
+     * Keys are read from files named after the key within the configured key directories, each
+     * holding a single line "<algorithm>:<hex key>" (the algorithm prefix is optional and defaults
+     * to the configured cipher or digest).  Encryption uses AES-GCM (default) or AES-CBC with a
+     * random IV per value, prepended to the ciphertext (GCM appends its tag); hashing uses
+     * HMAC-SHA-256 (default) or HMAC-SHA-512.  Format preserving encryption keys are AES keys
+     * ("aes-128-ecb", "aes-192-ecb" or "aes-256-ecb") kept in the encryption key directory.
+     *
+     * Each thread keeps pre-keyed cipher and HMAC contexts for every key it uses, so an operation
+     * only resets the IV (or HMAC state) and passes the whole buffer to OpenSSL in one call; the
+     * EVP layer selects AES-NI, PCLMULQDQ and SHA extensions when the CPU provides them.
+     */
+    class OpenSSLProvider : public Provider {
+     public:
+      /**
+       * Provider configuration
+       */
+      struct Options {
+        std::string encKeyPath = ".";           /**< Encryption key directory     */
+        std::string macKeyPath = ".";           /**< HMAC key directory           */
+        std::string cipher     = "aes-256-gcm"; /**< Default encryption algorithm */
+        std::string digest     = "sha256";      /**< Default HMAC digest          */
+      };
+
+      OpenSSLProvider( )
+        : OpenSSLProvider( Options( ) ) {}
+
+      /**
+       * @brief Create an OpenSSL provider
+       * @param _options provider configuration
+       */
+      explicit OpenSSLProvider( Options _options );
+
+      /**
+       * @brief Get (loading on first use) an encryption key
+       * @param name encryption key name (file name within the encryption key directory)
+       * @return encryption key, or nullptr if the key cannot be loaded
+       */
+      EncKey getEncKey( std::string name ) override;
+
+      /**
+       * @brief Get (loading on first use) a hash key
+       * @param name hash key name (file name within the HMAC key directory)
+       * @return hash key, or nullptr if the key cannot be loaded
+       */
+      MacKey getMacKey( std::string name ) override;
+
+      /**
+       * @brief Generate a new encryption key file (mode 0600)
+       * @param name key name
+       * @param parameters "cipher": encryption algorithm (default: configured cipher)
+       * @return encryption key, or nullptr if the key cannot be created (e.g. already exists)
+       */
+      EncKey createEncKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Generate a new hash key file (mode 0600)
+       * @param name key name
+       * @param parameters "digest": HMAC digest (default: configured digest)
+       * @return hash key, or nullptr if the key cannot be created (e.g. already exists)
+       */
+      MacKey createMacKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Get (loading on first use) a format preserving encryption key
+       * @param name key name (file name within the encryption key directory)
+       * @return format preserving encryption key, or nullptr if the key cannot be loaded
+       */
+      FpeKey getFpeKey( std::string name ) override;
+
+      /**
+       * @brief Generate a new format preserving encryption key file (mode 0600)
+       * @param name key name
+       * @param parameters "cipher": aes-128-ecb, aes-192-ecb or aes-256-ecb (default)
+       * @return format preserving encryption key, or nullptr if the key cannot be created
+       */
+      FpeKey createFpeKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Fill the block up to length with random bytes
+       * @param block memory block to fill
+       * @param length number of bytes to fill
+       */
+      void random( void *block, size_t length ) override;
+
+      /**
+       * @brief Set the command line options
+       * @param encOptions encryption options
+       * @param macOptions hmac options
+       */
+      void cmdArgs( boost::program_options::options_description &encOptions,
+                    boost::program_options::options_description &macOptions ) override;
+
+      /**
+       * @brief Describe the hardware acceleration available to OpenSSL on this CPU
+       * @return space separated feature list (e.g. "aes-ni pclmulqdq sha-ni"), empty if none
+       */
+      static std::string acceleration( );
+
+      explicit operator std::string( ) override { return "OpenSSL"; }
+
+     private:
+      /**
+       * @brief Build the path of a key file, rejecting names that escape the key directory
+       * @param directory key directory
+       * @param name key name
+       * @return key file path, empty if the name is invalid
+       */
+      static std::string keyFile( const std::string &directory, const std::string &name );
+
+      Options                         options; /**< Provider configuration */
+      std::map< std::string, EncKey > encKeys; /**< Loaded encryption keys */
+      std::map< std::string, MacKey > macKeys; /**< Loaded hash keys       */
+      std::map< std::string, FpeKey > fpeKeys; /**< Loaded FPE keys        */
+      std::mutex                      lock;    /**< Key cache lock         */
+    };
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_OPENSSL_HH__
@@ -4,6 +4,7 @@
 
 #include "token/crypto/base.hh"
 #include "token/crypto/encryption_key.hh"
+#include "token/crypto/fpe_key.hh"
 #include "token/crypto/hmac_key.hh"
 #include <boost/program_options.hpp>
 #include <map>
@@ -49,6 +50,23 @@ namespace token {
         return nullptr;
       }
 
+      /**
+       * @brief Get the format preserving encryption key
+       * @param name key name
+       * @return format preserving encryption key, nullptr if unsupported
+       */
+      virtual FpeKey getFpeKey( std::string name ) { return nullptr; }
+
+      /**
+       * @brief Create and get a format preserving encryption key
+       * @param name key name
+       * @param parameters key parameters
+       * @return format preserving encryption key, nullptr if unsupported
+       */
+      virtual FpeKey createFpeKey( std::string name, std::map< std::string, std::string > parameters ) {
+        return nullptr;
+      }
+
       /**
        * @brief Fill the variable with random bytes
        * @param v variable
@@ -0,0 +1,136 @@
+
+#ifndef __TOKENIZATION_SIMULATED_HH__
+#define __TOKENIZATION_SIMULATED_HH__
+
+#include "token/crypto/provider.hh"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace token {
+  namespace crypto {
+    /**
+     * Simulated latency provider, for testing
+     *
+     * Wraps a local provider and makes every call behave like a round trip to a remote device
+     * (e.g. an HSM): each key lookup, operation, batch operation and random request waits for the
+     * configured latency while holding one of a limited number of sessions.  Batch operations cost
+     * a single round trip, as with HSM batch interfaces.
+     */
+    class SimulatedProvider : public Provider {
+     public:
+      /**
+       * Simulation configuration
+       */
+      struct Options {
+        std::chrono::microseconds latency{ 1000 }; /**< Round trip latency                  */
+        size_t                    sessions = 0;    /**< Concurrent sessions (0: unlimited) */
+      };
+
+      /**
+       * @brief Create a simulated latency provider
+       * @param _provider provider performing the operations
+       * @param options simulation configuration
+       */
+      SimulatedProvider( std::shared_ptr< Provider > _provider, Options options );
+
+      /**
+       * @brief Get the encryption key
+       * @param name encryption key name
+       * @return encryption key, or nullptr
+       */
+      EncKey getEncKey( std::string name ) override;
+
+      /**
+       * @brief Get the hashing key
+       * @param name hashing key name
+       * @return hash key, or nullptr
+       */
+      MacKey getMacKey( std::string name ) override;
+
+      /**
+       * @brief Create and get an encryption key
+       * @param name key name
+       * @param parameters encryption key parameters
+       * @return encryption key, or nullptr
+       */
+      EncKey createEncKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Create and get a hash key
+       * @param name key name
+       * @param parameters hash key parameters
+       * @return hash key, or nullptr
+       */
+      MacKey createMacKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Get the format preserving encryption key
+       * @param name key name
+       * @return format preserving encryption key, or nullptr
+       */
+      FpeKey getFpeKey( std::string name ) override;
+
+      /**
+       * @brief Create and get a format preserving encryption key
+       * @param name key name
+       * @param parameters key parameters
+       * @return format preserving encryption key, or nullptr
+       */
+      FpeKey createFpeKey( std::string name, std::map< std::string, std::string > parameters ) override;
+
+      /**
+       * @brief Fill the block up to length with random bytes
+       * @param block memory block to fill
+       * @param length number of bytes to fill
+       */
+      void random( void *block, size_t length ) override;
+
+      /**
+       * @brief Set the command line options (those of the wrapped provider)
+       * @param encOptions encryption options
+       * @param macOptions hmac options
+       */
+      void cmdArgs( boost::program_options::options_description &encOptions,
+                    boost::program_options::options_description &macOptions ) override;
+
+      /**
+       * @brief Number of round trips simulated so far
+       * @return round trips
+       */
+      size_t roundTrips( ) const { return device->roundTrips; }
+
+      explicit operator std::string( ) override { return "Simulated(" + std::string( *provider ) + ")"; }
+
+      /**
+       * Simulated device: sessions and latency (shared with the keys handed out)
+       */
+      struct Device {
+        /**
+         * @brief Wait for a free session
+         */
+        void acquire( );
+
+        /**
+         * @brief Release a session
+         */
+        void release( );
+
+        Options                 options;         /**< Simulation configuration */
+        std::atomic< size_t >   roundTrips{ 0 }; /**< Round trips simulated    */
+        size_t                  busy = 0;        /**< Sessions in use          */
+        std::mutex              lock;            /**< Session lock             */
+        std::condition_variable available;       /**< Signalled on release     */
+      };
+
+     private:
+      std::shared_ptr< Provider > provider; /**< Wrapped provider */
+      std::shared_ptr< Device >   device;   /**< Simulated device */
+    };
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_SIMULATED_HH__
@@ -8,5 +8,6 @@
 #include "token/exceptions/token_no_vault_error.hh"
 #include "token/exceptions/token_range_error.hh"
 #include "token/exceptions/token_sql_error.hh"
+#include "token/exceptions/token_sql_state_error.hh"
 
 #endif
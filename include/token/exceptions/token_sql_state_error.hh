@@ -0,0 +1,29 @@
+
+#ifndef __TOKENIZATION_TOKEN_SQL_STATE_ERROR_HH__
+#define __TOKENIZATION_TOKEN_SQL_STATE_ERROR_HH__
+
+#include "token_sql_error.hh"
+#include <utility>
+
+namespace token {
+  namespace exceptions {
+    /**
+     * Database failure reported with its native diagnostics
+     */
+    class TokenSQLStateError : public TokenSQLError {
+      const std::string sqlState;   /**< SQLSTATE code (empty for a connection failure) */
+      const std::string constraint; /**< Violated constraint name, if any              */
+
+     public:
+      TokenSQLStateError( std::string string, std::string state, std::string name )
+        : TokenSQLError( string )
+        , sqlState( std::move( state ) )
+        , constraint( std::move( name ) ) {}
+
+      const std::string &state( ) const noexcept { return sqlState; }
+      const std::string &constraintName( ) const noexcept { return constraint; }
+    };
+  } // namespace exceptions
+} // namespace token
+
+#endif //__TOKENIZATION_TOKEN_SQL_STATE_ERROR_HH__
@@ -0,0 +1,96 @@
+
+#include "token/api/core/arena.hh"
+#include <algorithm>
+#include <openssl/crypto.h>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /** Alignment of the arena allocations */
+      static const size_t ALIGNMENT = alignof( std::max_align_t );
+
+      const size_t Arena::CHUNK_SIZE;
+
+      Arena::Scope::Scope( ) { ++local( ).depth; }
+
+      Arena::Scope::~Scope( ) {
+        auto &arena = local( );
+
+        if ( --arena.depth == 0 ) {
+          arena.reset( );
+        }
+      }
+
+      Arena &Arena::local( ) {
+        static thread_local Arena arena;
+        return arena;
+      }
+
+      Arena *Arena::current( ) {
+        auto &arena = local( );
+        return ( arena.depth > 0 ) ? &arena : nullptr;
+      }
+
+      void *Arena::allocate( size_t size ) {
+        auto arena = current( );
+        return arena ? arena->carve( size ) : ::operator new( size );
+      }
+
+      void Arena::deallocate( void *pointer ) {
+        if ( !local( ).owns( pointer ) ) {
+          ::operator delete( pointer );
+        }
+      }
+
+      void *Arena::carve( size_t size ) {
+        size = ( size + ALIGNMENT - 1 ) & ~( ALIGNMENT - 1 );
+
+        while ( ( active < chunks.size( ) ) && ( chunks[ active ].size - chunks[ active ].used < size ) ) {
+          ++active;
+        }
+
+        if ( active == chunks.size( ) ) {
+          Chunk chunk;
+
+          chunk.size = std::max( size, CHUNK_SIZE );
+          chunk.data.reset( new char[ chunk.size ] );
+          chunks.push_back( std::move( chunk ) );
+        }
+
+        auto &chunk = chunks[ active ];
+        auto  rc    = chunk.data.get( ) + chunk.used;
+
+        chunk.used += size;
+
+        return rc;
+      }
+
+      bool Arena::owns( const void *pointer ) const {
+        auto address = static_cast< const char * >( pointer );
+
+        return std::any_of( chunks.begin( ), chunks.end( ), [ address ]( const Chunk &chunk ) {
+          return ( address >= chunk.data.get( ) ) && ( address < chunk.data.get( ) + chunk.size );
+        } );
+      }
+
+      void Arena::reset( ) {
+        for ( auto &chunk : chunks ) {
+          OPENSSL_cleanse( chunk.data.get( ), chunk.used );
+          chunk.used = 0;
+        }
+
+        active = 0;
+      }
+
+      size_t Arena::used( ) const {
+        size_t rc = 0;
+
+        for ( auto &chunk : chunks ) {
+          rc += chunk.used;
+        }
+
+        return rc;
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
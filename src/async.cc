@@ -0,0 +1,105 @@
+
+#include "token/api.hh"
+#include <stdexcept>
+
+namespace token {
+  namespace api {
+    /**
+     * @brief Run an operation on a task executor
+     * @param executor task executor
+     * @param operation operation
+     * @return future result of the operation
+     */
+    template < typename T >
+    static std::future< T > submit( core::TaskExecutor &executor, std::function< T( ) > operation ) {
+      auto promise = std::make_shared< std::promise< T > >( );
+      auto rc      = promise->get_future( );
+      auto task    = [ promise, operation ]( ) {
+        try {
+          promise->set_value( operation( ) );
+        } catch ( ... ) {
+          promise->set_exception( std::current_exception( ) );
+        }
+      };
+
+      if ( !executor.submit( task ) ) {
+        promise->set_exception( std::make_exception_ptr( std::runtime_error( "Task executor stopped" ) ) );
+      }
+
+      return rc;
+    }
+
+    /**
+     * @brief Run an operation reporting to a completion on a task executor
+     * @param executor task executor
+     * @param entry entry of the operation
+     * @param operation operation, filling the entry
+     * @param done completion
+     */
+    static void submit( core::TaskExecutor &                     executor,
+                        TokenEntry                               entry,
+                        std::function< Result( TokenEntry & ) > operation,
+                        TokenManager::Completion                 done ) {
+      auto state = std::make_shared< TokenEntry >( std::move( entry ) );
+
+      if ( !executor.submit( [ state, operation, done ]( ) { done( operation( *state ), *state ); } ) ) {
+        done( Result::FAILED, *state );
+      }
+    }
+
+    std::shared_ptr< core::TaskExecutor > TokenManager::executor( ) {
+      auto rc = std::atomic_load( &asyncTasks );
+
+      if ( !rc ) {
+        auto created = std::make_shared< core::TaskExecutor >( );
+
+        /* Another thread may have created it first: use theirs, this one stops unused */
+        rc = std::atomic_compare_exchange_strong( &asyncTasks, &rc, created ) ? created : rc;
+      }
+
+      return rc;
+    }
+
+    std::future< TokenEntry > TokenManager::tokenizeAsync( std::string vault, std::string value, TokenEntry entry ) {
+      auto data = std::make_shared< TokenEntry >( std::move( entry ) );
+
+      return submit< TokenEntry >( *executor( ), [ this, vault, value, data ]( ) {
+        tokenize( boost::string_view( vault ), boost::string_view( value ), *data );
+        return std::move( *data );
+      } );
+    }
+
+    void TokenManager::tokenizeAsync( std::string vault, std::string value, TokenEntry entry, Completion done ) {
+      submit( *executor( ),
+              std::move( entry ),
+              [ this, vault, value ]( TokenEntry &data ) { return tryTokenize( vault, value, data ); },
+              std::move( done ) );
+    }
+
+    std::future< TokenEntry > TokenManager::detokenizeAsync( std::string vault, std::string token ) {
+      return submit< TokenEntry >( *executor( ), [ this, vault, token ]( ) { return detokenize( vault, token ); } );
+    }
+
+    void TokenManager::detokenizeAsync( std::string vault, std::string token, Completion done ) {
+      submit( *executor( ),
+              TokenEntry( ),
+              [ this, vault, token ]( TokenEntry &data ) { return tryDetokenize( vault, token, data ); },
+              std::move( done ) );
+    }
+
+    std::future< std::vector< TokenEntry > > TokenManager::retrieveAsync( std::string vault, std::string value ) {
+      return submit< std::vector< TokenEntry > >( *executor( ),
+                                                  [ this, vault, value ]( ) { return retrieve( vault, value ); } );
+    }
+
+    std::future< TokenEntry > TokenManager::removeAsync( std::string vault, std::string token ) {
+      return submit< TokenEntry >( *executor( ), [ this, vault, token ]( ) { return remove( vault, token ); } );
+    }
+
+    std::future< TokenEntry > TokenManager::updateAsync( std::string vault, TokenEntry entry ) {
+      auto data = std::make_shared< TokenEntry >( std::move( entry ) );
+
+      return submit< TokenEntry >( *executor( ), [ this, vault, data ]( ) { return update( vault, *data ); } );
+    }
+  } // namespace api
+} // namespace token
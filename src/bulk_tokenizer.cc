@@ -0,0 +1,848 @@
+
+#include "token/api.hh"
+#include "token/api/core/bounded_queue.hh"
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( bulkLogger->should_log( spdlog::level::lvl ) ) {                                                              \
+      bulkLogger->lvl( fmt, ##__VA_ARGS__ );                                                                           \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    /** Bulk tokenizer logger */
+    std::shared_ptr< spdlog::logger > bulkLogger = token::api::create_logger( "token::api::bulk", { } );
+
+    namespace {
+      using Buffer = std::shared_ptr< std::vector< char > >;
+
+      static const size_t NO_OWNER = static_cast< size_t >( -1 );
+
+      enum JobState {
+        PENDING,      /**< Not yet processed                             */
+        CREATED,      /**< New token, waiting to be stored               */
+        EXISTING,     /**< Durable value found in the vault              */
+        DEDUPLICATED, /**< Durable value resolved by an earlier record   */
+        DERIVED       /**< Vaultless token, derived without storage      */
+      };
+
+      /** A single value to tokenize */
+      struct Job {
+        size_t      record;             /**< Record index within the batch     */
+        size_t      field;              /**< Field mapping index               */
+        std::string value;              /**< Raw value                         */
+        TokenEntry  entry;              /**< Token entry                       */
+        JobState    state = PENDING;    /**< Processing state                  */
+        size_t      owner = NO_OWNER;   /**< Job holding the token (dedupe)    */
+      };
+
+      /** A single input record */
+      struct Record {
+        const char *               data;             /**< Raw record text               */
+        size_t                     length;           /**< Raw record length             */
+        std::vector< std::string > columns;          /**< Parsed CSV columns            */
+        nlohmann::json             document;         /**< Parsed JSON document          */
+        bool                       modified = false; /**< Record has tokenized values   */
+      };
+
+      /**
+       * @brief Locate the end of the record beginning at the supplied position
+       * @param begin record start
+       * @param end data end
+       * @param quoted honour CSV quoting (new lines within quoted fields)
+       * @return position of the terminating new line, nullptr if not found
+       */
+      const char *recordEnd( const char *begin, const char *end, bool quoted ) {
+        if ( !quoted ) {
+          return static_cast< const char * >( memchr( begin, '\n', end - begin ) );
+        }
+
+        bool inQuotes = false;
+
+        for ( auto pos = begin; pos < end; ++pos ) {
+          if ( *pos == '"' ) {
+            inQuotes = !inQuotes;
+          } else if ( ( *pos == '\n' ) && ( !inQuotes ) ) {
+            return pos;
+          }
+        }
+
+        return nullptr;
+      }
+
+      /**
+       * @brief Split a CSV record into its (unquoted) columns
+       * @param data record text
+       * @param length record length
+       * @param delimiter field delimiter
+       * @return columns
+       */
+      std::vector< std::string > splitColumns( const char *data, size_t length, char delimiter ) {
+        std::vector< std::string > columns( 1 );
+        bool                       quoted = false;
+
+        for ( size_t pos = 0; pos < length; ++pos ) {
+          char ch = data[ pos ];
+
+          if ( quoted ) {
+            if ( ch != '"' ) {
+              columns.back( ) += ch;
+            } else if ( ( pos + 1 < length ) && ( data[ pos + 1 ] == '"' ) ) {
+              columns.back( ) += '"';
+              ++pos;
+            } else {
+              quoted = false;
+            }
+          } else if ( ch == '"' ) {
+            quoted = true;
+          } else if ( ch == delimiter ) {
+            columns.emplace_back( );
+          } else {
+            columns.back( ) += ch;
+          }
+        }
+
+        return columns;
+      }
+
+      /**
+       * @brief Write CSV columns, quoting where required
+       * @param output destination
+       * @param columns record columns
+       * @param delimiter field delimiter
+       */
+      void writeColumns( std::ostream &output, const std::vector< std::string > &columns, char delimiter ) {
+        const char special[] = { delimiter, '"', '\r', '\n', '\0' };
+
+        for ( size_t num = 0; num < columns.size( ); ++num ) {
+          auto &column = columns[ num ];
+
+          if ( num != 0 ) {
+            output << delimiter;
+          }
+
+          if ( column.find_first_of( special ) == std::string::npos ) {
+            output << column;
+            continue;
+          }
+
+          output << '"';
+
+          for ( auto &ch : column ) {
+            if ( ch == '"' ) {
+              output << '"';
+            }
+            output << ch;
+          }
+
+          output << '"';
+        }
+      }
+
+      /** Unmaps a memory mapped input on scope exit */
+      struct Mapping {
+        void * data   = MAP_FAILED;
+        size_t length = 0;
+
+        ~Mapping( ) {
+          if ( data != MAP_FAILED ) {
+            munmap( data, length );
+          }
+        }
+      };
+    } // namespace
+
+    /**
+     * Record source, splits memory mapped or buffered stream input into records
+     */
+    struct BulkTokenizer::Source {
+      std::istream *input    = nullptr; /**< Buffered input (nullptr: mapped)   */
+      const char *  pos      = nullptr; /**< Current position                   */
+      const char *  end      = nullptr; /**< End of available data              */
+      Buffer        buffer;             /**< Current read buffer                */
+      bool          quoted   = false;   /**< Honour CSV quoting                 */
+      size_t        readSize = 0;       /**< Buffered read size                 */
+
+      /**
+       * @brief Read more data into a new buffer, carrying over the incomplete record
+       * @return true if data was read, false at end of input
+       */
+      bool fill( ) {
+        if ( ( input == nullptr ) || ( !*input ) ) {
+          return false;
+        }
+
+        size_t tail  = end - pos;
+        auto   fresh = std::make_shared< std::vector< char > >( std::max( readSize, tail * 2 ) );
+
+        if ( tail > 0 ) {
+          memcpy( fresh->data( ), pos, tail );
+        }
+
+        input->read( fresh->data( ) + tail, fresh->size( ) - tail );
+
+        auto count = static_cast< size_t >( input->gcount( ) );
+
+        buffer = std::move( fresh );
+        pos    = buffer->data( );
+        end    = pos + tail + count;
+
+        return count > 0;
+      }
+
+      /**
+       * @brief Get the next record
+       * @param data record text
+       * @param length record length (excluding the line terminator)
+       * @param owner buffer holding the record (empty for mapped input)
+       * @return true on success, false at end of input
+       */
+      bool next( const char *&data, size_t &length, Buffer &owner ) {
+        const char *stop = nullptr;
+
+        while ( ( pos == end ) || ( ( stop = recordEnd( pos, end, quoted ) ) == nullptr ) ) {
+          if ( !fill( ) ) {
+            break;
+          }
+        }
+
+        if ( stop == nullptr ) {
+          if ( pos == end ) {
+            return false;
+          }
+
+          stop = end;
+        }
+
+        data   = pos;
+        length = stop - pos;
+        owner  = buffer;
+        pos    = ( stop == end ) ? end : stop + 1;
+
+        if ( ( length > 0 ) && ( data[ length - 1 ] == '\r' ) ) {
+          --length;
+        }
+
+        return true;
+      }
+    };
+
+    /**
+     * Group of records moving through the pipeline
+     */
+    struct BulkTokenizer::Batch {
+      size_t                sequence = 0; /**< Input order                          */
+      std::vector< Buffer > buffers;      /**< Read buffers referenced by records   */
+      std::vector< Record > records;      /**< Records                              */
+      std::vector< Job >    jobs;         /**< Values to tokenize                   */
+    };
+
+    /**
+     * Pipeline run state shared by the stages
+     */
+    struct BulkTokenizer::Context {
+      using TokenMap = std::unordered_map< std::string, std::string >;
+
+      std::vector< nlohmann::json::json_pointer > pointers; /**< JSON pointer per field mapping     */
+      Stats                                       stats;    /**< Pipeline counters                  */
+      size_t                                      capacity; /**< Window size per vault              */
+      std::mutex                                  lock;     /**< Window lock                        */
+      std::map< std::string, TokenMap >           tokens;   /**< Durable hmac -> token, per table   */
+      std::map< std::string, std::deque< std::string > > order; /**< Window eviction order         */
+
+      explicit Context( size_t _capacity )
+        : capacity( _capacity ) {}
+
+      /**
+       * @brief Find a durable value's token in the dedupe window
+       * @param table vault table name
+       * @param hmac value hash
+       * @param token output token
+       * @return true if found
+       */
+      bool find( const std::string &table, const bytea &hmac, std::string &token ) {
+        std::lock_guard< std::mutex > guard( lock );
+        auto &                        map  = tokens[ table ];
+        auto                          iter = map.find( std::string( hmac.begin( ), hmac.end( ) ) );
+
+        if ( iter == map.end( ) ) {
+          return false;
+        }
+
+        token = iter->second;
+        return true;
+      }
+
+      /**
+       * @brief Remember a stored durable value's token, evicting the oldest entries
+       * @param table vault table name
+       * @param hmac value hash
+       * @param token token
+       */
+      void add( const std::string &table, const bytea &hmac, const std::string &token ) {
+        std::lock_guard< std::mutex > guard( lock );
+        auto &                        map   = tokens[ table ];
+        auto &                        queue = order[ table ];
+        auto                          key   = std::string( hmac.begin( ), hmac.end( ) );
+
+        if ( capacity == 0 ) {
+          return;
+        }
+
+        if ( map.emplace( key, token ).second ) {
+          queue.emplace_back( std::move( key ) );
+        }
+
+        while ( queue.size( ) > capacity ) {
+          map.erase( queue.front( ) );
+          queue.pop_front( );
+        }
+      }
+    };
+
+    BulkTokenizer::BulkTokenizer( TokenManager &_manager, Options _options )
+      : manager( _manager )
+      , options( std::move( _options ) ) {
+      for ( auto &field : options.fields ) {
+        LOG( debug, "Mapping field {} to vault {}", field.source, field.vault );
+
+        vaults.emplace_back( manager.getVaultInfo( field.vault ) );
+
+        if ( ( options.format == CSV_FORMAT ) && ( !options.header ) ) {
+          try {
+            columns.push_back( std::stoul( field.source ) );
+          } catch ( std::exception &ex ) {
+            throw exceptions::TokenRangeError( "Invalid column index: " + field.source );
+          }
+        }
+      }
+    }
+
+    BulkTokenizer::Stats BulkTokenizer::run( const std::string &path, std::ostream &output ) {
+      struct stat info = { };
+      Mapping     mapping;
+      Source      source;
+      int         fd = -1;
+
+      if ( path == "-" ) {
+        return run( std::cin, output );
+      }
+
+      if ( ( fd = ::open( path.c_str( ), O_RDONLY ) ) < 0 ) {
+        throw exceptions::TokenException( "Unable to open " + path + ": " + strerror( errno ) );
+      }
+
+      if ( ( fstat( fd, &info ) == 0 ) && ( S_ISREG( info.st_mode ) ) && ( info.st_size > 0 ) ) {
+        mapping.length = static_cast< size_t >( info.st_size );
+        mapping.data   = mmap( nullptr, mapping.length, PROT_READ, MAP_PRIVATE, fd, 0 );
+      }
+
+      ::close( fd );
+
+      if ( mapping.data == MAP_FAILED ) {
+        LOG( debug, "Reading {} through buffered reads", path );
+
+        std::ifstream input( path, std::ios::binary );
+        return run( input, output );
+      }
+
+      LOG( debug, "Reading {} through a {} byte mapping", path, mapping.length );
+
+      madvise( mapping.data, mapping.length, MADV_SEQUENTIAL );
+
+      source.quoted = options.format == CSV_FORMAT;
+      source.pos    = static_cast< const char * >( mapping.data );
+      source.end    = source.pos + mapping.length;
+
+      return run( source, output );
+    }
+
+    BulkTokenizer::Stats BulkTokenizer::run( std::istream &input, std::ostream &output ) {
+      Source source;
+
+      source.input    = &input;
+      source.quoted   = options.format == CSV_FORMAT;
+      source.readSize = std::max( options.readSize, static_cast< size_t >( 4096 ) );
+
+      return run( source, output );
+    }
+
+    BulkTokenizer::Stats BulkTokenizer::run( Source &source, std::ostream &output ) {
+      using BatchPtr = std::unique_ptr< Batch >;
+
+      core::BoundedQueue< BatchPtr > parsed( options.queueDepth );
+      core::BoundedQueue< BatchPtr > prepared( options.queueDepth );
+      core::BoundedQueue< BatchPtr > stored( options.queueDepth );
+      Context                        context( options.dedupeWindow );
+      std::vector< std::thread >     threads;
+      std::exception_ptr             failure;
+      std::mutex                     failureLock;
+      std::atomic< size_t >          workers( std::max( options.workers, static_cast< size_t >( 1 ) ) );
+      const char *                   data   = nullptr;
+      size_t                         length = 0;
+      Buffer                         owner;
+
+      auto fail = [ & ]( ) {
+        {
+          std::lock_guard< std::mutex > guard( failureLock );
+          if ( !failure ) {
+            failure = std::current_exception( );
+          }
+        }
+
+        parsed.close( );
+        prepared.close( );
+        stored.close( );
+      };
+
+      if ( options.format == CSV_FORMAT ) {
+        if ( options.header ) {
+          columns.clear( );
+
+          if ( source.next( data, length, owner ) ) {
+            auto header = splitColumns( data, length, options.delimiter );
+
+            for ( auto &field : options.fields ) {
+              auto iter = std::find( header.begin( ), header.end( ), field.source );
+
+              if ( iter == header.end( ) ) {
+                throw exceptions::TokenRangeError( "Column not found in header: " + field.source );
+              }
+
+              columns.push_back( static_cast< size_t >( iter - header.begin( ) ) );
+            }
+
+            output.write( data, length );
+            output << '\n';
+          }
+        }
+      } else {
+        for ( auto &field : options.fields ) {
+          context.pointers.emplace_back( field.source );
+        }
+      }
+
+      LOG( info, "Starting bulk tokenization with {} workers", workers.load( ) );
+
+      for ( size_t num = workers; num > 0; --num ) {
+        threads.emplace_back( [ & ]( ) {
+          try {
+            BatchPtr batch;
+
+            while ( parsed.pop( batch ) ) {
+              prepare( *batch, context );
+
+              if ( !prepared.push( std::move( batch ) ) ) {
+                break;
+              }
+            }
+          } catch ( ... ) {
+            fail( );
+          }
+
+          if ( --workers == 0 ) {
+            prepared.close( );
+          }
+        } );
+      }
+
+      threads.emplace_back( [ & ]( ) {
+        std::map< size_t, BatchPtr > pending;
+        size_t                       sequence = 0;
+
+        try {
+          BatchPtr batch;
+
+          while ( prepared.pop( batch ) ) {
+            pending[ batch->sequence ] = std::move( batch );
+
+            for ( auto iter = pending.begin( ); ( iter != pending.end( ) ) && ( iter->first == sequence );
+                  iter      = pending.begin( ), ++sequence ) {
+              store( *iter->second, context );
+
+              if ( !stored.push( std::move( iter->second ) ) ) {
+                return;
+              }
+
+              pending.erase( iter );
+            }
+          }
+        } catch ( ... ) {
+          fail( );
+        }
+
+        stored.close( );
+      } );
+
+      threads.emplace_back( [ & ]( ) {
+        try {
+          BatchPtr batch;
+
+          while ( stored.pop( batch ) ) {
+            write( *batch, context, output );
+          }
+
+          output.flush( );
+        } catch ( ... ) {
+          fail( );
+        }
+      } );
+
+      try {
+        BatchPtr batch;
+        size_t   sequence = 0;
+
+        while ( true ) {
+          bool more = source.next( data, length, owner );
+
+          if ( ( batch ) && ( ( !more ) || ( batch->records.size( ) >= options.batchSize ) ) ) {
+            if ( !parsed.push( std::move( batch ) ) ) {
+              break;
+            }
+          }
+
+          if ( !more ) {
+            break;
+          }
+
+          if ( !batch ) {
+            batch.reset( new Batch( ) );
+            batch->sequence = sequence++;
+            batch->records.reserve( options.batchSize );
+          }
+
+          if ( ( owner ) && ( ( batch->buffers.empty( ) ) || ( batch->buffers.back( ) != owner ) ) ) {
+            batch->buffers.push_back( owner );
+          }
+
+          batch->records.emplace_back( );
+          batch->records.back( ).data   = data;
+          batch->records.back( ).length = length;
+          ++context.stats.records;
+        }
+      } catch ( ... ) {
+        fail( );
+      }
+
+      parsed.close( );
+
+      for ( auto &thread : threads ) {
+        thread.join( );
+      }
+
+      if ( failure ) {
+        std::rethrow_exception( failure );
+      }
+
+      LOG( info,
+           "Bulk tokenization complete: {} records, {} values ({} created, {} existing, {} deduplicated, {} derived)",
+           context.stats.records,
+           context.stats.values,
+           context.stats.created,
+           context.stats.existing,
+           context.stats.deduplicated,
+           context.stats.derived );
+
+      return context.stats;
+    }
+
+    void BulkTokenizer::prepare( Batch &batch, Context &context ) {
+      for ( size_t num = 0; num < batch.records.size( ); ++num ) {
+        auto &record = batch.records[ num ];
+
+        if ( options.format == CSV_FORMAT ) {
+          record.columns = splitColumns( record.data, record.length, options.delimiter );
+
+          for ( size_t field = 0; field < columns.size( ); ++field ) {
+            auto column = columns[ field ];
+
+            if ( ( column < record.columns.size( ) ) && ( !record.columns[ column ].empty( ) ) ) {
+              batch.jobs.emplace_back( );
+              batch.jobs.back( ).record = num;
+              batch.jobs.back( ).field  = field;
+              batch.jobs.back( ).value  = record.columns[ column ];
+            }
+          }
+        } else if ( record.length > 0 ) {
+          record.document = nlohmann::json::parse( record.data, record.data + record.length );
+
+          for ( size_t field = 0; field < context.pointers.size( ); ++field ) {
+            auto &pointer = context.pointers[ field ];
+
+            if ( !record.document.contains( pointer ) ) {
+              continue;
+            }
+
+            auto &node = record.document.at( pointer );
+
+            if ( ( node.is_string( ) ) || ( node.is_number( ) ) ) {
+              batch.jobs.emplace_back( );
+              batch.jobs.back( ).record = num;
+              batch.jobs.back( ).field  = field;
+              batch.jobs.back( ).value  = node.is_string( ) ? node.get< std::string >( ) : node.dump( );
+            }
+          }
+        }
+      }
+
+      std::vector< std::vector< Job * > > byVault( vaults.size( ) );
+      std::vector< crypto::bytes_view >   values;
+      std::vector< bytea >                hashes;
+
+      for ( auto &job : batch.jobs ) {
+        byVault[ job.field ].push_back( &job );
+      }
+
+      for ( size_t field = 0; field < vaults.size( ); ++field ) {
+        auto &jobs = byVault[ field ];
+
+        if ( jobs.empty( ) ) {
+          continue;
+        }
+
+        if ( vaults[ field ]->vaultless( ) ) {
+          for ( auto job : jobs ) {
+            job->entry.token = manager.derive( vaults[ field ], job->value, true, &job->entry.mask );
+            job->state       = DERIVED;
+          }
+
+          /* Revocable vaults store every token issued: hashed below, stored as new tokens */
+          if ( !vaults[ field ]->revocable( ) ) {
+            jobs.clear( );
+            continue;
+          }
+        }
+
+        values.clear( );
+
+        for ( auto job : jobs ) {
+          values.emplace_back( job->value );
+        }
+
+        vaults[ field ]->macKey->hashBatch( values, hashes );
+
+        for ( size_t num = 0; num < jobs.size( ); ++num ) {
+          jobs[ num ]->entry.hmac = std::move( hashes[ num ] );
+        }
+
+        jobs.clear( );
+      }
+
+      /* The durable values already in the vault are found by the insert stage, in bulk */
+      for ( auto &job : batch.jobs ) {
+        auto &vault = vaults[ job.field ];
+
+        if ( ( job.state == DERIVED ) && ( !vault->revocable( ) ) ) {
+          continue;
+        }
+
+        if ( ( vault->durable ) && ( context.find( vault->table, job.entry.hmac, job.entry.token ) ) ) {
+          job.state = DEDUPLICATED;
+          continue;
+        }
+
+        job.entry.value = job.value;
+        job.state       = CREATED;
+
+        if ( vault->vaultless( ) ) {
+          continue;
+        }
+
+        /* Permuted tokens consume the keyspace: generated once the value is known to be new */
+        if ( ( !vault->durable ) || ( !vault->permuted( ) ) ) {
+          byVault[ job.field ].push_back( &job );
+        }
+      }
+
+      for ( size_t field = 0; field < vaults.size( ); ++field ) {
+        std::vector< TokenEntry * > entries;
+
+        for ( auto job : byVault[ field ] ) {
+          entries.push_back( &job->entry );
+        }
+
+        if ( !entries.empty( ) ) {
+          manager.prepare( vaults[ field ], entries );
+        }
+      }
+    }
+
+    void BulkTokenizer::store( Batch &batch, Context &context ) {
+      std::map< std::string, std::vector< size_t > >          inserts;
+      std::map< std::string, std::map< std::string, size_t > > owners;
+      std::vector< std::vector< TokenEntry * > >               unprepared( vaults.size( ) );
+      auto &                                                   stats = context.stats;
+
+      for ( size_t num = 0; num < batch.jobs.size( ); ++num ) {
+        auto &job   = batch.jobs[ num ];
+        auto &vault = vaults[ job.field ];
+
+        if ( ( job.state == CREATED ) && ( vault->durable ) ) {
+          auto &local = owners[ vault->table ];
+          auto  key   = std::string( job.entry.hmac.begin( ), job.entry.hmac.end( ) );
+          auto  iter  = local.find( key );
+
+          if ( context.find( vault->table, job.entry.hmac, job.entry.token ) ) {
+            job.state = DEDUPLICATED;
+          } else if ( iter != local.end( ) ) {
+            job.state = DEDUPLICATED;
+            job.owner = iter->second;
+          } else {
+            local[ key ] = num;
+          }
+        }
+      }
+
+      /* One lookup per vault table finds the durable values already tokenized */
+      for ( auto &local : owners ) {
+        std::vector< bytea > hmacs;
+
+        hmacs.reserve( local.second.size( ) );
+
+        for ( auto &owner : local.second ) {
+          hmacs.emplace_back( owner.first.begin( ), owner.first.end( ) );
+        }
+
+        for ( auto &existing : manager.storage->existing( local.first, hmacs ) ) {
+          auto iter = local.second.find( std::string( existing.hmac.begin( ), existing.hmac.end( ) ) );
+
+          if ( iter != local.second.end( ) ) {
+            auto &job = batch.jobs[ iter->second ];
+
+            job.entry.token = std::move( existing.token );
+            job.state       = EXISTING;
+
+            context.add( local.first, job.entry.hmac, job.entry.token );
+          }
+        }
+      }
+
+      for ( auto &job : batch.jobs ) {
+        if ( ( job.state == CREATED ) && ( job.entry.crypt.empty( ) ) && ( !vaults[ job.field ]->vaultless( ) ) ) {
+          unprepared[ job.field ].push_back( &job.entry );
+        }
+      }
+
+      for ( size_t field = 0; field < vaults.size( ); ++field ) {
+        if ( !unprepared[ field ].empty( ) ) {
+          manager.prepare( vaults[ field ], unprepared[ field ] );
+        }
+      }
+
+      for ( size_t num = 0; num < batch.jobs.size( ); ++num ) {
+        auto &job   = batch.jobs[ num ];
+        auto &vault = vaults[ job.field ];
+
+        ++stats.values;
+
+        switch ( job.state ) {
+          case CREATED:
+            inserts[ vault->table ].push_back( num );
+            break;
+          case EXISTING:
+            ++stats.existing;
+            break;
+          case DEDUPLICATED:
+            ++stats.deduplicated;
+            break;
+          case DERIVED:
+            ++stats.derived;
+            break;
+          default:
+            break;
+        }
+      }
+
+      for ( auto &insert : inserts ) {
+        std::vector< TokenEntry > entries;
+
+        entries.reserve( insert.second.size( ) );
+
+        for ( auto &num : insert.second ) {
+          entries.emplace_back( std::move( batch.jobs[ num ].entry ) );
+        }
+
+        try {
+          manager.storage->insert( insert.first, entries );
+
+          for ( size_t num = 0; num < entries.size( ); ++num ) {
+            batch.jobs[ insert.second[ num ] ].entry = std::move( entries[ num ] );
+          }
+
+          stats.created += entries.size( );
+        } catch ( std::exception &ex ) {
+          LOG( warn,
+               "Batch insert of {} tokens into {} failed, tokenizing singly: {}",
+               entries.size( ),
+               insert.first,
+               ex.what( ) );
+
+          for ( auto &num : insert.second ) {
+            auto &job = batch.jobs[ num ];
+
+            job.entry = manager.tokenize( vaults[ job.field ]->alias, job.value, nullptr );
+            ++stats.fallbacks;
+          }
+        }
+
+        for ( auto &num : insert.second ) {
+          auto &job = batch.jobs[ num ];
+
+          if ( vaults[ job.field ]->durable ) {
+            context.add( insert.first, job.entry.hmac, job.entry.token );
+          }
+        }
+      }
+
+      for ( auto &job : batch.jobs ) {
+        if ( job.owner != NO_OWNER ) {
+          job.entry.token = batch.jobs[ job.owner ].entry.token;
+        }
+      }
+    }
+
+    void BulkTokenizer::write( Batch &batch, Context &context, std::ostream &output ) {
+      for ( auto &job : batch.jobs ) {
+        auto &record = batch.records[ job.record ];
+
+        if ( options.format == CSV_FORMAT ) {
+          record.columns[ columns[ job.field ] ] = job.entry.token;
+        } else {
+          record.document[ context.pointers[ job.field ] ] = job.entry.token;
+        }
+
+        record.modified = true;
+      }
+
+      for ( auto &record : batch.records ) {
+        if ( !record.modified ) {
+          output.write( record.data, record.length );
+        } else if ( options.format == CSV_FORMAT ) {
+          writeColumns( output, record.columns, options.delimiter );
+        } else {
+          output << record.document.dump( );
+        }
+
+        output << '\n';
+      }
+
+      if ( !output ) {
+        throw exceptions::TokenException( "Error writing tokenized records" );
+      }
+    }
+  } // namespace api
+} // namespace token
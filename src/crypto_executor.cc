@@ -0,0 +1,490 @@
+
+#include "token/api.hh"
+#include "token/crypto/executor.hh"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( executorLogger->should_log( spdlog::level::lvl ) ) {                                                          \
+      executorLogger->lvl( fmt, ##__VA_ARGS__ );                                                                       \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace crypto {
+    /** Crypto executor logger */
+    std::shared_ptr< spdlog::logger > executorLogger = token::api::create_logger( "token::crypto::executor", { } );
+
+    struct ExecutorProvider::Core {
+      /** Queued operations */
+      enum Operation { ENCRYPT, DECRYPT, HASH, RANDOM };
+
+      /**
+       * Completion of a submission (one or more values), awaited by the submitter
+       */
+      struct Completion {
+        std::mutex              lock;          /**< Completion lock                  */
+        std::condition_variable done;          /**< Signalled on the last value      */
+        size_t                  remaining = 0; /**< Values not completed yet         */
+        std::exception_ptr      error;         /**< First error raised by the values */
+      };
+
+      /**
+       * A single queued value
+       */
+      struct Request {
+        bytes_view   input;      /**< Input value (random: requested length) */
+        bytea *      output;     /**< Result (encrypt, decrypt, hash)        */
+        uint8_t *    block;      /**< Result (random)                        */
+        Completion * completion; /**< Submission the value belongs to        */
+      };
+
+      /** Queue identity: the wrapped key (or provider) and operation */
+      using LaneId = std::pair< const void *, Operation >;
+
+      /**
+       * Values queued for a key and operation
+       */
+      struct Lane {
+        std::deque< Request > requests;      /**< Queued values               */
+        bool                  ready = false; /**< Lane is in the ready list   */
+      };
+
+      using Lanes = std::map< LaneId, Lane >;
+
+      explicit Core( ExecutorProvider::Options _options )
+        : options( _options ) {
+        options.workers  = std::max< size_t >( options.workers, 1 );
+        options.maxBatch = std::max< size_t >( options.maxBatch, 1 );
+        options.maxQueue = std::max< size_t >( options.maxQueue, 1 );
+
+        for ( size_t num = 0; num < options.workers; ++num ) {
+          workers.emplace_back( &Core::worker, this );
+        }
+      }
+
+      ~Core( ) { stop( ); }
+
+      /**
+       * @brief Stop the workers once the queued values are completed
+       */
+      void stop( ) {
+        {
+          std::unique_lock< std::mutex > guard( lock );
+
+          if ( stopped ) {
+            return;
+          }
+
+          stopped = true;
+        }
+
+        work.notify_all( );
+        space.notify_all( );
+
+        for ( auto &thread : workers ) {
+          thread.join( );
+        }
+      }
+
+      /**
+       * @brief Submit a set of values for an operation, and wait for their completion
+       * @param operation operation
+       * @param target wrapped key (interface::EncKey or interface::MacKey) or provider (random)
+       * @param requests values (the completion is filled in)
+       */
+      void run( Operation operation, const void *target, std::vector< Request > &requests ) {
+        Completion completion;
+
+        if ( requests.empty( ) ) {
+          return;
+        }
+
+        completion.remaining = requests.size( );
+
+        for ( auto &request : requests ) {
+          request.completion = &completion;
+        }
+
+        {
+          std::unique_lock< std::mutex > guard( lock );
+
+          space.wait( guard, [ & ]( ) {
+            return stopped || queued == 0 || queued + requests.size( ) <= options.maxQueue;
+          } );
+
+          if ( !stopped ) {
+            auto &lane = lanes[ LaneId( target, operation ) ];
+
+            lane.requests.insert( lane.requests.end( ), requests.begin( ), requests.end( ) );
+            queued += requests.size( );
+
+            if ( !lane.ready ) {
+              lane.ready = true;
+              ready.push_back( lanes.find( LaneId( target, operation ) ) );
+            }
+
+            guard.unlock( );
+            work.notify_one( );
+          } else {
+            guard.unlock( );
+            process( operation, target, requests );
+          }
+        }
+
+        std::unique_lock< std::mutex > guard( completion.lock );
+
+        completion.done.wait( guard, [ & ]( ) { return completion.remaining == 0; } );
+
+        if ( completion.error ) {
+          std::rethrow_exception( completion.error );
+        }
+      }
+
+      /**
+       * @brief Submit a single value, and wait for its completion
+       * @param operation operation
+       * @param target wrapped key or provider
+       * @param input input value
+       * @param output result
+       */
+      void run( Operation operation, const void *target, bytes_view input, bytea *output ) {
+        std::vector< Request > requests{ Request{ input, output, nullptr, nullptr } };
+
+        run( operation, target, requests );
+      }
+
+      /**
+       * @brief Worker loop: take the values queued for the first ready lane and execute them
+       */
+      void worker( ) {
+        std::unique_lock< std::mutex > guard( lock );
+        std::vector< Request >         batch;
+
+        while ( true ) {
+          work.wait( guard, [ & ]( ) { return stopped || !ready.empty( ); } );
+
+          if ( ready.empty( ) ) {
+            break;
+          }
+
+          auto entry = ready.front( );
+          auto id    = entry->first;
+          auto &lane = entry->second;
+          auto count = std::min( options.maxBatch, lane.requests.size( ) );
+
+          ready.pop_front( );
+
+          batch.assign( lane.requests.begin( ), lane.requests.begin( ) + count );
+          lane.requests.erase( lane.requests.begin( ), lane.requests.begin( ) + count );
+          queued -= count;
+
+          if ( lane.requests.empty( ) ) {
+            lanes.erase( entry );
+          } else {
+            ready.push_back( entry );
+            work.notify_one( );
+          }
+
+          guard.unlock( );
+          space.notify_all( );
+
+          process( id.second, id.first, batch );
+
+          guard.lock( );
+        }
+      }
+
+      /**
+       * @brief Execute a batch of values with a single call, retrying the values one by one if
+       * the batch fails so an error is only reported to the submission it belongs to
+       * @param operation operation
+       * @param target wrapped key or provider
+       * @param batch values
+       */
+      void process( Operation operation, const void *target, std::vector< Request > &batch ) {
+        std::vector< std::exception_ptr > errors( batch.size( ) );
+
+        LOG( trace, "Executing {} values (operation {})", batch.size( ), operation );
+
+        try {
+          execute( operation, target, batch.data( ), batch.size( ) );
+        } catch ( ... ) {
+          if ( batch.size( ) == 1 ) {
+            errors[ 0 ] = std::current_exception( );
+          } else {
+            LOG( debug, "Batch of {} values failed, retrying individually", batch.size( ) );
+
+            for ( size_t num = 0; num < batch.size( ); ++num ) {
+              try {
+                execute( operation, target, &batch[ num ], 1 );
+              } catch ( ... ) {
+                errors[ num ] = std::current_exception( );
+              }
+            }
+          }
+        }
+
+        for ( size_t num = 0; num < batch.size( ); ++num ) {
+          auto &                        completion = *batch[ num ].completion;
+          std::lock_guard< std::mutex > guard( completion.lock );
+
+          if ( errors[ num ] && !completion.error ) {
+            completion.error = errors[ num ];
+          }
+
+          if ( --completion.remaining == 0 ) {
+            completion.done.notify_all( );
+          }
+        }
+      }
+
+      /**
+       * @brief Execute values with a single call to the wrapped key or provider
+       * @param operation operation
+       * @param target wrapped key or provider
+       * @param requests values
+       * @param count number of values
+       */
+      static void execute( Operation operation, const void *target, Request *requests, size_t count ) {
+        thread_local std::vector< bytes_view > inputs;
+        thread_local std::vector< bytea >      outputs;
+
+        if ( operation == RANDOM ) {
+          size_t total = 0;
+
+          for ( size_t num = 0; num < count; ++num ) {
+            total += requests[ num ].input.size;
+          }
+
+          bytea block( total );
+          auto  position = block.data( );
+
+          const_cast< Provider * >( static_cast< const Provider * >( target ) )->random( block.data( ), total );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            std::copy( position, position + requests[ num ].input.size, requests[ num ].block );
+            position += requests[ num ].input.size;
+          }
+
+          std::fill( block.begin( ), block.end( ), 0 );
+          return;
+        }
+
+        inputs.clear( );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          inputs.push_back( requests[ num ].input );
+        }
+
+        switch ( operation ) {
+          case ENCRYPT:
+            static_cast< const interface::EncKey * >( target )->encryptBatch( inputs, outputs );
+            break;
+          case DECRYPT:
+            static_cast< const interface::EncKey * >( target )->decryptBatch( inputs, outputs );
+            break;
+          default:
+            static_cast< const interface::MacKey * >( target )->hashBatch( inputs, outputs );
+            break;
+        }
+
+        for ( size_t num = 0; num < count; ++num ) {
+          *requests[ num ].output = std::move( outputs[ num ] );
+        }
+      }
+
+      ExecutorProvider::Options     options;         /**< Executor configuration        */
+      std::vector< std::thread >    workers;         /**< Worker threads                */
+      Lanes                         lanes;           /**< Queued values per lane        */
+      std::deque< Lanes::iterator > ready;           /**< Lanes with values, FIFO       */
+      size_t                        queued  = 0;     /**< Values queued                 */
+      bool                          stopped = false; /**< Executor stopping             */
+      std::mutex                    lock;            /**< Queue lock                    */
+      std::condition_variable       work;            /**< Signalled when values queue   */
+      std::condition_variable       space;           /**< Signalled when values dequeue */
+    };
+
+    namespace {
+      using Core = ExecutorProvider::Core;
+
+      /**
+       * Encryption key submitting its operations to the executor
+       */
+      class ExecutorEncKey : public interface::EncKey {
+       public:
+        ExecutorEncKey( crypto::EncKey _key, std::shared_ptr< Core > _core )
+          : key( std::move( _key ) )
+          , core( std::move( _core ) ) {}
+
+        size_t encrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          bytea result;
+
+          core->run( Core::ENCRYPT, key.get( ), bytes_view( data, length ), &result );
+          return copyOut( result, out, outLength );
+        }
+
+        size_t decrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          bytea result;
+
+          core->run( Core::DECRYPT, key.get( ), bytes_view( data, length ), &result );
+          return copyOut( result, out, outLength );
+        }
+
+        bytea encrypt( const bytea data ) const override {
+          bytea result;
+
+          core->run( Core::ENCRYPT, key.get( ), bytes_view( data.data( ), data.size( ) ), &result );
+          return result;
+        }
+
+        bytea decrypt( const bytea data ) const override {
+          bytea result;
+
+          core->run( Core::DECRYPT, key.get( ), bytes_view( data.data( ), data.size( ) ), &result );
+          return result;
+        }
+
+        void encryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          submit( Core::ENCRYPT, inputs, outputs );
+        }
+
+        void decryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          submit( Core::DECRYPT, inputs, outputs );
+        }
+
+        size_t encryptedLength( size_t length ) const override { return key->encryptedLength( length ); }
+
+        size_t decryptedLength( size_t length ) const override { return key->decryptedLength( length ); }
+
+        explicit operator std::string( ) override { return std::string( *key ); }
+
+        bool isVersioned( ) const override { return key->isVersioned( ); }
+
+       private:
+        void submit( Core::Operation operation, const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const {
+          std::vector< Core::Request > requests;
+
+          outputs.resize( inputs.size( ) );
+          requests.reserve( inputs.size( ) );
+
+          for ( size_t num = 0; num < inputs.size( ); ++num ) {
+            requests.push_back( Core::Request{ inputs[ num ], &outputs[ num ], nullptr, nullptr } );
+          }
+
+          core->run( operation, key.get( ), requests );
+        }
+
+        crypto::EncKey          key;  /**< Wrapped key */
+        std::shared_ptr< Core > core; /**< Executor    */
+      };
+
+      /**
+       * Hash key submitting its operations to the executor
+       */
+      class ExecutorMacKey : public interface::MacKey {
+       public:
+        ExecutorMacKey( crypto::MacKey _key, std::shared_ptr< Core > _core )
+          : key( std::move( _key ) )
+          , core( std::move( _core ) ) {}
+
+        size_t hash( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          bytea result;
+
+          core->run( Core::HASH, key.get( ), bytes_view( data, length ), &result );
+
+          if ( result.size( ) <= outLength ) {
+            std::copy( result.begin( ), result.end( ), out );
+          }
+
+          return result.size( );
+        }
+
+        bytea hash( const bytea &data ) const override {
+          bytea result;
+
+          core->run( Core::HASH, key.get( ), bytes_view( data.data( ), data.size( ) ), &result );
+          return result;
+        }
+
+        void hashBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          std::vector< Core::Request > requests;
+
+          outputs.resize( inputs.size( ) );
+          requests.reserve( inputs.size( ) );
+
+          for ( size_t num = 0; num < inputs.size( ); ++num ) {
+            requests.push_back( Core::Request{ inputs[ num ], &outputs[ num ], nullptr, nullptr } );
+          }
+
+          core->run( Core::HASH, key.get( ), requests );
+        }
+
+        size_t hashLength( ) const override { return key->hashLength( ); }
+
+        explicit operator std::string( ) override { return std::string( *key ); }
+
+       private:
+        crypto::MacKey          key;  /**< Wrapped key */
+        std::shared_ptr< Core > core; /**< Executor    */
+      };
+    } // namespace
+
+    ExecutorProvider::ExecutorProvider( std::shared_ptr< Provider > _provider, Options options )
+      : provider( std::move( _provider ) )
+      , core( std::make_shared< Core >( options ) ) {
+      LOG( debug, "Crypto executor started: {} workers, batches of {}", options.workers, options.maxBatch );
+    }
+
+    ExecutorProvider::~ExecutorProvider( ) { core->stop( ); }
+
+    EncKey ExecutorProvider::getEncKey( std::string name ) {
+      auto key = provider->getEncKey( name );
+
+      return key ? std::make_shared< ExecutorEncKey >( key, core ) : nullptr;
+    }
+
+    MacKey ExecutorProvider::getMacKey( std::string name ) {
+      auto key = provider->getMacKey( name );
+
+      return key ? std::make_shared< ExecutorMacKey >( key, core ) : nullptr;
+    }
+
+    EncKey ExecutorProvider::createEncKey( std::string name, std::map< std::string, std::string > parameters ) {
+      auto key = provider->createEncKey( name, parameters );
+
+      return key ? std::make_shared< ExecutorEncKey >( key, core ) : nullptr;
+    }
+
+    MacKey ExecutorProvider::createMacKey( std::string name, std::map< std::string, std::string > parameters ) {
+      auto key = provider->createMacKey( name, parameters );
+
+      return key ? std::make_shared< ExecutorMacKey >( key, core ) : nullptr;
+    }
+
+    FpeKey ExecutorProvider::getFpeKey( std::string name ) { return provider->getFpeKey( name ); }
+
+    FpeKey ExecutorProvider::createFpeKey( std::string name, std::map< std::string, std::string > parameters ) {
+      return provider->createFpeKey( name, parameters );
+    }
+
+    void ExecutorProvider::random( void *block, size_t length ) {
+      std::vector< Core::Request > requests{ Core::Request{
+        bytes_view( nullptr, length ), nullptr, reinterpret_cast< uint8_t * >( block ), nullptr } };
+
+      core->run( Core::RANDOM, provider.get( ), requests );
+    }
+
+    void ExecutorProvider::cmdArgs( boost::program_options::options_description &encOptions,
+                                    boost::program_options::options_description &macOptions ) {
+      provider->cmdArgs( encOptions, macOptions );
+    }
+  } // namespace crypto
+} // namespace token
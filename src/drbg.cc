@@ -0,0 +1,73 @@
+
+#include "drbg.hh"
+#include "token/exceptions.hh"
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <vector>
+
+namespace token {
+  namespace crypto {
+    namespace {
+      /**
+       * @brief HMAC-SHA-256 of a message
+       * @param key key (HmacDrbg::LENGTH bytes)
+       * @param data message
+       * @param length message length
+       * @param out [out] digest (HmacDrbg::LENGTH bytes)
+       */
+      void hmac( const std::uint8_t *key, const std::uint8_t *data, size_t length, std::uint8_t *out ) {
+        std::uint8_t digest[ EVP_MAX_MD_SIZE ];
+        unsigned int size = 0;
+
+        if ( HMAC( EVP_sha256( ), key, HmacDrbg::LENGTH, data, length, digest, &size ) == nullptr ) {
+          throw exceptions::TokenCryptographyError( "Unable to compute DRBG HMAC" );
+        }
+
+        memcpy( out, digest, HmacDrbg::LENGTH );
+      }
+    } // namespace
+
+    HmacDrbg::HmacDrbg( const std::uint8_t *seed, size_t length ) {
+      memset( key, 0x00, sizeof( key ) );
+      memset( value, 0x01, sizeof( value ) );
+
+      update( seed, length );
+    }
+
+    void HmacDrbg::update( const std::uint8_t *data, size_t length ) {
+      std::vector< std::uint8_t > message( value, value + LENGTH );
+
+      message.push_back( 0x00 );
+      message.insert( message.end( ), data, data + ( data != nullptr ? length : 0 ) );
+
+      hmac( key, message.data( ), message.size( ), key );
+      hmac( key, value, LENGTH, value );
+
+      if ( ( data != nullptr ) && ( length > 0 ) ) {
+        message.assign( value, value + LENGTH );
+        message.push_back( 0x01 );
+        message.insert( message.end( ), data, data + length );
+
+        hmac( key, message.data( ), message.size( ), key );
+        hmac( key, value, LENGTH, value );
+      }
+    }
+
+    void HmacDrbg::generate( void *out, size_t length ) {
+      auto bytes = static_cast< std::uint8_t * >( out );
+
+      while ( length > 0 ) {
+        size_t count = length < LENGTH ? length : LENGTH;
+
+        hmac( key, value, LENGTH, value );
+        memcpy( bytes, value, count );
+
+        bytes += count;
+        length -= count;
+      }
+
+      update( nullptr, 0 );
+    }
+  } // namespace crypto
+} // namespace token
@@ -0,0 +1,47 @@
+
+#ifndef __TOKENIZATION_DRBG_HH__
+#define __TOKENIZATION_DRBG_HH__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace token {
+  namespace crypto {
+    /**
+     * HMAC_DRBG (NIST SP 800-90A) over SHA-256: a deterministic stream of pseudo-random bytes
+     * from a secret seed.  There is no reseeding; the same seed always produces the same stream.
+     */
+    class HmacDrbg {
+     public:
+      /** Output (and key) length of SHA-256 */
+      static constexpr size_t LENGTH = 32;
+
+      /**
+       * @brief Instantiate the generator
+       * @param seed seed material (entropy input, nonce and personalization)
+       * @param length seed length
+       */
+      HmacDrbg( const std::uint8_t *seed, size_t length );
+
+      /**
+       * @brief Generate pseudo-random bytes
+       * @param out [out] output
+       * @param length number of bytes to generate
+       */
+      void generate( void *out, size_t length );
+
+     private:
+      /**
+       * @brief Update the generator state with additional data
+       * @param data additional data (may be nullptr)
+       * @param length data length
+       */
+      void update( const std::uint8_t *data, size_t length );
+
+      std::uint8_t key[ LENGTH ];   /**< HMAC key (K) */
+      std::uint8_t value[ LENGTH ]; /**< Chain value (V) */
+    };
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_DRBG_HH__
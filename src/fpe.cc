@@ -0,0 +1,469 @@
+
+#include "fpe.hh"
+#include "token/exceptions.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace token {
+  namespace crypto {
+    namespace fpe {
+      namespace {
+        /** Smallest domain allowed by SP 800-38G Rev. 1 */
+        static constexpr uint64_t MIN_DOMAIN = 1000000;
+
+        /** Block size */
+        static constexpr size_t BLOCK = 16;
+
+        /**
+         * Unsigned integer of arbitrary size, only as wide as the numeral conversions require
+         */
+        class BigNum {
+         public:
+          /**
+           * @brief Multiply by, then add, small values
+           * @param mul multiplier
+           * @param add addend
+           */
+          void mulAdd( uint32_t mul, uint32_t add ) {
+            uint64_t carry = add;
+
+            for ( auto &limb : limbs ) {
+              uint64_t value = static_cast< uint64_t >( limb ) * mul + carry;
+
+              limb  = static_cast< uint32_t >( value );
+              carry = value >> 32;
+            }
+
+            if ( carry ) {
+              limbs.push_back( static_cast< uint32_t >( carry ) );
+            }
+          }
+
+          /**
+           * @brief Divide by a small value
+           * @param divisor divisor
+           * @return remainder
+           */
+          uint32_t divide( uint32_t divisor ) {
+            uint64_t remainder = 0;
+
+            for ( size_t num = limbs.size( ); num-- > 0; ) {
+              uint64_t value = ( remainder << 32 ) | limbs[ num ];
+
+              limbs[ num ] = static_cast< uint32_t >( value / divisor );
+              remainder    = value % divisor;
+            }
+
+            while ( ( !limbs.empty( ) ) && ( limbs.back( ) == 0 ) ) {
+              limbs.pop_back( );
+            }
+
+            return static_cast< uint32_t >( remainder );
+          }
+
+          /**
+           * @brief Load a big endian byte string
+           * @param data bytes
+           * @param length number of bytes
+           */
+          void load( const uint8_t *data, size_t length ) {
+            limbs.clear( );
+
+            for ( size_t num = 0; num < length; ++num ) {
+              mulAdd( 256, data[ num ] );
+            }
+          }
+
+          /**
+           * @brief Load a numeral string
+           * @param numerals numerals
+           * @param length number of numerals
+           * @param radix radix
+           * @param reversed least significant numeral first (FF3-1)
+           */
+          void load( const uint16_t *numerals, size_t length, unsigned radix, bool reversed ) {
+            limbs.clear( );
+
+            for ( size_t num = 0; num < length; ++num ) {
+              mulAdd( radix, numerals[ reversed ? length - num - 1 : num ] );
+            }
+          }
+
+          /**
+           * @brief Store as a fixed length big endian byte string (consumes the value)
+           * @param out output bytes
+           * @param length number of bytes
+           */
+          void store( uint8_t *out, size_t length ) {
+            for ( size_t num = length; num-- > 0; ) {
+              out[ num ] = static_cast< uint8_t >( divide( 256 ) );
+            }
+          }
+
+          /**
+           * @brief Identify a zero value
+           * @return true if zero
+           */
+          bool zero( ) const { return limbs.empty( ); }
+
+          /**
+           * @brief Number of significant bits
+           * @return bit length
+           */
+          size_t bits( ) const {
+            size_t count = limbs.size( ) * 32;
+
+            if ( limbs.empty( ) ) {
+              return 0;
+            }
+
+            for ( uint32_t top = limbs.back( ); ( top & 0x80000000u ) == 0; top <<= 1 ) {
+              --count;
+            }
+
+            return count;
+          }
+
+         private:
+          std::vector< uint32_t > limbs; /**< Little endian 32 bit limbs */
+        };
+
+        /**
+         * @brief Add (or subtract) y modulo radix^m to a numeral string of m numerals
+         * @param numerals [in/out] numerals, most significant first
+         * @param length number of numerals (m)
+         * @param radix radix
+         * @param y addend (consumed)
+         * @param subtract subtract rather than add
+         */
+        void combine( uint16_t *numerals, size_t length, unsigned radix, BigNum &y, bool subtract ) {
+          uint32_t carry = 0;
+
+          for ( size_t num = length; num-- > 0; ) {
+            uint32_t digit = y.divide( radix ) + carry;
+
+            if ( !subtract ) {
+              uint32_t sum    = numerals[ num ] + digit;
+              carry           = sum >= radix ? 1 : 0;
+              numerals[ num ] = static_cast< uint16_t >( sum - carry * radix );
+            } else {
+              carry           = numerals[ num ] < digit ? 1 : 0;
+              numerals[ num ] = static_cast< uint16_t >( numerals[ num ] + carry * radix - digit );
+            }
+          }
+        }
+
+        /**
+         * @brief Validate a domain
+         * @param radix radix
+         * @param length number of numerals
+         * @param ff3 FF3-1 limits
+         * @throws TokenRangeError if the domain is not supported
+         */
+        void validate( unsigned radix, size_t length, bool ff3 ) {
+          if ( !supported( radix, length, ff3 ) ) {
+            throw exceptions::TokenRangeError( "Value domain (radix " + std::to_string( radix ) + ", length " +
+                                               std::to_string( length ) +
+                                               ") unsupported by format preserving encryption" );
+          }
+        }
+
+        /**
+         * @brief FF3-1 rounds (also FF3, given a 64 bit tweak split in halves)
+         * @param key block cipher key
+         * @param radix radix
+         * @param left left tweak half (T_L)
+         * @param right right tweak half (T_R)
+         * @param numerals [in/out] numerals
+         * @param encrypt encrypt (true) or decrypt (false)
+         */
+        void ff3Rounds( const interface::FpeKey &key,
+                        unsigned                 radix,
+                        const uint8_t *          left,
+                        const uint8_t *          right,
+                        Numerals &               numerals,
+                        bool                     encrypt ) {
+          size_t   n = numerals.size( );
+          size_t   u = ( n + 1 ) / 2;
+          size_t   v = n - u;
+          Numerals a( numerals.begin( ), numerals.begin( ) + u );
+          Numerals b( numerals.begin( ) + u, numerals.end( ) );
+          uint8_t  block[ BLOCK ];
+          BigNum   y;
+
+          validate( radix, n, true );
+
+          for ( int step = 0; step < 8; ++step ) {
+            int            round = encrypt ? step : 7 - step;
+            size_t         m     = ( round % 2 == 0 ) ? u : v;
+            const uint8_t *w     = ( round % 2 == 0 ) ? right : left;
+            auto &         in    = encrypt ? b : a;
+            auto &         out   = encrypt ? a : b;
+
+            memcpy( block, w, 4 );
+            block[ 3 ] ^= static_cast< uint8_t >( round );
+
+            y.load( in.data( ), in.size( ), radix, true );
+            y.store( block + 4, BLOCK - 4 );
+
+            std::reverse( block, block + BLOCK );
+            key.encryptBlocks( block, block, 1 );
+            std::reverse( block, block + BLOCK );
+
+            y.load( block, BLOCK );
+
+            std::reverse( out.begin( ), out.end( ) );
+            combine( out.data( ), m, radix, y, !encrypt );
+            std::reverse( out.begin( ), out.end( ) );
+
+            std::swap( a, b );
+          }
+
+          memset( block, 0, sizeof( block ) );
+
+          std::copy( a.begin( ), a.end( ), numerals.begin( ) );
+          std::copy( b.begin( ), b.end( ), numerals.begin( ) + u );
+        }
+
+        /**
+         * @brief FF3-1 tweak halves
+         * @param tweak 56 bit tweak
+         * @param left [out] T_L
+         * @param right [out] T_R
+         */
+        void ff3Split( const uint8_t *tweak, uint8_t *left, uint8_t *right ) {
+          left[ 0 ]  = tweak[ 0 ];
+          left[ 1 ]  = tweak[ 1 ];
+          left[ 2 ]  = tweak[ 2 ];
+          left[ 3 ]  = tweak[ 3 ] & 0xf0;
+          right[ 0 ] = tweak[ 4 ];
+          right[ 1 ] = tweak[ 5 ];
+          right[ 2 ] = tweak[ 6 ];
+          right[ 3 ] = static_cast< uint8_t >( ( tweak[ 3 ] & 0x0f ) << 4 );
+        }
+
+        /**
+         * @brief FF1 rounds
+         * @param key block cipher key
+         * @param radix radix
+         * @param tweak tweak
+         * @param numerals [in/out] numerals
+         * @param encrypt encrypt (true) or decrypt (false)
+         */
+        void ff1Rounds(
+          const interface::FpeKey &key, unsigned radix, const bytea &tweak, Numerals &numerals, bool encrypt ) {
+          size_t   n = numerals.size( );
+          size_t   t = tweak.size( );
+          size_t   u = n / 2;
+          size_t   v = n - u;
+          Numerals a( numerals.begin( ), numerals.begin( ) + u );
+          Numerals b( numerals.begin( ) + u, numerals.end( ) );
+          BigNum   y;
+          size_t   bits = 0;
+
+          validate( radix, n, false );
+
+          if ( ( radix & ( radix - 1 ) ) == 0 ) {
+            for ( unsigned power = radix; power > 1; power >>= 1 ) {
+              bits += v;
+            }
+          } else {
+            BigNum power;
+
+            power.mulAdd( 1, 1 );
+
+            for ( size_t num = 0; num < v; ++num ) {
+              power.mulAdd( radix, 0 );
+            }
+
+            bits = power.bits( );
+          }
+
+          size_t  byteLength  = ( bits + 7 ) / 8;
+          size_t  d           = 4 * ( ( byteLength + 3 ) / 4 ) + 4;
+          size_t  pad         = ( BLOCK - ( ( t + byteLength + 1 ) % BLOCK ) ) % BLOCK;
+          size_t  qLength     = t + pad + 1 + byteLength;
+          size_t  sBlocks     = ( d + BLOCK - 1 ) / BLOCK;
+          uint8_t p[ BLOCK ]  = { 1, 2, 1 };
+          uint8_t pMac[ BLOCK ];
+          bytea   q( qLength );
+          bytea   s( sBlocks * BLOCK );
+
+          p[ 3 ]  = static_cast< uint8_t >( radix >> 16 );
+          p[ 4 ]  = static_cast< uint8_t >( radix >> 8 );
+          p[ 5 ]  = static_cast< uint8_t >( radix );
+          p[ 6 ]  = 10;
+          p[ 7 ]  = static_cast< uint8_t >( u );
+          p[ 8 ]  = static_cast< uint8_t >( n >> 24 );
+          p[ 9 ]  = static_cast< uint8_t >( n >> 16 );
+          p[ 10 ] = static_cast< uint8_t >( n >> 8 );
+          p[ 11 ] = static_cast< uint8_t >( n );
+          p[ 12 ] = static_cast< uint8_t >( t >> 24 );
+          p[ 13 ] = static_cast< uint8_t >( t >> 16 );
+          p[ 14 ] = static_cast< uint8_t >( t >> 8 );
+          p[ 15 ] = static_cast< uint8_t >( t );
+
+          key.encryptBlocks( p, pMac, 1 );
+          std::copy( tweak.begin( ), tweak.end( ), q.begin( ) );
+
+          for ( int step = 0; step < 10; ++step ) {
+            int    round = encrypt ? step : 9 - step;
+            size_t m     = ( round % 2 == 0 ) ? u : v;
+            auto & in    = encrypt ? b : a;
+            auto & out   = encrypt ? a : b;
+            auto   r     = s.data( );
+
+            q[ t + pad ] = static_cast< uint8_t >( round );
+            y.load( in.data( ), in.size( ), radix, false );
+            y.store( &q[ t + pad + 1 ], byteLength );
+
+            std::copy( pMac, pMac + BLOCK, r );
+
+            for ( size_t offset = 0; offset < qLength; offset += BLOCK ) {
+              for ( size_t num = 0; num < BLOCK; ++num ) {
+                r[ num ] ^= q[ offset + num ];
+              }
+
+              key.encryptBlocks( r, r, 1 );
+            }
+
+            for ( size_t index = 1; index < sBlocks; ++index ) {
+              auto next = r + index * BLOCK;
+
+              std::copy( r, r + BLOCK, next );
+
+              for ( size_t num = 0; num < sizeof( index ); ++num ) {
+                next[ BLOCK - 1 - num ] ^= static_cast< uint8_t >( index >> ( 8 * num ) );
+              }
+            }
+
+            if ( sBlocks > 1 ) {
+              key.encryptBlocks( r + BLOCK, r + BLOCK, sBlocks - 1 );
+            }
+
+            y.load( r, d );
+            combine( out.data( ), m, radix, y, !encrypt );
+
+            std::swap( a, b );
+          }
+
+          std::fill( q.begin( ), q.end( ), 0 );
+          std::fill( s.begin( ), s.end( ), 0 );
+
+          std::copy( a.begin( ), a.end( ), numerals.begin( ) );
+          std::copy( b.begin( ), b.end( ), numerals.begin( ) + u );
+        }
+      } // namespace
+
+      bool supported( unsigned radix, size_t length, bool ff3 ) {
+        uint64_t domain = 1;
+
+        if ( ( radix < 2 ) || ( radix > 65536 ) || ( length < 2 ) ) {
+          return false;
+        }
+
+        for ( size_t num = 0; ( num < length ) && ( domain < MIN_DOMAIN ); ++num ) {
+          domain *= radix;
+        }
+
+        if ( domain < MIN_DOMAIN ) {
+          return false;
+        }
+
+        if ( ff3 ) {
+          auto maxLength = 2 * static_cast< size_t >( std::floor( 96.0 / std::log2( radix ) + 1e-9 ) );
+
+          return length <= maxLength;
+        }
+
+        return length <= 0xffffffffu;
+      }
+
+      void ff1Encrypt( const interface::FpeKey &key, unsigned radix, const bytea &tweak, Numerals &numerals ) {
+        ff1Rounds( key, radix, tweak, numerals, true );
+      }
+
+      void ff1Decrypt( const interface::FpeKey &key, unsigned radix, const bytea &tweak, Numerals &numerals ) {
+        ff1Rounds( key, radix, tweak, numerals, false );
+      }
+
+      void ff3Encrypt( const interface::FpeKey &key, unsigned radix, const uint8_t *tweak, Numerals &numerals ) {
+        uint8_t left[ 4 ], right[ 4 ];
+
+        ff3Split( tweak, left, right );
+        ff3Rounds( key, radix, left, right, numerals, true );
+      }
+
+      void ff3Decrypt( const interface::FpeKey &key, unsigned radix, const uint8_t *tweak, Numerals &numerals ) {
+        uint8_t left[ 4 ], right[ 4 ];
+
+        ff3Split( tweak, left, right );
+        ff3Rounds( key, radix, left, right, numerals, false );
+      }
+
+      size_t radixLength( const std::vector< unsigned > &radices, unsigned radix ) {
+        BigNum largest;
+        size_t length = 0;
+
+        for ( auto base : radices ) {
+          largest.mulAdd( base, base - 1 );
+        }
+
+        for ( ; !largest.zero( ); ++length ) {
+          largest.divide( radix );
+        }
+
+        return length;
+      }
+
+      Numerals toRadix( const Numerals &numerals, const std::vector< unsigned > &radices, unsigned radix, size_t length ) {
+        Numerals out( length );
+        BigNum   value;
+
+        for ( size_t num = 0; num < numerals.size( ); ++num ) {
+          value.mulAdd( radices[ num ], numerals[ num ] );
+        }
+
+        for ( size_t num = length; num-- > 0; ) {
+          out[ num ] = static_cast< uint16_t >( value.divide( radix ) );
+        }
+
+        return out;
+      }
+
+      bool fromRadix( const Numerals &numerals, unsigned radix, const std::vector< unsigned > &radices, Numerals &out ) {
+        BigNum value;
+
+        value.load( numerals.data( ), numerals.size( ), radix, false );
+        out.resize( radices.size( ) );
+
+        for ( size_t num = radices.size( ); num-- > 0; ) {
+          out[ num ] = static_cast< uint16_t >( value.divide( radices[ num ] ) );
+        }
+
+        return value.zero( );
+      }
+
+      void ff3Tweak( const interface::FpeKey &key, const bytea &tweak, uint8_t *out ) {
+        static const uint8_t LABEL[ BLOCK ] = { 't', 'o', 'k', 'e', 'n', 'g', 'o', 'v', '-', 'f', 'f', '3', '-', 't', 'w', 0 };
+        uint8_t              mac[ BLOCK ];
+        size_t               length = tweak.size( );
+
+        std::copy( LABEL, LABEL + BLOCK, mac );
+        mac[ BLOCK - 1 ] = static_cast< uint8_t >( length );
+        key.encryptBlocks( mac, mac, 1 );
+
+        for ( size_t offset = 0; offset < length; offset += BLOCK ) {
+          for ( size_t num = 0; ( num < BLOCK ) && ( offset + num < length ); ++num ) {
+            mac[ num ] ^= tweak[ offset + num ];
+          }
+
+          key.encryptBlocks( mac, mac, 1 );
+        }
+
+        std::copy( mac, mac + FF3_TWEAK_LENGTH, out );
+      }
+    } // namespace fpe
+  }   // namespace crypto
+} // namespace token
@@ -0,0 +1,112 @@
+
+#ifndef __TOKENIZATION_FPE_HH__
+#define __TOKENIZATION_FPE_HH__
+
+#include "token/crypto/fpe_key.hh"
+#include <cstdint>
+#include <vector>
+
+namespace token {
+  namespace crypto {
+    /**
+     * NIST SP 800-38G (Rev. 1) format preserving encryption: FF1 and FF3-1, over strings of
+     * numerals (each numeral below the radix, most significant first)
+     */
+    namespace fpe {
+      using Numerals = std::vector< std::uint16_t >;
+
+      /** FF3-1 tweak length (56 bits) */
+      static constexpr size_t FF3_TWEAK_LENGTH = 7;
+
+      /**
+       * @brief Identify if a domain is supported (radix^length >= 1,000,000, and for FF3-1 the
+       * length is within 2 * floor(log_radix(2^96)))
+       * @param radix radix (2 to 65536)
+       * @param length number of numerals
+       * @param ff3 FF3-1 (true) or FF1 (false)
+       * @return true if supported
+       */
+      bool supported( unsigned radix, size_t length, bool ff3 );
+
+      /**
+       * @brief FF1 encryption
+       * @param key block cipher key
+       * @param radix radix
+       * @param tweak tweak
+       * @param numerals [in/out] plaintext, replaced by the ciphertext
+       * @throws TokenRangeError if the domain is not supported
+       */
+      void ff1Encrypt( const interface::FpeKey &key, unsigned radix, const bytea &tweak, Numerals &numerals );
+
+      /**
+       * @brief FF1 decryption
+       * @param key block cipher key
+       * @param radix radix
+       * @param tweak tweak
+       * @param numerals [in/out] ciphertext, replaced by the plaintext
+       * @throws TokenRangeError if the domain is not supported
+       */
+      void ff1Decrypt( const interface::FpeKey &key, unsigned radix, const bytea &tweak, Numerals &numerals );
+
+      /**
+       * @brief FF3-1 encryption
+       * @param key block cipher key
+       * @param radix radix
+       * @param tweak tweak (FF3_TWEAK_LENGTH bytes)
+       * @param numerals [in/out] plaintext, replaced by the ciphertext
+       * @throws TokenRangeError if the domain is not supported
+       */
+      void ff3Encrypt( const interface::FpeKey &key, unsigned radix, const std::uint8_t *tweak, Numerals &numerals );
+
+      /**
+       * @brief FF3-1 decryption
+       * @param key block cipher key
+       * @param radix radix
+       * @param tweak tweak (FF3_TWEAK_LENGTH bytes)
+       * @param numerals [in/out] ciphertext, replaced by the plaintext
+       * @throws TokenRangeError if the domain is not supported
+       */
+      void ff3Decrypt( const interface::FpeKey &key, unsigned radix, const std::uint8_t *tweak, Numerals &numerals );
+
+      /**
+       * @brief Number of numerals needed to represent every value of a mixed radix domain in a
+       * single radix
+       * @param radices radix of each position of the domain
+       * @param radix single radix
+       * @return number of numerals
+       */
+      size_t radixLength( const std::vector< unsigned > &radices, unsigned radix );
+
+      /**
+       * @brief Convert a mixed radix numeral string to a single radix
+       * @param numerals numerals, most significant first (each below its radix)
+       * @param radices radix of each numeral
+       * @param radix output radix
+       * @param length output length (see radixLength)
+       * @return output numerals
+       */
+      Numerals toRadix( const Numerals &numerals, const std::vector< unsigned > &radices, unsigned radix, size_t length );
+
+      /**
+       * @brief Convert a single radix numeral string to a mixed radix
+       * @param numerals numerals, most significant first
+       * @param radix input radix
+       * @param radices radix of each output numeral
+       * @param out [out] output numerals
+       * @return true on success, false if the value is outside the mixed radix domain
+       */
+      bool fromRadix( const Numerals &numerals, unsigned radix, const std::vector< unsigned > &radices, Numerals &out );
+
+      /**
+       * @brief Compress a tweak of any length into an FF3-1 tweak (CBC-MAC under the key, in its
+       * own domain: the first block differs from any FF1/FF3-1 round input)
+       * @param key block cipher key
+       * @param tweak tweak
+       * @param out [out] FF3-1 tweak (FF3_TWEAK_LENGTH bytes)
+       */
+      void ff3Tweak( const interface::FpeKey &key, const bytea &tweak, std::uint8_t *out );
+    } // namespace fpe
+  }   // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_FPE_HH__
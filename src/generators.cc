@@ -1,6 +1,7 @@
 
 #include "luhn.hh"
 #include "token/api.hh"
+#include "token/api/core/arena.hh"
 
 #include <cctype>
 #include <functional>
@@ -8,26 +9,34 @@
 
 namespace token {
   namespace api {
-    std::string generateRandom( const TokenManager::RandBytes &rand,
-                                const std::string &            value,
-                                std::string *                  mask,
-                                bool                           upper,
-                                bool                           lower,
-                                bool                           digits,
-                                bool                           punct ) {
+    /**
+     * @brief Replace the characters of the selected classes with random ones of those classes
+     * @param rand random byte source
+     * @param value value (or the free part of it)
+     * @param token [out] generated characters (a transient arena buffer)
+     * @param upper replace upper case letters
+     * @param lower replace lower case letters
+     * @param digits replace digits
+     * @param punct replace punctuation
+     */
+    static void generateInto( const TokenManager::RandBytes &rand,
+                              boost::string_view             value,
+                              core::ArenaString &            token,
+                              bool                           upper,
+                              bool                           lower,
+                              bool                           digits,
+                              bool                           punct ) {
       static char NUMERICS[] = "0123456789";
       static char UPPER[]    = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
       static char LOWER[]    = "abcdefghijklmnopqrstuvwxyz";
       static char PUNCT[]    = "!@#$%^&*()-=_+{}[]:\";\'<>?,./";
 
-      std::stringstream ss;
-      std::string       token;
-      uint8_t           bytes[ 256 ] = "";
-      uint8_t *         pbytes       = nullptr;
-      uint8_t *         pend         = nullptr;
-      uint8_t           block[ 100 ] = "";
-      uint8_t *         pblock       = block;
-      int               attempts     = 0;
+      uint8_t   bytes[ 256 ] = "";
+      uint8_t * pbytes       = nullptr;
+      uint8_t * pend         = nullptr;
+      uint8_t   block[ 100 ] = "";
+      uint8_t * pblock       = block;
+      int       attempts     = 0;
 
       if ( digits ) {
         memcpy( pblock, NUMERICS, sizeof( NUMERICS ) - 1 );
@@ -49,6 +58,8 @@ namespace token {
         pblock += sizeof( PUNCT ) - 1;
       }
 
+      token.reserve( value.size( ) );
+
       do {
         if ( ++attempts > 3 ) {
           throw exceptions::TokenGenerationError( "Too many token generation attempts" );
@@ -58,8 +69,7 @@ namespace token {
         pend   = bytes + std::min( sizeof( bytes ), value.size( ) );
         rand( bytes, pend - bytes );
 
-        ss.str( "" );
-        ss.clear( );
+        token.clear( );
 
         for ( auto &ch : value ) {
           if ( ( ( ::isdigit( ch ) != 0 ) && ( digits ) ) ||
@@ -72,25 +82,28 @@ namespace token {
               rand( bytes, pend - bytes );
             }
 
-            ss << block[ *( pbytes++ ) % ( pblock - block ) ];
+            token.push_back( static_cast< char >( block[ *( pbytes++ ) % ( pblock - block ) ] ) );
           }
         }
-      } while ( ss.str( ) == value );
-
-      token = ss.str( );
+      } while ( boost::string_view( token.data( ), token.size( ) ) == value );
+    }
 
-      if ( mask != nullptr ) {
-        ss.str( "" );
-        ss.clear( );
+    std::string generateRandom( const TokenManager::RandBytes &rand,
+                                const std::string &            value,
+                                std::string *                  mask,
+                                bool                           upper,
+                                bool                           lower,
+                                bool                           digits,
+                                bool                           punct ) {
+      core::ArenaString token;
 
-        for ( std::string::size_type num = 0; num < value.size( ); ++num ) {
-          ss << "*";
-        }
+      generateInto( rand, value, token, upper, lower, digits, punct );
 
-        *mask = ss.str( );
+      if ( mask != nullptr ) {
+        mask->assign( value.size( ), '*' );
       }
 
-      return token;
+      return std::string( token.data( ), token.size( ) );
     }
 
     std::string generateFPR( const TokenManager::RandBytes &rand,
@@ -126,44 +139,32 @@ namespace token {
                                    size_t                         back,
                                    bool                           passLuhn ) {
       if ( ( front + back ) >= value.size( ) ) {
-        std::stringstream ss;
-        ss << "Preserved lengths ";
-        ss << front << " " << back;
-        ss << ", exceed the length of the value to tokenize";
-
-        throw exceptions::TokenRangeError( ss.str( ) );
+        throw exceptions::TokenRangeError( "Preserved lengths " + std::to_string( front ) + " " + std::to_string( back ) +
+                                           ", exceed the length of the value to tokenize" );
       }
 
-      auto length = value.size( ) - back - front;
-
-      do {
-        std::stringstream ss;
-        std::string       tmp;
+      auto              length = value.size( ) - back - front;
+      auto              free   = boost::string_view( value ).substr( front, length );
+      core::ArenaString middle;
+      core::ArenaString token;
 
-        ss << value.substr( 0, front );
-        ss << generateRandom(
-          rand, value.substr( front, length ), nullptr, false, false, true, false );
-        ss << value.substr( front + length );
-        tmp = ss.str( );
+      token.reserve( value.size( ) );
 
-        if ( passLuhn == luhn::check( tmp ) ) {
-          if ( mask != nullptr ) {
-            ss.str( "" );
-            ss.clear( );
-
-            ss << value.substr( 0, front );
+      do {
+        generateInto( rand, free, middle, false, false, true, false );
 
-            for ( size_t num = 0; num < length; ++num ) {
-              ss << "*";
-            }
+        token.assign( value.data( ), front );
+        token.append( middle );
+        token.append( value.data( ) + front + length, back );
+      } while ( passLuhn != luhn::check( token ) );
 
-            ss << value.substr( front + length );
+      if ( mask != nullptr ) {
+        mask->append( value, 0, front );
+        mask->append( length, '*' );
+        mask->append( value, front + length, back );
+      }
 
-            *mask += ss.str( );
-          }
-          return tmp;
-        }
-      } while ( true );
+      return std::string( token.data( ), token.size( ) );
     }
 
     TokenManager::GeneratorMap TokenManager::generators{
@@ -0,0 +1,323 @@
+
+#include "preserved.hh"
+#include "token/api.hh"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( inventoryLogger->should_log( spdlog::level::lvl ) ) {                                                         \
+      inventoryLogger->lvl( fmt, ##__VA_ARGS__ );                                                                      \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    /** Inventory logger */
+    std::shared_ptr< spdlog::logger > inventoryLogger = token::api::create_logger( "token::api::inventory", { } );
+
+    std::string TokenInventory::shape( const core::VaultInfo &vault, const std::string &value ) {
+      auto        format = vault.tokenFormat( );
+      std::string rc( value );
+
+      /* Registered generators may look at anything in the value: only the built-in formats are shaped */
+      if ( ( vault.mode( ) != TokenManager::VAULTED_MODE ) || ( format > TokenManager::F6L4_NOLUHN_FORMAT ) ) {
+        return std::string( );
+      }
+
+      if ( auto digits = preserved( format ) ) {
+        if ( ( ( digits->front + digits->back ) >= value.size( ) ) ||
+             ( !std::all_of( value.begin( ), value.end( ), []( char ch ) { return ::isdigit( ch ) != 0; } ) ) ) {
+          return std::string( );
+        }
+
+        auto free = value.size( ) - digits->front - digits->back;
+
+        rc.replace( digits->front, free, free, '0' );
+        return rc;
+      }
+
+      for ( auto &ch : rc ) {
+        if ( ::isdigit( ch ) != 0 ) {
+          ch = '0';
+        } else if ( ::isupper( ch ) != 0 ) {
+          ch = 'A';
+        } else if ( ::islower( ch ) != 0 ) {
+          ch = 'a';
+        } else if ( ::ispunct( ch ) != 0 ) {
+          ch = '!';
+        } else {
+          ch = ' ';
+        }
+      }
+
+      return rc;
+    }
+
+    std::string TokenInventory::track( core::SharedVault vault, const std::string &sample ) {
+      auto key  = vault->table + '\0' + sample;
+      auto iter = shapes.find( key );
+
+      if ( iter == shapes.end( ) ) {
+        if ( shapes.size( ) >= options.maxShapes ) {
+          return std::string( );
+        }
+
+        iter                = shapes.emplace( key, Shape( ) ).first;
+        iter->second.vault  = std::move( vault );
+        iter->second.sample = sample;
+      }
+
+      if ( ( !iter->second.queued ) && ( iter->second.candidates.size( ) < options.lowWater ) ) {
+        iter->second.queued = true;
+        pending.push_back( key );
+        wakeup.notify_all( );
+      }
+
+      return key;
+    }
+
+    bool TokenInventory::take( core::SharedVault vault, const std::string &value, std::string &token, std::string *mask ) {
+      auto sample = shape( *vault, value );
+
+      if ( sample.empty( ) ) {
+        return false;
+      }
+
+      std::lock_guard< std::mutex > guard( lock );
+      auto                          iter = shapes.find( vault->table + '\0' + sample );
+      bool                          rc   = false;
+
+      if ( iter == shapes.end( ) ) {
+        LOG( debug, "New token shape for vault {} ({} characters)", vault->alias, value.size( ) );
+
+        track( vault, sample );
+        ++counters.misses;
+        return false;
+      }
+
+      auto &entry = iter->second;
+
+      while ( ( !rc ) && ( !entry.candidates.empty( ) ) ) {
+        auto candidate = std::move( entry.candidates.front( ) );
+
+        entry.candidates.pop_front( );
+        entry.tokens.erase( candidate.first );
+
+        /* A candidate matching the value itself is never its token */
+        if ( candidate.first != value ) {
+          token = std::move( candidate.first );
+
+          if ( mask != nullptr ) {
+            *mask = std::move( candidate.second );
+          }
+
+          rc = true;
+        }
+      }
+
+      rc ? ++counters.hits : ++counters.misses;
+
+      track( entry.vault, entry.sample );
+
+      return rc;
+    }
+
+    void TokenInventory::refill( const std::string &name, const std::string &value ) {
+      auto        vault  = manager.getVaultInfo( name );
+      auto        sample = shape( *vault, value );
+      std::string key;
+
+      if ( sample.empty( ) ) {
+        LOG( warn, "Vault {} does not use the token inventory", vault->alias );
+        return;
+      }
+
+      {
+        std::lock_guard< std::mutex > guard( lock );
+        key = track( vault, sample );
+      }
+
+      if ( key.empty( ) ) {
+        LOG( warn, "Token inventory full ({} shapes), not refilling vault {}", options.maxShapes, vault->alias );
+        return;
+      }
+
+      fill( key );
+    }
+
+    bool TokenInventory::fill( const std::string &key ) {
+      core::SharedVault vault;
+      std::string       sample;
+      size_t            wanted    = 0;
+      size_t            batchSize = std::max( options.batchSize, static_cast< size_t >( 1 ) );
+
+      {
+        std::lock_guard< std::mutex > guard( lock );
+        auto                          iter = shapes.find( key );
+
+        if ( iter == shapes.end( ) ) {
+          return false;
+        }
+
+        vault  = iter->second.vault;
+        sample = iter->second.sample;
+
+        if ( iter->second.candidates.size( ) < options.highWater ) {
+          wanted = options.highWater - iter->second.candidates.size( );
+        }
+      }
+
+      LOG( debug, "Refilling {} candidate tokens for vault {}", wanted, vault->alias );
+
+      while ( wanted > 0 ) {
+        auto                                                 count = std::min( wanted, batchSize );
+        std::vector< std::pair< std::string, std::string > > batch;
+        std::vector< std::string >                           tokens;
+        std::unordered_set< std::string >                    generated;
+
+        batch.reserve( count );
+        tokens.reserve( count );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          std::string mask;
+          auto        token = manager.generate( vault, sample, &mask );
+
+          if ( generated.insert( token ).second ) {
+            tokens.push_back( token );
+            batch.emplace_back( std::move( token ), std::move( mask ) );
+          }
+        }
+
+        auto                              inUse = manager.storage->used( vault->table, tokens );
+        std::unordered_set< std::string > used( inUse.begin( ), inUse.end( ) );
+
+        std::lock_guard< std::mutex > guard( lock );
+        auto                          iter = shapes.find( key );
+
+        if ( iter == shapes.end( ) ) {
+          return false;
+        }
+
+        counters.generated += count;
+        counters.used += used.size( );
+
+        for ( auto &candidate : batch ) {
+          if ( ( used.count( candidate.first ) == 0 ) && ( iter->second.tokens.insert( candidate.first ).second ) ) {
+            iter->second.candidates.push_back( std::move( candidate ) );
+          }
+        }
+
+        wanted -= count;
+      }
+
+      std::lock_guard< std::mutex > guard( lock );
+      ++counters.refills;
+
+      return true;
+    }
+
+    void TokenInventory::start( ) {
+      std::lock_guard< std::mutex > guard( lock );
+
+      if ( !running ) {
+        LOG( info, "Starting token inventory" );
+
+        running  = true;
+        stopping = false;
+        thread   = std::thread( &TokenInventory::run, this );
+      }
+    }
+
+    void TokenInventory::stop( ) {
+      {
+        std::lock_guard< std::mutex > guard( lock );
+
+        if ( !running ) {
+          return;
+        }
+
+        LOG( info, "Stopping token inventory" );
+
+        stopping = true;
+        wakeup.notify_all( );
+      }
+
+      thread.join( );
+
+      std::lock_guard< std::mutex > guard( lock );
+      running = false;
+    }
+
+    TokenInventory::Metrics TokenInventory::metrics( ) {
+      std::lock_guard< std::mutex > guard( lock );
+      Metrics                       rc = counters;
+
+      rc.available = 0;
+      rc.shapes    = shapes.size( );
+
+      for ( auto &entry : shapes ) {
+        rc.available += entry.second.candidates.size( );
+      }
+
+      return rc;
+    }
+
+    void TokenInventory::run( ) {
+      using Clock = std::chrono::steady_clock;
+
+      std::unique_lock< std::mutex > guard( lock );
+      auto                           report = Clock::now( ) + options.report;
+
+      while ( !stopping ) {
+        if ( ( options.report.count( ) > 0 ) && ( report <= Clock::now( ) ) ) {
+          size_t available = 0;
+
+          for ( auto &entry : shapes ) {
+            available += entry.second.candidates.size( );
+          }
+
+          LOG( info,
+               "Token inventory: {} hits, {} misses, {} generated, {} used, {} refills, {} available in {} shapes",
+               counters.hits,
+               counters.misses,
+               counters.generated,
+               counters.used,
+               counters.refills,
+               available,
+               shapes.size( ) );
+
+          report = Clock::now( ) + options.report;
+        }
+
+        if ( pending.empty( ) ) {
+          if ( options.report.count( ) > 0 ) {
+            wakeup.wait_until( guard, report );
+          } else {
+            wakeup.wait( guard );
+          }
+          continue;
+        }
+
+        auto key = std::move( pending.front( ) );
+
+        pending.pop_front( );
+        guard.unlock( );
+
+        try {
+          fill( key );
+        } catch ( std::exception &ex ) {
+          LOG( warn, "Token inventory refill failed: {}", ex.what( ) );
+        }
+
+        guard.lock( );
+
+        auto iter = shapes.find( key );
+
+        if ( iter != shapes.end( ) ) {
+          iter->second.queued = false;
+        }
+      }
+    }
+  } // namespace api
+} // namespace token
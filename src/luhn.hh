@@ -55,6 +55,35 @@ namespace token {
     bool check( T value ) {
       return check( std::begin( value ), std::end( value ) - 1 );
     }
+
+    /**
+     * @brief Luhn weight of a digit (its contribution to the checksum)
+     * @param digit digit value
+     * @param doubled digit is at a doubled position (every second from the right, check digit excluded)
+     * @return digit contribution
+     */
+    inline uint16_t weight( uint16_t digit, bool doubled ) {
+      return doubled ? ( digit * 2 > 9 ? digit * 2 - 9 : digit * 2 ) : digit;
+    }
+
+    /**
+     * @brief Luhn checksum residue of a complete number (check digit included)
+     * @param begin first digit
+     * @param end end of the digits
+     * @return checksum modulo 10, 0 for a number passing the check
+     */
+    template < typename Iter >
+    uint16_t residue( Iter begin, Iter end ) {
+      uint16_t sum     = 0;
+      bool     doubled = false;
+
+      for ( auto iter = std::reverse_iterator< Iter >( end ); iter != std::reverse_iterator< Iter >( begin ); ++iter ) {
+        sum     = ( sum + weight( *iter - '0', doubled ) ) % 10;
+        doubled = !doubled;
+      }
+
+      return sum;
+    }
   } // namespace luhn
 } // namespace token
 
@@ -0,0 +1,726 @@
+
+#include "multibuffer.hh"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+#define MULTIBUFFER_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace token {
+  namespace crypto {
+    namespace multibuffer {
+      namespace {
+        const uint32_t SHA256_IV[ 8 ] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+        const uint32_t SHA256_K[ 64 ] = {
+          0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+          0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+          0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+          0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+          0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+          0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+          0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+          0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        inline uint32_t load32( const uint8_t *data ) {
+          return ( uint32_t( data[ 0 ] ) << 24 ) | ( uint32_t( data[ 1 ] ) << 16 ) | ( uint32_t( data[ 2 ] ) << 8 ) |
+                 uint32_t( data[ 3 ] );
+        }
+
+        inline void store32( uint8_t *data, uint32_t value ) {
+          data[ 0 ] = uint8_t( value >> 24 );
+          data[ 1 ] = uint8_t( value >> 16 );
+          data[ 2 ] = uint8_t( value >> 8 );
+          data[ 3 ] = uint8_t( value );
+        }
+
+        inline void store64( uint8_t *data, uint64_t value ) {
+          store32( data, uint32_t( value >> 32 ) );
+          store32( data + 4, uint32_t( value ) );
+        }
+
+        inline uint32_t rotr( uint32_t value, int bits ) { return ( value >> bits ) | ( value << ( 32 - bits ) ); }
+
+        /**
+         * @brief Single block SHA-256 compression (key setup only)
+         * @param state hash state
+         * @param block 64 byte block
+         */
+        void compress( uint32_t state[ 8 ], const uint8_t *block ) {
+          uint32_t w[ 64 ];
+          uint32_t v[ 8 ];
+
+          for ( int t = 0; t < 16; ++t ) {
+            w[ t ] = load32( block + t * 4 );
+          }
+
+          for ( int t = 16; t < 64; ++t ) {
+            auto s0 = rotr( w[ t - 15 ], 7 ) ^ rotr( w[ t - 15 ], 18 ) ^ ( w[ t - 15 ] >> 3 );
+            auto s1 = rotr( w[ t - 2 ], 17 ) ^ rotr( w[ t - 2 ], 19 ) ^ ( w[ t - 2 ] >> 10 );
+            w[ t ]  = w[ t - 16 ] + s0 + w[ t - 7 ] + s1;
+          }
+
+          std::copy( state, state + 8, v );
+
+          for ( int t = 0; t < 64; ++t ) {
+            auto s1  = rotr( v[ 4 ], 6 ) ^ rotr( v[ 4 ], 11 ) ^ rotr( v[ 4 ], 25 );
+            auto ch  = ( v[ 4 ] & v[ 5 ] ) ^ ( ~v[ 4 ] & v[ 6 ] );
+            auto t1  = v[ 7 ] + s1 + ch + SHA256_K[ t ] + w[ t ];
+            auto s0  = rotr( v[ 0 ], 2 ) ^ rotr( v[ 0 ], 13 ) ^ rotr( v[ 0 ], 22 );
+            auto maj = ( v[ 0 ] & v[ 1 ] ) ^ ( v[ 0 ] & v[ 2 ] ) ^ ( v[ 1 ] & v[ 2 ] );
+
+            v[ 7 ] = v[ 6 ];
+            v[ 6 ] = v[ 5 ];
+            v[ 5 ] = v[ 4 ];
+            v[ 4 ] = v[ 3 ] + t1;
+            v[ 3 ] = v[ 2 ];
+            v[ 2 ] = v[ 1 ];
+            v[ 1 ] = v[ 0 ];
+            v[ 0 ] = t1 + s0 + maj;
+          }
+
+          for ( int i = 0; i < 8; ++i ) {
+            state[ i ] += v[ i ];
+          }
+        }
+
+        /**
+         * @brief SHA-256 of a message (key setup only)
+         * @param data message
+         * @param length message length
+         * @param digest [out] 32 byte digest
+         */
+        void sha256( const uint8_t *data, size_t length, uint8_t *digest ) {
+          uint32_t state[ 8 ];
+          uint8_t  block[ 64 ];
+          size_t   pos = 0;
+
+          std::copy( SHA256_IV, SHA256_IV + 8, state );
+
+          for ( ; pos + 64 <= length; pos += 64 ) {
+            compress( state, data + pos );
+          }
+
+          memset( block, 0, sizeof( block ) );
+          memcpy( block, data + pos, length - pos );
+          block[ length - pos ] = 0x80;
+
+          if ( length - pos >= 56 ) {
+            compress( state, block );
+            memset( block, 0, sizeof( block ) );
+          }
+
+          store64( block + 56, uint64_t( length ) * 8 );
+          compress( state, block );
+
+          for ( int i = 0; i < 8; ++i ) {
+            store32( digest + i * 4, state[ i ] );
+          }
+        }
+
+        /**
+         * @brief Bytes of SHA-256 padding blocks needed after an already hashed 64 byte block
+         * @param length message length
+         * @return padded message length
+         */
+        inline size_t paddedLength( size_t length ) { return ( length + 9 + 63 ) & ~size_t( 63 ); }
+
+        /**
+         * @brief Write a padded message (following a 64 byte key block) into a buffer
+         * @param buffer [out] buffer of paddedLength( length ) bytes
+         * @param data message
+         * @param length message length
+         */
+        void pad( uint8_t *buffer, const uint8_t *data, size_t length ) {
+          auto total = paddedLength( length );
+
+          /* An empty message may come with no data at all */
+          if ( length > 0 ) {
+            memcpy( buffer, data, length );
+          }
+
+          memset( buffer + length, 0, total - length );
+          buffer[ length ] = 0x80;
+          store64( buffer + total - 8, ( uint64_t( length ) + 64 ) * 8 );
+        }
+
+#ifdef MULTIBUFFER_X86
+        /**
+         * CPU features relevant to the kernels
+         */
+        struct Features {
+          bool avx2   = false;
+          bool aesni  = false;
+          bool pclmul = false;
+          bool ssse3  = false;
+
+          Features( ) {
+            unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+            if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) {
+              return;
+            }
+
+            bool osxsave = ( ecx & ( 1u << 27 ) ) != 0;
+            bool avx     = ( ecx & ( 1u << 28 ) ) != 0;
+
+            ssse3  = ( ecx & ( 1u << 9 ) ) != 0;
+            pclmul = ( ecx & ( 1u << 1 ) ) != 0;
+            aesni  = ( ecx & ( 1u << 25 ) ) != 0;
+
+            if ( osxsave && avx ) {
+              uint32_t xcr0 = 0, xcr0hi = 0;
+
+              __asm__( "xgetbv" : "=a"( xcr0 ), "=d"( xcr0hi ) : "c"( 0 ) );
+
+              if ( ( ( xcr0 & 0x6 ) == 0x6 ) && __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) ) {
+                avx2 = ( ebx & ( 1u << 5 ) ) != 0;
+              }
+            }
+          }
+        };
+
+        const Features &features( ) {
+          static const Features detected;
+          return detected;
+        }
+
+        /* -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*-
+         * SHA-256, 8 lanes (AVX2)
+         * -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*/
+
+#define MB_AVX2 __attribute__( ( target( "avx2" ) ) )
+
+        MB_AVX2 inline __m256i rotr8( __m256i value, int bits ) {
+          return _mm256_or_si256( _mm256_srli_epi32( value, bits ), _mm256_slli_epi32( value, 32 - bits ) );
+        }
+
+        /**
+         * @brief Compress one block in each of 8 lanes; lanes outside the mask keep their state
+         * @param state lane hash state (word major)
+         * @param blocks lane block pointers
+         * @param mask active lanes (all ones) / inactive lanes (zero)
+         */
+        MB_AVX2 void compress8( __m256i state[ 8 ], const uint8_t *const blocks[ SHA256_LANES ], __m256i mask ) {
+          __m256i w[ 16 ];
+          __m256i v[ 8 ];
+
+          for ( int t = 0; t < 16; ++t ) {
+            w[ t ] = _mm256_set_epi32( load32( blocks[ 7 ] + t * 4 ),
+                                       load32( blocks[ 6 ] + t * 4 ),
+                                       load32( blocks[ 5 ] + t * 4 ),
+                                       load32( blocks[ 4 ] + t * 4 ),
+                                       load32( blocks[ 3 ] + t * 4 ),
+                                       load32( blocks[ 2 ] + t * 4 ),
+                                       load32( blocks[ 1 ] + t * 4 ),
+                                       load32( blocks[ 0 ] + t * 4 ) );
+          }
+
+          for ( int i = 0; i < 8; ++i ) {
+            v[ i ] = state[ i ];
+          }
+
+          for ( int t = 0; t < 64; ++t ) {
+            __m256i wt;
+
+            if ( t < 16 ) {
+              wt = w[ t ];
+            } else {
+              auto w15 = w[ ( t - 15 ) & 15 ];
+              auto w2  = w[ ( t - 2 ) & 15 ];
+              auto s0  = _mm256_xor_si256( _mm256_xor_si256( rotr8( w15, 7 ), rotr8( w15, 18 ) ),
+                                          _mm256_srli_epi32( w15, 3 ) );
+              auto s1  = _mm256_xor_si256( _mm256_xor_si256( rotr8( w2, 17 ), rotr8( w2, 19 ) ),
+                                          _mm256_srli_epi32( w2, 10 ) );
+
+              wt = _mm256_add_epi32( _mm256_add_epi32( w[ t & 15 ], s0 ), _mm256_add_epi32( w[ ( t - 7 ) & 15 ], s1 ) );
+              w[ t & 15 ] = wt;
+            }
+
+            auto s1 = _mm256_xor_si256( _mm256_xor_si256( rotr8( v[ 4 ], 6 ), rotr8( v[ 4 ], 11 ) ), rotr8( v[ 4 ], 25 ) );
+            auto ch = _mm256_xor_si256( _mm256_and_si256( v[ 4 ], v[ 5 ] ), _mm256_andnot_si256( v[ 4 ], v[ 6 ] ) );
+            auto t1 = _mm256_add_epi32( _mm256_add_epi32( v[ 7 ], s1 ),
+                                        _mm256_add_epi32( _mm256_add_epi32( ch, wt ),
+                                                          _mm256_set1_epi32( static_cast< int >( SHA256_K[ t ] ) ) ) );
+            auto s0 = _mm256_xor_si256( _mm256_xor_si256( rotr8( v[ 0 ], 2 ), rotr8( v[ 0 ], 13 ) ), rotr8( v[ 0 ], 22 ) );
+            auto maj = _mm256_xor_si256( _mm256_and_si256( v[ 0 ], v[ 1 ] ),
+                                         _mm256_and_si256( v[ 2 ], _mm256_xor_si256( v[ 0 ], v[ 1 ] ) ) );
+
+            v[ 7 ] = v[ 6 ];
+            v[ 6 ] = v[ 5 ];
+            v[ 5 ] = v[ 4 ];
+            v[ 4 ] = _mm256_add_epi32( v[ 3 ], t1 );
+            v[ 3 ] = v[ 2 ];
+            v[ 2 ] = v[ 1 ];
+            v[ 1 ] = v[ 0 ];
+            v[ 0 ] = _mm256_add_epi32( t1, _mm256_add_epi32( s0, maj ) );
+          }
+
+          for ( int i = 0; i < 8; ++i ) {
+            state[ i ] = _mm256_blendv_epi8( state[ i ], _mm256_add_epi32( state[ i ], v[ i ] ), mask );
+          }
+        }
+
+        /**
+         * @brief HMAC-SHA-256 of up to 8 messages
+         */
+        MB_AVX2 void hmac8( const HmacSha256 &  key,
+                            const uint8_t *const data[],
+                            const size_t         lengths[],
+                            size_t               count,
+                            uint8_t *const       out[] ) {
+          static const uint8_t             ZERO[ 64 ] = { };
+          static thread_local std::vector< uint8_t > scratch;
+          const uint8_t *                  blocks[ SHA256_LANES ];
+          size_t                           offsets[ SHA256_LANES ];
+          size_t                           nblocks[ SHA256_LANES ];
+          size_t                           total = 0;
+          size_t                           most  = 0;
+          __m256i                          state[ 8 ];
+          alignas( 32 ) uint32_t           words[ 8 ][ SHA256_LANES ];
+          uint8_t                          outer[ SHA256_LANES ][ 64 ];
+
+          for ( size_t lane = 0; lane < count; ++lane ) {
+            offsets[ lane ] = total;
+            nblocks[ lane ] = paddedLength( lengths[ lane ] ) / 64;
+            total += nblocks[ lane ] * 64;
+            most = std::max( most, nblocks[ lane ] );
+          }
+
+          scratch.resize( total );
+
+          for ( size_t lane = 0; lane < count; ++lane ) {
+            pad( scratch.data( ) + offsets[ lane ], data[ lane ], lengths[ lane ] );
+          }
+
+          /* Inner hash */
+          for ( int i = 0; i < 8; ++i ) {
+            state[ i ] = _mm256_set1_epi32( static_cast< int >( key.inner[ i ] ) );
+          }
+
+          for ( size_t block = 0; block < most; ++block ) {
+            alignas( 32 ) int32_t active[ SHA256_LANES ];
+
+            for ( size_t lane = 0; lane < SHA256_LANES; ++lane ) {
+              bool live       = ( lane < count ) && ( block < nblocks[ lane ] );
+              blocks[ lane ]  = live ? scratch.data( ) + offsets[ lane ] + block * 64 : ZERO;
+              active[ lane ]  = live ? -1 : 0;
+            }
+
+            compress8( state, blocks, _mm256_load_si256( reinterpret_cast< const __m256i * >( active ) ) );
+          }
+
+          for ( int i = 0; i < 8; ++i ) {
+            _mm256_store_si256( reinterpret_cast< __m256i * >( words[ i ] ), state[ i ] );
+          }
+
+          /* Outer hash, a single block: inner digest and padding */
+          for ( size_t lane = 0; lane < SHA256_LANES; ++lane ) {
+            memset( outer[ lane ], 0, sizeof( outer[ lane ] ) );
+
+            for ( int i = 0; i < 8; ++i ) {
+              store32( outer[ lane ] + i * 4, words[ i ][ lane ] );
+            }
+
+            outer[ lane ][ 32 ] = 0x80;
+            store64( outer[ lane ] + 56, ( 64 + 32 ) * 8 );
+            blocks[ lane ] = outer[ lane ];
+          }
+
+          for ( int i = 0; i < 8; ++i ) {
+            state[ i ] = _mm256_set1_epi32( static_cast< int >( key.outer[ i ] ) );
+          }
+
+          compress8( state, blocks, _mm256_set1_epi32( -1 ) );
+
+          for ( int i = 0; i < 8; ++i ) {
+            _mm256_store_si256( reinterpret_cast< __m256i * >( words[ i ] ), state[ i ] );
+          }
+
+          for ( size_t lane = 0; lane < count; ++lane ) {
+            for ( int i = 0; i < 8; ++i ) {
+              store32( out[ lane ] + i * 4, words[ i ][ lane ] );
+            }
+          }
+
+          memset( outer, 0, sizeof( outer ) );
+          std::fill( scratch.begin( ), scratch.end( ), 0 );
+        }
+
+        /* -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*-
+         * AES-GCM (AES-NI, PCLMULQDQ)
+         * -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*- -*/
+
+#define MB_AES __attribute__( ( target( "aes,pclmul,ssse3" ) ) )
+
+        /** AES blocks encrypted together */
+        static constexpr size_t AES_LANES = 8;
+
+        MB_AES inline __m128i expand128( __m128i key, __m128i assist ) {
+          assist = _mm_shuffle_epi32( assist, 0xff );
+          key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          return _mm_xor_si128( key, assist );
+        }
+
+        MB_AES inline __m128i expand256( __m128i key, __m128i other ) {
+          auto assist = _mm_shuffle_epi32( _mm_aeskeygenassist_si128( other, 0x00 ), 0xaa );
+          key         = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          key         = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          key         = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+          return _mm_xor_si128( key, assist );
+        }
+
+        MB_AES void expandKey128( const uint8_t *key, __m128i rk[ 11 ] ) {
+          rk[ 0 ] = _mm_loadu_si128( reinterpret_cast< const __m128i * >( key ) );
+
+#define MB_EXPAND128( i, rcon ) rk[ i ] = expand128( rk[ i - 1 ], _mm_aeskeygenassist_si128( rk[ i - 1 ], rcon ) )
+          MB_EXPAND128( 1, 0x01 );
+          MB_EXPAND128( 2, 0x02 );
+          MB_EXPAND128( 3, 0x04 );
+          MB_EXPAND128( 4, 0x08 );
+          MB_EXPAND128( 5, 0x10 );
+          MB_EXPAND128( 6, 0x20 );
+          MB_EXPAND128( 7, 0x40 );
+          MB_EXPAND128( 8, 0x80 );
+          MB_EXPAND128( 9, 0x1b );
+          MB_EXPAND128( 10, 0x36 );
+#undef MB_EXPAND128
+        }
+
+        MB_AES void expandKey256( const uint8_t *key, __m128i rk[ 15 ] ) {
+          rk[ 0 ] = _mm_loadu_si128( reinterpret_cast< const __m128i * >( key ) );
+          rk[ 1 ] = _mm_loadu_si128( reinterpret_cast< const __m128i * >( key + 16 ) );
+
+#define MB_EXPAND256( i, rcon )                                                                                        \
+  rk[ i ]     = expand128( rk[ i - 2 ], _mm_aeskeygenassist_si128( rk[ i - 1 ], rcon ) );                               \
+  rk[ i + 1 ] = expand256( rk[ i - 1 ], rk[ i ] )
+          MB_EXPAND256( 2, 0x01 );
+          MB_EXPAND256( 4, 0x02 );
+          MB_EXPAND256( 6, 0x04 );
+          MB_EXPAND256( 8, 0x08 );
+          MB_EXPAND256( 10, 0x10 );
+          MB_EXPAND256( 12, 0x20 );
+#undef MB_EXPAND256
+          rk[ 14 ] = expand128( rk[ 12 ], _mm_aeskeygenassist_si128( rk[ 13 ], 0x40 ) );
+        }
+
+        /**
+         * @brief Encrypt a run of independent blocks in place, AES_LANES at a time
+         * @param state key state
+         * @param blocks blocks (16 bytes each)
+         * @param count number of blocks
+         */
+        MB_AES void encryptBlocks( const AesGcm &state, uint8_t *blocks, size_t count ) {
+          auto   rk     = reinterpret_cast< const __m128i * >( state.roundKeys );
+          int    rounds = state.rounds;
+          size_t pos    = 0;
+
+          for ( ; pos < count; pos += AES_LANES ) {
+            size_t  lanes = std::min( AES_LANES, count - pos );
+            __m128i b[ AES_LANES ];
+            auto    data = reinterpret_cast< __m128i * >( blocks + pos * 16 );
+
+            for ( size_t i = 0; i < lanes; ++i ) {
+              b[ i ] = _mm_xor_si128( _mm_loadu_si128( data + i ), _mm_load_si128( rk ) );
+            }
+
+            for ( int r = 1; r < rounds; ++r ) {
+              auto key = _mm_load_si128( rk + r );
+
+              for ( size_t i = 0; i < lanes; ++i ) {
+                b[ i ] = _mm_aesenc_si128( b[ i ], key );
+              }
+            }
+
+            auto last = _mm_load_si128( rk + rounds );
+
+            for ( size_t i = 0; i < lanes; ++i ) {
+              _mm_storeu_si128( data + i, _mm_aesenclast_si128( b[ i ], last ) );
+            }
+          }
+        }
+
+        MB_AES inline __m128i byteSwap( __m128i value ) {
+          return _mm_shuffle_epi8( value, _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 ) );
+        }
+
+        /**
+         * @brief GF(2^128) multiplication of byte reversed operands (GHASH)
+         */
+        MB_AES __m128i gfmul( __m128i a, __m128i b ) {
+          auto lo  = _mm_clmulepi64_si128( a, b, 0x00 );
+          auto mid = _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x10 ), _mm_clmulepi64_si128( a, b, 0x01 ) );
+          auto hi  = _mm_clmulepi64_si128( a, b, 0x11 );
+
+          lo = _mm_xor_si128( lo, _mm_slli_si128( mid, 8 ) );
+          hi = _mm_xor_si128( hi, _mm_srli_si128( mid, 8 ) );
+
+          /* Shift the 256 bit product left by one (bit reflection) */
+          auto carryLo = _mm_srli_epi32( lo, 31 );
+          auto carryHi = _mm_srli_epi32( hi, 31 );
+          auto cross   = _mm_srli_si128( carryLo, 12 );
+
+          lo = _mm_or_si128( _mm_slli_epi32( lo, 1 ), _mm_slli_si128( carryLo, 4 ) );
+          hi = _mm_or_si128( _mm_or_si128( _mm_slli_epi32( hi, 1 ), _mm_slli_si128( carryHi, 4 ) ), cross );
+
+          /* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+          auto r1 = _mm_xor_si128( _mm_xor_si128( _mm_slli_epi32( lo, 31 ), _mm_slli_epi32( lo, 30 ) ),
+                                   _mm_slli_epi32( lo, 25 ) );
+          auto r2 = _mm_srli_si128( r1, 4 );
+
+          lo      = _mm_xor_si128( lo, _mm_slli_si128( r1, 12 ) );
+          auto r3 = _mm_xor_si128( _mm_xor_si128( _mm_srli_epi32( lo, 1 ), _mm_srli_epi32( lo, 2 ) ),
+                                   _mm_xor_si128( _mm_srli_epi32( lo, 7 ), r2 ) );
+
+          return _mm_xor_si128( hi, _mm_xor_si128( lo, r3 ) );
+        }
+
+        /**
+         * @brief GHASH of a ciphertext (no additional authenticated data)
+         * @param state key state
+         * @param data ciphertext
+         * @param length ciphertext length
+         * @return byte reversed GHASH value
+         */
+        MB_AES __m128i ghash( const AesGcm &state, const uint8_t *data, size_t length ) {
+          auto    h = _mm_load_si128( reinterpret_cast< const __m128i * >( state.hash ) );
+          auto    x = _mm_setzero_si128( );
+          uint8_t block[ 16 ];
+          size_t  pos = 0;
+
+          for ( ; pos + 16 <= length; pos += 16 ) {
+            auto c = byteSwap( _mm_loadu_si128( reinterpret_cast< const __m128i * >( data + pos ) ) );
+            x      = gfmul( _mm_xor_si128( x, c ), h );
+          }
+
+          if ( pos < length ) {
+            memset( block, 0, sizeof( block ) );
+            memcpy( block, data + pos, length - pos );
+            x = gfmul( _mm_xor_si128( x, byteSwap( _mm_loadu_si128( reinterpret_cast< const __m128i * >( block ) ) ) ), h );
+          }
+
+          memset( block, 0, 8 );
+          store64( block + 8, uint64_t( length ) * 8 );
+
+          return gfmul( _mm_xor_si128( x, byteSwap( _mm_loadu_si128( reinterpret_cast< const __m128i * >( block ) ) ) ), h );
+        }
+
+        /**
+         * @brief Build and encrypt the counter blocks of a set of values: block 0 of each value is
+         * E(K, J0) (the tag mask), followed by the keystream blocks
+         * @param state key state
+         * @param lengths value lengths
+         * @param ivs value IVs
+         * @param count number of values
+         * @param stream [out] encrypted counter blocks
+         * @param offsets [out] first block of each value
+         */
+        MB_AES void keystream( const AesGcm &               state,
+                               const size_t                 lengths[],
+                               const uint8_t *const         ivs[],
+                               size_t                       count,
+                               std::vector< uint8_t > &     stream,
+                               std::vector< size_t > &      offsets ) {
+          size_t blocks = 0;
+
+          offsets.resize( count );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            offsets[ num ] = blocks;
+            blocks += 1 + ( lengths[ num ] + 15 ) / 16;
+          }
+
+          stream.resize( blocks * 16 );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            size_t n = 1 + ( lengths[ num ] + 15 ) / 16;
+
+            for ( size_t i = 0; i < n; ++i ) {
+              auto block = stream.data( ) + ( offsets[ num ] + i ) * 16;
+
+              memcpy( block, ivs[ num ], GCM_IV_LENGTH );
+              store32( block + GCM_IV_LENGTH, uint32_t( i + 1 ) );
+            }
+          }
+
+          encryptBlocks( state, stream.data( ), blocks );
+        }
+
+        MB_AES bool initGcm( AesGcm &state, const uint8_t *key, size_t length ) {
+          __m128i rk[ 15 ];
+          uint8_t zero[ 16 ] = { };
+
+          if ( length == 16 ) {
+            expandKey128( key, rk );
+            state.rounds = 10;
+          } else if ( length == 32 ) {
+            expandKey256( key, rk );
+            state.rounds = 14;
+          } else {
+            return false;
+          }
+
+          for ( int r = 0; r <= state.rounds; ++r ) {
+            _mm_store_si128( reinterpret_cast< __m128i * >( state.roundKeys[ r ] ), rk[ r ] );
+          }
+
+          encryptBlocks( state, zero, 1 );
+          _mm_store_si128( reinterpret_cast< __m128i * >( state.hash ),
+                           byteSwap( _mm_loadu_si128( reinterpret_cast< const __m128i * >( zero ) ) ) );
+
+          memset( rk, 0, sizeof( rk ) );
+          return true;
+        }
+
+        MB_AES void tagOf( const AesGcm &state, const uint8_t *crypt, size_t length, const uint8_t *mask, uint8_t *tag ) {
+          auto x = byteSwap( ghash( state, crypt, length ) );
+          _mm_storeu_si128( reinterpret_cast< __m128i * >( tag ),
+                            _mm_xor_si128( x, _mm_loadu_si128( reinterpret_cast< const __m128i * >( mask ) ) ) );
+        }
+
+        void xorInto( uint8_t *out, const uint8_t *data, const uint8_t *stream, size_t length ) {
+          for ( size_t pos = 0; pos < length; ++pos ) {
+            out[ pos ] = data[ pos ] ^ stream[ pos ];
+          }
+        }
+#endif
+      } // namespace
+
+      bool hmacSha256Supported( ) {
+#ifdef MULTIBUFFER_X86
+        return features( ).avx2;
+#else
+        return false;
+#endif
+      }
+
+      void init( HmacSha256 &state, const uint8_t *key, size_t length ) {
+        uint8_t block[ 64 ] = { };
+        uint8_t ipad[ 64 ];
+        uint8_t opad[ 64 ];
+
+        if ( length > sizeof( block ) ) {
+          sha256( key, length, block );
+        } else {
+          memcpy( block, key, length );
+        }
+
+        for ( size_t pos = 0; pos < sizeof( block ); ++pos ) {
+          ipad[ pos ] = block[ pos ] ^ 0x36;
+          opad[ pos ] = block[ pos ] ^ 0x5c;
+        }
+
+        std::copy( SHA256_IV, SHA256_IV + 8, state.inner );
+        std::copy( SHA256_IV, SHA256_IV + 8, state.outer );
+        compress( state.inner, ipad );
+        compress( state.outer, opad );
+
+        memset( block, 0, sizeof( block ) );
+        memset( ipad, 0, sizeof( ipad ) );
+        memset( opad, 0, sizeof( opad ) );
+      }
+
+      void hmacSha256( const HmacSha256 &state,
+                       const uint8_t *const data[],
+                       const size_t         lengths[],
+                       size_t               count,
+                       uint8_t *const       out[] ) {
+#ifdef MULTIBUFFER_X86
+        for ( size_t pos = 0; pos < count; pos += SHA256_LANES ) {
+          hmac8( state, data + pos, lengths + pos, std::min( SHA256_LANES, count - pos ), out + pos );
+        }
+#endif
+      }
+
+      bool aesGcmSupported( ) {
+#ifdef MULTIBUFFER_X86
+        return features( ).aesni && features( ).pclmul && features( ).ssse3;
+#else
+        return false;
+#endif
+      }
+
+      bool init( AesGcm &state, const uint8_t *key, size_t length ) {
+#ifdef MULTIBUFFER_X86
+        return aesGcmSupported( ) && initGcm( state, key, length );
+#else
+        return false;
+#endif
+      }
+
+      void aesGcmEncrypt( const AesGcm &       state,
+                          const uint8_t *const data[],
+                          const size_t         lengths[],
+                          const uint8_t *const ivs[],
+                          size_t               count,
+                          uint8_t *const       out[],
+                          uint8_t *const       tags[] ) {
+#ifdef MULTIBUFFER_X86
+        static thread_local std::vector< uint8_t > stream;
+        static thread_local std::vector< size_t >  offsets;
+
+        keystream( state, lengths, ivs, count, stream, offsets );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          auto blocks = stream.data( ) + offsets[ num ] * 16;
+
+          xorInto( out[ num ], data[ num ], blocks + 16, lengths[ num ] );
+          tagOf( state, out[ num ], lengths[ num ], blocks, tags[ num ] );
+        }
+
+        std::fill( stream.begin( ), stream.end( ), 0 );
+#endif
+      }
+
+      bool aesGcmDecrypt( const AesGcm &       state,
+                          const uint8_t *const data[],
+                          const size_t         lengths[],
+                          const uint8_t *const ivs[],
+                          const uint8_t *const tags[],
+                          size_t               count,
+                          uint8_t *const       out[] ) {
+        bool valid = true;
+
+#ifdef MULTIBUFFER_X86
+        static thread_local std::vector< uint8_t > stream;
+        static thread_local std::vector< size_t >  offsets;
+
+        keystream( state, lengths, ivs, count, stream, offsets );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          auto    blocks = stream.data( ) + offsets[ num ] * 16;
+          uint8_t tag[ GCM_TAG_LENGTH ];
+          uint8_t diff = 0;
+
+          tagOf( state, data[ num ], lengths[ num ], blocks, tag );
+
+          for ( size_t pos = 0; pos < GCM_TAG_LENGTH; ++pos ) {
+            diff |= tag[ pos ] ^ tags[ num ][ pos ];
+          }
+
+          if ( diff != 0 ) {
+            valid = false;
+            continue;
+          }
+
+          xorInto( out[ num ], data[ num ], blocks + 16, lengths[ num ] );
+        }
+
+        std::fill( stream.begin( ), stream.end( ), 0 );
+#else
+        valid = false;
+#endif
+
+        return valid;
+      }
+    } // namespace multibuffer
+  }   // namespace crypto
+} // namespace token
@@ -0,0 +1,128 @@
+
+#ifndef __TOKENIZATION_MULTIBUFFER_HH__
+#define __TOKENIZATION_MULTIBUFFER_HH__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace token {
+  namespace crypto {
+    /**
+     * Multi-buffer kernels, processing many short independent values together so the SIMD lanes
+     * (SHA-256) and the AES pipeline (AES-GCM) are kept busy across values rather than idling on
+     * the dependency chain of a single value.  Kernels are selected at run time; callers fall back
+     * to the single buffer path when a kernel is not supported by the CPU.
+     */
+    namespace multibuffer {
+      /** Messages hashed together by the SHA-256 kernel */
+      static constexpr size_t SHA256_LANES = 8;
+
+      /** AES-GCM IV length */
+      static constexpr size_t GCM_IV_LENGTH = 12;
+
+      /** AES-GCM tag length */
+      static constexpr size_t GCM_TAG_LENGTH = 16;
+
+      /**
+       * HMAC-SHA-256 key state: the compressed key ^ ipad and key ^ opad blocks
+       */
+      struct HmacSha256 {
+        uint32_t inner[ 8 ]; /**< Inner hash state */
+        uint32_t outer[ 8 ]; /**< Outer hash state */
+      };
+
+      /**
+       * AES-GCM key state
+       */
+      struct AesGcm {
+        alignas( 16 ) uint8_t roundKeys[ 15 ][ 16 ]; /**< AES round keys            */
+        alignas( 16 ) uint8_t hash[ 16 ];            /**< GHASH key (byte reversed) */
+        int rounds;                                  /**< AES rounds                */
+      };
+
+      /**
+       * @brief Identify if the multi-buffer HMAC-SHA-256 kernel is usable (AVX2)
+       * @return true if supported
+       */
+      bool hmacSha256Supported( );
+
+      /**
+       * @brief Prepare an HMAC-SHA-256 key state
+       * @param state [out] key state
+       * @param key key bytes
+       * @param length key length
+       */
+      void init( HmacSha256 &state, const uint8_t *key, size_t length );
+
+      /**
+       * @brief HMAC-SHA-256 of a set of messages, SHA256_LANES at a time
+       * @param state key state
+       * @param data message pointers
+       * @param lengths message lengths
+       * @param count number of messages
+       * @param out output pointers (32 bytes each)
+       */
+      void hmacSha256( const HmacSha256 &state,
+                       const uint8_t *const data[],
+                       const size_t         lengths[],
+                       size_t               count,
+                       uint8_t *const       out[] );
+
+      /**
+       * @brief Identify if the multi-buffer AES-GCM kernel is usable (AES-NI, PCLMULQDQ, SSSE3)
+       * @return true if supported
+       */
+      bool aesGcmSupported( );
+
+      /**
+       * @brief Prepare an AES-GCM key state
+       * @param state [out] key state
+       * @param key key bytes
+       * @param length key length (16 or 32)
+       * @return true on success, false if unsupported
+       */
+      bool init( AesGcm &state, const uint8_t *key, size_t length );
+
+      /**
+       * @brief AES-GCM encrypt a set of values (no additional authenticated data), interleaving the
+       * AES blocks of all values
+       * @param state key state
+       * @param data plaintext pointers
+       * @param lengths plaintext lengths
+       * @param ivs IV pointers (GCM_IV_LENGTH bytes each)
+       * @param count number of values
+       * @param out ciphertext pointers (same length as the plaintext)
+       * @param tags tag pointers (GCM_TAG_LENGTH bytes each)
+       */
+      void aesGcmEncrypt( const AesGcm &       state,
+                          const uint8_t *const data[],
+                          const size_t         lengths[],
+                          const uint8_t *const ivs[],
+                          size_t               count,
+                          uint8_t *const       out[],
+                          uint8_t *const       tags[] );
+
+      /**
+       * @brief AES-GCM decrypt a set of values (no additional authenticated data), interleaving the
+       * AES blocks of all values; values failing authentication are not decrypted
+       * @param state key state
+       * @param data ciphertext pointers
+       * @param lengths ciphertext lengths
+       * @param ivs IV pointers (GCM_IV_LENGTH bytes each)
+       * @param tags tag pointers (GCM_TAG_LENGTH bytes each)
+       * @param count number of values
+       * @param out plaintext pointers (same length as the ciphertext)
+       * @return true if every value authenticated, false otherwise
+       */
+      bool aesGcmDecrypt( const AesGcm &       state,
+                          const uint8_t *const data[],
+                          const size_t         lengths[],
+                          const uint8_t *const ivs[],
+                          const uint8_t *const tags[],
+                          size_t               count,
+                          uint8_t *const       out[] );
+    } // namespace multibuffer
+  }   // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_MULTIBUFFER_HH__
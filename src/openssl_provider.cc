@@ -0,0 +1,965 @@
+
+#include "token/api.hh"
+#include "token/crypto/openssl.hh"
+#include "multibuffer.hh"
+#include <atomic>
+#include <climits>
+#include <fcntl.h>
+#include <fstream>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+#include <spdlog/spdlog.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#endif
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( osslLogger->should_log( spdlog::level::lvl ) ) {                                                              \
+      osslLogger->lvl( fmt, ##__VA_ARGS__ );                                                                           \
+    }                                                                                                                  \
+  } while ( 0 )
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static HMAC_CTX *HMAC_CTX_new( void ) {
+  HMAC_CTX *ctx = reinterpret_cast< HMAC_CTX * >( OPENSSL_malloc( sizeof( *ctx ) ) );
+  if ( ctx ) {
+    HMAC_CTX_init( ctx );
+  }
+  return ctx;
+}
+
+static void HMAC_CTX_free( HMAC_CTX *ctx ) {
+  if ( ctx ) {
+    HMAC_CTX_cleanup( ctx );
+    OPENSSL_free( ctx );
+  }
+}
+#endif
+
+namespace token {
+  namespace crypto {
+    /** OpenSSL provider logger */
+    std::shared_ptr< spdlog::logger > osslLogger = token::api::create_logger( "token::crypto::openssl", { } );
+
+    namespace {
+      static constexpr size_t GCM_IV_LENGTH  = multibuffer::GCM_IV_LENGTH;
+      static constexpr size_t GCM_TAG_LENGTH = multibuffer::GCM_TAG_LENGTH;
+
+      /** Key identifiers, distinguishing the per-thread contexts of each loaded key */
+      std::atomic< uint64_t > nextKeyId{ 1 };
+
+      /**
+       * Key bytes, wiped on release
+       */
+      struct KeyMaterial {
+        std::vector< uint8_t > bytes; /**< Raw key */
+
+        ~KeyMaterial( ) {
+          if ( !bytes.empty( ) ) {
+            OPENSSL_cleanse( bytes.data( ), bytes.size( ) );
+          }
+        }
+      };
+
+      struct CipherFree {
+        void operator( )( EVP_CIPHER_CTX *ctx ) const { EVP_CIPHER_CTX_free( ctx ); }
+      };
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+      using HmacCtx = EVP_MAC_CTX;
+
+      struct HmacFree {
+        void operator( )( EVP_MAC_CTX *ctx ) const { EVP_MAC_CTX_free( ctx ); }
+      };
+
+      struct MacFree {
+        void operator( )( EVP_MAC *mac ) const { EVP_MAC_free( mac ); }
+      };
+#else
+      using HmacCtx = HMAC_CTX;
+
+      struct HmacFree {
+        void operator( )( HMAC_CTX *ctx ) const { HMAC_CTX_free( ctx ); }
+      };
+#endif
+
+      /**
+       * Pre-keyed cipher contexts of a key (one per direction)
+       */
+      struct CipherContext {
+        std::unique_ptr< EVP_CIPHER_CTX, CipherFree > encrypt; /**< Encryption context */
+        std::unique_ptr< EVP_CIPHER_CTX, CipherFree > decrypt; /**< Decryption context */
+      };
+
+      /**
+       * Pre-keyed HMAC context of a key
+       */
+      struct HmacContext {
+        std::unique_ptr< HmacCtx, HmacFree > hmac; /**< HMAC context */
+      };
+
+      /**
+       * Per-thread context cache; entries are released with the thread, or once their key has
+       * been released (swept whenever a new key is first used on the thread)
+       */
+      template < typename Context >
+      class ContextCache {
+       public:
+        /**
+         * @brief Get the contexts of a key, creating an empty entry on first use
+         * @param id key identifier
+         * @param owner key material, tracked to expire the entry
+         * @return key contexts
+         */
+        Context &get( uint64_t id, const std::shared_ptr< KeyMaterial > &owner ) {
+          auto iter = entries.find( id );
+
+          if ( iter != entries.end( ) ) {
+            return iter->second.second;
+          }
+
+          for ( auto entry = entries.begin( ); entry != entries.end( ); ) {
+            if ( entry->second.first.expired( ) ) {
+              entry = entries.erase( entry );
+            } else {
+              ++entry;
+            }
+          }
+
+          auto &entry = entries[ id ];
+          entry.first = owner;
+          return entry.second;
+        }
+
+       private:
+        std::unordered_map< uint64_t, std::pair< std::weak_ptr< KeyMaterial >, Context > > entries;
+      };
+
+      /**
+       * @brief Look up an encryption algorithm by name
+       * @param name algorithm name
+       * @return cipher, nullptr if unsupported
+       */
+      const EVP_CIPHER *cipherByName( const std::string &name ) {
+        if ( name == "aes-256-gcm" ) {
+          return EVP_aes_256_gcm( );
+        } else if ( name == "aes-128-gcm" ) {
+          return EVP_aes_128_gcm( );
+        } else if ( name == "aes-256-cbc" ) {
+          return EVP_aes_256_cbc( );
+        } else if ( name == "aes-128-cbc" ) {
+          return EVP_aes_128_cbc( );
+        }
+
+        return nullptr;
+      }
+
+      /**
+       * @brief Look up a format preserving encryption block cipher by name
+       * @param name algorithm name
+       * @return cipher, nullptr if unsupported
+       */
+      const EVP_CIPHER *blockCipherByName( const std::string &name ) {
+        if ( name == "aes-256-ecb" ) {
+          return EVP_aes_256_ecb( );
+        } else if ( name == "aes-192-ecb" ) {
+          return EVP_aes_192_ecb( );
+        } else if ( name == "aes-128-ecb" ) {
+          return EVP_aes_128_ecb( );
+        }
+
+        return nullptr;
+      }
+
+      /**
+       * @brief Look up an HMAC digest by name
+       * @param name digest name
+       * @return digest, nullptr if unsupported
+       */
+      const EVP_MD *digestByName( const std::string &name ) {
+        if ( name == "sha256" ) {
+          return EVP_sha256( );
+        } else if ( name == "sha512" ) {
+          return EVP_sha512( );
+        }
+
+        return nullptr;
+      }
+
+      /**
+       * @brief Read a key file ("<algorithm>:<hex key>")
+       * @param path key file path
+       * @param algorithm [in/out] algorithm name (unchanged if the file has no prefix)
+       * @param key [out] key bytes
+       * @return true on success, false on failure
+       */
+      bool readKeyFile( const std::string &path, std::string &algorithm, KeyMaterial &key ) {
+        std::ifstream file( path );
+        std::string   line;
+        bool          rc = true;
+
+        if ( ( !file ) || ( !std::getline( file, line ) ) ) {
+          return false;
+        }
+
+        while ( ( !line.empty( ) ) && ( isspace( line.back( ) ) ) ) {
+          line.pop_back( );
+        }
+
+        auto pos = line.rfind( ':' );
+        auto hex = pos == std::string::npos ? 0 : pos + 1;
+
+        if ( pos != std::string::npos ) {
+          algorithm = line.substr( 0, pos );
+        }
+
+        if ( ( line.size( ) - hex ) % 2 != 0 ) {
+          rc = false;
+        }
+
+        key.bytes.reserve( ( line.size( ) - hex ) / 2 );
+
+        for ( size_t num = hex; rc && ( num < line.size( ) ); num += 2 ) {
+          unsigned int byte = 0;
+
+          if ( ( !isxdigit( line[ num ] ) ) || ( !isxdigit( line[ num + 1 ] ) ) ||
+               ( sscanf( &line[ num ], "%2x", &byte ) != 1 ) ) {
+            rc = false;
+          } else {
+            key.bytes.push_back( static_cast< uint8_t >( byte ) );
+          }
+        }
+
+        OPENSSL_cleanse( &line[ 0 ], line.size( ) );
+
+        return rc && !key.bytes.empty( );
+      }
+
+      /**
+       * @brief Write a new key file with owner only access; fails if the file already exists
+       * @param path key file path
+       * @param algorithm algorithm name
+       * @param key key bytes
+       * @return true on success, false on failure
+       */
+      bool writeKeyFile( const std::string &path, const std::string &algorithm, const KeyMaterial &key ) {
+        static const char HEX[] = "0123456789abcdef";
+        std::string       line  = algorithm + ":";
+        int               fd    = open( path.c_str( ), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR );
+        bool              rc    = false;
+
+        if ( fd < 0 ) {
+          return false;
+        }
+
+        for ( auto byte : key.bytes ) {
+          line.push_back( HEX[ byte >> 4 ] );
+          line.push_back( HEX[ byte & 0x0f ] );
+        }
+
+        line.push_back( '\n' );
+
+        rc = write( fd, line.data( ), line.size( ) ) == static_cast< ssize_t >( line.size( ) );
+        rc = ( fsync( fd ) == 0 ) && rc;
+        rc = ( close( fd ) == 0 ) && rc;
+
+        OPENSSL_cleanse( &line[ 0 ], line.size( ) );
+
+        if ( !rc ) {
+          unlink( path.c_str( ) );
+        }
+
+        return rc;
+      }
+
+      /**
+       * OpenSSL AES encryption key (GCM or CBC)
+       */
+      class OpenSSLEncKey : public interface::EncKey {
+       public:
+        OpenSSLEncKey( std::string _name, const EVP_CIPHER *_cipher, std::shared_ptr< KeyMaterial > _material )
+          : name( std::move( _name ) )
+          , cipher( _cipher )
+          , material( std::move( _material ) )
+          , id( nextKeyId++ )
+          , gcm( EVP_CIPHER_mode( _cipher ) == EVP_CIPH_GCM_MODE )
+          , ivLength( gcm ? GCM_IV_LENGTH : EVP_CIPHER_iv_length( _cipher ) )
+          , blockSize( EVP_CIPHER_block_size( _cipher ) ) {
+          batched = gcm && multibuffer::init( batchKey, material->bytes.data( ), material->bytes.size( ) );
+        }
+
+        ~OpenSSLEncKey( ) { OPENSSL_cleanse( &batchKey, sizeof( batchKey ) ); }
+
+        void encryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          size_t count = inputs.size( );
+
+          if ( ( !batched ) || ( count < 2 ) ) {
+            return interface::EncKey::encryptBatch( inputs, outputs );
+          }
+
+          std::vector< const uint8_t * > data( count ), ivs( count );
+          std::vector< uint8_t * >       out( count ), tags( count );
+          std::vector< size_t >          lengths( count );
+          bytea                          random( count * ivLength );
+
+          if ( RAND_bytes( random.data( ), random.size( ) ) != 1 ) {
+            throw exceptions::TokenCryptographyError( "Encryption failure: " + name );
+          }
+
+          outputs.resize( count );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            auto &output = outputs[ num ];
+
+            output.resize( encryptedLength( inputs[ num ].size ) );
+            std::copy( &random[ num * ivLength ], &random[ num * ivLength ] + ivLength, output.begin( ) );
+
+            data[ num ]    = inputs[ num ].data;
+            lengths[ num ] = inputs[ num ].size;
+            ivs[ num ]     = output.data( );
+            out[ num ]     = output.data( ) + ivLength;
+            tags[ num ]    = output.data( ) + ivLength + lengths[ num ];
+          }
+
+          multibuffer::aesGcmEncrypt( batchKey, data.data( ), lengths.data( ), ivs.data( ), count, out.data( ), tags.data( ) );
+        }
+
+        void decryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          size_t count = inputs.size( );
+
+          if ( ( !batched ) || ( count < 2 ) ) {
+            return interface::EncKey::decryptBatch( inputs, outputs );
+          }
+
+          std::vector< const uint8_t * > data( count ), ivs( count ), tags( count );
+          std::vector< uint8_t * >       out( count );
+          std::vector< size_t >          lengths( count );
+
+          outputs.resize( count );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            auto &input = inputs[ num ];
+
+            if ( input.size < ivLength + GCM_TAG_LENGTH ) {
+              throw exceptions::TokenCryptographyError( "Invalid ciphertext length: " + name );
+            }
+
+            lengths[ num ] = input.size - ivLength - GCM_TAG_LENGTH;
+            ivs[ num ]     = input.data;
+            data[ num ]    = input.data + ivLength;
+            tags[ num ]    = input.data + ivLength + lengths[ num ];
+
+            outputs[ num ].resize( lengths[ num ] );
+            out[ num ] = outputs[ num ].data( );
+          }
+
+          if ( !multibuffer::aesGcmDecrypt(
+                 batchKey, data.data( ), lengths.data( ), ivs.data( ), tags.data( ), count, out.data( ) ) ) {
+            throw exceptions::TokenCryptographyError( "Decryption failure (authentication): " + name );
+          }
+        }
+
+        size_t encrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          size_t required = encryptedLength( length );
+          int    update   = 0;
+          int    final    = 0;
+
+          if ( required > outLength ) {
+            return required;
+          }
+
+          if ( length > INT_MAX ) {
+            throw exceptions::TokenCryptographyError( "Value too large to encrypt" );
+          }
+
+          auto ctx = context( true );
+
+          if ( ( RAND_bytes( out, ivLength ) != 1 ) ||
+               ( EVP_EncryptInit_ex( ctx, nullptr, nullptr, nullptr, out ) != 1 ) ||
+               ( ( length > 0 ) && ( EVP_EncryptUpdate( ctx, out + ivLength, &update, data, length ) != 1 ) ) ||
+               ( EVP_EncryptFinal_ex( ctx, out + ivLength + update, &final ) != 1 ) ) {
+            throw exceptions::TokenCryptographyError( "Encryption failure: " + name );
+          }
+
+          if ( gcm ) {
+            auto tag = out + ivLength + update + final;
+
+            if ( EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag ) != 1 ) {
+              throw exceptions::TokenCryptographyError( "Encryption failure: " + name );
+            }
+          }
+
+          return ivLength + update + final + ( gcm ? GCM_TAG_LENGTH : 0 );
+        }
+
+        size_t decrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          size_t required = decryptedLength( length );
+          size_t overhead = ivLength + ( gcm ? GCM_TAG_LENGTH : 0 );
+          int    update   = 0;
+          int    final    = 0;
+
+          if ( ( length < overhead ) || ( length > INT_MAX ) ) {
+            throw exceptions::TokenCryptographyError( "Invalid ciphertext length: " + name );
+          }
+
+          if ( required > outLength ) {
+            return required;
+          }
+
+          auto ctx  = context( false );
+          auto body = length - overhead;
+
+          if ( ( EVP_DecryptInit_ex( ctx, nullptr, nullptr, nullptr, data ) != 1 ) ||
+               ( ( body > 0 ) && ( EVP_DecryptUpdate( ctx, out, &update, data + ivLength, body ) != 1 ) ) ) {
+            throw exceptions::TokenCryptographyError( "Decryption failure: " + name );
+          }
+
+          if ( gcm ) {
+            auto tag = const_cast< uint8_t * >( data + length - GCM_TAG_LENGTH );
+
+            if ( EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LENGTH, tag ) != 1 ) {
+              throw exceptions::TokenCryptographyError( "Decryption failure: " + name );
+            }
+          }
+
+          if ( EVP_DecryptFinal_ex( ctx, out + update, &final ) != 1 ) {
+            throw exceptions::TokenCryptographyError( "Decryption failure (authentication): " + name );
+          }
+
+          return update + final;
+        }
+
+        size_t encryptedLength( size_t length ) const override {
+          if ( gcm ) {
+            return ivLength + length + GCM_TAG_LENGTH;
+          }
+
+          return ivLength + ( length / blockSize + 1 ) * blockSize;
+        }
+
+        size_t decryptedLength( size_t length ) const override {
+          size_t overhead = ivLength + ( gcm ? GCM_TAG_LENGTH : 0 );
+          return length > overhead ? length - overhead : 0;
+        }
+
+        explicit operator std::string( ) override { return name; }
+
+       private:
+        /**
+         * @brief Get this thread's pre-keyed context
+         * @param encrypt encryption (true) or decryption (false) context
+         * @return cipher context, ready for an IV reset
+         */
+        EVP_CIPHER_CTX *context( bool encrypt ) const {
+          static thread_local ContextCache< CipherContext > cache;
+
+          auto &contexts = cache.get( id, material );
+          auto &ctx      = encrypt ? contexts.encrypt : contexts.decrypt;
+
+          if ( !ctx ) {
+            std::unique_ptr< EVP_CIPHER_CTX, CipherFree > fresh( EVP_CIPHER_CTX_new( ) );
+
+            if ( ( !fresh ) ||
+                 ( EVP_CipherInit_ex( fresh.get( ), cipher, nullptr, nullptr, nullptr, encrypt ? 1 : 0 ) != 1 ) ||
+                 ( gcm && ( EVP_CIPHER_CTX_ctrl( fresh.get( ), EVP_CTRL_GCM_SET_IVLEN, ivLength, nullptr ) != 1 ) ) ||
+                 ( EVP_CipherInit_ex( fresh.get( ), nullptr, nullptr, material->bytes.data( ), nullptr, -1 ) != 1 ) ) {
+              throw exceptions::TokenCryptographyError( "Unable to initialize cipher context: " + name );
+            }
+
+            ctx = std::move( fresh );
+          }
+
+          return ctx.get( );
+        }
+
+        std::string                    name;      /**< Key name                       */
+        const EVP_CIPHER *             cipher;    /**< Encryption algorithm           */
+        std::shared_ptr< KeyMaterial > material;  /**< Key bytes                      */
+        uint64_t                       id;        /**< Per-thread context identifier  */
+        bool                           gcm;       /**< Authenticated (GCM) mode       */
+        size_t                         ivLength;  /**< IV length                      */
+        size_t                         blockSize; /**< Cipher block size              */
+        multibuffer::AesGcm            batchKey;  /**< Multi-buffer key state         */
+        bool                           batched;   /**< Multi-buffer kernel available  */
+      };
+
+      /**
+       * OpenSSL HMAC key (SHA-256 or SHA-512)
+       */
+      class OpenSSLMacKey : public interface::MacKey {
+       public:
+        OpenSSLMacKey( std::string _name, const EVP_MD *_md, std::shared_ptr< KeyMaterial > _material )
+          : name( std::move( _name ) )
+          , md( _md )
+          , material( std::move( _material ) )
+          , id( nextKeyId++ )
+          , mdSize( EVP_MD_size( _md ) ) {
+          batched = ( EVP_MD_type( _md ) == NID_sha256 ) && multibuffer::hmacSha256Supported( );
+
+          if ( batched ) {
+            multibuffer::init( batchKey, material->bytes.data( ), material->bytes.size( ) );
+          }
+        }
+
+        ~OpenSSLMacKey( ) { OPENSSL_cleanse( &batchKey, sizeof( batchKey ) ); }
+
+        void hashBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          size_t count = inputs.size( );
+
+          if ( ( !batched ) || ( count < 2 ) ) {
+            return interface::MacKey::hashBatch( inputs, outputs );
+          }
+
+          std::vector< const uint8_t * > data( count );
+          std::vector< uint8_t * >       out( count );
+          std::vector< size_t >          lengths( count );
+
+          outputs.resize( count );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            outputs[ num ].resize( mdSize );
+
+            data[ num ]    = inputs[ num ].data;
+            lengths[ num ] = inputs[ num ].size;
+            out[ num ]     = outputs[ num ].data( );
+          }
+
+          multibuffer::hmacSha256( batchKey, data.data( ), lengths.data( ), count, out.data( ) );
+        }
+
+        size_t hash( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          if ( mdSize > outLength ) {
+            return mdSize;
+          }
+
+          auto ctx = context( );
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+          size_t digestLength = 0;
+
+          // A null key restarts the context with the key it was initialized with
+          if ( ( EVP_MAC_init( ctx, nullptr, 0, nullptr ) != 1 ) ||
+               ( ( length > 0 ) && ( EVP_MAC_update( ctx, data, length ) != 1 ) ) ||
+               ( EVP_MAC_final( ctx, out, &digestLength, outLength ) != 1 ) ) {
+            throw exceptions::TokenCryptographyError( "HMAC failure: " + name );
+          }
+#else
+          unsigned int digestLength = 0;
+
+          if ( ( HMAC_Init_ex( ctx, nullptr, 0, nullptr, nullptr ) != 1 ) ||
+               ( ( length > 0 ) && ( HMAC_Update( ctx, data, length ) != 1 ) ) ||
+               ( HMAC_Final( ctx, out, &digestLength ) != 1 ) ) {
+            throw exceptions::TokenCryptographyError( "HMAC failure: " + name );
+          }
+#endif
+
+          return digestLength;
+        }
+
+        size_t hashLength( ) const override { return mdSize; }
+
+        explicit operator std::string( ) override { return name; }
+
+       private:
+        /**
+         * @brief Get this thread's pre-keyed HMAC context
+         * @return HMAC context, ready for a reset
+         */
+        HmacCtx *context( ) const {
+          static thread_local ContextCache< HmacContext > cache;
+
+          auto &ctx = cache.get( id, material ).hmac;
+
+          if ( !ctx ) {
+            auto &key = material->bytes;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            std::unique_ptr< EVP_MAC, MacFree >      mac( EVP_MAC_fetch( nullptr, "HMAC", nullptr ) );
+            std::unique_ptr< EVP_MAC_CTX, HmacFree > fresh( mac ? EVP_MAC_CTX_new( mac.get( ) ) : nullptr );
+            auto                                     digest = const_cast< char * >( EVP_MD_get0_name( md ) );
+            OSSL_PARAM                               params[] = {
+              OSSL_PARAM_construct_utf8_string( OSSL_MAC_PARAM_DIGEST, digest, 0 ), OSSL_PARAM_construct_end( ) };
+
+            if ( ( !fresh ) || ( EVP_MAC_init( fresh.get( ), key.data( ), key.size( ), params ) != 1 ) ) {
+              throw exceptions::TokenCryptographyError( "Unable to initialize HMAC context: " + name );
+            }
+#else
+            std::unique_ptr< HMAC_CTX, HmacFree > fresh( HMAC_CTX_new( ) );
+
+            if ( ( !fresh ) || ( HMAC_Init_ex( fresh.get( ), key.data( ), key.size( ), md, nullptr ) != 1 ) ) {
+              throw exceptions::TokenCryptographyError( "Unable to initialize HMAC context: " + name );
+            }
+#endif
+
+            ctx = std::move( fresh );
+          }
+
+          return ctx.get( );
+        }
+
+        std::string                    name;     /**< Key name                      */
+        const EVP_MD *                 md;       /**< HMAC digest                   */
+        std::shared_ptr< KeyMaterial > material; /**< Key bytes                     */
+        uint64_t                       id;       /**< Per-thread context identifier */
+        size_t                         mdSize;   /**< Digest size                   */
+        multibuffer::HmacSha256        batchKey; /**< Multi-buffer key state        */
+        bool                           batched;  /**< Multi-buffer kernel available */
+      };
+
+      /**
+       * OpenSSL AES block cipher key, for format preserving encryption
+       */
+      class OpenSSLFpeKey : public interface::FpeKey {
+       public:
+        OpenSSLFpeKey( std::string _name, const EVP_CIPHER *_cipher, std::shared_ptr< KeyMaterial > _material )
+          : name( std::move( _name ) )
+          , cipher( _cipher )
+          , material( std::move( _material ) )
+          , id( nextKeyId++ ) {}
+
+        void encryptBlocks( const uint8_t *data, uint8_t *out, size_t blocks ) const override {
+          int length = 0;
+
+          if ( ( blocks > INT_MAX / 16 ) ||
+               ( EVP_EncryptUpdate( context( ), out, &length, data, static_cast< int >( blocks * 16 ) ) != 1 ) ) {
+            throw exceptions::TokenCryptographyError( "Encryption failure: " + name );
+          }
+        }
+
+        explicit operator std::string( ) override { return name; }
+
+       private:
+        /**
+         * @brief Get this thread's pre-keyed context
+         * @return cipher context (ECB, no padding)
+         */
+        EVP_CIPHER_CTX *context( ) const {
+          static thread_local ContextCache< CipherContext > cache;
+
+          auto &ctx = cache.get( id, material ).encrypt;
+
+          if ( !ctx ) {
+            std::unique_ptr< EVP_CIPHER_CTX, CipherFree > fresh( EVP_CIPHER_CTX_new( ) );
+
+            if ( ( !fresh ) ||
+                 ( EVP_EncryptInit_ex( fresh.get( ), cipher, nullptr, material->bytes.data( ), nullptr ) != 1 ) ||
+                 ( EVP_CIPHER_CTX_set_padding( fresh.get( ), 0 ) != 1 ) ) {
+              throw exceptions::TokenCryptographyError( "Unable to initialize cipher context: " + name );
+            }
+
+            ctx = std::move( fresh );
+          }
+
+          return ctx.get( );
+        }
+
+        std::string                    name;     /**< Key name                      */
+        const EVP_CIPHER *             cipher;   /**< Block cipher (ECB)            */
+        std::shared_ptr< KeyMaterial > material; /**< Key bytes                     */
+        uint64_t                       id;       /**< Per-thread context identifier */
+      };
+
+      /**
+       * @brief Build an encryption key from a key file
+       * @param path key file path
+       * @param name key name
+       * @param algorithm default algorithm
+       * @return encryption key, nullptr on failure
+       */
+      EncKey loadEncKey( const std::string &path, const std::string &name, std::string algorithm ) {
+        auto material = std::make_shared< KeyMaterial >( );
+
+        if ( !readKeyFile( path, algorithm, *material ) ) {
+          LOG( warn, "Unable to read encryption key {} from {}", name, path );
+          return nullptr;
+        }
+
+        auto cipher = cipherByName( algorithm );
+
+        if ( cipher == nullptr ) {
+          LOG( warn, "Encryption key {} uses an unsupported algorithm: {}", name, algorithm );
+          return nullptr;
+        }
+
+        if ( material->bytes.size( ) != static_cast< size_t >( EVP_CIPHER_key_length( cipher ) ) ) {
+          LOG( warn, "Encryption key {} has an invalid length for {}", name, algorithm );
+          return nullptr;
+        }
+
+        LOG( debug, "Loaded {} encryption key {}", algorithm, name );
+
+        return std::make_shared< OpenSSLEncKey >( name, cipher, std::move( material ) );
+      }
+
+      /**
+       * @brief Build a hash key from a key file
+       * @param path key file path
+       * @param name key name
+       * @param algorithm default digest
+       * @return hash key, nullptr on failure
+       */
+      MacKey loadMacKey( const std::string &path, const std::string &name, std::string algorithm ) {
+        auto material = std::make_shared< KeyMaterial >( );
+
+        if ( !readKeyFile( path, algorithm, *material ) ) {
+          LOG( warn, "Unable to read HMAC key {} from {}", name, path );
+          return nullptr;
+        }
+
+        auto md = digestByName( algorithm );
+
+        if ( md == nullptr ) {
+          LOG( warn, "HMAC key {} uses an unsupported digest: {}", name, algorithm );
+          return nullptr;
+        }
+
+        LOG( debug, "Loaded HMAC-{} key {}", algorithm, name );
+
+        return std::make_shared< OpenSSLMacKey >( name, md, std::move( material ) );
+      }
+
+      /**
+       * @brief Build a format preserving encryption key from a key file
+       * @param path key file path
+       * @param name key name
+       * @return format preserving encryption key, nullptr on failure
+       */
+      FpeKey loadFpeKey( const std::string &path, const std::string &name ) {
+        auto        material  = std::make_shared< KeyMaterial >( );
+        std::string algorithm = "aes-256-ecb";
+
+        if ( !readKeyFile( path, algorithm, *material ) ) {
+          LOG( warn, "Unable to read format preserving encryption key {} from {}", name, path );
+          return nullptr;
+        }
+
+        auto cipher = blockCipherByName( algorithm );
+
+        if ( ( cipher == nullptr ) ||
+             ( material->bytes.size( ) != static_cast< size_t >( EVP_CIPHER_key_length( cipher ) ) ) ) {
+          LOG( warn, "Format preserving encryption key {} is not a valid AES key ({})", name, algorithm );
+          return nullptr;
+        }
+
+        LOG( debug, "Loaded {} format preserving encryption key {}", algorithm, name );
+
+        return std::make_shared< OpenSSLFpeKey >( name, cipher, std::move( material ) );
+      }
+    } // namespace
+
+    OpenSSLProvider::OpenSSLProvider( Options _options )
+      : options( std::move( _options ) ) {
+      auto features = acceleration( );
+
+      LOG( info,
+           "OpenSSL provider ({}), hardware acceleration: {}",
+           OPENSSL_VERSION_TEXT,
+           features.empty( ) ? "none" : features );
+    }
+
+    std::string OpenSSLProvider::keyFile( const std::string &directory, const std::string &name ) {
+      if ( name.empty( ) || ( name[ 0 ] == '.' ) || ( name.find( '/' ) != std::string::npos ) ) {
+        LOG( warn, "Invalid key name: '{}'", name );
+        return "";
+      }
+
+      return directory + "/" + name;
+    }
+
+    EncKey OpenSSLProvider::getEncKey( std::string name ) {
+      std::lock_guard< std::mutex > guard( lock );
+      auto &                        key = encKeys[ name ];
+
+      if ( !key ) {
+        auto path = keyFile( options.encKeyPath, name );
+
+        if ( path.empty( ) || !( key = loadEncKey( path, name, options.cipher ) ) ) {
+          encKeys.erase( name );
+          return nullptr;
+        }
+      }
+
+      return key;
+    }
+
+    MacKey OpenSSLProvider::getMacKey( std::string name ) {
+      std::lock_guard< std::mutex > guard( lock );
+      auto &                        key = macKeys[ name ];
+
+      if ( !key ) {
+        auto path = keyFile( options.macKeyPath, name );
+
+        if ( path.empty( ) || !( key = loadMacKey( path, name, options.digest ) ) ) {
+          macKeys.erase( name );
+          return nullptr;
+        }
+      }
+
+      return key;
+    }
+
+    EncKey OpenSSLProvider::createEncKey( std::string name, std::map< std::string, std::string > parameters ) {
+      auto        path      = keyFile( options.encKeyPath, name );
+      auto        algorithm = parameters.count( "cipher" ) ? parameters[ "cipher" ] : options.cipher;
+      auto        cipher    = cipherByName( algorithm );
+      KeyMaterial material;
+
+      if ( path.empty( ) ) {
+        return nullptr;
+      }
+
+      if ( cipher == nullptr ) {
+        LOG( warn, "Unable to create encryption key {}: unsupported algorithm {}", name, algorithm );
+        return nullptr;
+      }
+
+      material.bytes.resize( EVP_CIPHER_key_length( cipher ) );
+      random( material.bytes.data( ), material.bytes.size( ) );
+
+      if ( !writeKeyFile( path, algorithm, material ) ) {
+        LOG( warn, "Unable to create encryption key {} at {}", name, path );
+        return nullptr;
+      }
+
+      LOG( info, "Created {} encryption key {}", algorithm, name );
+
+      return getEncKey( name );
+    }
+
+    MacKey OpenSSLProvider::createMacKey( std::string name, std::map< std::string, std::string > parameters ) {
+      auto        path      = keyFile( options.macKeyPath, name );
+      auto        algorithm = parameters.count( "digest" ) ? parameters[ "digest" ] : options.digest;
+      auto        md        = digestByName( algorithm );
+      KeyMaterial material;
+
+      if ( path.empty( ) ) {
+        return nullptr;
+      }
+
+      if ( md == nullptr ) {
+        LOG( warn, "Unable to create HMAC key {}: unsupported digest {}", name, algorithm );
+        return nullptr;
+      }
+
+      material.bytes.resize( EVP_MD_size( md ) );
+      random( material.bytes.data( ), material.bytes.size( ) );
+
+      if ( !writeKeyFile( path, algorithm, material ) ) {
+        LOG( warn, "Unable to create HMAC key {} at {}", name, path );
+        return nullptr;
+      }
+
+      LOG( info, "Created HMAC-{} key {}", algorithm, name );
+
+      return getMacKey( name );
+    }
+
+    FpeKey OpenSSLProvider::getFpeKey( std::string name ) {
+      std::lock_guard< std::mutex > guard( lock );
+      auto &                        key = fpeKeys[ name ];
+
+      if ( !key ) {
+        auto path = keyFile( options.encKeyPath, name );
+
+        if ( path.empty( ) || !( key = loadFpeKey( path, name ) ) ) {
+          fpeKeys.erase( name );
+          return nullptr;
+        }
+      }
+
+      return key;
+    }
+
+    FpeKey OpenSSLProvider::createFpeKey( std::string name, std::map< std::string, std::string > parameters ) {
+      auto        path      = keyFile( options.encKeyPath, name );
+      auto        algorithm = parameters.count( "cipher" ) ? parameters[ "cipher" ] : std::string( "aes-256-ecb" );
+      auto        cipher    = blockCipherByName( algorithm );
+      KeyMaterial material;
+
+      if ( path.empty( ) ) {
+        return nullptr;
+      }
+
+      if ( cipher == nullptr ) {
+        LOG( warn, "Unable to create format preserving encryption key {}: unsupported algorithm {}", name, algorithm );
+        return nullptr;
+      }
+
+      material.bytes.resize( EVP_CIPHER_key_length( cipher ) );
+      random( material.bytes.data( ), material.bytes.size( ) );
+
+      if ( !writeKeyFile( path, algorithm, material ) ) {
+        LOG( warn, "Unable to create format preserving encryption key {} at {}", name, path );
+        return nullptr;
+      }
+
+      LOG( info, "Created {} format preserving encryption key {}", algorithm, name );
+
+      return getFpeKey( name );
+    }
+
+    void OpenSSLProvider::random( void *block, size_t length ) {
+      if ( ( length > INT_MAX ) || ( RAND_bytes( static_cast< uint8_t * >( block ), length ) != 1 ) ) {
+        throw exceptions::TokenCryptographyError( "Unable to generate random bytes" );
+      }
+    }
+
+    void OpenSSLProvider::cmdArgs( boost::program_options::options_description &encOptions,
+                                   boost::program_options::options_description &macOptions ) {
+      namespace po = boost::program_options;
+
+      encOptions.add_options( )                                                                        //
+        ( "enc-key-dir", po::value( &options.encKeyPath )->default_value( options.encKeyPath ), "encryption key directory" ) //
+        ( "enc-cipher", po::value( &options.cipher )->default_value( options.cipher ), "default encryption algorithm" );
+
+      macOptions.add_options( )                                                                        //
+        ( "mac-key-dir", po::value( &options.macKeyPath )->default_value( options.macKeyPath ), "HMAC key directory" ) //
+        ( "mac-digest", po::value( &options.digest )->default_value( options.digest ), "default HMAC digest" );
+    }
+
+    std::string OpenSSLProvider::acceleration( ) {
+      std::string features;
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+      unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+      if ( __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) {
+        if ( ecx & ( 1u << 25 ) ) {
+          features += "aes-ni ";
+        }
+
+        if ( ecx & ( 1u << 1 ) ) {
+          features += "pclmulqdq ";
+        }
+      }
+
+      if ( __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) ) {
+        if ( ebx & ( 1u << 5 ) ) {
+          features += "avx2 ";
+        }
+
+        if ( ebx & ( 1u << 29 ) ) {
+          features += "sha-ni ";
+        }
+      }
+#endif
+
+      if ( !features.empty( ) ) {
+        features.pop_back( );
+      }
+
+      return features;
+    }
+  } // namespace crypto
+} // namespace token
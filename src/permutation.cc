@@ -0,0 +1,69 @@
+
+#include "permutation.hh"
+#include "token/exceptions.hh"
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+namespace token {
+  namespace crypto {
+    Permutation::Permutation( bytea _key, std::uint64_t _size )
+      : key( std::move( _key ) )
+      , domain( _size )
+      , half( 1 ) {
+      if ( ( domain == 0 ) || ( domain > ( std::uint64_t( 1 ) << 62 ) ) ) {
+        throw exceptions::TokenRangeError( "Unsupported permutation domain" );
+      }
+
+      while ( ( half < 31 ) && ( ( std::uint64_t( 1 ) << ( 2 * half ) ) < domain ) ) {
+        ++half;
+      }
+    }
+
+    std::uint64_t Permutation::operator( )( std::uint64_t value ) const {
+      if ( value >= domain ) {
+        throw exceptions::TokenRangeError( "Value outside of the permutation domain" );
+      }
+
+      /* The covering domain is below 4 * size: on average fewer than 4 passes */
+      do {
+        value = feistel( value );
+      } while ( value >= domain );
+
+      return value;
+    }
+
+    std::uint64_t Permutation::feistel( std::uint64_t value ) const {
+      std::uint64_t mask  = ( std::uint64_t( 1 ) << half ) - 1;
+      std::uint64_t left  = value >> half;
+      std::uint64_t right = value & mask;
+      std::uint8_t  input[ 9 ];
+      std::uint8_t  digest[ EVP_MAX_MD_SIZE ];
+      unsigned int  length = 0;
+
+      for ( unsigned round = 0; round < ROUNDS; ++round ) {
+        std::uint64_t output = 0;
+
+        input[ 0 ] = static_cast< std::uint8_t >( round );
+
+        for ( int num = 0; num < 8; ++num ) {
+          input[ 1 + num ] = static_cast< std::uint8_t >( right >> ( 56 - 8 * num ) );
+        }
+
+        if ( HMAC( EVP_sha256( ), key.data( ), key.size( ), input, sizeof( input ), digest, &length ) == nullptr ) {
+          throw exceptions::TokenCryptographyError( "Unable to compute permutation round" );
+        }
+
+        for ( int num = 0; num < 8; ++num ) {
+          output = ( output << 8 ) | digest[ num ];
+        }
+
+        std::uint64_t next = left ^ ( output & mask );
+
+        left  = right;
+        right = next;
+      }
+
+      return ( left << half ) | right;
+    }
+  } // namespace crypto
+} // namespace token
@@ -0,0 +1,55 @@
+
+#ifndef __TOKENIZATION_PERMUTATION_HH__
+#define __TOKENIZATION_PERMUTATION_HH__
+
+#include "token/crypto/base.hh"
+#include <cstdint>
+
+namespace token {
+  namespace crypto {
+    /**
+     * Keyed pseudorandom permutation of [0, size): a balanced Feistel network over the smallest
+     * even number of bits covering the domain (HMAC-SHA-256 round function), cycle walking
+     * outputs outside the domain
+     */
+    class Permutation {
+     public:
+      /** Feistel rounds */
+      static constexpr unsigned ROUNDS = 8;
+
+      /**
+       * @brief Create a permutation
+       * @param _key permutation key (any length)
+       * @param _size domain size (up to 2^62)
+       */
+      Permutation( bytea _key, std::uint64_t _size );
+
+      /**
+       * @brief Permute a value
+       * @param value value (below the domain size)
+       * @return permuted value (below the domain size)
+       */
+      std::uint64_t operator( )( std::uint64_t value ) const;
+
+      /**
+       * @brief Domain size
+       * @return domain size
+       */
+      std::uint64_t size( ) const { return domain; }
+
+     private:
+      /**
+       * @brief One pass of the Feistel network over the covering domain
+       * @param value value (below 2^(2 * half))
+       * @return permuted value
+       */
+      std::uint64_t feistel( std::uint64_t value ) const;
+
+      bytea         key;    /**< HMAC key                   */
+      std::uint64_t domain; /**< Domain size                */
+      unsigned      half;   /**< Bits of each Feistel half  */
+    };
+  } // namespace crypto
+} // namespace token
+
+#endif //__TOKENIZATION_PERMUTATION_HH__
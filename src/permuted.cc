@@ -0,0 +1,163 @@
+
+#include "luhn.hh"
+#include "permutation.hh"
+#include "preserved.hh"
+#include "token/api.hh"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( permutedLogger->should_log( spdlog::level::lvl ) ) {                                                          \
+      permutedLogger->lvl( fmt, ##__VA_ARGS__ );                                                                       \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    /** Permuted generation logger */
+    std::shared_ptr< spdlog::logger > permutedLogger = token::api::create_logger( "token::api::permuted", { } );
+
+    namespace {
+      /** Largest number of free digits (the domain must fit the permutation) */
+      static const size_t MAX_FREE = 18;
+
+      /** Keyspace usage reported with a warning (fraction of the space) */
+      static const double WARN_USAGE = 0.9;
+
+      /**
+       * Token space of a value: the tokens sharing its preserved prefix, suffix and length
+       */
+      struct Space {
+        const Preserved *digits;  /**< Preserved digits                                     */
+        std::string      scope;   /**< Counter scope (prefix, suffix and length)            */
+        size_t           free;    /**< Free digits                                          */
+        uint64_t         classes; /**< Luhn residues allowed (1: residue 0, 9: non-zero)    */
+        uint64_t         size;    /**< Tokens in the space                                  */
+      };
+
+      /**
+       * @brief Get the token space of a value
+       * @param vault vault information
+       * @param value value (or token)
+       * @return token space
+       */
+      Space space( const core::VaultInfo &vault, const std::string &value ) {
+        Space rc;
+
+        if ( ( !vault.permuted( ) ) || ( ( rc.digits = preserved( vault.tokenFormat( ) ) ) == nullptr ) ) {
+          throw exceptions::InvalidTokenFormat( vault.alias, vault.format );
+        }
+
+        if ( ( rc.digits->front + rc.digits->back ) >= value.size( ) ) {
+          throw exceptions::TokenRangeError( "Preserved lengths exceed the length of the value to tokenize" );
+        }
+
+        if ( !std::all_of( value.begin( ), value.end( ), []( char ch ) { return ::isdigit( ch ) != 0; } ) ) {
+          throw exceptions::TokenRangeError( "Card number formats only support digits" );
+        }
+
+        rc.free = value.size( ) - rc.digits->front - rc.digits->back;
+
+        if ( rc.free > MAX_FREE ) {
+          throw exceptions::TokenRangeError( "Too many free digits for a permuted vault" );
+        }
+
+        rc.scope   = fmt::format( "{}:{}:{}",
+                                value.substr( 0, rc.digits->front ),
+                                value.substr( value.size( ) - rc.digits->back ),
+                                value.size( ) );
+        rc.classes = rc.digits->passLuhn ? 1 : 9;
+        rc.size    = rc.classes;
+
+        /* The last free digit is fixed by the Luhn residue */
+        for ( size_t num = 1; num < rc.free; ++num ) {
+          rc.size *= 10;
+        }
+
+        return rc;
+      }
+
+      /**
+       * @brief Build the token of a permuted counter value
+       * @param space token space
+       * @param value value (preserved digits)
+       * @param index permuted counter value (below the space size)
+       * @return token
+       */
+      std::string build( const Space &space, const std::string &value, uint64_t index ) {
+        std::string token  = value;
+        auto        last   = space.digits->front + space.free - 1;
+        auto        target = static_cast< uint16_t >( space.classes == 1 ? 0 : index % space.classes + 1 );
+
+        index /= space.classes;
+
+        for ( size_t num = last; num-- > space.digits->front; ) {
+          token[ num ] = static_cast< char >( '0' + index % 10 );
+          index /= 10;
+        }
+
+        token[ last ] = '0';
+
+        bool     doubled = ( ( token.size( ) - 1 - last ) % 2 ) == 1;
+        uint16_t weight  = ( target + 10 - luhn::residue( token.begin( ), token.end( ) ) ) % 10;
+
+        for ( uint16_t digit = 0; digit < 10; ++digit ) {
+          if ( luhn::weight( digit, doubled ) == weight ) {
+            token[ last ] = static_cast< char >( '0' + digit );
+            break;
+          }
+        }
+
+        return token;
+      }
+    } // namespace
+
+    std::string TokenManager::permute( core::SharedVault vault, const std::string &value, std::string *mask ) {
+      auto tokens = space( *vault, value );
+      auto label  = "tokengov-permutation:" + vault->alias + ":" + tokens.scope;
+      auto key    = vault->macKey->hash( label );
+
+      crypto::Permutation permutation( key, tokens.size );
+
+      for ( ;; ) {
+        auto counter = storage->reserve( vault->table, tokens.scope, 1 );
+
+        if ( counter >= tokens.size ) {
+          LOG( critical, "Keyspace exhausted for vault {} ({} tokens)", vault->alias, tokens.size );
+
+          throw exceptions::TokenRangeError( "Keyspace exhausted for vault " + vault->alias );
+        }
+
+        if ( counter + 1 == static_cast< uint64_t >( static_cast< double >( tokens.size ) * WARN_USAGE ) ) {
+          LOG( warn, "Vault {} keyspace usage reached {} of {}", vault->alias, counter + 1, tokens.size );
+        }
+
+        auto token = build( tokens, value, permutation( counter ) );
+
+        /* The value itself is never its token: the counter value is skipped */
+        if ( token != value ) {
+          if ( mask != nullptr ) {
+            *mask = value;
+            mask->replace( tokens.digits->front, tokens.free, tokens.free, '*' );
+          }
+
+          return token;
+        }
+      }
+    }
+
+    TokenManager::Keyspace TokenManager::keyspace( const std::string &vault, const std::string &value ) {
+      auto     vaultInfo = getVaultInfo( vault );
+      auto     tokens    = space( *vaultInfo, value );
+      Keyspace rc;
+
+      rc.size = tokens.size;
+      rc.used = std::min( storage->counter( vaultInfo->table, tokens.scope ), tokens.size );
+
+      LOG( debug, "Vault {} keyspace usage: {} of {}", vaultInfo->alias, rc.used, rc.size );
+
+      return rc;
+    }
+  } // namespace api
+} // namespace token
@@ -0,0 +1,842 @@
+
+#include "token/api.hh"
+#include "token/api/core/pg_pipeline.hh"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <libpq-fe.h>
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( pipelineLogger->should_log( spdlog::level::lvl ) ) {                                                          \
+      pipelineLogger->lvl( fmt, ##__VA_ARGS__ );                                                                       \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    namespace core {
+      /** Pipeline logger */
+      std::shared_ptr< spdlog::logger > pipelineLogger = token::api::create_logger( "token::api::pgpipeline", { } );
+
+      /** Seconds from the Unix epoch to the PostgreSQL epoch (2000-01-01), for binary timestamps */
+      static constexpr int64_t PG_EPOCH = 946684800;
+
+      /** Statement parameters bound per request, at most (see insert) */
+      static constexpr size_t MAX_PARAMS = 8;
+
+      /**
+       * Pipelined statement; owned by the calling thread's stack.  The parameters are sent in
+       * binary format, and the results requested in binary format.
+       */
+      struct PgPipelineDB::Request {
+        std::string                 sql;                /**< Statement                      */
+        std::vector< const char * > values;             /**< Parameter values               */
+        std::vector< int >          lengths;            /**< Parameter lengths              */
+        std::vector< int >          formats;            /**< Parameter formats (all binary) */
+        char                        integers[ 2 ][ 8 ]; /**< Encoded integer parameters     */
+        size_t                      used   = 0;         /**< Integer parameters encoded     */
+        PGresult *                  result = nullptr;   /**< Statement result               */
+        std::string                 error;              /**< Failure message                */
+        std::string                 state;              /**< Failure SQLSTATE               */
+        std::string                 constraint;         /**< Violated constraint            */
+        bool                        done = false;       /**< Completed by the event loop    */
+        std::mutex                  lock;               /**< Completion lock                */
+        std::condition_variable     ready;              /**< Signalled on completion        */
+
+        Request( ) {
+          values.reserve( MAX_PARAMS );
+          lengths.reserve( MAX_PARAMS );
+          formats.reserve( MAX_PARAMS );
+        }
+
+        ~Request( ) { PQclear( result ); }
+
+        /**
+         * @brief Bind a parameter; the data must outlive the request
+         * @param data parameter bytes
+         * @param length number of bytes
+         */
+        void bind( const void *data, size_t length ) {
+          /* A null pointer is an SQL NULL: empty values point at an empty string */
+          values.push_back( length ? static_cast< const char * >( data ) : "" );
+          lengths.push_back( static_cast< int >( length ) );
+          formats.push_back( 1 );
+        }
+
+        void bind( const std::string &value ) { bind( value.data( ), value.size( ) ); }
+
+        void bind( const bytea &value ) { bind( value.data( ), value.size( ) ); }
+
+        /**
+         * @brief Bind an int8 (or timestamp) parameter
+         * @param value value
+         */
+        void bind( int64_t value ) {
+          auto bytes = integers[ used++ ];
+          auto bits  = static_cast< uint64_t >( value );
+
+          for ( int num = 7; num >= 0; --num, bits >>= 8 ) {
+            bytes[ num ] = static_cast< char >( bits & 0xff );
+          }
+
+          bind( bytes, 8 );
+        }
+      };
+
+      /**
+       * Pipelined connection; owned by the event loop thread
+       */
+      struct PgPipelineDB::Session {
+        PGconn *                              connection = nullptr; /**< libpq connection     */
+        int                                   socket     = -1;      /**< Watched socket       */
+        uint32_t                              events     = 0;       /**< Watched events       */
+        bool                                  ready      = false;   /**< In pipeline mode     */
+        std::deque< Request * >               inflight;             /**< Statements in flight */
+        std::chrono::steady_clock::time_point retry;                /**< Reconnection time    */
+      };
+
+      /**
+       * @brief Convert a dbcpp PostgreSQL uri to a libpq connection uri
+       * @param uri uri
+       * @return connection uri
+       * @throws TokenSQLError if the uri is not a PostgreSQL one
+       */
+      static std::string connectionUri( const std::string &uri ) {
+        if ( Schema::dialect( uri ) != Schema::POSTGRESQL ) {
+          throw exceptions::TokenSQLError( "Pipelined storage requires a PostgreSQL uri" );
+        }
+
+        return "postgresql" + uri.substr( uri.find( "://" ) );
+      }
+
+      PgPipelineDB::PgPipelineDB( std::string uri, size_t cxnCount, Options options )
+        : TokenDB( uri, cxnCount )
+        , options( options )
+        , conninfo( connectionUri( uri ) ) {
+        epoll_event event{ };
+
+        if ( ( pollFd = ::epoll_create1( EPOLL_CLOEXEC ) ) < 0 ) {
+          throw exceptions::TokenSQLError( std::string( "epoll_create1: " ) + ::strerror( errno ) );
+        }
+
+        if ( ( wakeFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) < 0 ) {
+          ::close( pollFd );
+          throw exceptions::TokenSQLError( std::string( "eventfd: " ) + ::strerror( errno ) );
+        }
+
+        /* The queue's event carries no session */
+        event.events   = EPOLLIN;
+        event.data.ptr = nullptr;
+        ::epoll_ctl( pollFd, EPOLL_CTL_ADD, wakeFd, &event );
+
+        for ( size_t num = 0; num < std::max< size_t >( options.connections, 1 ); ++num ) {
+          sessions.emplace_back( new Session );
+        }
+
+        loop = std::thread( &PgPipelineDB::run, this );
+      }
+
+      PgPipelineDB::~PgPipelineDB( ) {
+        uint64_t one = 1;
+
+        {
+          std::lock_guard< std::mutex > guard( lock );
+          stopping = true;
+        }
+
+        ( void ) !::write( wakeFd, &one, sizeof( one ) );
+
+        loop.join( );
+
+        ::close( wakeFd );
+        ::close( pollFd );
+      }
+
+      void PgPipelineDB::execute( Request &request ) {
+        bool     wake;
+        uint64_t one = 1;
+
+        {
+          std::lock_guard< std::mutex > guard( lock );
+
+          if ( stopping ) {
+            throw exceptions::TokenSQLStateError( "Pipelined storage stopping", "", "" );
+          }
+
+          /* The loop drains the queue (or waits on the sessions to make room): wake it on the first */
+          wake = queue.empty( );
+          queue.push_back( &request );
+        }
+
+        if ( wake ) {
+          ( void ) !::write( wakeFd, &one, sizeof( one ) );
+        }
+
+        std::unique_lock< std::mutex > guard( request.lock );
+
+        request.ready.wait( guard, [ &request ]( ) { return request.done; } );
+
+        if ( !request.error.empty( ) ) {
+          throw exceptions::TokenSQLStateError( request.error, request.state, request.constraint );
+        }
+      }
+
+      void PgPipelineDB::complete( Request &request ) {
+        std::lock_guard< std::mutex > guard( request.lock );
+
+        /* Notified under the lock: the caller owns the request, and may release it once done */
+        request.done = true;
+        request.ready.notify_all( );
+      }
+
+      void PgPipelineDB::run( ) {
+        std::vector< epoll_event > events( sessions.size( ) + 1 );
+
+        for ( auto &session : sessions ) {
+          connect( *session );
+        }
+
+        while ( true ) {
+          auto    now     = std::chrono::steady_clock::now( );
+          int64_t timeout = -1;
+          bool    idle    = true;
+
+          dispatch( );
+
+          for ( auto &session : sessions ) {
+            idle = ( idle ) && ( session->inflight.empty( ) );
+
+            if ( session->connection == nullptr ) {
+              auto wait = std::chrono::duration_cast< std::chrono::milliseconds >( session->retry - now ).count( );
+
+              /* Wake for the earliest reconnection */
+              wait    = std::max< int64_t >( wait, 0 );
+              timeout = ( timeout < 0 ) ? wait : std::min( timeout, wait );
+            }
+          }
+
+          {
+            std::lock_guard< std::mutex > guard( lock );
+
+            if ( ( stopping ) && ( idle ) && ( queue.empty( ) ) ) {
+              break;
+            }
+          }
+
+          int count =
+            ::epoll_wait( pollFd, events.data( ), static_cast< int >( events.size( ) ), static_cast< int >( timeout ) );
+
+          if ( ( count < 0 ) && ( errno != EINTR ) ) {
+            LOG( warn, "epoll_wait: {}", ::strerror( errno ) );
+          }
+
+          for ( int num = 0; num < count; ++num ) {
+            if ( events[ num ].data.ptr == nullptr ) {
+              uint64_t value;
+
+              ( void ) !::read( wakeFd, &value, sizeof( value ) );
+            } else {
+              service( *static_cast< Session * >( events[ num ].data.ptr ), events[ num ].events );
+            }
+          }
+
+          now = std::chrono::steady_clock::now( );
+
+          for ( auto &session : sessions ) {
+            if ( ( session->connection == nullptr ) && ( session->retry <= now ) ) {
+              connect( *session );
+            }
+          }
+        }
+
+        for ( auto &session : sessions ) {
+          if ( session->connection != nullptr ) {
+            drop( *session, "Pipelined storage stopped" );
+          }
+        }
+      }
+
+      void PgPipelineDB::connect( Session &session ) {
+        {
+          std::lock_guard< std::mutex > guard( lock );
+
+          if ( stopping ) {
+            return;
+          }
+        }
+
+        LOG( debug, "Opening pipelined connection" );
+
+        session.connection = ::PQconnectStart( conninfo.c_str( ) );
+
+        if ( ( session.connection == nullptr ) || ( ::PQstatus( session.connection ) == CONNECTION_BAD ) ) {
+          drop( session, session.connection ? ::PQerrorMessage( session.connection ) : "out of memory" );
+          return;
+        }
+
+        /* Connecting starts with the write of the startup packet */
+        watch( session, EPOLLOUT );
+      }
+
+      void PgPipelineDB::watch( Session &session, uint32_t events ) {
+        epoll_event event{ };
+        int         socket = ::PQsocket( session.connection );
+
+        event.events   = events;
+        event.data.ptr = &session;
+
+        /* The socket may change while connecting (e.g. trying the next host) */
+        if ( socket != session.socket ) {
+          if ( session.socket >= 0 ) {
+            ::epoll_ctl( pollFd, EPOLL_CTL_DEL, session.socket, nullptr );
+          }
+
+          session.socket = socket;
+          session.events = events;
+
+          if ( ::epoll_ctl( pollFd, EPOLL_CTL_ADD, socket, &event ) < 0 ) {
+            drop( session, std::string( "epoll_ctl: " ) + ::strerror( errno ) );
+          }
+        } else if ( events != session.events ) {
+          session.events = events;
+          ::epoll_ctl( pollFd, EPOLL_CTL_MOD, socket, &event );
+        }
+      }
+
+      void PgPipelineDB::service( Session &session, uint32_t events ) {
+        if ( session.connection == nullptr ) {
+          return;
+        }
+
+        if ( !session.ready ) {
+          switch ( ::PQconnectPoll( session.connection ) ) {
+            case PGRES_POLLING_READING:
+              watch( session, EPOLLIN );
+              break;
+
+            case PGRES_POLLING_WRITING:
+              watch( session, EPOLLOUT );
+              break;
+
+            case PGRES_POLLING_OK:
+              if ( ( ::PQsetnonblocking( session.connection, 1 ) != 0 ) ||
+                   ( ::PQenterPipelineMode( session.connection ) != 1 ) ) {
+                drop( session, ::PQerrorMessage( session.connection ) );
+                break;
+              }
+
+              LOG( debug, "Pipelined connection ready" );
+
+              session.ready = true;
+              watch( session, EPOLLIN );
+              break;
+
+            default:
+              drop( session, ::PQerrorMessage( session.connection ) );
+              break;
+          }
+
+          return;
+        }
+
+        if ( events & EPOLLOUT ) {
+          flush( session );
+        }
+
+        if ( ( session.connection != nullptr ) && ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) ) {
+          receive( session );
+        }
+      }
+
+      void PgPipelineDB::flush( Session &session ) {
+        switch ( ::PQflush( session.connection ) ) {
+          case 0:
+            watch( session, EPOLLIN );
+            break;
+
+          case 1:
+            /* The socket is full: the rest is sent once it is writable */
+            watch( session, EPOLLIN | EPOLLOUT );
+            break;
+
+          default:
+            drop( session, ::PQerrorMessage( session.connection ) );
+            break;
+        }
+      }
+
+      void PgPipelineDB::receive( Session &session ) {
+        auto connection = session.connection;
+        bool ended      = false;
+
+        if ( !::PQconsumeInput( connection ) ) {
+          drop( session, ::PQerrorMessage( connection ) );
+          return;
+        }
+
+        while ( ( !session.inflight.empty( ) ) && ( !::PQisBusy( connection ) ) ) {
+          auto  result  = ::PQgetResult( connection );
+          auto &request = *session.inflight.front( );
+
+          /* A null result ends the results of a statement, its sync point follows */
+          if ( result == nullptr ) {
+            if ( ended ) {
+              break;
+            }
+
+            ended = true;
+            continue;
+          }
+
+          ended = false;
+
+          switch ( ::PQresultStatus( result ) ) {
+            case PGRES_PIPELINE_SYNC:
+              ::PQclear( result );
+              session.inflight.pop_front( );
+              complete( request );
+              break;
+
+            case PGRES_TUPLES_OK:
+            case PGRES_COMMAND_OK:
+              if ( ( request.result == nullptr ) && ( request.error.empty( ) ) ) {
+                request.result = result;
+              } else {
+                ::PQclear( result );
+              }
+              break;
+
+            default: {
+              auto state      = ::PQresultErrorField( result, PG_DIAG_SQLSTATE );
+              auto constraint = ::PQresultErrorField( result, PG_DIAG_CONSTRAINT_NAME );
+
+              request.error      = ::PQresultErrorMessage( result );
+              request.state      = state ? state : "";
+              request.constraint = constraint ? constraint : "";
+
+              if ( request.error.empty( ) ) {
+                request.error = ::PQresStatus( ::PQresultStatus( result ) );
+              }
+
+              ::PQclear( result );
+              break;
+            }
+          }
+        }
+
+        if ( ::PQstatus( connection ) == CONNECTION_BAD ) {
+          drop( session, ::PQerrorMessage( connection ) );
+        }
+      }
+
+      void PgPipelineDB::dispatch( ) {
+        std::vector< Session * > touched;
+
+        while ( true ) {
+          Session *target = nullptr;
+          Request *request;
+          bool     available = false;
+
+          /* Least loaded session with room in its pipeline */
+          for ( auto &session : sessions ) {
+            available = ( available ) || ( session->connection != nullptr );
+
+            if ( ( session->ready ) && ( session->inflight.size( ) < std::max< size_t >( options.depth, 1 ) ) &&
+                 ( ( target == nullptr ) || ( session->inflight.size( ) < target->inflight.size( ) ) ) ) {
+              target = session.get( );
+            }
+          }
+
+          {
+            std::lock_guard< std::mutex > guard( lock );
+
+            if ( queue.empty( ) ) {
+              break;
+            }
+
+            /* No session up nor connecting: fail the calls rather than hold them until a retry */
+            if ( !available ) {
+              for ( auto queued : queue ) {
+                queued->error = "Pipelined storage connection unavailable: " + lastError;
+                complete( *queued );
+              }
+
+              queue.clear( );
+              break;
+            }
+
+            if ( target == nullptr ) {
+              break;
+            }
+
+            request = queue.front( );
+            queue.pop_front( );
+          }
+
+          if ( ::PQsendQueryParams( target->connection,
+                                    request->sql.c_str( ),
+                                    static_cast< int >( request->values.size( ) ),
+                                    nullptr,
+                                    request->values.data( ),
+                                    request->lengths.data( ),
+                                    request->formats.data( ),
+                                    1 ) != 1 ) {
+            request->error = ::PQerrorMessage( target->connection );
+            complete( *request );
+
+            if ( ::PQstatus( target->connection ) == CONNECTION_BAD ) {
+              drop( *target, request->error );
+            }
+
+            continue;
+          }
+
+          target->inflight.push_back( request );
+
+          if ( ::PQpipelineSync( target->connection ) != 1 ) {
+            drop( *target, ::PQerrorMessage( target->connection ) );
+            continue;
+          }
+
+          if ( std::find( touched.begin( ), touched.end( ), target ) == touched.end( ) ) {
+            touched.push_back( target );
+          }
+        }
+
+        for ( auto session : touched ) {
+          if ( session->connection != nullptr ) {
+            flush( *session );
+          }
+        }
+      }
+
+      void PgPipelineDB::drop( Session &session, const std::string &message ) {
+        auto error = message;
+
+        error.erase( error.find_last_not_of( " \n" ) + 1 );
+
+        LOG( warn, "Pipelined connection failed: {}", error );
+
+        if ( session.socket >= 0 ) {
+          ::epoll_ctl( pollFd, EPOLL_CTL_DEL, session.socket, nullptr );
+        }
+
+        if ( session.connection != nullptr ) {
+          ::PQfinish( session.connection );
+        }
+
+        for ( auto request : session.inflight ) {
+          request->error = "Pipelined connection lost: " + error;
+          complete( *request );
+        }
+
+        session.inflight.clear( );
+        session.connection = nullptr;
+        session.socket     = -1;
+        session.events     = 0;
+        session.ready      = false;
+        session.retry      = std::chrono::steady_clock::now( ) + options.retry;
+
+        std::lock_guard< std::mutex > guard( lock );
+        lastError = error;
+      }
+
+      /**
+       * @brief Decode a binary int8
+       * @param data value bytes (big endian)
+       * @return value
+       */
+      static int64_t int8( const char *data ) {
+        uint64_t value = 0;
+
+        for ( int num = 0; num < 8; ++num ) {
+          value = ( value << 8 ) | static_cast< uint8_t >( data[ num ] );
+        }
+
+        return static_cast< int64_t >( value );
+      }
+
+      /**
+       * @brief Load a token entry from a binary result row (see TokenEntry::load)
+       * @param result result
+       * @param row row number
+       * @param entry [out] token entry (the raw value is kept)
+       * @param table table layout
+       * @param columns select list of the result
+       */
+      static void load( const PGresult *           result,
+                        int                        row,
+                        TokenEntry &               entry,
+                        const TokenDB::Layout &    table,
+                        const TokenEntry::Columns &columns ) {
+        using Columns = TokenEntry::Columns;
+
+        auto data = [ & ]( Columns::Column column ) {
+          return ::PQgetvalue( result, row, static_cast< int >( columns[ column ] ) );
+        };
+        auto size = [ & ]( Columns::Column column ) {
+          return static_cast< size_t >( ::PQgetlength( result, row, static_cast< int >( columns[ column ] ) ) );
+        };
+        auto null = [ & ]( Columns::Column column ) {
+          return ::PQgetisnull( result, row, static_cast< int >( columns[ column ] ) ) != 0;
+        };
+        auto bytes = [ & ]( Columns::Column column ) {
+          auto begin = reinterpret_cast< const uint8_t * >( data( column ) );
+          return bytea( begin, begin + size( column ) );
+        };
+
+        entry.encKey.clear( );
+        entry.token.clear( );
+        entry.hmac.clear( );
+        entry.crypt.clear( );
+        entry.mask.clear( );
+        entry.expiration = dbcpp::DBTime( );
+        entry.properties.clear( );
+
+        if ( ( columns.has( Columns::ENCKEY ) ) && ( !null( Columns::ENCKEY ) ) ) {
+          entry.encKey.assign( data( Columns::ENCKEY ), size( Columns::ENCKEY ) );
+        }
+
+        if ( ( columns.has( Columns::TOKEN ) ) && ( !null( Columns::TOKEN ) ) ) {
+          if ( table.numeric ) {
+            entry.token = TokenEntry::unpack( static_cast< uint64_t >( int8( data( Columns::TOKEN ) ) ) );
+          } else {
+            entry.token.assign( data( Columns::TOKEN ), size( Columns::TOKEN ) );
+          }
+        }
+
+        if ( columns.has( Columns::HMAC ) ) {
+          entry.hmac = bytes( Columns::HMAC );
+        }
+
+        if ( columns.has( Columns::CRYPT ) ) {
+          entry.crypt = bytes( Columns::CRYPT );
+        }
+
+        if ( ( columns.has( Columns::MASK ) ) && ( !null( Columns::MASK ) ) ) {
+          entry.mask.assign( data( Columns::MASK ), size( Columns::MASK ) );
+        }
+
+        if ( ( columns.has( Columns::EXPIRATION ) ) && ( !null( Columns::EXPIRATION ) ) ) {
+          auto micros = int8( data( Columns::EXPIRATION ) );
+
+          entry.expiration = dbcpp::DBTime( std::chrono::seconds( micros / 1000000 + PG_EPOCH ) );
+        }
+
+        if ( columns.has( Columns::PROPERTIES ) ) {
+          entry.properties.assign( bytes( Columns::PROPERTIES ), table.names );
+        }
+      }
+
+      /**
+       * @brief Get the lookup key (hkey column) of an hmac
+       * @param hmac hmac
+       * @param prefix prefix length
+       * @return hmac prefix
+       */
+      static bytea lookupKey( const bytea &hmac, size_t prefix ) {
+        return bytea( hmac.begin( ), hmac.begin( ) + std::min( prefix, hmac.size( ) ) );
+      }
+
+      bool PgPipelineDB::get( const std::string &        tableName,
+                              const std::string &        token,
+                              TokenEntry &               entry,
+                              const TokenEntry::Columns &columns ) {
+        Request request;
+        auto    table = layout( tableName );
+
+        LOG( debug, "Getting entry for token {} from table {}", token, tableName );
+
+        /* A numeric table holds 1 to 18 digit tokens only */
+        auto packed = table.numeric ? TokenEntry::pack( token ) : 0;
+
+        if ( ( table.numeric ) && ( packed == 0 ) ) {
+          LOG( debug, "No record found for {} from {}: not a numeric token", token, tableName );
+          entry.clear( );
+          return false;
+        }
+
+        request.sql.assign( "SELECT " ).append( columns.list( ) ).append( " FROM " ).append( tableName );
+        request.sql.append( " WHERE token = $1" );
+
+        if ( table.numeric ) {
+          request.bind( static_cast< int64_t >( packed ) );
+        } else {
+          request.bind( token );
+        }
+
+        execute( request );
+
+        if ( ::PQntuples( request.result ) > 0 ) {
+          LOG( debug, "Successfully retrieved record for {} from {}", token, tableName );
+          load( request.result, 0, entry, table, columns );
+          resolve( tableName, table, entry.properties );
+          return true;
+        }
+
+        LOG( debug, "No record found for {} from {}", token, tableName );
+        entry.clear( );
+
+        return false;
+      }
+
+      std::vector< TokenEntry > PgPipelineDB::get( const std::string &        tableName,
+                                                   const bytea &              hmac,
+                                                   const TokenEntry::Columns &columns ) {
+        Request                   request;
+        std::vector< TokenEntry > entries;
+        auto                      table = layout( tableName );
+        auto                      key   = lookupKey( hmac, table.prefix );
+
+        LOG( debug, "Performing hash lookup in table {}", tableName );
+
+        /* The index narrows the rows to the prefix, the full hmac is compared on those */
+        request.sql = "SELECT " + columns.list( ) + " FROM " + tableName +
+                      ( table.prefix ? " WHERE hkey = $1 AND hmac = $2" : " WHERE hmac = $1" );
+
+        if ( table.prefix ) {
+          request.bind( key );
+        }
+
+        request.bind( hmac );
+
+        execute( request );
+
+        entries.resize( static_cast< size_t >( ::PQntuples( request.result ) ) );
+
+        for ( size_t row = 0; row < entries.size( ); ++row ) {
+          load( request.result, static_cast< int >( row ), entries[ row ], table, columns );
+          resolve( tableName, table, entries[ row ].properties );
+        }
+
+        LOG( debug,
+             "Successfully retrieved {} record{} from {}",
+             entries.size( ),
+             entries.size( ) > 1 ? "s" : "",
+             tableName );
+
+        return entries;
+      }
+
+      void PgPipelineDB::insert( const std::string &tableName, const TokenEntry &entry ) {
+        bool grouped;
+
+        {
+          std::lock_guard< std::mutex > guard( groupLock );
+          grouped = groupOptions.enabled;
+        }
+
+        /* Group commit batches are transactions of their own, on the pool */
+        if ( grouped ) {
+          TokenDB::insert( tableName, entry );
+          return;
+        }
+
+        Request request;
+        size_t  param = 0;
+        auto    table = layout( tableName );
+        auto    key   = lookupKey( entry.hmac, table.prefix );
+        auto    props = entry.properties.encode( table.names );
+        auto    since = std::chrono::duration_cast< std::chrono::seconds >( entry.expiration.time_since_epoch( ) );
+        auto    names = std::string( );
+        auto    next  = [ &param ]( ) { return "$" + std::to_string( ++param ); };
+
+        LOG( debug, "Inserting record for token {} into table {}", entry.token, tableName );
+
+        request.sql.assign( "INSERT INTO " ).append( tableName ).append( "( " );
+
+        if ( entry.encKey.length( ) > 0 ) {
+          request.sql.append( "ENCKEY, " );
+          names.append( next( ) ).append( ", " );
+          request.bind( entry.encKey );
+        }
+
+        if ( table.prefix ) {
+          request.sql.append( "HKEY, " );
+          names.append( next( ) ).append( ", " );
+          request.bind( key );
+        }
+
+        request.sql.append( "TOKEN, HMAC, CRYPT, MASK, EXPIRATION, PROPERTIES ) VALUES ( " ).append( names );
+
+        for ( int num = 0; num < 6; ++num ) {
+          request.sql.append( next( ) ).append( num < 5 ? ", " : " )" );
+        }
+
+        if ( table.numeric ) {
+          auto packed = TokenEntry::pack( entry.token );
+
+          if ( packed == 0 ) {
+            throw exceptions::TokenRangeError( "Token '" + entry.token + "' is not a numeric token of 1 to 18 digits" );
+          }
+
+          request.bind( static_cast< int64_t >( packed ) );
+        } else {
+          request.bind( entry.token );
+        }
+
+        request.bind( entry.hmac );
+        request.bind( entry.crypt );
+        request.bind( entry.mask );
+        request.bind( ( since.count( ) - PG_EPOCH ) * 1000000 );
+        request.bind( props );
+
+        execute( request );
+
+        if ( ::strcmp( ::PQcmdTuples( request.result ), "1" ) != 0 ) {
+          LOG( debug, "Failed to insert {} record into {}", entry.token, tableName );
+          throw exceptions::TokenSQLError( "Unable to insert token into " + tableName );
+        }
+
+        LOG( debug, "Successfully inserted {} record into {}", entry.token, tableName );
+      }
+
+      /**
+       * @brief Check the suffix of a name
+       * @param name name
+       * @param suffix suffix
+       * @return true if the name ends with the suffix
+       */
+      static bool endsWith( const std::string &name, const char *suffix ) {
+        auto length = ::strlen( suffix );
+
+        return ( name.size( ) >= length ) && ( name.compare( name.size( ) - length, length, suffix ) == 0 );
+      }
+
+      Result PgPipelineDB::classify( const std::string &tableName, const std::exception &error ) noexcept {
+        auto failure = dynamic_cast< const exceptions::TokenSQLStateError * >( &error );
+
+        if ( failure == nullptr ) {
+          return TokenDB::classify( tableName, error );
+        }
+
+        auto &state = failure->state( );
+        auto &name  = failure->constraintName( );
+
+        /* unique_violation: the constraint names of the vault schema (see Schema::vault) */
+        if ( state == "23505" ) {
+          if ( ( endsWith( name, "_hmac_key" ) ) || ( endsWith( name, "_hkey_key" ) ) ) {
+            return Result::DUPLICATE_HMAC;
+          }
+
+          if ( ( endsWith( name, "_pkey" ) ) || ( endsWith( name, "_tok_key" ) ) ) {
+            return Result::DUPLICATE_TOKEN;
+          }
+
+          LOG( debug, "Unique violation on {} not identified: {}", tableName, error.what( ) );
+
+          return Result::DUPLICATE;
+        }
+
+        /* Failures without a state are connection failures (see drop) */
+        return ( ( state.empty( ) ) || ( transient( state ) ) ) ? Result::TRANSIENT : Result::FAILED;
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
@@ -0,0 +1,42 @@
+
+#ifndef __TOKENIZATION_PRESERVED_HH__
+#define __TOKENIZATION_PRESERVED_HH__
+
+#include "token/api/manager.hh"
+#include <map>
+
+namespace token {
+  namespace api {
+    /**
+     * Preserved digits of a card number format
+     */
+    struct Preserved {
+      size_t front;    /**< Leading digits preserved  */
+      size_t back;     /**< Trailing digits preserved */
+      bool   passLuhn; /**< Token passes a Luhn check */
+    };
+
+    /**
+     * @brief Get the preserved digits of a card number format
+     * @param format token format (without the vault mode)
+     * @return preserved digits, or nullptr if not a card number format
+     */
+    inline const Preserved *preserved( size_t format ) {
+      static const std::map< size_t, Preserved > formats = {
+        { TokenManager::L4_FORMAT, { 0, 4, true } },
+        { TokenManager::F6_FORMAT, { 6, 0, true } },
+        { TokenManager::F2L4_FORMAT, { 2, 4, true } },
+        { TokenManager::F6L4_FORMAT, { 6, 4, true } },
+        { TokenManager::L4_NOLUHN_FORMAT, { 0, 4, false } },
+        { TokenManager::F6_NOLUHN_FORMAT, { 6, 0, false } },
+        { TokenManager::F2L4_NOLUHN_FORMAT, { 2, 4, false } },
+        { TokenManager::F6L4_NOLUHN_FORMAT, { 6, 4, false } },
+      };
+      auto iter = formats.find( format );
+
+      return iter != formats.end( ) ? &iter->second : nullptr;
+    }
+  } // namespace api
+} // namespace token
+
+#endif //__TOKENIZATION_PRESERVED_HH__
@@ -0,0 +1,321 @@
+
+#include "token/api/properties.hh"
+#include "token/exceptions.hh"
+#include <cstdint>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+namespace token {
+  namespace api {
+    constexpr size_t PropertyDictionary::npos;
+
+    namespace {
+      /**
+       * Leading byte of the binary encoding; CBOR rows start with 0x81 (an array of one map)
+       *
+       * Layout: version, property count, then per property the name (varint of the name length
+       * shifted left by one followed by the text, or of the dictionary index shifted left by one
+       * with the low bit set) and the value (varint length followed by the text)
+       */
+      const uint8_t VERSION = 0x01;
+
+      /**
+       * @brief Append a varint (7 bits per byte, low bits first)
+       * @param bytes output buffer
+       * @param number number
+       */
+      void putVarint( bytea &bytes, uint64_t number ) {
+        while ( number >= 0x80 ) {
+          bytes.push_back( static_cast< uint8_t >( number | 0x80 ) );
+          number >>= 7;
+        }
+
+        bytes.push_back( static_cast< uint8_t >( number ) );
+      }
+
+      /**
+       * Sequential reader of the binary encoding
+       */
+      struct Reader {
+        const uint8_t *                                    pos;   /**< Read position     */
+        const uint8_t *                                    end;   /**< End of the buffer */
+        const std::shared_ptr< const PropertyDictionary > &names; /**< Name dictionary   */
+
+        Reader( const bytea &bytes, const std::shared_ptr< const PropertyDictionary > &_names )
+          : pos( bytes.data( ) + 1 )
+          , end( bytes.data( ) + bytes.size( ) )
+          , names( _names ) {}
+
+        uint64_t varint( ) {
+          uint64_t rc = 0;
+
+          for ( unsigned shift = 0; shift < 64; shift += 7 ) {
+            if ( pos == end ) {
+              break;
+            }
+
+            auto byte = *pos++;
+            rc |= static_cast< uint64_t >( byte & 0x7f ) << shift;
+
+            if ( ( byte & 0x80 ) == 0 ) {
+              return rc;
+            }
+          }
+
+          throw exceptions::TokenSQLError( "Malformed token properties" );
+        }
+
+        /**
+         * @brief Read a text
+         * @param length text length
+         * @return view of the text
+         */
+        boost::string_view text( uint64_t length ) {
+          if ( length > static_cast< uint64_t >( end - pos ) ) {
+            throw exceptions::TokenSQLError( "Malformed token properties" );
+          }
+
+          auto rc = boost::string_view( reinterpret_cast< const char * >( pos ), length );
+
+          pos += length;
+          return rc;
+        }
+
+        /**
+         * @brief Read a property name
+         * @return view of the name (into the buffer, or the dictionary)
+         */
+        boost::string_view name( ) {
+          auto key = varint( );
+
+          if ( ( key & 1 ) == 0 ) {
+            return text( key >> 1 );
+          }
+
+          auto rc = names ? names->name( key >> 1 ) : nullptr;
+
+          if ( rc == nullptr ) {
+            throw exceptions::TokenSQLError( "Token property name not in the vault property dictionary" );
+          }
+
+          return *rc;
+        }
+
+        /**
+         * @brief Read a property value
+         * @return view of the value
+         */
+        boost::string_view value( ) { return text( varint( ) ); }
+      };
+    } // namespace
+
+    PropertyDictionary::PropertyDictionary( std::vector< std::string > _names )
+      : names( std::move( _names ) ) {
+      for ( size_t num = 0; num < names.size( ); ++num ) {
+        indexes.emplace( names[ num ], num );
+      }
+    }
+
+    /**
+     * @brief Get the lock decoding the stored form of properties: striped by address, rather
+     * than held by each entry
+     * @param properties properties
+     * @return decoding lock
+     */
+    static std::mutex &decoding( const Properties *properties ) {
+      static std::mutex locks[ 64 ];
+
+      return locks[ ( reinterpret_cast< uintptr_t >( properties ) / sizeof( Properties ) ) % 64 ];
+    }
+
+    Properties::Properties( const Properties &other ) {
+      std::lock_guard< std::mutex > guard( decoding( &other ) );
+
+      values = other.values;
+      stored = other.stored;
+      names  = other.names;
+      pending.store( other.pending.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    }
+
+    Properties::Properties( Properties &&other ) noexcept
+      : values( std::move( other.values ) )
+      , stored( std::move( other.stored ) )
+      , names( std::move( other.names ) )
+      , pending( other.pending.load( std::memory_order_relaxed ) ) {
+      other.pending.store( false, std::memory_order_relaxed );
+    }
+
+    Properties &Properties::operator=( const Properties &other ) {
+      if ( this != &other ) {
+        *this = Properties( other );
+      }
+
+      return *this;
+    }
+
+    Properties &Properties::operator=( Properties &&other ) noexcept {
+      values = std::move( other.values );
+      stored = std::move( other.stored );
+      names  = std::move( other.names );
+      pending.store( other.pending.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+      other.pending.store( false, std::memory_order_relaxed );
+
+      return *this;
+    }
+
+    void Properties::assign( bytea bytes, std::shared_ptr< const PropertyDictionary > dictionary ) {
+      values.clear( );
+      stored = std::move( bytes );
+      names  = std::move( dictionary );
+      pending.store( !stored.empty( ), std::memory_order_relaxed );
+    }
+
+    bytea Properties::encode( const std::shared_ptr< const PropertyDictionary > &dictionary ) const {
+      bytea rc;
+
+      if ( ( !stored.empty( ) ) && ( stored.front( ) == VERSION ) && ( names == dictionary ) ) {
+        return stored;
+      }
+
+      auto &map = this->map( );
+
+      rc.reserve( 2 + map.size( ) * 16 );
+      rc.push_back( VERSION );
+      putVarint( rc, map.size( ) );
+
+      for ( auto &entry : map ) {
+        auto index = dictionary ? dictionary->index( entry.first ) : PropertyDictionary::npos;
+
+        if ( index != PropertyDictionary::npos ) {
+          putVarint( rc, ( static_cast< uint64_t >( index ) << 1 ) | 1 );
+        } else {
+          putVarint( rc, static_cast< uint64_t >( entry.first.size( ) ) << 1 );
+          rc.insert( rc.end( ), entry.first.begin( ), entry.first.end( ) );
+        }
+
+        putVarint( rc, entry.second.size( ) );
+        rc.insert( rc.end( ), entry.second.begin( ), entry.second.end( ) );
+      }
+
+      return rc;
+    }
+
+    const Properties::map_type &Properties::map( ) const {
+      if ( !pending.load( std::memory_order_acquire ) ) {
+        return values;
+      }
+
+      std::lock_guard< std::mutex > guard( decoding( this ) );
+
+      if ( !pending.load( std::memory_order_relaxed ) ) {
+        return values;
+      }
+
+      if ( stored.front( ) != VERSION ) {
+        auto json = nlohmann::json::from_cbor( stored );
+
+        for ( auto &entry : json[ 0 ].items( ) ) {
+          values[ entry.key( ) ] = entry.value( ).get< std::string >( );
+        }
+      } else {
+        Reader reader( stored, names );
+
+        for ( auto count = reader.varint( ); count > 0; --count ) {
+          auto name  = reader.name( );
+          auto value = reader.value( );
+
+          values[ name.to_string( ) ].assign( value.data( ), value.size( ) );
+        }
+      }
+
+      pending.store( false, std::memory_order_release );
+      return values;
+    }
+
+    void Properties::each( const bytea &                                                  bytes,
+                           const std::shared_ptr< const PropertyDictionary > &            dictionary,
+                           const std::function< void( boost::string_view, boost::string_view ) > &visit ) {
+      if ( bytes.empty( ) ) {
+        return;
+      }
+
+      if ( bytes.front( ) != VERSION ) {
+        Properties properties;
+
+        properties.assign( bytes );
+
+        for ( auto &entry : properties.map( ) ) {
+          visit( entry.first, entry.second );
+        }
+
+        return;
+      }
+
+      Reader reader( bytes, dictionary );
+
+      for ( auto count = reader.varint( ); count > 0; --count ) {
+        auto name = reader.name( );
+
+        visit( name, reader.value( ) );
+      }
+    }
+
+    bool Properties::resolves( const bytea &bytes, const std::shared_ptr< const PropertyDictionary > &dictionary ) {
+      if ( ( bytes.empty( ) ) || ( bytes.front( ) != VERSION ) ) {
+        return true;
+      }
+
+      Reader reader( bytes, dictionary );
+
+      for ( auto count = reader.varint( ); count > 0; --count ) {
+        auto key = reader.varint( );
+
+        if ( ( key & 1 ) == 0 ) {
+          reader.text( key >> 1 );
+        } else if ( ( !dictionary ) || ( dictionary->name( key >> 1 ) == nullptr ) ) {
+          return false;
+        }
+
+        reader.value( );
+      }
+
+      return true;
+    }
+
+    bool Properties::get( const std::string &name, std::string &value ) const {
+      if ( ( !pending ) || ( stored.front( ) != VERSION ) ) {
+        auto &map  = this->map( );
+        auto  iter = map.find( name );
+
+        if ( iter == map.end( ) ) {
+          return false;
+        }
+
+        value = iter->second;
+        return true;
+      }
+
+      Reader reader( stored, names );
+
+      for ( auto count = reader.varint( ); count > 0; --count ) {
+        auto found = reader.name( ) == name;
+        auto text  = reader.value( );
+
+        if ( found ) {
+          value.assign( text.data( ), text.size( ) );
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool Properties::empty( ) const {
+      if ( ( pending ) && ( stored.front( ) == VERSION ) ) {
+        return ( stored.size( ) < 2 ) || ( stored[ 1 ] == 0 );
+      }
+
+      return map( ).empty( );
+    }
+  } // namespace api
+} // namespace token
@@ -0,0 +1,264 @@
+
+#include "token/api.hh"
+#include "token/api/core/schema.hh"
+#include <ctime>
+#include <spdlog/spdlog.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( schemaLogger->should_log( spdlog::level::lvl ) ) {                                                            \
+      schemaLogger->lvl( fmt, ##__VA_ARGS__ );                                                                         \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    namespace core {
+      /** Schema logger */
+      std::shared_ptr< spdlog::logger > schemaLogger = token::api::create_logger( "token::api::schema", { } );
+
+      namespace {
+        /**
+         * @brief Join strings
+         * @param parts strings
+         * @param separator separator
+         * @return joined string
+         */
+        std::string join( const std::vector< std::string > &parts, const char *separator ) {
+          std::string rc;
+
+          for ( auto &part : parts ) {
+            if ( !rc.empty( ) ) {
+              rc += separator;
+            }
+
+            rc += part;
+          }
+
+          return rc;
+        }
+
+        /**
+         * @brief Get the storage parameters of a PostgreSQL table (or partition)
+         * @param options table options
+         * @return WITH clause, empty for the server defaults
+         */
+        std::string storage( const Schema::Options &options ) {
+          std::vector< std::string > parameters;
+
+          if ( options.fillfactor > 0 ) {
+            parameters.push_back( fmt::format( "fillfactor = {}", options.fillfactor ) );
+          }
+
+          if ( options.vacuumScale > 0 ) {
+            parameters.push_back( fmt::format( "autovacuum_vacuum_scale_factor = {}", options.vacuumScale ) );
+          }
+
+          if ( options.analyzeScale > 0 ) {
+            parameters.push_back( fmt::format( "autovacuum_analyze_scale_factor = {}", options.analyzeScale ) );
+          }
+
+          if ( options.insertScale > 0 ) {
+            parameters.push_back( fmt::format( "autovacuum_vacuum_insert_scale_factor = {}", options.insertScale ) );
+          }
+
+          return parameters.empty( ) ? std::string( ) : " WITH ( " + join( parameters, ", " ) + " )";
+        }
+      } // namespace
+
+      Schema::Dialect Schema::dialect( const std::string &uri ) {
+        auto scheme = uri.substr( 0, uri.find( "://" ) );
+
+        if ( ( scheme == "sqlite" ) || ( scheme == "sqlite3" ) ) {
+          return SQLITE;
+        }
+
+        if ( ( scheme == "psql" ) || ( scheme == "pgsql" ) || ( scheme == "postgres" ) || ( scheme == "postgresql" ) ) {
+          return POSTGRESQL;
+        }
+
+        throw exceptions::TokenSQLError( "No vault schema for database scheme '" + scheme + "'" );
+      }
+
+      std::vector< std::string > Schema::vaults( Dialect dialect ) {
+        return { fmt::format( "CREATE TABLE IF NOT EXISTS vaults ( "
+                              "  format    INTEGER,"
+                              "  alias     VARCHAR( 255 ),"
+                              "  tablename VARCHAR( 255 ),"
+                              "  enckey    VARCHAR( 255 ),"
+                              "  mackey    VARCHAR( 255 ),"
+                              "  durable   {},"
+                              "  CONSTRAINT vaults_alias_key PRIMARY KEY ( alias ),"
+                              "  CONSTRAINT vaults_name_key UNIQUE ( tablename ) )",
+                              dialect == POSTGRESQL ? "BOOLEAN" : "INTEGER" ) };
+      }
+
+      std::vector< std::string > Schema::vault( Dialect dialect, const VaultInfo &vault, const Options &options ) {
+        std::vector< std::string > rc;
+        std::vector< std::string > columns;
+        auto                       postgres = dialect == POSTGRESQL;
+        auto                       binary   = postgres ? "BYTEA" : "BLOB";
+        auto                       table    = vault.table;
+        auto                       lookup   = vault.hmacPrefix( ) ? "hkey" : "hmac";
+        auto                       integer  = postgres ? "BIGINT" : "INTEGER";
+
+        /* Unique constraints the tokenization relies on (see the class description) */
+        bool needToken   = ( !vault.permuted( ) ) && ( !vault.vaultless( ) );
+        bool needHmac    = vault.durable;
+        bool uniqueToken = !vault.vaultless( );
+        bool uniqueHmac  = vault.durable;
+        bool keyToken    = true;
+        bool keyHmac     = true;
+
+        if ( vault.vaultless( ) ) {
+          /* The token of a vaultless vault is a bijection of the value: either constraint will do,
+             but the metadata rows rely on one of them (an insert falls back to an update) */
+          uniqueToken = options.partitioning != HMAC_HASH;
+          uniqueHmac  = !uniqueToken;
+          needToken   = uniqueToken;
+          needHmac    = uniqueHmac;
+        }
+
+        /* A unique short prefix would reject distinct values sharing it */
+        if ( ( uniqueHmac ) && ( vault.hmacPrefix( ) ) && ( vault.hmacPrefix( ) < 16 ) ) {
+          throw exceptions::TokenRangeError( "Vault " + vault.alias + " needs an hmac prefix of 16 bytes or more" );
+        }
+
+        if ( options.partitioning != UNPARTITIONED ) {
+          if ( !postgres ) {
+            throw exceptions::TokenRangeError( "Vault partitioning requires PostgreSQL" );
+          }
+
+          keyToken = options.partitioning == TOKEN_HASH;
+          keyHmac  = options.partitioning == HMAC_HASH;
+
+          if ( ( ( needToken ) && ( !keyToken ) ) || ( ( needHmac ) && ( !keyHmac ) ) ) {
+            throw exceptions::TokenRangeError( "Partitioning of vault " + vault.alias +
+                                               " would drop a unique constraint its tokenization relies on" );
+          }
+
+          /* The permuted tokens are unique by construction: their constraint is kept when it can be */
+          uniqueToken = ( uniqueToken ) && ( keyToken );
+
+          if ( options.partitions == 0 ) {
+            throw exceptions::TokenRangeError( "Partitioned vaults need at least one partition" );
+          }
+        }
+
+        columns = {
+          vault.numeric( ) ? fmt::format( "token {} NOT NULL", integer )
+                           : fmt::format( "token VARCHAR( {} ) NOT NULL", vault.length ),
+          fmt::format( "hmac {}", binary ),
+          fmt::format( "crypt {}", binary ),
+          fmt::format( "mask VARCHAR( {} )", vault.length ),
+          "expiration TIMESTAMP",
+          fmt::format( "properties {}", binary ),
+          "enckey VARCHAR( 255 )",
+        };
+
+        if ( vault.hmacPrefix( ) ) {
+          columns.push_back( fmt::format( "hkey {}", binary ) );
+        }
+
+        /* Searches sort on the creation time by default, range partitions split on it */
+        columns.push_back( "creation_date TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP" );
+
+        if ( uniqueToken ) {
+          columns.push_back( vault.durable ? fmt::format( "CONSTRAINT {}_pkey PRIMARY KEY ( token )", table )
+                                           : fmt::format( "CONSTRAINT {}_tran_tok_key UNIQUE ( token )", table ) );
+        }
+
+        if ( uniqueHmac ) {
+          columns.push_back( fmt::format( "CONSTRAINT {0}_{1}_key UNIQUE ( {1} )", table, lookup ) );
+        }
+
+        auto create = fmt::format( "CREATE TABLE {} ( {} )", table, join( columns, ", " ) );
+
+        switch ( options.partitioning ) {
+          case UNPARTITIONED:
+            rc.push_back( create + ( postgres ? storage( options ) : std::string( ) ) );
+            break;
+
+          case TOKEN_HASH:
+          case HMAC_HASH:
+            rc.push_back( create + fmt::format( " PARTITION BY HASH ( {} )", keyToken ? "token" : lookup ) );
+
+            for ( size_t num = 0; num < options.partitions; ++num ) {
+              rc.push_back( fmt::format( "CREATE TABLE {0}_p{1} PARTITION OF {0} "
+                                         "FOR VALUES WITH ( MODULUS {2}, REMAINDER {1} ){3}",
+                                         table,
+                                         num,
+                                         options.partitions,
+                                         storage( options ) ) );
+            }
+            break;
+
+          case CREATED_RANGE: {
+            auto now   = std::time( nullptr );
+            auto start = *std::gmtime( &now );
+            int  year  = start.tm_year + 1900;
+            int  month = start.tm_mon;
+
+            rc.push_back( create + " PARTITION BY RANGE ( creation_date )" );
+
+            for ( size_t num = 0; num < options.partitions; ++num, ++month ) {
+              int from = year + month / 12;
+              int to   = year + ( month + 1 ) / 12;
+
+              rc.push_back( fmt::format( "CREATE TABLE {0}_{1:04}{2:02} PARTITION OF {0} "
+                                         "FOR VALUES FROM ( '{1:04}-{2:02}-01' ) TO ( '{3:04}-{4:02}-01' ){5}",
+                                         table,
+                                         from,
+                                         month % 12 + 1,
+                                         to,
+                                         ( month + 1 ) % 12 + 1,
+                                         storage( options ) ) );
+            }
+
+            rc.push_back( fmt::format( "CREATE TABLE {0}_default PARTITION OF {0} DEFAULT{1}", table, storage( options ) ) );
+            break;
+          }
+        }
+
+        if ( ( postgres ) && ( ( options.tokenHash ) || ( !uniqueToken ) ) ) {
+          rc.push_back( fmt::format( "CREATE INDEX {0}_token_hash ON {0} USING HASH ( token )", table ) );
+        } else if ( !uniqueToken ) {
+          rc.push_back( fmt::format( "CREATE INDEX {0}_token_idx ON {0} ( token )", table ) );
+        }
+
+        if ( ( options.hmacIndex ) && ( !uniqueHmac ) ) {
+          rc.push_back( fmt::format( "CREATE INDEX {0}_{1}_idx ON {0} ( {1} )", table, lookup ) );
+        }
+
+        if ( options.expirationIndex ) {
+          rc.push_back( fmt::format( "CREATE INDEX {0}_expiration_idx ON {0} ( expiration )", table ) );
+        }
+
+        if ( vault.permuted( ) ) {
+          rc.push_back( fmt::format( "CREATE TABLE {0}_counters ( "
+                                     "  scope   VARCHAR( 255 ) NOT NULL,"
+                                     "  counter {1} NOT NULL,"
+                                     "  CONSTRAINT {0}_counters_pkey PRIMARY KEY ( scope ) )",
+                                     table,
+                                     integer ) );
+        }
+
+        for ( auto &sql : properties( table ) ) {
+          rc.push_back( sql );
+        }
+
+        LOG( debug, "Generated {} schema statements for vault {}", rc.size( ), vault.alias );
+
+        return rc;
+      }
+
+      std::vector< std::string > Schema::properties( const std::string &table ) {
+        return { fmt::format( "CREATE TABLE IF NOT EXISTS {0}_properties ( "
+                              "  position INTEGER NOT NULL,"
+                              "  name     VARCHAR( 255 ) NOT NULL,"
+                              "  CONSTRAINT {0}_properties_pkey PRIMARY KEY ( position ) )",
+                              table ) };
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
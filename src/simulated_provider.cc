@@ -0,0 +1,210 @@
+
+#include "token/crypto/simulated.hh"
+#include <algorithm>
+#include <thread>
+
+namespace token {
+  namespace crypto {
+    namespace {
+      using Device = SimulatedProvider::Device;
+
+      /**
+       * A round trip: holds a session for the simulated latency, then for the wrapped call
+       */
+      class RoundTrip {
+       public:
+        explicit RoundTrip( Device &_device )
+          : device( _device ) {
+          device.acquire( );
+          device.roundTrips++;
+          std::this_thread::sleep_for( device.options.latency );
+        }
+
+        ~RoundTrip( ) { device.release( ); }
+
+       private:
+        Device &device; /**< Simulated device */
+      };
+
+      /**
+       * Encryption key simulating a round trip per call
+       */
+      class SimulatedEncKey : public interface::EncKey {
+       public:
+        SimulatedEncKey( crypto::EncKey _key, std::shared_ptr< Device > _device )
+          : key( std::move( _key ) )
+          , device( std::move( _device ) ) {}
+
+        size_t encrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          RoundTrip trip( *device );
+          return key->encrypt( data, length, out, outLength );
+        }
+
+        size_t decrypt( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          RoundTrip trip( *device );
+          return key->decrypt( data, length, out, outLength );
+        }
+
+        bytea encrypt( const bytea data ) const override {
+          RoundTrip trip( *device );
+          return key->encrypt( data );
+        }
+
+        bytea decrypt( const bytea data ) const override {
+          RoundTrip trip( *device );
+          return key->decrypt( data );
+        }
+
+        void encryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          RoundTrip trip( *device );
+          key->encryptBatch( inputs, outputs );
+        }
+
+        void decryptBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          RoundTrip trip( *device );
+          key->decryptBatch( inputs, outputs );
+        }
+
+        size_t encryptedLength( size_t length ) const override { return key->encryptedLength( length ); }
+
+        size_t decryptedLength( size_t length ) const override { return key->decryptedLength( length ); }
+
+        explicit operator std::string( ) override { return std::string( *key ); }
+
+        bool isVersioned( ) const override { return key->isVersioned( ); }
+
+       private:
+        crypto::EncKey            key;    /**< Wrapped key      */
+        std::shared_ptr< Device > device; /**< Simulated device */
+      };
+
+      /**
+       * Hash key simulating a round trip per call
+       */
+      class SimulatedMacKey : public interface::MacKey {
+       public:
+        SimulatedMacKey( crypto::MacKey _key, std::shared_ptr< Device > _device )
+          : key( std::move( _key ) )
+          , device( std::move( _device ) ) {}
+
+        size_t hash( const uint8_t *data, size_t length, uint8_t *out, size_t outLength ) const override {
+          RoundTrip trip( *device );
+          return key->hash( data, length, out, outLength );
+        }
+
+        bytea hash( const bytea &data ) const override {
+          RoundTrip trip( *device );
+          return key->hash( data );
+        }
+
+        void hashBatch( const std::vector< bytes_view > &inputs, std::vector< bytea > &outputs ) const override {
+          RoundTrip trip( *device );
+          key->hashBatch( inputs, outputs );
+        }
+
+        size_t hashLength( ) const override { return key->hashLength( ); }
+
+        explicit operator std::string( ) override { return std::string( *key ); }
+
+       private:
+        crypto::MacKey            key;    /**< Wrapped key      */
+        std::shared_ptr< Device > device; /**< Simulated device */
+      };
+
+      /**
+       * Format preserving encryption key simulating a round trip per call
+       */
+      class SimulatedFpeKey : public interface::FpeKey {
+       public:
+        SimulatedFpeKey( crypto::FpeKey _key, std::shared_ptr< Device > _device )
+          : key( std::move( _key ) )
+          , device( std::move( _device ) ) {}
+
+        void encryptBlocks( const uint8_t *data, uint8_t *out, size_t blocks ) const override {
+          RoundTrip trip( *device );
+          key->encryptBlocks( data, out, blocks );
+        }
+
+        explicit operator std::string( ) override { return std::string( *key ); }
+
+       private:
+        crypto::FpeKey            key;    /**< Wrapped key      */
+        std::shared_ptr< Device > device; /**< Simulated device */
+      };
+    } // namespace
+
+    void SimulatedProvider::Device::acquire( ) {
+      std::unique_lock< std::mutex > guard( lock );
+
+      available.wait( guard, [ & ]( ) { return options.sessions == 0 || busy < options.sessions; } );
+      busy++;
+    }
+
+    void SimulatedProvider::Device::release( ) {
+      {
+        std::lock_guard< std::mutex > guard( lock );
+        busy--;
+      }
+
+      available.notify_one( );
+    }
+
+    SimulatedProvider::SimulatedProvider( std::shared_ptr< Provider > _provider, Options options )
+      : provider( std::move( _provider ) )
+      , device( std::make_shared< Device >( ) ) {
+      device->options = options;
+    }
+
+    EncKey SimulatedProvider::getEncKey( std::string name ) {
+      RoundTrip trip( *device );
+      auto      key = provider->getEncKey( name );
+
+      return key ? std::make_shared< SimulatedEncKey >( key, device ) : nullptr;
+    }
+
+    MacKey SimulatedProvider::getMacKey( std::string name ) {
+      RoundTrip trip( *device );
+      auto      key = provider->getMacKey( name );
+
+      return key ? std::make_shared< SimulatedMacKey >( key, device ) : nullptr;
+    }
+
+    EncKey SimulatedProvider::createEncKey( std::string name, std::map< std::string, std::string > parameters ) {
+      RoundTrip trip( *device );
+      auto      key = provider->createEncKey( name, parameters );
+
+      return key ? std::make_shared< SimulatedEncKey >( key, device ) : nullptr;
+    }
+
+    MacKey SimulatedProvider::createMacKey( std::string name, std::map< std::string, std::string > parameters ) {
+      RoundTrip trip( *device );
+      auto      key = provider->createMacKey( name, parameters );
+
+      return key ? std::make_shared< SimulatedMacKey >( key, device ) : nullptr;
+    }
+
+    FpeKey SimulatedProvider::getFpeKey( std::string name ) {
+      RoundTrip trip( *device );
+      auto      key = provider->getFpeKey( name );
+
+      return key ? std::make_shared< SimulatedFpeKey >( key, device ) : nullptr;
+    }
+
+    FpeKey SimulatedProvider::createFpeKey( std::string name, std::map< std::string, std::string > parameters ) {
+      RoundTrip trip( *device );
+      auto      key = provider->createFpeKey( name, parameters );
+
+      return key ? std::make_shared< SimulatedFpeKey >( key, device ) : nullptr;
+    }
+
+    void SimulatedProvider::random( void *block, size_t length ) {
+      RoundTrip trip( *device );
+      provider->random( block, length );
+    }
+
+    void SimulatedProvider::cmdArgs( boost::program_options::options_description &encOptions,
+                                     boost::program_options::options_description &macOptions ) {
+      provider->cmdArgs( encOptions, macOptions );
+    }
+  } // namespace crypto
+} // namespace token
@@ -0,0 +1,80 @@
+
+#include "token/api/core/string_pool.hh"
+#include <algorithm>
+#include <cstring>
+#include <openssl/crypto.h>
+
+namespace token {
+  namespace api {
+    namespace core {
+      StringPool::StringPool( StringPool &&other ) noexcept
+        : chunks( std::move( other.chunks ) )
+        , current( other.current )
+        , chunkSize( other.chunkSize ) {
+        other.chunks.clear( );
+        other.current = 0;
+      }
+
+      StringPool &StringPool::operator=( StringPool &&other ) noexcept {
+        if ( this != &other ) {
+          clear( );
+
+          chunks    = std::move( other.chunks );
+          current   = other.current;
+          chunkSize = other.chunkSize;
+
+          other.chunks.clear( );
+          other.current = 0;
+        }
+
+        return *this;
+      }
+
+      boost::string_view StringPool::store( const void *data, size_t size ) {
+        if ( size == 0 ) {
+          return boost::string_view( );
+        }
+
+        /* Move on to the next chunk with room, allocating one when none is left */
+        while ( ( current < chunks.size( ) ) && ( chunks[ current ].size - chunks[ current ].used < size ) ) {
+          ++current;
+        }
+
+        if ( current == chunks.size( ) ) {
+          Chunk chunk;
+
+          chunk.size = std::max( size, chunkSize );
+          chunk.data.reset( new char[ chunk.size ] );
+          chunks.push_back( std::move( chunk ) );
+        }
+
+        auto &chunk = chunks[ current ];
+        auto  rc    = chunk.data.get( ) + chunk.used;
+
+        std::memcpy( rc, data, size );
+        chunk.used += size;
+
+        return boost::string_view( rc, size );
+      }
+
+      void StringPool::clear( ) {
+        for ( auto &chunk : chunks ) {
+          OPENSSL_cleanse( chunk.data.get( ), chunk.used );
+          chunk.used = 0;
+        }
+
+        current = 0;
+      }
+
+      size_t StringPool::used( ) const {
+        size_t rc = 0;
+
+        for ( auto &chunk : chunks ) {
+          rc += chunk.used;
+        }
+
+        return rc;
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
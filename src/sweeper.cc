@@ -0,0 +1,164 @@
+
+#include "token/api.hh"
+#include <spdlog/spdlog.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( sweepLogger->should_log( spdlog::level::lvl ) ) {                                                             \
+      sweepLogger->lvl( fmt, ##__VA_ARGS__ );                                                                          \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    /** Sweeper logger */
+    std::shared_ptr< spdlog::logger > sweepLogger = token::api::create_logger( "token::api::sweeper", { } );
+
+    void ExpirationSweeper::schedule( const std::string &vault, Schedule schedule ) {
+      std::lock_guard< std::mutex > guard( lock );
+      auto &                        entry = vaults[ vault ];
+
+      LOG( info, "Scheduling expiration sweep of {} every {}s", vault, schedule.interval.count( ) );
+
+      entry.schedule = schedule;
+      entry.next     = Clock::now( );
+
+      wakeup.notify_all( );
+    }
+
+    void ExpirationSweeper::unschedule( const std::string &vault ) {
+      std::lock_guard< std::mutex > guard( lock );
+
+      LOG( info, "Removing expiration sweep schedule of {}", vault );
+
+      vaults.erase( vault );
+      wakeup.notify_all( );
+    }
+
+    size_t ExpirationSweeper::purged( const std::string &vault ) {
+      std::lock_guard< std::mutex > guard( lock );
+      auto                          iter = vaults.find( vault );
+
+      return ( iter != vaults.end( ) ) ? iter->second.purged : 0;
+    }
+
+    size_t ExpirationSweeper::sweep( const std::string &vault, const Schedule &schedule ) {
+      auto   table     = storage->getVault( vault )->table;
+      auto   batchSize = std::max( schedule.batchSize, static_cast< size_t >( 1 ) );
+      size_t rc        = 0;
+
+      LOG( debug, "Sweeping expired entries from vault {}", vault );
+
+      while ( true ) {
+        auto started = Clock::now( );
+        auto now     = dbcpp::DBTime(
+          std::chrono::duration_cast< std::chrono::seconds >( std::chrono::system_clock::now( ).time_since_epoch( ) ) );
+        auto count = storage->purgeExpired( table, now, batchSize );
+
+        rc += count;
+        total += count;
+
+        if ( count < batchSize ) {
+          break;
+        }
+
+        if ( schedule.rate > 0 ) {
+          std::unique_lock< std::mutex > guard( lock );
+          auto budget = std::chrono::microseconds( count * 1000000 / schedule.rate );
+
+          if ( !waitUntil( guard, started + budget ) ) {
+            LOG( info, "Expiration sweep of vault {} interrupted", vault );
+            break;
+          }
+        }
+      }
+
+      LOG( info, "Purged {} expired entries from vault {}", rc, vault );
+
+      return rc;
+    }
+
+    void ExpirationSweeper::start( ) {
+      std::lock_guard< std::mutex > guard( lock );
+
+      if ( !running ) {
+        LOG( info, "Starting expiration sweeper" );
+
+        running  = true;
+        stopping = false;
+        thread   = std::thread( &ExpirationSweeper::run, this );
+      }
+    }
+
+    void ExpirationSweeper::stop( ) {
+      {
+        std::lock_guard< std::mutex > guard( lock );
+
+        if ( !running ) {
+          return;
+        }
+
+        LOG( info, "Stopping expiration sweeper" );
+
+        stopping = true;
+        wakeup.notify_all( );
+      }
+
+      thread.join( );
+
+      std::lock_guard< std::mutex > guard( lock );
+      running = false;
+    }
+
+    bool ExpirationSweeper::waitUntil( std::unique_lock< std::mutex > &guard, Clock::time_point until ) {
+      wakeup.wait_until( guard, until, [ this ]( ) { return stopping; } );
+      return !stopping;
+    }
+
+    void ExpirationSweeper::run( ) {
+      std::unique_lock< std::mutex > guard( lock );
+
+      while ( !stopping ) {
+        auto due = vaults.end( );
+
+        for ( auto iter = vaults.begin( ); iter != vaults.end( ); ++iter ) {
+          if ( ( due == vaults.end( ) ) || ( iter->second.next < due->second.next ) ) {
+            due = iter;
+          }
+        }
+
+        if ( due == vaults.end( ) ) {
+          wakeup.wait( guard );
+          continue;
+        }
+
+        if ( due->second.next > Clock::now( ) ) {
+          wakeup.wait_until( guard, due->second.next );
+          continue;
+        }
+
+        auto   vault    = due->first;
+        auto   schedule = due->second.schedule;
+        size_t count    = 0;
+
+        due->second.next = Clock::now( ) + schedule.interval;
+
+        guard.unlock( );
+
+        try {
+          count = sweep( vault, schedule );
+        } catch ( std::exception &ex ) {
+          LOG( warn, "Expiration sweep of vault {} failed: {}", vault, ex.what( ) );
+        }
+
+        guard.lock( );
+
+        auto iter = vaults.find( vault );
+
+        if ( iter != vaults.end( ) ) {
+          iter->second.purged += count;
+        }
+      }
+    }
+  } // namespace api
+} // namespace token
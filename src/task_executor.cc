@@ -0,0 +1,50 @@
+
+#include "token/api/core/task_executor.hh"
+#include <algorithm>
+
+namespace token {
+  namespace api {
+    namespace core {
+      /** Executor the current thread is a worker of */
+      static thread_local const TaskExecutor *working = nullptr;
+
+      TaskExecutor::TaskExecutor( Options options )
+        : tasks( options.maxQueue ) {
+        for ( size_t num = 0; num < std::max< size_t >( options.workers, 1 ); ++num ) {
+          workers.emplace_back( &TaskExecutor::run, this );
+        }
+      }
+
+      TaskExecutor::~TaskExecutor( ) {
+        tasks.close( );
+
+        for ( auto &worker : workers ) {
+          worker.join( );
+        }
+      }
+
+      bool TaskExecutor::submit( task_f task ) {
+        if ( working != this ) {
+          return tasks.push( std::move( task ) );
+        }
+
+        if ( !tasks.tryPush( task ) ) {
+          task( );
+        }
+
+        return true;
+      }
+
+      void TaskExecutor::run( ) {
+        task_f task;
+
+        working = this;
+
+        while ( tasks.pop( task ) ) {
+          task( );
+          task = nullptr;
+        }
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
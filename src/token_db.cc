@@ -1,5 +1,10 @@
 
 #include "token/api.hh"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <sstream>
 
 #define LOG( lvl, fmt, ... )                                                                       \
@@ -15,40 +20,283 @@ namespace token {
       static constexpr auto NO_TIME  = dbcpp::DBTime( std::chrono::seconds( 0 ) );
       static auto           HASH_LIT = std::string{ "hash" };
 
+      /** Select list of the token entry reads (rows are read by ordinal) */
+      static const TokenEntry::Columns &COLUMNS = TokenEntry::Columns::all( );
+
       /** Datasource logger */
       std::shared_ptr< spdlog::logger > dblogger =
         token::api::create_logger( "token::api::tokendb", { } );
 
+      void TokenDB::createVaults( ) {
+        auto statements = Schema::vaults( Schema::dialect( dbUri ) );
+        auto connection = dbPool.getConnection( );
+
+        LOG( debug, "Creating vaults table" );
+
+        try {
+          for ( auto &sql : statements ) {
+            ( connection << sql ).execute( );
+          }
+
+          connection.commit( );
+        } catch ( ... ) {
+          connection.rollback( );
+          throw;
+        }
+      }
+
+      bool TokenDB::createVault( const VaultInfo &vault ) {
+        Schema::Options options;
+
+        {
+          std::lock_guard< std::mutex > guard( vaultLock );
+          options = schemaOptions;
+        }
+
+        auto statements = Schema::vault( Schema::dialect( dbUri ), vault, options );
+        auto connection = dbPool.getConnection( );
+
+        LOG( info, "Creating vault {} (table {})", vault.alias, vault.table );
+
+        try {
+          for ( auto &sql : statements ) {
+            LOG( trace, "{}", sql );
+            ( connection << sql ).execute( );
+          }
+
+          auto statement =
+            connection
+            << "INSERT INTO vaults ( format, alias, tablename, enckey, mackey, durable ) VALUES ( ?, ?, ?, ?, ?, ? )";
+
+          statement << vault.format << vault.alias << vault.table << vault.encKeyName << vault.macKeyName
+                    << vault.durable;
+
+          if ( statement.executeUpdate( ) != 1 ) {
+            LOG( warn, "Failed to register vault {}", vault.alias );
+            connection.rollback( );
+            return false;
+          }
+
+          connection.commit( );
+        } catch ( ... ) {
+          connection.rollback( );
+          throw;
+        }
+
+        std::lock_guard< std::mutex > guard( vaultLock );
+        layouts[ vault.table ] = Layout( vault );
+        dictionaries.emplace( vault.table, nullptr ); /* No property names until propertyNames */
+
+        return true;
+      }
+
+      void TokenDB::propertyNames( const std::string &vault, std::vector< std::string > names ) {
+        auto table      = getVault( vault )->table;
+        auto statements = Schema::properties( table );
+        auto connection = dbPool.getConnection( );
+
+        LOG( debug, "Setting {} property names of table {}", names.size( ), table );
+
+        try {
+          for ( auto &sql : statements ) {
+            ( connection << sql ).execute( );
+          }
+
+          auto select = connection << fmt::format( "SELECT name FROM {}_properties ORDER BY position", table );
+          auto rs     = select.executeQuery( );
+          auto stored = size_t( 0 );
+
+          /* Rows only decode with the names they were written with: the stored ones are kept */
+          while ( rs.next( ) ) {
+            if ( ( stored >= names.size( ) ) || ( names[ stored ] != rs.get< std::string >( 0 ) ) ) {
+              throw exceptions::TokenRangeError( "Property names of vault " + vault +
+                                                 " can only be appended to the names stored" );
+            }
+
+            ++stored;
+          }
+
+          for ( auto num = stored; num < names.size( ); ++num ) {
+            auto insert = connection
+                          << fmt::format( "INSERT INTO {}_properties ( position, name ) VALUES ( ?, ? )", table )
+                          << num << names[ num ];
+
+            insert.executeUpdate( );
+          }
+
+          connection.commit( );
+        } catch ( ... ) {
+          connection.rollback( );
+          throw;
+        }
+
+        auto dictionary = std::make_shared< const PropertyDictionary >( std::move( names ) );
+
+        std::lock_guard< std::mutex > guard( vaultLock );
+        dictionaries[ table ] = std::move( dictionary );
+      }
+
+      std::shared_ptr< const PropertyDictionary > TokenDB::readPropertyNames( const std::string &tableName ) {
+        std::vector< std::string > names;
+        auto                       connection = dbPool.getConnection( );
+
+        try {
+          auto statement = connection << fmt::format( "SELECT name FROM {}_properties ORDER BY position", tableName );
+          auto rs        = statement.executeQuery( );
+
+          while ( rs.next( ) ) {
+            names.push_back( rs.get< std::string >( 0 ) );
+          }
+        } catch ( dbcpp::DBException &ex ) {
+          /* Vaults created by earlier releases have no property names table until names are set */
+          LOG( debug, "No property names for table {}: {}", tableName, ex.what( ) );
+          connection.rollback( );
+          return nullptr;
+        }
+
+        if ( names.empty( ) ) {
+          return nullptr;
+        }
+
+        LOG( debug, "Loaded {} property names of table {}", names.size( ), tableName );
+
+        return std::make_shared< const PropertyDictionary >( std::move( names ) );
+      }
+
+      std::shared_ptr< const PropertyDictionary > TokenDB::reloadPropertyNames( const std::string &tableName ) {
+        auto dictionary = readPropertyNames( tableName );
+
+        std::lock_guard< std::mutex > guard( vaultLock );
+        auto &                        current = dictionaries[ tableName ];
+
+        /* Names are only appended: a concurrent reload may already hold more of them */
+        if ( ( dictionary ) && ( ( !current ) || ( dictionary->size( ) > current->size( ) ) ) ) {
+          LOG( info, "Property names of table {} extended to {}", tableName, dictionary->size( ) );
+          current = std::move( dictionary );
+        }
+
+        return current;
+      }
+
+      void TokenDB::resolve( const std::string &tableName, Layout &table, Properties &properties ) {
+        if ( !properties.resolved( ) ) {
+          table.names = reloadPropertyNames( tableName );
+          properties.rebind( table.names );
+        }
+      }
+
       TokenEntry TokenDB::get( const std::string &tableName, const std::string &token ) {
         TokenEntry entry;
 
+        get( tableName, token, entry );
+
+        return entry;
+      }
+
+      /**
+       * @brief Identify if a token can be stored in a table: the tables storing numeric tokens
+       * hold 1 to 18 digit tokens only, so no other token can be found in them
+       * @param token token
+       * @param numeric table stores numeric tokens (TokenEntry::pack)
+       * @return true if the token can be stored
+       */
+      static bool storable( const std::string &token, bool numeric ) {
+        return ( !numeric ) || ( TokenEntry::pack( token ) != 0 );
+      }
+
+      /**
+       * @brief Bind a token parameter, packed for the tables storing numeric tokens
+       * @param statement statement
+       * @param token token
+       * @param numeric table stores numeric tokens (TokenEntry::pack)
+       * @throws TokenRangeError if the table stores numeric tokens and the token is not 1 to 18 digits
+       */
+      static void bindToken( dbcpp::Statement &statement, const std::string &token, bool numeric ) {
+        if ( numeric ) {
+          auto packed = TokenEntry::pack( token );
+
+          if ( packed == 0 ) {
+            throw exceptions::TokenRangeError( "Token '" + token + "' is not a numeric token of 1 to 18 digits" );
+          }
+
+          statement << packed;
+        } else {
+          statement << token;
+        }
+      }
+
+      bool TokenDB::get( const std::string &        tableName,
+                         const std::string &        token,
+                         TokenEntry &               entry,
+                         const TokenEntry::Columns &columns ) {
+        static thread_local std::string sql;
+        auto                            table   = layout( tableName );
+
         LOG( debug, "Getting entry for token {} from table {}", token, tableName );
 
+        if ( !storable( token, table.numeric ) ) {
+          LOG( debug, "No record found for {} from {}: not a numeric token", token, tableName );
+          entry.clear( );
+          return false;
+        }
+
+        sql.assign( "SELECT " ).append( columns.list( ) ).append( " FROM " ).append( tableName );
+        sql.append( " WHERE token = ?" );
+
         auto connection = dbPool.getConnection( );
-        auto statement  = connection << ( "SELECT * FROM " + tableName + " WHERE token = ?" )
-                                    << token;
+        auto statement  = connection << sql;
+
+        bindToken( statement, token, table.numeric );
+
         auto rs = statement.executeQuery( );
 
         if ( rs.next( ) ) {
           LOG( debug, "Successfully retrieved record for {} from {}", token, tableName );
-          entry.load( rs );
-        } else {
-          LOG( debug, "No record found for {} from {}", token, tableName );
+          entry.load( rs, table.numeric, table.names, columns );
+          resolve( tableName, table, entry.properties );
+          return true;
         }
 
-        return entry;
+        LOG( debug, "No record found for {} from {}", token, tableName );
+        entry.clear( );
+
+        return false;
+      }
+
+      /**
+       * @brief Get the lookup key (hkey column) of an hmac
+       * @param hmac hmac
+       * @param prefix prefix length
+       * @return hmac prefix
+       */
+      static bytea lookupKey( const bytea &hmac, size_t prefix ) {
+        return bytea( hmac.begin( ), hmac.begin( ) + std::min( prefix, hmac.size( ) ) );
       }
 
-      std::vector< TokenEntry > TokenDB::get( const std::string &tableName, const bytea &hmac ) {
+      std::vector< TokenEntry > TokenDB::get( const std::string &        tableName,
+                                              const bytea &              hmac,
+                                              const TokenEntry::Columns &columns ) {
         std::vector< TokenEntry > entries;
+        auto                      table  = layout( tableName );
+        auto                      prefix = table.prefix;
         LOG( debug, "Performing hash lookup in table {}", tableName );
 
+        /* The index narrows the rows to the prefix, the full hmac is compared on those */
         auto connection = dbPool.getConnection( );
-        auto statement = connection << ( "SELECT * FROM " + tableName + " WHERE hmac = ?" ) << hmac;
-        auto rs        = statement.executeQuery( );
+        auto statement  = connection << ( "SELECT " + columns.list( ) + " FROM " + tableName +
+                                         ( prefix ? " WHERE hkey = ? AND hmac = ?" : " WHERE hmac = ?" ) );
+
+        if ( prefix ) {
+          statement << lookupKey( hmac, prefix );
+        }
+
+        statement << hmac;
+
+        auto rs = statement.executeQuery( );
 
         while ( rs.next( ) ) {
-          entries.emplace_back( TokenEntry( rs ) );
+          entries.emplace_back( TokenEntry( rs, table.numeric, table.names, columns ) );
+          resolve( tableName, table, entries.back( ).properties );
         }
 
         LOG( debug,
@@ -60,38 +308,81 @@ namespace token {
         return entries;
       }
 
-      void TokenDB::insert( const std::string &tableName, const TokenEntry &entry ) {
-        auto connection = dbPool.getConnection( );
+      /**
+       * @brief Build the insert statement for a token entry
+       * @param connection database connection
+       * @param tableName token vault table name
+       * @param entry token entry
+       * @param table table layout
+       * @return bound insert statement
+       */
+      template < typename Connection >
+      static dbcpp::Statement insertStatement( Connection &           connection,
+                                               const std::string &    tableName,
+                                               const TokenEntry &     entry,
+                                               const TokenDB::Layout &table ) {
+        static thread_local std::string sql;
+        dbcpp::Statement                statement;
+        auto                            prefix = table.prefix;
+
+        sql.assign( "INSERT INTO " ).append( tableName ).append( "( " );
 
-        std::stringstream ss;
-        dbcpp::Statement  statement;
+        if ( entry.encKey.length( ) > 0 ) {
+          sql.append( "ENCKEY, " );
+        }
 
-        LOG( debug, "Inserting record for token {} into table {}", entry.token, tableName );
+        if ( prefix ) {
+          sql.append( "HKEY, " );
+        }
 
-        ss << "INSERT INTO " << tableName << "( ";
+        sql.append( "TOKEN, HMAC, CRYPT, MASK, EXPIRATION, PROPERTIES ) VALUES ( " );
 
         if ( entry.encKey.length( ) > 0 ) {
-          ss << "ENCKEY, ";
+          sql.append( "?, " );
         }
 
-        ss << "TOKEN, HMAC, CRYPT, MASK, EXPIRATION, PROPERTIES ) VALUES ( ";
-
-        if ( entry.encKey.length( ) > 0 ) {
-          ss << "?, ";
+        if ( prefix ) {
+          sql.append( "?, " );
         }
 
-        ss << "?, ?, ?, ?, ?, ? )";
+        sql.append( "?, ?, ?, ?, ?, ? )" );
 
-        statement = connection << ss.str( );
+        statement = connection << sql;
 
         if ( entry.encKey.length( ) > 0 ) {
           statement << entry.encKey;
         }
 
-        statement << entry.token << entry.hmac << entry.crypt << entry.mask << entry.expiration
-                  << TokenEntry::serialize( entry.properties );
+        if ( prefix ) {
+          statement << lookupKey( entry.hmac, prefix );
+        }
 
-        if ( statement.executeUpdate( ) != 1 ) {
+        bindToken( statement, entry.token, table.numeric );
+
+        statement << entry.hmac << entry.crypt << entry.mask << entry.expiration
+                  << entry.properties.encode( table.names );
+
+        return statement;
+      }
+
+      void TokenDB::insert( const std::string &tableName, const TokenEntry &entry ) {
+        GroupCommit options;
+
+        {
+          std::lock_guard< std::mutex > guard( groupLock );
+          options = groupOptions;
+        }
+
+        if ( options.enabled ) {
+          groupInsert( tableName, entry, options );
+          return;
+        }
+
+        auto connection = dbPool.getConnection( );
+
+        LOG( debug, "Inserting record for token {} into table {}", entry.token, tableName );
+
+        if ( insertStatement( connection, tableName, entry, layout( tableName ) ).executeUpdate( ) != 1 ) {
           LOG( debug, "Failed to insert {} record into {}", entry.token, tableName );
           throw exceptions::TokenSQLError( "Unable to insert token into tableName" );
         }
@@ -101,8 +392,399 @@ namespace token {
         connection.commit( );
       }
 
+      void TokenDB::insert( const std::string &tableName, const std::vector< TokenEntry > &entries ) {
+        if ( entries.empty( ) ) {
+          return;
+        }
+
+        auto connection = dbPool.getConnection( );
+        auto table      = layout( tableName );
+
+        LOG( debug, "Inserting batch of {} records into table {}", entries.size( ), tableName );
+
+        try {
+          for ( auto &entry : entries ) {
+            if ( insertStatement( connection, tableName, entry, table ).executeUpdate( ) != 1 ) {
+              LOG( debug, "Failed to insert {} record into {}", entry.token, tableName );
+              throw exceptions::TokenSQLError( "Unable to insert token into " + tableName );
+            }
+          }
+
+          connection.commit( );
+        } catch ( ... ) {
+          LOG( debug, "Rolling back batch of {} records for {}", entries.size( ), tableName );
+          connection.rollback( );
+          throw;
+        }
+
+        LOG( debug, "Successfully inserted {} records into {}", entries.size( ), tableName );
+      }
+
+      Result TokenDB::tryInsert( const std::string & tableName,
+                                 const TokenEntry &  entry,
+                                 std::exception_ptr *error ) noexcept {
+        try {
+          insert( tableName, entry );
+          return Result::OK;
+        } catch ( std::exception &ex ) {
+          auto rc = classify( tableName, ex );
+
+          LOG( debug, "Failed to insert {} record into {} ({}): {}", entry.token, tableName, describe( rc ), ex.what( ) );
+
+          if ( error != nullptr ) {
+            *error = std::current_exception( );
+          }
+
+          return rc;
+        } catch ( ... ) {
+          if ( error != nullptr ) {
+            *error = std::current_exception( );
+          }
+
+          return Result::FAILED;
+        }
+      }
+
+      Result TokenDB::tryGet( const std::string &tableName, const std::string &token, TokenEntry &entry ) noexcept {
+        try {
+          return get( tableName, token, entry ) ? Result::OK : Result::NOT_FOUND;
+        } catch ( std::exception &ex ) {
+          auto rc = classify( tableName, ex );
+
+          LOG( debug, "Failed to get {} record from {} ({}): {}", token, tableName, describe( rc ), ex.what( ) );
+
+          return duplicate( rc ) ? Result::FAILED : rc;
+        } catch ( ... ) {
+          return Result::FAILED;
+        }
+      }
+
+      /**
+       * @brief Case insensitive search of a driver message
+       * @param message driver message
+       * @param word lower case word
+       * @return true if the message contains the word
+       */
+      static bool mentions( const char *message, const char *word ) {
+        auto end = message + ::strlen( message );
+
+        return std::search( message, end, word, word + ::strlen( word ), []( char ch, char lower ) {
+                 return ::tolower( static_cast< unsigned char >( ch ) ) == lower;
+               } ) != end;
+      }
+
+      /**
+       * @brief Find the SQLSTATE reported in a driver message: "SQLSTATE 40001", "SQLSTATE[40001]"
+       * or the verbose libpq form "ERROR:  40001: ..."
+       * @param message driver message
+       * @return SQLSTATE, empty if the message does not report one
+       */
+      static std::string sqlState( const char *message ) {
+        static const char *MARKERS[] = { "sqlstate", "error:  " };
+
+        auto code = []( const char *pos ) {
+          for ( size_t num = 0; num < 5; ++num ) {
+            if ( ( !::isdigit( static_cast< unsigned char >( pos[ num ] ) ) ) &&
+                 ( !::isupper( static_cast< unsigned char >( pos[ num ] ) ) ) ) {
+              return false;
+            }
+          }
+
+          return !::isalnum( static_cast< unsigned char >( pos[ 5 ] ) );
+        };
+
+        for ( auto marker : MARKERS ) {
+          auto end    = message + ::strlen( message );
+          auto length = ::strlen( marker );
+
+          for ( auto pos = message; ( pos = std::search( pos, end, marker, marker + length, []( char ch, char lower ) {
+                                        return ::tolower( static_cast< unsigned char >( ch ) ) == lower;
+                                      } ) ) != end; ++pos ) {
+            auto state = pos + length;
+
+            while ( ( *state == ' ' ) || ( *state == '[' ) || ( *state == ':' ) || ( *state == '=' ) ) {
+              ++state;
+            }
+
+            if ( ( static_cast< size_t >( end - state ) >= 5 ) && ( code( state ) ) ) {
+              return std::string( state, 5 );
+            }
+          }
+        }
+
+        return std::string( );
+      }
+
+      /**
+       * @brief Check whether a driver message reports one of a set of errors, by the complete
+       * message (or name) of the error code: another word must not follow it, so longer messages
+       * sharing the words are not taken for the error
+       * @param message driver message
+       * @param errors messages of the error codes
+       * @param count number of messages
+       * @return true if reported
+       */
+      static bool reports( const char *message, const char *const *errors, size_t count ) {
+        auto end = message + ::strlen( message );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          auto error  = errors[ num ];
+          auto length = ::strlen( error );
+
+          for ( auto pos = message; ( pos = std::search( pos, end, error, error + length ) ) != end; ++pos ) {
+            auto next = pos + length;
+
+            if ( ( next == end ) || ( ( !::isalnum( static_cast< unsigned char >( *next ) ) ) &&
+                                      ( ( *next != ' ' ) || ( !::isalpha( static_cast< unsigned char >( next[ 1 ] ) ) ) ) ) ) {
+              return true;
+            }
+          }
+        }
+
+        return false;
+      }
+
+      bool TokenDB::transient( const std::string &state ) noexcept {
+        /* Connection exceptions (class 08), serialization failures and deadlocks, lock timeouts,
+         * cancellations and shutdowns */
+        return ( state.compare( 0, 2, "08" ) == 0 ) || ( state == "40001" ) || ( state == "40P01" ) ||
+               ( state == "55P03" ) || ( state == "57014" ) || ( state == "57P01" );
+      }
+
+      Result TokenDB::classify( const std::string &tableName, const std::exception &error ) noexcept {
+        static const char *HMAC[]  = { ".hmac", "(hmac)", "_hmac_key", ".hkey", "(hkey)", "_hkey_key" };
+        static const char *TOKEN[] = { ".token", "(token)", "_pkey", "_tok_key" };
+
+        /* The messages of the transient error codes, for the drivers not reporting the code:
+         * SQLITE_BUSY and SQLITE_LOCKED (sqlite3_errstr), and the PostgreSQL server and libpq
+         * messages of the SQLSTATEs accepted by transient() */
+        static const char *TRANSIENT[] = { "database is locked",
+                                           "database table is locked",
+                                           "SQLITE_BUSY",
+                                           "SQLITE_LOCKED",
+                                           "could not serialize access due to concurrent update",
+                                           "could not serialize access due to read/write dependencies among transactions",
+                                           "deadlock detected",
+                                           "canceling statement due to lock timeout",
+                                           "canceling statement due to statement timeout",
+                                           "terminating connection due to administrator command",
+                                           "server closed the connection unexpectedly",
+                                           "no connection to the server",
+                                           "could not receive data from server",
+                                           "could not send data to server" };
+
+        auto message = error.what( );
+        auto any     = [ message ]( const char *const *words, size_t count ) {
+          return std::any_of( words, words + count, [ message ]( const char *word ) { return mentions( message, word ); } );
+        };
+
+        /* A token the table can not store (see bindToken) */
+        if ( dynamic_cast< const exceptions::TokenRangeError * >( &error ) != nullptr ) {
+          return Result::INVALID;
+        }
+
+        if ( dynamic_cast< const dbcpp::DBException * >( &error ) == nullptr ) {
+          return Result::FAILED;
+        }
+
+        auto state  = sqlState( message );
+        auto unique = state.empty( ) ? ( mentions( message, "unique" ) ) || ( mentions( message, "duplicate" ) )
+                                     : ( state == "23505" );
+
+        if ( unique ) {
+          if ( any( HMAC, sizeof( HMAC ) / sizeof( HMAC[ 0 ] ) ) ) {
+            return Result::DUPLICATE_HMAC;
+          }
+
+          if ( any( TOKEN, sizeof( TOKEN ) / sizeof( TOKEN[ 0 ] ) ) ) {
+            return Result::DUPLICATE_TOKEN;
+          }
+
+          LOG( debug, "Unique violation on {} not identified: {}", tableName, message );
+
+          return Result::DUPLICATE;
+        }
+
+        if ( !state.empty( ) ) {
+          return transient( state ) ? Result::TRANSIENT : Result::FAILED;
+        }
+
+        return reports( message, TRANSIENT, sizeof( TRANSIENT ) / sizeof( TRANSIENT[ 0 ] ) ) ? Result::TRANSIENT
+                                                                                           : Result::FAILED;
+      }
+
+      /**
+       * Group commit participant; owned by the inserting caller's stack
+       */
+      struct GroupInsert {
+        const TokenEntry * entry;         /**< Entry to insert                  */
+        std::exception_ptr error;         /**< Failure reported to the caller   */
+        bool               done = false;  /**< Entry committed or failed        */
+
+        explicit GroupInsert( const TokenEntry *_entry )
+          : entry( _entry ) {}
+      };
+
+      /**
+       * Per-table group commit state
+       */
+      struct TokenDB::CommitGroup {
+        std::deque< GroupInsert * > pending;                                  /**< Queued inserts      */
+        std::mutex                  lock;                                     /**< Group lock          */
+        std::condition_variable     arrived;                                  /**< New insert queued   */
+        std::condition_variable     completed;                                /**< Batch completed     */
+        std::chrono::microseconds   window = std::chrono::microseconds( 0 );  /**< Collection window   */
+        bool                        leader = false;                           /**< Batch in progress   */
+      };
+
+      /**
+       * @brief Insert a set of group commit participants within a single transaction, isolating
+       * each row with a savepoint so one caller's failure leaves the others' rows intact
+       * @param connection database connection
+       * @param tableName token vault table name
+       * @param table table layout
+       * @param batch participants
+       */
+      template < typename Connection >
+      static void commitGroup( Connection &                  connection,
+                               const std::string &           tableName,
+                               const TokenDB::Layout &       table,
+                               std::vector< GroupInsert * > &batch ) {
+        try {
+          if ( batch.size( ) == 1 ) {
+            try {
+              if ( insertStatement( connection, tableName, *batch.front( )->entry, table ).executeUpdate( ) != 1 ) {
+                throw exceptions::TokenSQLError( "Unable to insert token into " + tableName );
+              }
+            } catch ( ... ) {
+              batch.front( )->error = std::current_exception( );
+              connection.rollback( );
+              return;
+            }
+          } else {
+            for ( auto insert : batch ) {
+              ( connection << "SAVEPOINT token_insert" ).execute( );
+
+              try {
+                if ( insertStatement( connection, tableName, *insert->entry, table ).executeUpdate( ) != 1 ) {
+                  throw exceptions::TokenSQLError( "Unable to insert token into " + tableName );
+                }
+
+                ( connection << "RELEASE SAVEPOINT token_insert" ).execute( );
+              } catch ( ... ) {
+                LOG( debug, "Failed to insert {} record into {}", insert->entry->token, tableName );
+                insert->error = std::current_exception( );
+                ( connection << "ROLLBACK TO SAVEPOINT token_insert" ).execute( );
+              }
+            }
+          }
+
+          connection.commit( );
+        } catch ( ... ) {
+          LOG( warn, "Group commit of {} records into {} failed", batch.size( ), tableName );
+
+          try {
+            connection.rollback( );
+          } catch ( ... ) {
+          }
+
+          for ( auto insert : batch ) {
+            if ( !insert->error ) {
+              insert->error = std::current_exception( );
+            }
+          }
+        }
+      }
+
+      void TokenDB::groupInsert( const std::string &tableName, const TokenEntry &entry, const GroupCommit &options ) {
+        static constexpr auto WINDOW_STEP = std::chrono::microseconds( 50 );
+
+        std::shared_ptr< CommitGroup > group;
+        GroupInsert                    self( &entry );
+
+        {
+          std::lock_guard< std::mutex > guard( groupLock );
+          auto &                        slot = groups[ tableName ];
+
+          if ( !slot ) {
+            slot = std::make_shared< CommitGroup >( );
+          }
+
+          group = slot;
+        }
+
+        std::unique_lock< std::mutex > guard( group->lock );
+        size_t                         maxBatch = std::max< size_t >( options.maxBatch, 1 );
+
+        group->pending.push_back( &self );
+        group->arrived.notify_one( );
+
+        while ( !self.done ) {
+          if ( group->leader ) {
+            group->completed.wait( guard, [ & ]( ) { return self.done || !group->leader; } );
+            continue;
+          }
+
+          group->leader = true;
+          group->window = std::max( group->window, options.minWindow );
+
+          /* Collect followers until the batch is full or the window closes */
+          group->arrived.wait_for( guard, group->window, [ & ]( ) { return group->pending.size( ) >= maxBatch; } );
+
+          std::vector< GroupInsert * > batch;
+
+          while ( !group->pending.empty( ) && ( batch.size( ) < maxBatch ) ) {
+            batch.push_back( group->pending.front( ) );
+            group->pending.pop_front( );
+          }
+
+          guard.unlock( );
+
+          LOG( debug, "Group committing {} record{} into {}", batch.size( ), batch.size( ) > 1 ? "s" : "", tableName );
+
+          try {
+            auto connection = dbPool.getConnection( );
+
+            groupTransactions.fetch_add( 1, std::memory_order_relaxed );
+            commitGroup( connection, tableName, layout( tableName ), batch );
+          } catch ( ... ) {
+            for ( auto insert : batch ) {
+              if ( !insert->error ) {
+                insert->error = std::current_exception( );
+              }
+            }
+          }
+
+          guard.lock( );
+
+          /* Inserts queued behind the commit or a partial batch widen the window (throughput),
+           * solitary inserts and full batches shrink it back toward minWindow (latency) */
+          if ( ( !group->pending.empty( ) ) || ( ( batch.size( ) > 1 ) && ( batch.size( ) < maxBatch ) ) ) {
+            group->window = std::min( options.maxWindow, std::max( group->window * 2, WINDOW_STEP ) );
+          } else {
+            group->window = std::max( options.minWindow, group->window / 2 );
+          }
+
+          for ( auto insert : batch ) {
+            insert->done = true;
+          }
+
+          group->leader = false;
+          group->completed.notify_all( );
+        }
+
+        guard.unlock( );
+
+        if ( self.error ) {
+          std::rethrow_exception( self.error );
+        }
+
+        LOG( debug, "Successfully inserted {} record into {}", entry.token, tableName );
+      }
+
       void TokenDB::remove( const std::string &tableName, TokenEntry &entry ) {
         auto connection = dbPool.getConnection( );
+        auto table      = layout( tableName );
 
         if ( ( entry.token.empty( ) ) && ( entry.hmac.empty( ) ) ) {
           LOG( warn, "No token or hmac supplied for removal operation from {}", tableName );
@@ -111,41 +793,53 @@ namespace token {
             "Unable to remove token, no unique/identifer values (token, or hmac)" );
         }
 
-        LOG( debug,
-             "Preparing to remove {} record from {}",
-             entry.token.empty( ) ? entry.token : HASH_LIT,
-             tableName );
+        if ( ( !entry.token.empty( ) ) && ( !storable( entry.token, table.numeric ) ) ) {
+          LOG( debug, "Unable to remove non-numeric token from {}", tableName );
+          throw exceptions::TokenSQLError( "Unable to remove token, entry does not exist" );
+        }
+
+        /* The final retrieve and the removal select the same row: by token, or by hash */
+        auto byToken = !entry.token.empty( );
+        auto prefix  = table.prefix;
+        auto name    = byToken ? entry.token : HASH_LIT;
+        auto where   = std::string( byToken ? " WHERE token = ?"
+                                            : ( prefix ? " WHERE hkey = ? AND hmac = ?" : " WHERE hmac = ?" ) );
+        auto bind    = [ & ]( dbcpp::Statement &statement ) {
+          if ( byToken ) {
+            bindToken( statement, entry.token, table.numeric );
+            return;
+          }
+
+          if ( prefix ) {
+            statement << lookupKey( entry.hmac, prefix );
+          }
+
+          statement << entry.hmac;
+        };
+
+        LOG( debug, "Preparing to remove {} record from {}", name, tableName );
 
         {
-          LOG( debug,
-               "Performing final retrieve of {} record from {}",
-               entry.token.empty( ) ? entry.token : HASH_LIT,
-               tableName );
+          LOG( debug, "Performing final retrieve of {} record from {}", name, tableName );
+
+          auto statement = connection << ( "SELECT " + COLUMNS.list( ) + " FROM " + tableName + where );
+
+          bind( statement );
 
-          auto statement = connection << ( "SELECT * FROM " + tableName + " WHERE token = ?" )
-                                      << entry.token;
           auto rs = statement.executeQuery( );
 
           if ( rs.next( ) ) {
-            LOG( debug,
-                 "Successfully retrieved record {} from {}",
-                 entry.token.empty( ) ? entry.token : HASH_LIT,
-                 tableName );
-            entry.load( rs );
+            LOG( debug, "Successfully retrieved record {} from {}", name, tableName );
+            entry.load( rs, table.numeric, table.names );
+            resolve( tableName, table, entry.properties );
           }
         }
 
-        dbcpp::Statement statement;
+        LOG( debug, "Remove {} record from {}", name, tableName );
 
-        if ( !entry.token.empty( ) ) {
-          LOG( debug, "Remove {} record from {} by token", entry.token, tableName );
-          statement = connection << ( "DELETE FROM " + tableName + " WHERE token = ?" )
-                                 << entry.token;
-        } else if ( !entry.hmac.empty( ) ) {
-          LOG( debug, "Remove hash record from {}", tableName );
-          statement = connection << ( "DELETE FROM " + tableName + " WHERE hmac = ?" )
-                                 << entry.hmac;
-        }
+        auto statement = connection << ( "DELETE FROM " + tableName + where );
+
+        bind( statement );
 
         if ( statement.executeUpdate( ) != 1 ) {
           LOG( debug, "Unable to remove non-existant record from {}", tableName );
@@ -162,6 +856,8 @@ namespace token {
         dbcpp::Statement  statement;
         auto              connection = dbPool.getConnection( );
         auto              fieldSet   = false;
+        auto              table      = layout( tableName );
+        auto              prefix     = table.prefix;
 
         ss << "UPDATE " << tableName << " SET ";
 
@@ -179,7 +875,7 @@ namespace token {
             ss << ", ";
           }
 
-          ss << "HMAC = ?";
+          ss << ( prefix ? "HKEY = ?, HMAC = ?" : "HMAC = ?" );
           fieldSet = true;
         }
 
@@ -232,6 +928,10 @@ namespace token {
         }
 
         if ( !entry.hmac.empty( ) ) {
+          if ( prefix ) {
+            statement << lookupKey( entry.hmac, prefix );
+          }
+
           statement << entry.hmac;
         }
 
@@ -248,9 +948,11 @@ namespace token {
         }
 
         if ( !entry.properties.empty( ) ) {
-          statement << TokenEntry::serialize( entry.properties );
+          statement << entry.properties.encode( table.names );
         }
 
+        bindToken( statement, entry.token, table.numeric );
+
         LOG( debug, "Performing record update for {} in table {}", entry.token, tableName );
 
         if ( statement.executeUpdate( ) == 0 ) {
@@ -262,13 +964,15 @@ namespace token {
 
         LOG( debug, "Getting updated entry for token {} from table {}", entry.token, tableName );
 
-        statement = connection << ( "SELECT * FROM " + tableName + " WHERE token = ?" )
-                               << entry.token;
+        statement = connection << ( "SELECT " + COLUMNS.list( ) + " FROM " + tableName + " WHERE token = ?" );
+        bindToken( statement, entry.token, table.numeric );
+
         auto rs = statement.executeQuery( );
 
         if ( rs.next( ) ) {
           LOG( debug, "Successfully retrieved record for {} from {}", entry.token, tableName );
-          entry.load( rs );
+          entry.load( rs, table.numeric, table.names );
+          resolve( tableName, table, entry.properties );
         }
       }
 
@@ -304,20 +1008,111 @@ namespace token {
                                                 size_t                              limit,
                                                 size_t *                            recordCount ) {
         std::vector< TokenEntry > rc;
-        std::string::size_type    orderByIndex = 0;
-        dbcpp::Statement          statement;
-        std::stringstream         build;
-        std::stringstream         where;
-        std::string               query;
-        auto                      connection = dbPool.getConnection( );
+
+        select( tableName,
+                tokens,
+                hmacs,
+                expirations,
+                std::move( sortField ),
+                sortAsc,
+                offset,
+                limit,
+                [ this, &tableName, &rc ]( dbcpp::ResultSet &rs, Layout &table ) {
+                  rc.emplace_back( TokenEntry( rs, table.numeric, table.names ) );
+                  resolve( tableName, table, rc.back( ).properties );
+                },
+                recordCount );
+
+        return rc;
+      }
+
+      void TokenDB::query( const std::string &                 tableName,
+                           const std::vector< std::string > &  tokens,
+                           const std::vector< bytea > &        hmacs,
+                           const std::vector< dbcpp::DBTime > &expirations,
+                           std::string                         sortField,
+                           bool                                sortAsc,
+                           size_t                              offset,
+                           size_t                              limit,
+                           TokenEntries &                      entries,
+                           size_t *                            recordCount ) {
+        select( tableName,
+                tokens,
+                hmacs,
+                expirations,
+                std::move( sortField ),
+                sortAsc,
+                offset,
+                limit,
+                [ this, &tableName, &entries ]( dbcpp::ResultSet &rs, Layout &table ) {
+                  if ( entries.append( rs, table.numeric, table.names ) ) {
+                    return;
+                  }
+
+                  table.names = reloadPropertyNames( tableName );
+
+                  if ( !entries.append( rs, table.numeric, table.names ) ) {
+                    throw exceptions::TokenSQLError( "Token property name not in the vault property dictionary" );
+                  }
+                },
+                recordCount );
+      }
+
+      void TokenDB::select( const std::string &                 tableName,
+                            const std::vector< std::string > &  tokens,
+                            const std::vector< bytea > &        hmacs,
+                            const std::vector< dbcpp::DBTime > &expirations,
+                            std::string                         sortField,
+                            bool                                sortAsc,
+                            size_t                              offset,
+                            size_t                              limit,
+                            const row_f &                       row,
+                            size_t *                            recordCount ) {
+        std::string::size_type     fromIndex    = 0;
+        std::string::size_type     orderByIndex = 0;
+        dbcpp::Statement           statement;
+        std::stringstream          build;
+        std::stringstream          where;
+        std::string                query;
+        std::vector< bytea >       keys;
+        std::vector< std::string > searched;
+        auto                       connection = dbPool.getConnection( );
+        auto                       table      = layout( tableName );
+        auto                       prefix     = hmacs.empty( ) ? 0 : table.prefix;
+
+        /* Tokens a numeric table can not hold match no row */
+        for ( auto &token : tokens ) {
+          if ( storable( token, table.numeric ) ) {
+            searched.push_back( token );
+          }
+        }
+
+        if ( ( searched.empty( ) ) && ( !tokens.empty( ) ) ) {
+          LOG( debug, "None of the {} tokens searched can be in {}", tokens.size( ), tableName );
+
+          if ( recordCount != nullptr ) {
+            *recordCount = 0;
+          }
+
+          return;
+        }
+
+        if ( prefix ) {
+          for ( auto &hmac : hmacs ) {
+            keys.push_back( lookupKey( hmac, prefix ) );
+          }
+        }
 
         if ( sortField.empty( ) ) {
           sortField = "creation_date";
         }
 
-        build << "SELECT * FROM " << tableName;
+        build << "SELECT " << COLUMNS.list( );
+        fromIndex = build.str( ).size( );
+        build << " FROM " << tableName;
 
-        queryAddSet( where, "token", tokens.size( ) );
+        queryAddSet( where, "token", searched.size( ) );
+        queryAddSet( where, "hkey", keys.size( ) );
         queryAddSet( where, "hmac", hmacs.size( ) );
         queryAddSet( where, "expiration", expirations.size( ) );
 
@@ -340,8 +1135,12 @@ namespace token {
         query     = build.str( );
         statement = connection << query;
 
-        for ( auto &token : tokens ) {
-          statement << token;
+        for ( auto &token : searched ) {
+          bindToken( statement, token, table.numeric );
+        }
+
+        for ( auto &key : keys ) {
+          statement << key;
         }
 
         for ( auto &hmac : hmacs ) {
@@ -353,14 +1152,18 @@ namespace token {
         }
 
         for ( auto rs = statement.executeQuery( ); rs.next( ); ) {
-          rc.emplace_back( TokenEntry( rs ) );
+          row( rs, table );
         }
 
         if ( recordCount != nullptr ) {
-          query     = "SELECT COUNT(0) " + query.substr( 8, orderByIndex - 8 );
+          query     = "SELECT COUNT(0)" + query.substr( fromIndex, orderByIndex - fromIndex );
           statement = connection << query;
-          for ( auto &token : tokens ) {
-            statement << token;
+          for ( auto &token : searched ) {
+            bindToken( statement, token, table.numeric );
+          }
+
+          for ( auto &key : keys ) {
+            statement << key;
           }
 
           for ( auto &hmac : hmacs ) {
@@ -379,10 +1182,162 @@ namespace token {
 
           *recordCount = rs.get< size_t >( 0 );
         }
+      }
+
+      std::vector< std::string > TokenDB::used( const std::string &tableName, const std::vector< std::string > &tokens ) {
+        std::vector< std::string > rc;
+        std::vector< std::string > searched;
+        std::stringstream          where;
+        auto                       numeric = layout( tableName ).numeric;
+
+        /* Tokens a numeric table can not hold are not in use */
+        for ( auto &token : tokens ) {
+          if ( storable( token, numeric ) ) {
+            searched.push_back( token );
+          }
+        }
+
+        if ( searched.empty( ) ) {
+          return rc;
+        }
+
+        queryAddSet( where, "token", searched.size( ) );
+
+        auto connection = dbPool.getConnection( );
+        auto statement  = connection << ( "SELECT token FROM " + tableName + " WHERE " + where.str( ) );
+
+        for ( auto &token : searched ) {
+          bindToken( statement, token, numeric );
+        }
+
+        for ( auto rs = statement.executeQuery( ); rs.next( ); ) {
+          rc.emplace_back( numeric ? TokenEntry::unpack( rs.get< uint64_t >( 0 ) ) : rs.get< std::string >( 0 ) );
+        }
+
+        LOG( trace, "{} of {} tokens in use in {}", rc.size( ), tokens.size( ), tableName );
 
         return rc;
       }
 
+      std::vector< TokenEntry > TokenDB::existing( const std::string &tableName, const std::vector< bytea > &hmacs ) {
+        static const TokenEntry::Columns columns{ TokenEntry::Columns::TOKEN, TokenEntry::Columns::HMAC };
+        static const size_t              MAX_SET = 500;
+
+        std::vector< TokenEntry > rc;
+        auto                      table      = layout( tableName );
+        auto                      connection = dbPool.getConnection( );
+
+        /* Bounded sets keep the statements under the driver's parameter limits */
+        for ( size_t first = 0; first < hmacs.size( ); first += MAX_SET ) {
+          auto              count = std::min( MAX_SET, hmacs.size( ) - first );
+          std::stringstream where;
+
+          if ( table.prefix ) {
+            queryAddSet( where, "hkey", count );
+          }
+
+          queryAddSet( where, "hmac", count );
+
+          auto statement = connection << ( "SELECT " + columns.list( ) + " FROM " + tableName + " WHERE " + where.str( ) );
+
+          if ( table.prefix ) {
+            for ( size_t num = first; num < first + count; ++num ) {
+              statement << lookupKey( hmacs[ num ], table.prefix );
+            }
+          }
+
+          for ( size_t num = first; num < first + count; ++num ) {
+            statement << hmacs[ num ];
+          }
+
+          for ( auto rs = statement.executeQuery( ); rs.next( ); ) {
+            rc.emplace_back( TokenEntry( rs, table.numeric, table.names, columns ) );
+            resolve( tableName, table, rc.back( ).properties );
+          }
+        }
+
+        LOG( trace, "{} of {} values tokenized in {}", rc.size( ), hmacs.size( ), tableName );
+
+        return rc;
+      }
+
+      size_t TokenDB::purgeExpired( const std::string &tableName, const dbcpp::DBTime &before, size_t limit ) {
+        auto connection = dbPool.getConnection( );
+        auto statement =
+          connection << fmt::format( "DELETE FROM {0} WHERE token IN ( "
+                                     "SELECT token FROM {0} WHERE expiration > ? AND expiration < ? "
+                                     "ORDER BY expiration LIMIT {1} )",
+                                     tableName,
+                                     limit )
+                     << NO_TIME << before;
+
+        LOG( debug, "Purging up to {} expired records from {}", limit, tableName );
+
+        try {
+          auto rc = statement.executeUpdate( );
+          connection.commit( );
+
+          LOG( debug, "Purged {} expired records from {}", rc, tableName );
+
+          return rc;
+        } catch ( ... ) {
+          connection.rollback( );
+          throw;
+        }
+      }
+
+      uint64_t TokenDB::reserve( const std::string &tableName, const std::string &scope, uint64_t count ) {
+        static const size_t MAX_RETRIES = 3;
+        auto                connection  = dbPool.getConnection( );
+        auto                counters    = tableName + "_counters";
+
+        for ( size_t num = 0;; ++num ) {
+          try {
+            auto update = connection << fmt::format( "UPDATE {} SET counter = counter + ? WHERE scope = ?", counters )
+                                     << count << scope;
+
+            if ( update.executeUpdate( ) == 1 ) {
+              auto select = connection << fmt::format( "SELECT counter FROM {} WHERE scope = ?", counters ) << scope;
+              auto rs     = select.executeQuery( );
+              auto rc     = rs.next( ) ? rs.get< uint64_t >( 0 ) - count : 0;
+
+              connection.commit( );
+
+              LOG( trace, "Reserved {} values at {} from {}", count, rc, counters );
+
+              return rc;
+            }
+
+            auto insert = connection << fmt::format( "INSERT INTO {} ( scope, counter ) VALUES ( ?, ? )", counters )
+                                     << scope << count;
+
+            insert.executeUpdate( );
+            connection.commit( );
+
+            LOG( debug, "Created counter scope in {}", counters );
+
+            return 0;
+          } catch ( dbcpp::DBException &ex ) {
+            connection.rollback( );
+
+            /* A concurrent first reservation created the row: update it instead */
+            if ( num >= ( MAX_RETRIES - 1 ) ) {
+              LOG( warn, "Unable to reserve values from {}: {}", counters, ex.what( ) );
+              throw;
+            }
+          }
+        }
+      }
+
+      uint64_t TokenDB::counter( const std::string &tableName, const std::string &scope ) {
+        auto connection = dbPool.getConnection( );
+        auto statement  = connection << fmt::format( "SELECT counter FROM {}_counters WHERE scope = ?", tableName )
+                                    << scope;
+        auto rs = statement.executeQuery( );
+
+        return rs.next( ) ? rs.get< uint64_t >( 0 ) : 0;
+      }
+
       bool TokenDB::updateKey( SharedVault vault, const std::string &encKey ) {
         auto connection = dbPool.getConnection( );
         auto statement  = connection << "UPDATE vaults SET enckey = ? WHERE tablename = ?" << encKey
@@ -405,13 +1360,15 @@ namespace token {
       bool TokenDB::rekey( SharedVault vault, const std::string &encKey, recrypt_type recrypt ) {
         try {
           auto connection = dbPool.getConnection( );
-          auto statement = connection << fmt::format( "SELECT * FROM {} FOR UPDATE", vault->table );
+          auto statement = connection << fmt::format( "SELECT {} FROM {} FOR UPDATE", COLUMNS.list( ), vault->table );
           auto results   = statement.executeQuery( );
+          auto        prefix  = vault->hmacPrefix( );
+          auto        where   = prefix ? "hkey = ? AND hmac = ?" : "hmac = ?";
           std::string query[] = {
-            fmt::format( "UPDATE {} SET crypt = ? WHERE hmac = ?", vault->table ),
-            fmt::format( "UPDATE {} SET enckey = ?, crypt = ? WHERE hmac = ?", vault->table ) };
+            fmt::format( "UPDATE {} SET crypt = ? WHERE {}", vault->table, where ),
+            fmt::format( "UPDATE {} SET enckey = ?, crypt = ? WHERE {}", vault->table, where ) };
           while ( results.next( ) ) {
-            TokenEntry entry( results );
+            TokenEntry entry( results, vault->numeric( ) );
             auto       ret = recrypt( encKey, //
                                 !entry.encKey.empty( ) ? entry.encKey : vault->encKeyName,
                                 entry.crypt );
@@ -424,6 +1381,11 @@ namespace token {
               }
 
               stmt << ret;
+
+              if ( prefix ) {
+                stmt << lookupKey( entry.hmac, prefix );
+              }
+
               stmt << entry.hmac;
 
               if ( !stmt.executeUpdate( ) ) {
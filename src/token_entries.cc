@@ -0,0 +1,163 @@
+
+#include "token/api/token_entries.hh"
+#include "token/exceptions.hh"
+#include <algorithm>
+
+namespace token {
+  namespace api {
+    constexpr size_t CompactEntry::HMAC_CAPACITY;
+
+    bool TokenEntries::append( dbcpp::ResultSet &                                  results,
+                               bool                                                numeric,
+                               const std::shared_ptr< const PropertyDictionary > &names,
+                               const TokenEntry::Columns &                         columns ) {
+      using Columns = TokenEntry::Columns;
+
+      CompactEntry entry;
+      auto         properties = results.get< bytea >( columns[ Columns::PROPERTIES ] );
+
+      if ( !Properties::resolves( properties, names ) ) {
+        return false;
+      }
+
+      auto hmac = results.get< bytea >( columns[ Columns::HMAC ] );
+
+      if ( hmac.size( ) > CompactEntry::HMAC_CAPACITY ) {
+        throw exceptions::TokenRangeError( "HMAC of " + std::to_string( hmac.size( ) ) + " bytes exceeds the compact entry" );
+      }
+
+      auto crypt = results.get< bytea >( columns[ Columns::CRYPT ] );
+      auto token = columns[ Columns::TOKEN ];
+
+      entry.encKey     = pool.store( results.get< std::string >( columns[ Columns::ENCKEY ] ) );
+      entry.token      = numeric ? pool.store( TokenEntry::unpack( results.get< uint64_t >( token ) ) )
+                                 : pool.store( results.get< std::string >( token ) );
+      entry.crypt      = pool.store( crypt.data( ), crypt.size( ) );
+      entry.mask       = pool.store( results.get< std::string >( columns[ Columns::MASK ] ) );
+      entry.expiration = results.get< dbcpp::DBTime >( columns[ Columns::EXPIRATION ] );
+      entry.hmacSize   = static_cast< uint8_t >( hmac.size( ) );
+
+      std::copy( hmac.begin( ), hmac.end( ), entry.hmacBytes.begin( ) );
+
+      entry.firstProperty = static_cast< uint32_t >( flat.size( ) );
+
+      Properties::each( properties,
+                        names,
+                        [ this ]( boost::string_view name, boost::string_view value ) {
+                          flat.emplace_back( pool.store( name ), pool.store( value ) );
+                        } );
+
+      entry.propertyCount = static_cast< uint32_t >( flat.size( ) - entry.firstProperty );
+
+      std::sort( flat.begin( ) + entry.firstProperty, flat.end( ), []( const Property &lhs, const Property &rhs ) {
+        return lhs.first < rhs.first;
+      } );
+
+      rows.push_back( entry );
+      return true;
+    }
+
+    bool TokenEntries::property( const CompactEntry &entry, boost::string_view name, boost::string_view &value ) const {
+      auto range = properties( entry );
+      auto iter  = std::lower_bound(
+        range.first, range.second, name, []( const Property &property, boost::string_view key ) { return property.first < key; } );
+
+      if ( ( iter == range.second ) || ( iter->first != name ) ) {
+        return false;
+      }
+
+      value = iter->second;
+      return true;
+    }
+
+    void TokenEntries::defer( size_t first, decrypt_f decryptor ) {
+      if ( !pending ) {
+        pending.reset( new Pending );
+      }
+
+      pending->segments.emplace_back( first, std::move( decryptor ) );
+    }
+
+    void TokenEntries::decryptPending( const std::vector< size_t > &indexes ) {
+      std::vector< std::vector< size_t > > batches( pending->segments.size( ) );
+
+      /* Group the entries not decrypted yet by the query (segment) that appended them */
+      for ( auto index : indexes ) {
+        if ( rows[ index ].decrypted ) {
+          continue;
+        }
+
+        auto segment = std::upper_bound( pending->segments.begin( ),
+                                         pending->segments.end( ),
+                                         index,
+                                         []( size_t row, const std::pair< size_t, decrypt_f > &entry ) {
+                                           return row < entry.first;
+                                         } );
+
+        if ( segment != pending->segments.begin( ) ) {
+          batches[ ( segment - pending->segments.begin( ) ) - 1 ].push_back( index );
+        }
+      }
+
+      for ( size_t num = 0; num < batches.size( ); ++num ) {
+        if ( !batches[ num ].empty( ) ) {
+          pending->segments[ num ].second( *this, batches[ num ] );
+
+          /* Entries without an encrypted value are done as well */
+          for ( auto index : batches[ num ] ) {
+            rows[ index ].decrypted = true;
+          }
+        }
+      }
+    }
+
+    boost::string_view TokenEntries::value( const CompactEntry &entry ) {
+      if ( pending ) {
+        std::lock_guard< std::mutex > guard( pending->lock );
+
+        if ( !entry.decrypted ) {
+          decryptPending( { static_cast< size_t >( &entry - rows.data( ) ) } );
+        }
+      }
+
+      return entry.value;
+    }
+
+    void TokenEntries::decrypt( size_t first, size_t count ) {
+      std::vector< size_t > indexes;
+
+      for ( auto index = first; ( index < rows.size( ) ) && ( index - first < count ); ++index ) {
+        indexes.push_back( index );
+      }
+
+      decrypt( indexes );
+    }
+
+    void TokenEntries::decrypt( const std::vector< size_t > &indexes ) {
+      if ( pending ) {
+        std::lock_guard< std::mutex > guard( pending->lock );
+
+        decryptPending( indexes );
+      }
+    }
+
+    TokenEntry TokenEntries::expand( const CompactEntry &entry ) {
+      TokenEntry rc;
+      auto       range = properties( entry );
+
+      rc.encKey     = entry.encKey.to_string( );
+      rc.token      = entry.token.to_string( );
+      rc.hmac       = bytea( entry.hmacBytes.begin( ), entry.hmacBytes.begin( ) + entry.hmacSize );
+      rc.crypt      = bytea( entry.crypt.begin( ), entry.crypt.end( ) );
+      rc.mask       = entry.mask.to_string( );
+      rc.value      = value( entry ).to_string( );
+      rc.expiration = entry.expiration;
+
+      for ( auto property = range.first; property != range.second; ++property ) {
+        rc.properties[ property->first.to_string( ) ] = property->second.to_string( );
+      }
+
+      return rc;
+    }
+  } // namespace api
+} // namespace token
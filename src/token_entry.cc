@@ -1,23 +1,110 @@
 
 #include "token/api.hh"
-#include <iostream>
-#include <nlohmann/json.hpp>
 
 namespace token {
   namespace api {
     using map_t = std::map< std::string, std::string >;
 
-    bytea TokenEntry::serialize( const map_t &map ) { return nlohmann::json::to_cbor( nlohmann::json{ map } ); }
+    /** Names of the token entry columns, by TokenEntry::Columns::Column */
+    static const char *COLUMN_NAMES[] = { "enckey", "token", "hmac", "crypt", "mask", "expiration", "properties" };
+
+    constexpr size_t TokenEntry::Columns::npos;
+
+    TokenEntry::Columns::Columns( std::initializer_list< Column > columns ) {
+      size_t ordinal = 0;
+
+      ordinals.fill( npos );
+
+      for ( auto column : columns ) {
+        if ( ordinal > 0 ) {
+          select.append( ", " );
+        }
+
+        select.append( COLUMN_NAMES[ column ] );
+        ordinals[ column ] = ordinal++;
+      }
+    }
+
+    const TokenEntry::Columns &TokenEntry::Columns::all( ) {
+      static const Columns columns{ ENCKEY, TOKEN, HMAC, CRYPT, MASK, EXPIRATION, PROPERTIES };
+      return columns;
+    }
+
+    void TokenEntry::load( dbcpp::ResultSet &                                  results,
+                           bool                                                numeric,
+                           const std::shared_ptr< const PropertyDictionary > &names,
+                           const Columns &                                     columns ) {
+      /* The raw value is not stored, it is kept for the caller to decrypt into */
+      encKey.clear( );
+      token.clear( );
+      hmac.clear( );
+      crypt.clear( );
+      mask.clear( );
+      expiration = dbcpp::DBTime( );
+      properties.clear( );
+
+      if ( columns.has( Columns::ENCKEY ) ) {
+        encKey = results.get< std::string >( columns[ Columns::ENCKEY ] );
+      }
+
+      if ( columns.has( Columns::TOKEN ) ) {
+        token = numeric ? unpack( results.get< uint64_t >( columns[ Columns::TOKEN ] ) )
+                        : results.get< std::string >( columns[ Columns::TOKEN ] );
+      }
+
+      if ( columns.has( Columns::HMAC ) ) {
+        hmac = results.get< bytea >( columns[ Columns::HMAC ] );
+      }
+
+      if ( columns.has( Columns::CRYPT ) ) {
+        crypt = results.get< bytea >( columns[ Columns::CRYPT ] );
+      }
+
+      if ( columns.has( Columns::MASK ) ) {
+        mask = results.get< std::string >( columns[ Columns::MASK ] );
+      }
+
+      if ( columns.has( Columns::EXPIRATION ) ) {
+        expiration = results.get< dbcpp::DBTime >( columns[ Columns::EXPIRATION ] );
+      }
+
+      if ( columns.has( Columns::PROPERTIES ) ) {
+        properties.assign( results.get< bytea >( columns[ Columns::PROPERTIES ] ), names );
+      }
+    }
+
+    bytea TokenEntry::serialize( const map_t &map ) { return Properties( map ).encode( ); }
 
     map_t TokenEntry::deserialize( const bytea &bytes ) {
-      map_t result{ };
-      auto  json = nlohmann::json::from_cbor( bytes );
+      Properties properties;
+
+      properties.assign( bytes );
 
-      for ( auto &entry : json[ 0 ].items( ) ) {
-        result[ entry.key( ) ] = entry.value( ).get< std::string >( );
+      return properties.map( );
+    }
+
+    uint64_t TokenEntry::pack( const std::string &token ) {
+      uint64_t rc = 1;
+
+      if ( ( token.empty( ) ) || ( token.size( ) > 18 ) ) {
+        return 0;
       }
 
-      return result;
+      for ( auto ch : token ) {
+        if ( ( ch < '0' ) || ( ch > '9' ) ) {
+          return 0;
+        }
+
+        rc = rc * 10 + static_cast< uint64_t >( ch - '0' );
+      }
+
+      return rc;
+    }
+
+    std::string TokenEntry::unpack( uint64_t packed ) {
+      auto digits = std::to_string( packed );
+
+      return packed ? digits.substr( 1 ) : std::string( );
     }
   } // namespace api
 } // namespace token
@@ -1,6 +1,9 @@
 
+#include "drbg.hh"
 #include "token/api.hh"
+#include "token/api/core/arena.hh"
 #include <boost/thread/shared_lock_guard.hpp>
+#include <chrono>
 #include <functional>
 #include <spdlog/spdlog.h>
 
@@ -19,136 +22,743 @@ namespace token {
     std::shared_ptr< spdlog::logger > logger = token::api::create_logger( "token::api::manager", { } );
     boost::shared_mutex               TokenManager::generatorLock;
 
+    /** Smallest batch of values decrypted by a worker (see TokenManager::parallelDecrypt) */
+    static const size_t MIN_PARALLEL_BATCH = 64;
+
+    /* Select lists of the lookups not reading the encrypted value */
+    static const TokenEntry::Columns TOKEN_COLUMNS{ TokenEntry::Columns::TOKEN };
+    static const TokenEntry::Columns MASK_COLUMNS{ TokenEntry::Columns::TOKEN, TokenEntry::Columns::MASK };
+    static const TokenEntry::Columns METADATA_COLUMNS{
+      TokenEntry::Columns::TOKEN, TokenEntry::Columns::EXPIRATION, TokenEntry::Columns::PROPERTIES };
+
+    /**
+     * @brief Copy a name into per-thread storage, avoiding an allocation once warmed up
+     * @param name name
+     * @return thread local copy of the name, valid until the next call on this thread
+     */
+    static const std::string &scratch( boost::string_view name ) {
+      static thread_local std::string storage;
+      storage.assign( name.data( ), name.size( ) );
+      return storage;
+    }
+
+    /**
+     * @brief Decrypt directly into the storage of a string
+     * @param key encryption key
+     * @param crypt encrypted value
+     * @param value [out] decrypted value
+     */
+    static void decryptInto( const crypto::EncKey &key, const bytea &crypt, std::string &value ) {
+      size_t length = key->decryptedLength( crypt.size( ) );
+
+      /* Unknown size: a single call through the byte sequence method, rather than a retry */
+      if ( length == 0 ) {
+        auto plain = key->decrypt( crypt );
+
+        value.assign( plain.begin( ), plain.end( ) );
+        return;
+      }
+
+      value.resize( length );
+
+      auto required = key->decrypt( crypt.data( ), crypt.size( ), reinterpret_cast< uint8_t * >( &value[ 0 ] ), value.size( ) );
+
+      if ( required > value.size( ) ) {
+        value.resize( required );
+        required = key->decrypt( crypt.data( ), crypt.size( ), reinterpret_cast< uint8_t * >( &value[ 0 ] ), value.size( ) );
+      }
+
+      value.resize( required );
+    }
+
+    /**
+     * @brief Encrypt directly into the storage of a byte array
+     * @param key encryption key
+     * @param value value to encrypt
+     * @param crypt [out] encrypted value
+     */
+    static void encryptInto( const crypto::EncKey &key, boost::string_view value, bytea &crypt ) {
+      auto   data   = reinterpret_cast< const uint8_t * >( value.data( ) );
+      size_t length = key->encryptedLength( value.size( ) );
+
+      if ( length == 0 ) {
+        crypt = key->encrypt( bytea( data, data + value.size( ) ) );
+        return;
+      }
+
+      crypt.resize( length );
+
+      auto required = key->encrypt( data, value.size( ), crypt.data( ), crypt.size( ) );
+
+      if ( required > crypt.size( ) ) {
+        crypt.resize( required );
+        required = key->encrypt( data, value.size( ), crypt.data( ), crypt.size( ) );
+      }
+
+      crypt.resize( required );
+    }
+
+    /**
+     * @brief Hash directly into the storage of a byte array
+     * @param key HMAC key
+     * @param value value to hash
+     * @param hmac [out] hashed value
+     */
+    static void hashInto( const crypto::MacKey &key, boost::string_view value, bytea &hmac ) {
+      auto   data   = reinterpret_cast< const uint8_t * >( value.data( ) );
+      size_t length = key->hashLength( );
+
+      if ( length == 0 ) {
+        hmac = key->hash( bytea( data, data + value.size( ) ) );
+        return;
+      }
+
+      hmac.resize( length );
+
+      auto required = key->hash( data, value.size( ), hmac.data( ), hmac.size( ) );
+
+      if ( required > hmac.size( ) ) {
+        hmac.resize( required );
+        required = key->hash( data, value.size( ), hmac.data( ), hmac.size( ) );
+      }
+
+      hmac.resize( required );
+    }
+
+    /**
+     * @brief Map a failure raised by an operation to its result code
+     * @param storage token storage (classifies the database failures)
+     * @param error failure
+     * @return result code
+     */
+    static Result failure( core::TokenDB &storage, std::exception_ptr error ) noexcept {
+      try {
+        std::rethrow_exception( error );
+      } catch ( exceptions::TokenNoVaultError &ex ) {
+        return Result::NO_VAULT;
+      } catch ( exceptions::InvalidTokenFormat &ex ) {
+        return Result::INVALID;
+      } catch ( exceptions::TokenRangeError &ex ) {
+        return Result::INVALID;
+      } catch ( exceptions::TokenCryptographyError &ex ) {
+        return Result::CRYPTO;
+      } catch ( dbcpp::DBException &ex ) {
+        return storage.classify( std::string( ), ex );
+      } catch ( ... ) {
+        return Result::FAILED;
+      }
+    }
+
+    /**
+     * @brief Store the metadata (properties, expiration) of a vaultless token, replacing any
+     * metadata stored by an earlier tokenization of the value
+     * @param storage token storage
+     * @param table vault table name
+     * @param entry token entry (token, hmac, mask and metadata)
+     */
+    static void keep( core::TokenDB &storage, const std::string &table, TokenEntry &entry ) {
+      std::exception_ptr error;
+      auto               result = storage.tryInsert( table, entry, &error );
+
+      if ( result == Result::OK ) {
+        return;
+      }
+
+      /* Only an entry already stored is replaced: any other failure is the caller's */
+      if ( ( result != Result::DUPLICATE_TOKEN ) && ( result != Result::DUPLICATE_HMAC ) ) {
+        if ( error ) {
+          std::rethrow_exception( error );
+        }
+
+        throw exceptions::TokenSQLError( describe( result ) );
+      }
+
+      LOG( debug, "Token {} already stored in {}, updating", entry.token, table );
+      storage.update( table, entry );
+    }
+
     TokenEntry TokenManager::tokenize( const std::string &vault, const std::string &value, TokenEntry *data ) {
+      auto rc = TokenEntry( );
+
+      if ( data != nullptr ) {
+        rc.token      = data->token;
+        rc.expiration = data->expiration;
+        rc.properties = data->properties;
+      }
+
+      tokenize( boost::string_view( vault ), boost::string_view( value ), rc );
+
+      return rc;
+    }
+
+    void TokenManager::tokenize( boost::string_view vault, boost::string_view value, TokenEntry &rc ) {
+      std::exception_ptr error;
+      auto               result = tokenize( getVaultInfo( scratch( vault ) ), value, rc, &error );
+
+      if ( result != Result::OK ) {
+        if ( error ) {
+          std::rethrow_exception( error );
+        }
+
+        throw exceptions::TokenSQLError( describe( result ) );
+      }
+    }
+
+    Result TokenManager::tryTokenize( boost::string_view vault, boost::string_view value, TokenEntry &rc ) noexcept {
+      try {
+        return tokenize( getVaultInfo( scratch( vault ) ), value, rc, nullptr );
+      } catch ( ... ) {
+        return failure( *storage, std::current_exception( ) );
+      }
+    }
+
+    Result TokenManager::tokenize( core::SharedVault  vaultInfo,
+                                   boost::string_view value,
+                                   TokenEntry &       rc,
+                                   std::exception_ptr *error ) {
       static const size_t MAX_RETRIES = 10;
 
-      auto rc        = TokenEntry( );
-      auto vaultInfo = getVaultInfo( vault );
+      auto &name = vaultInfo->alias;
 
       LOG( info,
            "Preparing to tokenize value for {} a {} vault",
-           vault,
+           name,
            vaultInfo->durable ? "durable" : "transactional" );
 
-      if ( vaultInfo->durable ) {
-        LOG( info, "Retrieving existing token from vault {}", vault );
+      rc.encKey.clear( );
+      rc.hmac.clear( );
+      rc.crypt.clear( );
+      rc.mask.clear( );
+      rc.value.clear( );
 
-        auto entries = retrieve( vault, value );
+      if ( vaultInfo->vaultless( ) ) {
+        auto token = derive( vaultInfo, value, true, &rc.mask );
+
+        if ( ( !rc.token.empty( ) ) && ( rc.token != token ) ) {
+          throw exceptions::TokenGenerationError( "Supplied tokens are not supported by vaultless vault " + name );
+        }
+
+        rc.token = std::move( token );
+        rc.value.assign( value.data( ), value.size( ) );
+
+        /* Storage only keeps what can not be derived: the metadata, or the tokens issued */
+        if ( ( vaultInfo->revocable( ) ) || ( !rc.properties.empty( ) ) || ( rc.expiration != dbcpp::DBTime( ) ) ) {
+          LOG( trace, "Storing entry for vault {} token {}", name, rc.token );
+
+          hashInto( vaultInfo->macKey, value, rc.hmac );
+          keep( *storage, vaultInfo->table, rc );
+        }
+
+        goto finish;
+      }
+
+      if ( ( vaultInfo->durable ) && ( !vaultInfo->derived( ) ) ) {
+        LOG( info, "Retrieving existing token from vault {}", name );
+
+        hashInto( vaultInfo->macKey, value, rc.hmac );
+
+        auto entries = storage->get( vaultInfo->table, rc.hmac );
 
         if ( !entries.empty( ) ) {
-          rc = entries[ 0 ];
+          /* The hmac matched: the stored value is the one being tokenized, no need to decrypt it */
+          rc = std::move( entries[ 0 ] );
+          rc.value.assign( value.data( ), value.size( ) );
 
           goto finish;
         }
       }
 
-      if ( data != nullptr ) {
-        if ( !data->token.empty( ) ) {
-          LOG( debug, "Using supplied token {} for vault {}", vault, data->token );
+      if ( !rc.token.empty( ) ) {
+        if ( vaultInfo->derived( ) ) {
+          throw exceptions::TokenGenerationError( "Supplied tokens are not supported by derived vault " + name );
+        }
 
-          rc.token = data->token;
+        /* Permuted tokens are unique by construction only: a supplied token may be generated later */
+        if ( vaultInfo->permuted( ) ) {
+          throw exceptions::TokenGenerationError( "Supplied tokens are not supported by permuted vault " + name );
         }
 
-        rc.expiration = data->expiration;
-        rc.properties = data->properties;
+        LOG( debug, "Using supplied token {} for vault {}", rc.token, name );
+      }
+
+      prepare( vaultInfo, value, rc );
+
+      for ( size_t num = 0;; ++num ) {
+        auto result = storage->tryInsert( vaultInfo->table, rc, error );
+
+        if ( result == Result::OK ) {
+          break;
+        }
+
+        LOG( warn, "Failed to insert token {} into vault {}: {}", rc.token, name, describe( result ) );
+
+        if ( vaultInfo->derived( ) ) {
+          auto existing = storage->get( vaultInfo->table, rc.token );
+
+          if ( ( !existing.token.empty( ) ) && ( existing.hmac == rc.hmac ) ) {
+            LOG( info, "Value already tokenized concurrently in vault {}", name );
+
+            rc = std::move( existing );
+            rc.value.assign( value.data( ), value.size( ) );
+
+            goto finish;
+          }
+
+          if ( !existing.token.empty( ) ) {
+            result = Result::DUPLICATE_TOKEN;
+          }
+        } else if ( result == Result::DUPLICATE ) {
+          LOG( debug, "Failure on {} for {} did not identify the duplicate entry, performing lookup", name, rc.token );
+
+          if ( !storage->get( vaultInfo->table, rc.token ).token.empty( ) ) {
+            result = Result::DUPLICATE_TOKEN;
+          }
+        }
+
+        /* A durable vault holds one token per value: adopt the one inserted concurrently */
+        if ( ( vaultInfo->durable ) && ( ( result == Result::DUPLICATE_HMAC ) || ( result == Result::DUPLICATE ) ) ) {
+          auto entries = storage->get( vaultInfo->table, rc.hmac );
+
+          if ( !entries.empty( ) ) {
+            LOG( info, "Value already tokenized concurrently in vault {}", name );
+
+            rc = std::move( entries[ 0 ] );
+            rc.value.assign( value.data( ), value.size( ) );
+
+            goto finish;
+          }
+        }
+
+        if ( result != Result::DUPLICATE_TOKEN ) {
+          LOG( debug, "{} is not a duplicate for vault {}", rc.token, name );
+          return result;
+        }
+
+        if ( num >= ( MAX_RETRIES - 1 ) ) {
+          LOG( warn, "Maximum retries for tokenize operation failed against vault {}", name );
+          return result;
+        }
+
+        LOG( info, "Regenerating token for vault {}", name );
+
+        if ( vaultInfo->permuted( ) ) {
+          rc.token = permute( vaultInfo, rc.value, nullptr );
+        } else if ( vaultInfo->derived( ) ) {
+          rc.token = generate( vaultInfo, rc.value, rc.hmac, num + 1, nullptr );
+        } else {
+          rc.token = generate( vaultInfo, rc.value, nullptr );
+        }
+      }
+
+    finish:
+      LOG( info, "Successfully tokenized value for vault {}: {}", name, rc.token );
+
+      return Result::OK;
+    }
+
+    void TokenManager::prepare( core::SharedVault vaultInfo, boost::string_view value, TokenEntry &rc ) {
+      core::Arena::Scope scope;
+      auto &             vault = vaultInfo->alias;
+
+      rc.value.assign( value.data( ), value.size( ) );
+
+      if ( rc.hmac.empty( ) ) {
+        LOG( trace, "Hashing value for vault {}", vault );
+        hashInto( vaultInfo->macKey, value, rc.hmac );
       }
 
       if ( rc.token.empty( ) ) {
         LOG( trace, "Generating token for vault {}", vault );
 
-        rc.token = generate( vaultInfo, value, &rc.mask );
+        if ( vaultInfo->permuted( ) ) {
+          rc.token = permute( vaultInfo, rc.value, &rc.mask );
+        } else if ( vaultInfo->derived( ) ) {
+          rc.token = generate( vaultInfo, rc.value, rc.hmac, 0, &rc.mask );
+        } else if ( ( !candidates ) || ( !candidates->take( vaultInfo, rc.value, rc.token, &rc.mask ) ) ) {
+          rc.token = generate( vaultInfo, rc.value, &rc.mask );
+        }
 
         LOG( trace, "Generated token {} for vault {}", rc.token, vault );
       }
 
-      rc.value = value;
-
-      LOG( trace, "Hashing value for token {} from vault {}", rc.token, vault );
-      rc.hmac = vaultInfo->macKey->hash( value );
-
       LOG( trace, "Encrypting value for token {} from vault {}", rc.token, vault );
-      rc.crypt = vaultInfo->encKey->encrypt( value );
+      encryptInto( vaultInfo->encKey, value, rc.crypt );
 
       if ( !vaultInfo->encKey->isVersioned( ) ) {
         LOG( trace, "Saving unversioned key for {} from {}", rc.token, vault );
 
         rc.encKey = vaultInfo->encKeyName;
       }
+    }
 
-      for ( size_t num = 0;; ++num ) {
-        try {
-          storage->insert( vaultInfo->table, rc );
+    void TokenManager::prepare( core::SharedVault vaultInfo, const std::vector< TokenEntry * > &entries ) {
+      std::vector< crypto::bytes_view > values;
+      std::vector< crypto::bytes_view > unhashed;
+      std::vector< bytea >              outputs;
+      core::Arena::Scope                scope;
+      auto &                            vault = vaultInfo->alias;
 
-          break;
-        } catch ( dbcpp::DBException &ex ) {
-          LOG( warn, "Failed to insert token {} into vault {}: {}", rc.token, vault, ex.what( ) );
+      LOG( trace, "Preparing {} entries for vault {}", entries.size( ), vault );
 
-          bool        is_token_dup = false;
-          std::string err          = ex.what( );
+      values.reserve( entries.size( ) );
 
-          std::transform( err.begin( ), err.end( ), err.begin( ), ::toupper );
+      for ( auto entry : entries ) {
+        values.emplace_back( entry->value );
+
+        if ( entry->hmac.empty( ) ) {
+          unhashed.emplace_back( entry->value );
+        }
+      }
 
-          is_token_dup = ( ( err.find( "UNIQUE" ) != std::string::npos ) && //
-                           ( err.find( "TOKEN" ) != std::string::npos ) );
+      if ( !unhashed.empty( ) ) {
+        LOG( trace, "Hashing {} values for vault {}", unhashed.size( ), vault );
+        vaultInfo->macKey->hashBatch( unhashed, outputs );
 
-          if ( !is_token_dup ) {
-            LOG( debug,
-                 "Exception on {} for {} did not identify if it is a duplicate entry, performing lookup",
-                 vault,
-                 rc.token );
+        auto hash = outputs.begin( );
 
-            is_token_dup = !storage->get( vaultInfo->table, rc.token ).token.empty( );
+        for ( auto entry : entries ) {
+          if ( entry->hmac.empty( ) ) {
+            entry->hmac = std::move( *hash++ );
           }
+        }
+      }
 
-          if ( !is_token_dup ) {
-            LOG( debug, "{} is not a duplicate for vault {}", rc.token, vault );
-            throw ex;
+      for ( auto entry : entries ) {
+        if ( entry->token.empty( ) ) {
+          if ( vaultInfo->permuted( ) ) {
+            entry->token = permute( vaultInfo, entry->value, &entry->mask );
+          } else if ( vaultInfo->derived( ) ) {
+            entry->token = generate( vaultInfo, entry->value, entry->hmac, 0, &entry->mask );
+          } else if ( ( !candidates ) || ( !candidates->take( vaultInfo, entry->value, entry->token, &entry->mask ) ) ) {
+            entry->token = generate( vaultInfo, entry->value, &entry->mask );
           }
+        }
+      }
+
+      LOG( trace, "Encrypting {} values for vault {}", values.size( ), vault );
+      vaultInfo->encKey->encryptBatch( values, outputs );
+
+      for ( size_t num = 0; num < entries.size( ); ++num ) {
+        entries[ num ]->crypt = std::move( outputs[ num ] );
+
+        if ( !vaultInfo->encKey->isVersioned( ) ) {
+          entries[ num ]->encKey = vaultInfo->encKeyName;
+        }
+      }
+    }
+
+    std::vector< bytea > TokenManager::decrypt( core::SharedVault                        vaultInfo,
+                                                const std::vector< boost::string_view > &keys,
+                                                const std::vector< crypto::bytes_view > &crypts ) {
+      std::map< boost::string_view, std::vector< size_t > >             groups;
+      std::vector< std::pair< crypto::EncKey, std::vector< size_t > > > batches;
+      std::vector< bytea >                                              rc( crypts.size( ) );
+      size_t                                                            total = 0;
+
+      for ( size_t num = 0; num < crypts.size( ); ++num ) {
+        if ( crypts[ num ].size > 0 ) {
+          groups[ keys[ num ] ].push_back( num );
+          ++total;
+        }
+      }
 
-          if ( num >= ( MAX_RETRIES - 1 ) ) {
-            LOG( warn, "Maximum retries for tokenize operation failed against vault {}", vault );
-            throw ex;
+      /* Above the threshold, the groups are split into a few batches per worker */
+      auto parallel = ( decryptPool ) && ( decryptPool->size( ) > 0 ) && ( total >= decryptThreshold );
+      auto size     = parallel ? std::max( MIN_PARALLEL_BATCH, total / ( decryptPool->size( ) * 4 ) + 1 ) : total;
+
+      for ( auto &group : groups ) {
+        auto key = vaultInfo->encKey;
+
+        if ( !group.first.empty( ) ) {
+          LOG( trace, "Getting encryption key {} for vault {}", group.first.to_string( ), vaultInfo->alias );
+
+          if ( !( key = provider->getEncKey( group.first.to_string( ) ) ) ) {
+            throw exceptions::TokenCryptographyError( "Error acquiring key: " + group.first.to_string( ) );
           }
+        }
 
-          LOG( info, "Regenerating token for vault {}", vault );
+        for ( auto first = group.second.begin( ); first != group.second.end( ); ) {
+          auto last = first + std::min( size, static_cast< size_t >( group.second.end( ) - first ) );
 
-          rc.token = generate( vaultInfo, value, nullptr );
+          batches.emplace_back( key, std::vector< size_t >( first, last ) );
+          first = last;
         }
       }
 
-    finish:
-      LOG( info, "Successfully tokenized value for vault {}: {}", vault, rc.token );
+      LOG( trace, "Decrypting {} entries from vault {} in {} batches", total, vaultInfo->alias, batches.size( ) );
+
+      auto run = [ & ]( size_t index ) {
+        std::vector< crypto::bytes_view > inputs;
+        std::vector< bytea >              outputs;
+        auto &                            batch = batches[ index ];
+
+        for ( auto num : batch.second ) {
+          inputs.push_back( crypts[ num ] );
+        }
+
+        batch.first->decryptBatch( inputs, outputs );
+
+        for ( size_t num = 0; num < batch.second.size( ); ++num ) {
+          rc[ batch.second[ num ] ] = std::move( outputs[ num ] );
+        }
+      };
+
+      if ( parallel ) {
+        decryptPool->run( batches.size( ), run );
+      } else {
+        for ( size_t index = 0; index < batches.size( ); ++index ) {
+          run( index );
+        }
+      }
 
       return rc;
     }
 
+    void TokenManager::decrypt( core::SharedVault vaultInfo, std::vector< TokenEntry > &entries ) {
+      std::vector< boost::string_view > keys;
+      std::vector< crypto::bytes_view > crypts;
+
+      if ( vaultInfo->vaultless( ) ) {
+        for ( auto &entry : entries ) {
+          entry.value = derive( vaultInfo, entry.token, false, nullptr );
+        }
+
+        return;
+      }
+
+      for ( auto &entry : entries ) {
+        keys.emplace_back( entry.encKey );
+        crypts.emplace_back( entry.crypt );
+      }
+
+      auto values = decrypt( vaultInfo, keys, crypts );
+
+      for ( size_t num = 0; num < entries.size( ); ++num ) {
+        if ( !entries[ num ].crypt.empty( ) ) {
+          entries[ num ].value.assign( values[ num ].begin( ), values[ num ].end( ) );
+        }
+      }
+    }
+
+    void TokenManager::decrypt( core::SharedVault             vaultInfo,
+                                TokenEntries &                entries,
+                                const std::vector< size_t > &rows ) {
+      std::vector< boost::string_view > keys;
+      std::vector< crypto::bytes_view > crypts;
+
+      if ( vaultInfo->vaultless( ) ) {
+        for ( auto num : rows ) {
+          entries.assign( num, derive( vaultInfo, entries[ num ].token, false, nullptr ) );
+        }
+
+        return;
+      }
+
+      for ( auto num : rows ) {
+        auto &crypt = entries[ num ].crypt;
+
+        keys.push_back( entries[ num ].encKey );
+        crypts.emplace_back( reinterpret_cast< const uint8_t * >( crypt.data( ) ), crypt.size( ) );
+      }
+
+      auto values = decrypt( vaultInfo, keys, crypts );
+
+      for ( size_t num = 0; num < rows.size( ); ++num ) {
+        if ( !entries[ rows[ num ] ].crypt.empty( ) ) {
+          auto &value = values[ num ];
+          auto  text  = reinterpret_cast< const char * >( value.data( ) );
+
+          entries.assign( rows[ num ], boost::string_view( text, value.size( ) ) );
+        }
+      }
+    }
+
     TokenEntry TokenManager::detokenize( const std::string &vault, const std::string &token ) {
-      LOG( info, "Detokenizing value for vault {} token {}", vault, token );
-      LOG( trace, "Getting vault info for {}", vault );
+      auto entry = TokenEntry( );
 
-      auto vaultInfo = getVaultInfo( vault );
-      auto entry     = storage->get( vaultInfo->table, token );
-      auto key       = vaultInfo->encKey;
+      detokenize( boost::string_view( vault ), boost::string_view( token ), entry );
 
-      if ( !entry.encKey.empty( ) ) {
-        LOG( trace, "Getting encryption key for vault {} token {}", vault, token );
-        key = provider->getEncKey( entry.encKey );
+      return entry;
+    }
+
+    bool TokenManager::detokenize( boost::string_view vault, boost::string_view token, TokenEntry &entry ) {
+      LOG( trace, "Getting vault info for detokenization" );
+
+      auto  vaultInfo = getVaultInfo( scratch( vault ) );
+      auto &name      = vaultInfo->alias;
+      auto &tokenName = scratch( token );
+
+      LOG( info, "Detokenizing value for vault {} token {}", name, tokenName );
+
+      if ( vaultInfo->vaultless( ) ) {
+        std::string mask;
+        std::string value;
+
+        try {
+          value = derive( vaultInfo, token, false, &mask );
+        } catch ( exceptions::TokenRangeError &ex ) {
+          LOG( info, "Token {} is not valid for vault {}: {}", tokenName, name, ex.what( ) );
+          entry.clear( );
+          return false;
+        }
+
+        if ( !vaultInfo->readsEntry( ) ) {
+          entry.clear( );
+          entry.token = tokenName;
+          entry.value = std::move( value );
+          entry.mask  = std::move( mask );
+
+          LOG( info, "Successfully derived value for vault {} token {}", name, entry.token );
+
+          return true;
+        }
+
+        /* The stored entry tells a token that was issued (and not removed) from a forged one */
+        if ( !storage->get( vaultInfo->table, tokenName, entry ) ) {
+          if ( vaultInfo->revocable( ) ) {
+            LOG( info, "No entry found for vault {} token {}", name, tokenName );
+            return false;
+          }
+
+          entry.token = tokenName;
+        }
+
+        auto now = dbcpp::DBTime(
+          std::chrono::duration_cast< std::chrono::seconds >( std::chrono::system_clock::now( ).time_since_epoch( ) ) );
+
+        if ( ( entry.expiration != dbcpp::DBTime( ) ) && ( entry.expiration <= now ) ) {
+          LOG( info, "Token {} of vault {} has expired", tokenName, name );
+          entry.clear( );
+          return false;
+        }
+
+        entry.value = std::move( value );
+
+        if ( entry.mask.empty( ) ) {
+          entry.mask = std::move( mask );
+        }
+
+        LOG( info, "Successfully derived value for vault {} token {}", name, entry.token );
+
+        return true;
+      }
+
+      if ( !storage->get( vaultInfo->table, tokenName, entry ) ) {
+        LOG( info, "No entry found for vault {} token {}", name, tokenName );
+        return false;
       }
 
+      entry.value.clear( );
+
       if ( !entry.crypt.empty( ) ) {
-        LOG( trace, "Decrypting value for vault {} token {}", vault, token );
+        auto key = vaultInfo->encKey;
 
-        auto dec    = key->decrypt( entry.crypt );
-        entry.value = std::string( dec.begin( ), dec.end( ) );
+        if ( !entry.encKey.empty( ) ) {
+          LOG( trace, "Getting encryption key for vault {} token {}", name, entry.token );
+          key = provider->getEncKey( entry.encKey );
+        }
+
+        LOG( trace, "Decrypting value for vault {} token {}", name, entry.token );
+        decryptInto( key, entry.crypt, entry.value );
       }
 
-      LOG( info, "Successfully retrieved value for vault {} token {}", vault, token );
+      LOG( info, "Successfully retrieved value for vault {} token {}", name, entry.token );
 
-      return entry;
+      return true;
+    }
+
+    Result TokenManager::tryDetokenize( boost::string_view vault, boost::string_view token, TokenEntry &entry ) noexcept {
+      try {
+        return detokenize( vault, token, entry ) ? Result::OK : Result::NOT_FOUND;
+      } catch ( ... ) {
+        entry.clear( );
+        return failure( *storage, std::current_exception( ) );
+      }
+    }
+
+    bool TokenManager::lookup( boost::string_view vault, boost::string_view value, std::string &token ) {
+      auto  vaultInfo = getVaultInfo( scratch( vault ) );
+      auto &name      = vaultInfo->alias;
+
+      LOG( info, "Performing token-only lookup by value for vault {}", name );
+
+      token.clear( );
+
+      if ( ( vaultInfo->vaultless( ) ) && ( !vaultInfo->revocable( ) ) ) {
+        try {
+          token = derive( vaultInfo, value, true, nullptr );
+        } catch ( exceptions::TokenRangeError &ex ) {
+          LOG( info, "Value is not valid for vault {}: {}", name, ex.what( ) );
+          return false;
+        }
+
+        return true;
+      }
+
+      bytea hmac;
+
+      hashInto( vaultInfo->macKey, value, hmac );
+
+      auto entries = storage->get( vaultInfo->table, hmac, TOKEN_COLUMNS );
+
+      if ( entries.empty( ) ) {
+        LOG( info, "No token found for value in vault {}", name );
+        return false;
+      }
+
+      token = std::move( entries[ 0 ].token );
+
+      return true;
+    }
+
+    bool TokenManager::mask( boost::string_view vault, boost::string_view token, std::string &mask ) {
+      auto  vaultInfo = getVaultInfo( scratch( vault ) );
+      auto &name      = vaultInfo->alias;
+      auto &tokenName = scratch( token );
+
+      LOG( info, "Getting mask for vault {} token {}", name, tokenName );
+
+      mask.clear( );
+
+      if ( vaultInfo->vaultless( ) ) {
+        try {
+          mask = deriveMask( vaultInfo, token );
+        } catch ( exceptions::TokenRangeError &ex ) {
+          LOG( info, "Token {} is not valid for vault {}: {}", tokenName, name, ex.what( ) );
+          return false;
+        }
+
+        return true;
+      }
+
+      TokenEntry entry;
+
+      if ( !storage->get( vaultInfo->table, tokenName, entry, MASK_COLUMNS ) ) {
+        LOG( info, "No entry found for vault {} token {}", name, tokenName );
+        return false;
+      }
+
+      mask = std::move( entry.mask );
+
+      return true;
+    }
+
+    bool TokenManager::metadata( boost::string_view vault, boost::string_view token, TokenEntry &entry ) {
+      auto  vaultInfo = getVaultInfo( scratch( vault ) );
+      auto &name      = vaultInfo->alias;
+      auto &tokenName = scratch( token );
+
+      LOG( info, "Getting metadata for vault {} token {}", name, tokenName );
+
+      if ( !storage->get( vaultInfo->table, tokenName, entry, METADATA_COLUMNS ) ) {
+        LOG( info, "No entry found for vault {} token {}", name, tokenName );
+        return false;
+      }
+
+      return true;
     }
 
     std::vector< TokenEntry > TokenManager::retrieve( const std::string &vault, const std::string &value ) {
-      std::map< std::string, crypto::EncKey > keys;
       LOG( info, "Performing token lookup by value for vault {}", vault );
       LOG( trace, "Getting vault info for {}", vault );
       auto vaultInfo = getVaultInfo( vault );
@@ -157,23 +767,16 @@ namespace token {
       auto bytes   = vaultInfo->macKey->hash( value );
       auto entries = storage->get( vaultInfo->table, bytes );
 
-      for ( auto &entry : entries ) {
-        if ( !entry.crypt.empty( ) ) {
-          auto key = vaultInfo->encKey;
-
-          if ( !entry.encKey.empty( ) ) {
-            if ( !( key = keys[ entry.encKey ] ) ) {
-              LOG( trace, "Getting encryption key for vault {} token {}", vault, entry.token );
+      if ( ( entries.empty( ) ) && ( vaultInfo->vaultless( ) ) && ( !vaultInfo->revocable( ) ) ) {
+        LOG( trace, "Deriving token for lookup in vault {}", vault );
 
-              key                  = provider->getEncKey( entry.encKey );
-              keys[ entry.encKey ] = key;
-            }
-          }
+        entries.emplace_back( );
+        entries.back( ).token = derive( vaultInfo, value, true, &entries.back( ).mask );
+      }
 
-          LOG( trace, "Decrypting value for vault {} token {}", vault, entry.token );
-          auto dec    = key->decrypt( entry.crypt );
-          entry.value = std::string( dec.begin( ), dec.end( ) );
-        }
+      /* The entries match the hash of the value: it is their value, no need to decrypt it */
+      for ( auto &entry : entries ) {
+        entry.value = value;
       }
 
       LOG( info, "Successfully retrieved {} values from vault {}", entries.size( ), vault );
@@ -186,6 +789,29 @@ namespace token {
       LOG( trace, "Getting vault info for {}", vault );
       auto vaultInfo = getVaultInfo( vault );
 
+      if ( vaultInfo->vaultless( ) ) {
+        auto entry = TokenEntry( );
+
+        entry.token = token;
+
+        /* Only the revocable vaults store every token */
+        try {
+          storage->remove( vaultInfo->table, entry );
+        } catch ( exceptions::TokenSQLError &ex ) {
+          if ( vaultInfo->revocable( ) ) {
+            throw;
+          }
+
+          LOG( debug, "No metadata stored for token {} in vault {}", token, vault );
+        }
+
+        entry.value = derive( vaultInfo, token, false, &entry.mask );
+
+        LOG( info, "Successfully removed {} from vault {}", token, vault );
+
+        return entry;
+      }
+
       LOG( trace, "Removing token {} from vault {}", token, vault );
       auto entry = storage->remove( vaultInfo->table, token );
       auto key   = vaultInfo->encKey;
@@ -199,8 +825,7 @@ namespace token {
       if ( !entry.crypt.empty( ) ) {
         LOG( trace, "Decrypting value for vault {} token {}", vault, entry.token );
 
-        auto dec    = key->decrypt( entry.crypt );
-        entry.value = std::string( dec.begin( ), dec.end( ) );
+        decryptInto( key, entry.crypt, entry.value );
       }
 
       LOG( info, "Successfully removed {} from vault {}", token, vault );
@@ -218,6 +843,24 @@ namespace token {
       rc.expiration = entry.expiration;
       rc.properties = entry.properties;
 
+      if ( vaultInfo->vaultless( ) ) {
+        auto value = derive( vaultInfo, entry.token, false, &rc.mask );
+
+        if ( ( !entry.value.empty( ) ) && ( entry.value != value ) ) {
+          throw exceptions::TokenGenerationError( "The value of a token from vaultless vault " + vault +
+                                                  " can not change" );
+        }
+
+        rc.hmac = vaultInfo->macKey->hash( value );
+        keep( *storage, vaultInfo->table, rc );
+
+        entry.value = rc.value = std::move( value );
+
+        LOG( info, "Successfully updated {} from vault {}", entry.token, vault );
+
+        return rc;
+      }
+
       if ( !entry.value.empty( ) ) {
         LOG( trace, "Setting new value for vault {} token {}", vault, entry.token );
 
@@ -245,8 +888,7 @@ namespace token {
       if ( ( !rc.crypt.empty( ) ) && ( entry.value.empty( ) ) ) {
         LOG( trace, "Decrypting value for vault {} token {}", vault, entry.token );
 
-        auto dec    = vaultInfo->encKey->decrypt( entry.crypt );
-        entry.value = std::string( dec.begin( ), dec.end( ) );
+        decryptInto( vaultInfo->encKey, entry.crypt, entry.value );
       }
 
       LOG( info, "Successfully updated {} from vault {}", entry.token, vault );
@@ -268,44 +910,63 @@ namespace token {
       std::vector< TokenEntry > rc;
       auto                      vaultInfo = getVaultInfo( vault );
 
-      std::transform( values.begin( ), values.end( ), std::back_inserter( hmacs ), [ & ]( const std::string &value ) {
-        return vaultInfo->macKey->hash( value );
-      } );
+      vaultInfo->macKey->hashBatch( std::vector< crypto::bytes_view >( values.begin( ), values.end( ) ), hmacs );
 
       rc =
         storage->query( vaultInfo->table, tokens, hmacs, expirations, sortField, sortAsc, offset, limit, recordCount );
 
-      for ( auto &entry : rc ) {
-        if ( !entry.crypt.empty( ) ) {
-          auto key = vaultInfo->encKey;
+      decrypt( vaultInfo, rc );
 
-          if ( !entry.encKey.empty( ) ) {
-            key = provider->getEncKey( entry.encKey );
-          }
+      LOG( info, "Successfully found {} entries from querying vault {}", rc.size( ), vault );
 
-          LOG( trace, "Decrypting entry for token {} from vault {}", entry.token, vault );
+      return rc;
+    }
 
-          auto dec    = key->decrypt( entry.crypt );
-          entry.value = std::string( dec.begin( ), dec.end( ) );
-        }
-      }
+    void TokenManager::query( const std::string &                 vault,
+                              const std::vector< std::string > &  tokens,
+                              const std::vector< std::string > &  values,
+                              const std::vector< dbcpp::DBTime > &expirations,
+                              const std::string &                 sortField,
+                              bool                                sortAsc,
+                              size_t                              offset,
+                              size_t                              limit,
+                              TokenEntries &                      entries,
+                              size_t *                            recordCount ) {
+      LOG( info, "Performing query against vault {}", vault );
+      std::vector< bytea > hmacs;
+      auto                 vaultInfo = getVaultInfo( vault );
+      auto                 first     = entries.size( );
 
-      LOG( info, "Successfully found {} entries from querying vault {}", rc.size( ), vault );
+      vaultInfo->macKey->hashBatch( std::vector< crypto::bytes_view >( values.begin( ), values.end( ) ), hmacs );
 
-      return rc;
+      storage->query(
+        vaultInfo->table, tokens, hmacs, expirations, sortField, sortAsc, offset, limit, entries, recordCount );
+
+      /* Values are decrypted on first access, a batch per call */
+      entries.defer( first, [ this, vaultInfo ]( TokenEntries &set, const std::vector< size_t > &rows ) {
+        decrypt( vaultInfo, set, rows );
+      } );
+
+      LOG( info, "Successfully found {} entries from querying vault {}", entries.size( ) - first, vault );
     }
 
-    std::string TokenManager::generate( core::SharedVault vault, const std::string &value, std::string *mask ) {
+    std::string TokenManager::generate( core::SharedVault  vault,
+                                        const std::string &value,
+                                        std::string *      mask,
+                                        RandBytes          rand ) {
       Generator generator = nullptr;
-      auto      rand      = [ this ]( void *block, size_t length ) -> void { random( block, length ); };
+
+      if ( !rand ) {
+        rand = [ this ]( void *block, size_t length ) -> void { random( block, length ); };
+      }
 
       LOG( info, "Generating token against vault {} (format: {})", vault->alias, vault->format );
 
-      LOG( debug, "Looking up token generator format id {}", vault->format );
+      LOG( debug, "Looking up token generator format id {}", vault->tokenFormat( ) );
 
       {
         auto guard    = boost::shared_lock< boost::shared_mutex >( generatorLock );
-        auto iterator = generators.find( vault->format );
+        auto iterator = generators.find( vault->tokenFormat( ) );
 
         if ( iterator == generators.end( ) ) {
           LOG( critical, "Failed to find generator format {} for vault {}", vault->alias, vault->format );
@@ -323,6 +984,24 @@ namespace token {
       return token;
     }
 
+    std::string TokenManager::generate( core::SharedVault  vault,
+                                        const std::string &value,
+                                        const bytea &      hmac,
+                                        uint64_t           counter,
+                                        std::string *      mask ) {
+      bytea seed( hmac );
+
+      LOG( trace, "Deriving token {} for vault {}", counter, vault->alias );
+
+      for ( int shift = 56; shift >= 0; shift -= 8 ) {
+        seed.push_back( static_cast< uint8_t >( counter >> shift ) );
+      }
+
+      crypto::HmacDrbg drbg( seed.data( ), seed.size( ) );
+
+      return generate( vault, value, mask, [ &drbg ]( void *block, size_t length ) { drbg.generate( block, length ); } );
+    }
+
     Status TokenManager::status( ) {
       LOG( info, "Performing generic status using provider random" );
 
@@ -354,7 +1033,12 @@ namespace token {
       auto vaultInfo = getVaultInfo( vault );
 
       try {
-        vaultInfo->encKey->encrypt( vault );
+        if ( vaultInfo->vaultless( ) ) {
+          uint8_t block[ 16 ] = { };
+          vaultInfo->fpeKey->encryptBlocks( block, block, 1 );
+        } else {
+          vaultInfo->encKey->encrypt( vault );
+        }
       } catch ( std::exception &e ) {
         LOG( critical, "Status check for vault {} failed: crypto", vault );
         return STATUS_INOPERATIVE_CRYPTO;
@@ -388,10 +1072,23 @@ namespace token {
       vault.alias      = std::move( alias );
       vault.encKeyName = std::move( encKey );
       vault.macKeyName = std::move( macKey );
-      vault.durable    = durable;
+      vault.durable    = durable || vault.derived( );
+
+      auto card = ( vault.tokenFormat( ) >= L4_FORMAT ) && ( vault.tokenFormat( ) <= F6L4_NOLUHN_FORMAT );
+
+      /* Generated date tokens keep the digits of the value only; vaultless ones keep its separators */
+      auto date = ( vault.tokenFormat( ) == DATE_FORMAT ) && ( !vault.vaultless( ) );
+
+      if ( ( vault.numeric( ) ) && ( ( ( !card ) && ( !date ) ) || ( value_len > 18 ) ) ) {
+        throw exceptions::TokenRangeError( "Numeric token storage requires a card or date format of up to 18 digits" );
+      }
+
+      if ( ( !vault.vaultless( ) ) && ( ( format & ( core::VaultInfo::METADATA_BIT | core::VaultInfo::REVOCATION_BIT ) ) != 0 ) ) {
+        throw exceptions::TokenRangeError( "Vaultless entry options require the FF1 or FF3-1 mode" );
+      }
 
       if ( tableName.empty( ) ) {
-        vault.table = fmt::format( "{}{}_{}_{}", alias, value_len, format, suffixes[ durable ] );
+        vault.table = fmt::format( "{}{}_{}_{}", alias, value_len, format, suffixes[ vault.durable ] );
       } else {
         vault.table = std::move( tableName );
       }
@@ -402,6 +1099,11 @@ namespace token {
     bool TokenManager::rekeyVault( const std::string &vault, const std::string &encKey, bool deep ) {
       auto                                    vaultInfo = storage->getVault( vault );
       std::map< std::string, crypto::EncKey > cache;
+
+      if ( vaultInfo->vaultless( ) ) {
+        throw exceptions::TokenCryptographyError( "Vaultless vault " + vault + " can not be re-keyed" );
+      }
+
       core::recrypt_type                      doer =
         [ & ]( const std::string &destKey, const std::string &srcKey, const bytea &src ) -> bytea {
         bytea          decrypted;
@@ -0,0 +1,312 @@
+
+#include "fpe.hh"
+#include "luhn.hh"
+#include "preserved.hh"
+#include "token/api.hh"
+#include <spdlog/spdlog.h>
+
+#define LOG( lvl, fmt, ... )                                                                                           \
+  do {                                                                                                                 \
+    if ( vaultlessLogger->should_log( spdlog::level::lvl ) ) {                                                         \
+      vaultlessLogger->lvl( fmt, ##__VA_ARGS__ );                                                                      \
+    }                                                                                                                  \
+  } while ( 0 )
+
+namespace token {
+  namespace api {
+    /** Vaultless tokenization logger */
+    std::shared_ptr< spdlog::logger > vaultlessLogger = token::api::create_logger( "token::api::vaultless", { } );
+
+    namespace {
+      namespace fpe = crypto::fpe;
+
+      /** Maximum cycle walking steps before giving up on a value */
+      static const size_t MAX_WALK = 1000;
+
+      /* Alphabets, as used by the token generators */
+      const std::string NUMERICS = "0123456789";
+      const std::string UPPER    = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+      const std::string LOWER    = "abcdefghijklmnopqrstuvwxyz";
+      const std::string PUNCT    = "!@#$%^&*()-=_+{}[]:\";\'<>?,./";
+      const std::string ALPHA    = UPPER + LOWER;
+      const std::string ALL      = NUMERICS + UPPER + LOWER + PUNCT;
+
+      /**
+       * Format preserving layout of a value: the characters enciphered, and the alphabet of each
+       */
+      struct Layout {
+        std::vector< size_t >              positions;           /**< Enciphered character positions          */
+        std::vector< const std::string * > alphabets;           /**< Alphabet of each enciphered character   */
+        std::string                        skeleton;            /**< Input, enciphered characters as markers */
+        const Preserved *                  preserved = nullptr; /**< Card number digits, or nullptr          */
+
+        /**
+         * @brief Add a character to the enciphered domain
+         * @param position character position
+         * @param alphabet alphabet of the character
+         * @param marker skeleton marker (the same for a value and its token)
+         */
+        void add( size_t position, const std::string *alphabet, char marker ) {
+          positions.push_back( position );
+          alphabets.push_back( alphabet );
+          skeleton[ position ] = marker;
+        }
+      };
+
+      /**
+       * @brief Build the layout of a value (or token) for a token format
+       * @param vault vault information
+       * @param input value or token
+       * @return layout
+       */
+      Layout layout( const core::VaultInfo &vault, boost::string_view input ) {
+        Layout rc;
+        auto   format = vault.tokenFormat( );
+        auto   digits = preserved( format );
+
+        rc.skeleton.assign( input.data( ), input.size( ) );
+
+        if ( digits != nullptr ) {
+
+          if ( ( digits->front + digits->back ) >= input.size( ) ) {
+            throw exceptions::TokenRangeError( "Preserved lengths exceed the length of the value to tokenize" );
+          }
+
+          for ( size_t num = 0; num < input.size( ); ++num ) {
+            if ( ::isdigit( input[ num ] ) == 0 ) {
+              throw exceptions::TokenRangeError( "Card number formats only support digits" );
+            }
+
+            if ( ( num >= digits->front ) && ( num < input.size( ) - digits->back ) ) {
+              rc.add( num, &NUMERICS, '\1' );
+            }
+          }
+
+          rc.preserved = digits;
+
+          return rc;
+        }
+
+        for ( size_t num = 0; num < input.size( ); ++num ) {
+          char ch = input[ num ];
+
+          switch ( format ) {
+            case TokenManager::RANDOM_FORMAT:
+              if ( ALL.find( ch ) != std::string::npos ) {
+                rc.add( num, &ALL, '\1' );
+              }
+              break;
+            case TokenManager::FP_RANDOM_FORMAT:
+              if ( ::isdigit( ch ) != 0 ) {
+                rc.add( num, &NUMERICS, '\1' );
+              } else if ( ::isupper( ch ) != 0 ) {
+                rc.add( num, &UPPER, '\2' );
+              } else if ( ::islower( ch ) != 0 ) {
+                rc.add( num, &LOWER, '\3' );
+              }
+              break;
+            case TokenManager::DATE_FORMAT:
+              if ( ::isdigit( ch ) != 0 ) {
+                rc.add( num, &NUMERICS, '\1' );
+              }
+              break;
+            case TokenManager::EMAIL_FORMAT:
+              if ( ::isalpha( ch ) != 0 ) {
+                rc.add( num, &ALPHA, '\1' );
+              }
+              break;
+            default:
+              throw exceptions::InvalidTokenFormat( vault.alias, vault.format );
+          }
+        }
+
+        return rc;
+      }
+
+      /**
+       * @brief Luhn residue of a card number
+       * @param value card number
+       * @return residue (0 passes a Luhn check)
+       */
+      uint16_t residue( const std::string &value ) { return luhn::residue( value.begin( ), value.end( ) ); }
+
+      /**
+       * @brief Shift the Luhn residue of a card number by 5, by substituting one digit (applying
+       * the shift twice restores the number)
+       * @note Used by the NOLUHN formats: a valid card number (residue 0) maps to an invalid one
+       * @param value [in/out] card number
+       * @param position position of the digit to substitute
+       */
+      void shift( std::string &value, size_t position ) {
+        bool     doubled = ( ( value.size( ) - 1 - position ) % 2 ) == 1;
+        uint16_t target  = ( luhn::weight( value[ position ] - '0', doubled ) + 5 ) % 10;
+
+        for ( uint16_t digit = 0; digit < 10; ++digit ) {
+          if ( luhn::weight( digit, doubled ) == target ) {
+            value[ position ] = static_cast< char >( '0' + digit );
+            break;
+          }
+        }
+      }
+    } // namespace
+
+    std::string TokenManager::derive( core::SharedVault vault, boost::string_view input, bool encrypt, std::string *mask ) {
+      if ( ( vault->mode( ) != FF1_MODE ) && ( vault->mode( ) != FF3_1_MODE ) ) {
+        throw exceptions::InvalidTokenFormat( vault->alias, vault->format );
+      }
+
+      auto        info   = layout( *vault, input );
+      bool        ff3    = vault->mode( ) == FF3_1_MODE;
+      std::string output = input.to_string( );
+      bytea       tweak( vault->alias.begin( ), vault->alias.end( ) );
+      uint8_t     ff3Tweak[ fpe::FF3_TWEAK_LENGTH ] = { };
+      auto &      positions                         = info.positions;
+
+      LOG( trace, "Deriving {} for vault {} over {} characters", encrypt ? "token" : "value", vault->alias, positions.size( ) );
+
+      tweak.push_back( 0 );
+      tweak.insert( tweak.end( ), info.skeleton.begin( ), info.skeleton.end( ) );
+
+      if ( ff3 ) {
+        fpe::ff3Tweak( *vault->fpeKey, tweak, ff3Tweak );
+      }
+
+      std::vector< unsigned > radices;
+      fpe::Numerals           numerals;
+      bool                    uniform = true;
+
+      for ( size_t num = 0; num < positions.size( ); ++num ) {
+        radices.push_back( static_cast< unsigned >( info.alphabets[ num ]->size( ) ) );
+        numerals.push_back( static_cast< uint16_t >( info.alphabets[ num ]->find( input[ positions[ num ] ] ) ) );
+        uniform = uniform && ( radices[ num ] == radices[ 0 ] );
+      }
+
+      /* Mixed alphabets are enciphered as a binary string, walking back into the mixed domain */
+      unsigned radix  = uniform ? ( radices.empty( ) ? 10 : radices[ 0 ] ) : 2;
+      size_t   length = uniform ? numerals.size( ) : fpe::radixLength( radices, 2 );
+
+      if ( !fpe::supported( radix, length, ff3 ) ) {
+        throw exceptions::TokenRangeError( "Value does not fit the format preserving encryption domain of vault " +
+                                           vault->alias );
+      }
+
+      auto working = uniform ? numerals : fpe::toRadix( numerals, radices, 2, length );
+      auto step    = [ & ]( ) {
+        if ( ff3 ) {
+          encrypt ? fpe::ff3Encrypt( *vault->fpeKey, radix, ff3Tweak, working )
+                  : fpe::ff3Decrypt( *vault->fpeKey, radix, ff3Tweak, working );
+        } else {
+          encrypt ? fpe::ff1Encrypt( *vault->fpeKey, radix, tweak, working )
+                  : fpe::ff1Decrypt( *vault->fpeKey, radix, tweak, working );
+        }
+      };
+      auto store = [ & ]( ) -> bool {
+        if ( !uniform && !fpe::fromRadix( working, 2, radices, numerals ) ) {
+          return false;
+        }
+
+        for ( size_t num = 0; num < positions.size( ); ++num ) {
+          output[ positions[ num ] ] = ( *info.alphabets[ num ] )[ uniform ? working[ num ] : numerals[ num ] ];
+        }
+
+        return true;
+      };
+
+      uint16_t target = 0;
+
+      if ( info.preserved != nullptr ) {
+        /* Card numbers keep their Luhn residue: cycle walk within the residue class of the input */
+        bool   passLuhn = info.preserved->passLuhn;
+        size_t last     = positions.back( );
+
+        target = residue( output );
+
+        if ( encrypt ) {
+          if ( passLuhn && ( target != 0 ) ) {
+            throw exceptions::TokenRangeError( "Value does not pass a Luhn check, required by the vault format" );
+          } else if ( !passLuhn && ( target == 5 ) ) {
+            /* Its shifted token would pass a Luhn check: the nine other classes are all taken */
+            throw exceptions::TokenRangeError( "Values of Luhn residue 5 have no token failing a Luhn check" );
+          }
+        } else {
+          if ( passLuhn == ( target != 0 ) ) {
+            throw exceptions::TokenRangeError( "Token does not match the Luhn check of the vault format" );
+          }
+
+          if ( !passLuhn ) {
+            shift( output, last );
+            target = residue( output );
+
+            for ( size_t num = 0; num < positions.size( ); ++num ) {
+              working[ num ] = static_cast< uint16_t >( output[ positions[ num ] ] - '0' );
+            }
+          }
+        }
+
+        for ( size_t walk = 0;; ++walk ) {
+          if ( walk >= MAX_WALK ) {
+            throw exceptions::TokenGenerationError( "Too many format preserving encryption cycle walks" );
+          }
+
+          step( );
+          store( );
+
+          if ( residue( output ) == target ) {
+            break;
+          }
+        }
+
+        if ( encrypt && !passLuhn ) {
+          shift( output, last );
+        }
+      } else {
+        for ( size_t walk = 0;; ++walk ) {
+          if ( walk >= MAX_WALK ) {
+            throw exceptions::TokenGenerationError( "Too many format preserving encryption cycle walks" );
+          }
+
+          step( );
+
+          if ( store( ) ) {
+            break;
+          }
+        }
+      }
+
+      if ( mask != nullptr ) {
+        mask->assign( input.size( ), '*' );
+
+        if ( info.preserved != nullptr ) {
+          mask->replace( 0, info.preserved->front, output, 0, info.preserved->front );
+          mask->replace( input.size( ) - info.preserved->back, info.preserved->back, output,
+                         input.size( ) - info.preserved->back, info.preserved->back );
+        }
+      }
+
+      return output;
+    }
+
+    std::string TokenManager::deriveMask( core::SharedVault vault, boost::string_view token ) {
+      if ( ( vault->mode( ) != FF1_MODE ) && ( vault->mode( ) != FF3_1_MODE ) ) {
+        throw exceptions::InvalidTokenFormat( vault->alias, vault->format );
+      }
+
+      auto        info = layout( *vault, token );
+      std::string rc( token.size( ), '*' );
+
+      if ( info.preserved != nullptr ) {
+        if ( info.preserved->passLuhn == ( luhn::residue( token.begin( ), token.end( ) ) != 0 ) ) {
+          throw exceptions::TokenRangeError( "Token does not match the Luhn check of the vault format" );
+        }
+
+        rc.replace( 0, info.preserved->front, token.data( ), info.preserved->front );
+        rc.replace( token.size( ) - info.preserved->back,
+                    info.preserved->back,
+                    token.data( ) + token.size( ) - info.preserved->back,
+                    info.preserved->back );
+      }
+
+      return rc;
+    }
+  } // namespace api
+} // namespace token
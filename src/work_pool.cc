@@ -0,0 +1,162 @@
+
+#include "token/api/core/work_pool.hh"
+#include <exception>
+
+namespace token {
+  namespace api {
+    namespace core {
+      WorkPool::WorkPool( size_t threads ) {
+        for ( size_t num = 0; num < threads; ++num ) {
+          queues.emplace_back( new Queue );
+        }
+
+        for ( size_t num = 0; num < threads; ++num ) {
+          this->threads.emplace_back( &WorkPool::work, this, num );
+        }
+      }
+
+      WorkPool::~WorkPool( ) {
+        {
+          std::lock_guard< std::mutex > guard( lock );
+          stopped = true;
+        }
+
+        ready.notify_all( );
+
+        for ( auto &thread : threads ) {
+          thread.join( );
+        }
+      }
+
+      bool WorkPool::take( size_t self, std::function< void( ) > &task ) {
+        if ( self < queues.size( ) ) {
+          std::lock_guard< std::mutex > guard( queues[ self ]->lock );
+          auto &                        tasks = queues[ self ]->tasks;
+
+          if ( !tasks.empty( ) ) {
+            task = std::move( tasks.back( ) );
+            tasks.pop_back( );
+            return true;
+          }
+        }
+
+        for ( size_t num = 1; num <= queues.size( ); ++num ) {
+          auto &                        victim = *queues[ ( self + num ) % queues.size( ) ];
+          std::lock_guard< std::mutex > guard( victim.lock );
+
+          if ( !victim.tasks.empty( ) ) {
+            task = std::move( victim.tasks.front( ) );
+            victim.tasks.pop_front( );
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      void WorkPool::work( size_t self ) {
+        std::function< void( ) > task;
+
+        while ( true ) {
+          if ( take( self, task ) ) {
+            {
+              std::lock_guard< std::mutex > guard( lock );
+              --pending;
+            }
+
+            task( );
+            continue;
+          }
+
+          std::unique_lock< std::mutex > guard( lock );
+
+          ready.wait( guard, [ this ]( ) { return stopped || ( pending > 0 ); } );
+
+          if ( ( stopped ) && ( pending == 0 ) ) {
+            return;
+          }
+        }
+      }
+
+      void WorkPool::run( size_t count, const std::function< void( size_t ) > &task ) {
+        std::mutex              jobLock;
+        std::condition_variable done;
+        std::exception_ptr      error;
+        size_t                  remaining = count;
+
+        if ( queues.empty( ) ) {
+          for ( size_t num = 0; num < count; ++num ) {
+            task( num );
+          }
+
+          return;
+        }
+
+        {
+          std::lock_guard< std::mutex > guard( lock );
+
+          for ( size_t num = 0; num < count; ++num ) {
+            auto &queue = *queues[ next++ % queues.size( ) ];
+
+            std::lock_guard< std::mutex > queueGuard( queue.lock );
+
+            queue.tasks.emplace_back( [ &, num ]( ) {
+              std::exception_ptr failure;
+
+              try {
+                task( num );
+              } catch ( ... ) {
+                failure = std::current_exception( );
+              }
+
+              std::lock_guard< std::mutex > jobGuard( jobLock );
+
+              if ( ( failure ) && ( !error ) ) {
+                error = failure;
+              }
+
+              if ( --remaining == 0 ) {
+                done.notify_all( );
+              }
+            } );
+          }
+
+          pending += count;
+        }
+
+        ready.notify_all( );
+
+        /* Help with the queued tasks (ours or other callers') until ours are done */
+        std::function< void( ) > help;
+
+        while ( true ) {
+          {
+            std::unique_lock< std::mutex > guard( jobLock );
+
+            if ( remaining == 0 ) {
+              break;
+            }
+          }
+
+          if ( take( queues.size( ), help ) ) {
+            {
+              std::lock_guard< std::mutex > guard( lock );
+              --pending;
+            }
+
+            help( );
+            continue;
+          }
+
+          std::unique_lock< std::mutex > guard( jobLock );
+
+          done.wait( guard, [ & ]( ) { return remaining == 0; } );
+        }
+
+        if ( error ) {
+          std::rethrow_exception( error );
+        }
+      }
+    } // namespace core
+  }   // namespace api
+} // namespace token
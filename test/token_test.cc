@@ -1,12 +1,18 @@
 
 #include "osslprovider.hh"
+#include "multibuffer.hh"
+#include "token/api/core/arena.hh"
 #include "pgsqldb.hh"
 #include "sqlitedb.hh"
 #include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
 #include <unistd.h>
 
+#include <nlohmann/json.hpp>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 #define SQLITE3_DB "sqlite3.db"
@@ -16,6 +22,8 @@
 bool OpenSSLProvider::randomize = true;
 int  OpenSSLProvider::cycle     = 10;
 
+std::shared_ptr< token::api::core::TokenDB > storage;
+
 static void basic( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
   token::api::TokenEntry entry;
 
@@ -66,6 +74,35 @@ static void duplicateFail( token::api::TokenManager &tm, const std::string &vaul
   assert( false );
 }
 
+static void results( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  using token::api::Result;
+
+  token::api::TokenEntry entry;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* The all zero token is taken (duplicateFail): every retry collides, without an exception */
+  OpenSSLProvider::randomize = false;
+  OpenSSLProvider::cycle     = 10;
+
+  assert( tm.tryTokenize( vault, value, entry ) == Result::DUPLICATE_TOKEN );
+
+  entry = token::api::TokenEntry( );
+
+  assert( tm.tryTokenize( vault, value, entry ) == Result::OK );
+  assert( tm.tryDetokenize( vault, entry.token, entry ) == Result::OK );
+  assert( entry.value == value );
+
+  /* Searches sort on the creation time of the vault tables by default */
+  assert( tm.query( vault, { entry.token }, { }, { }, "", true, 0, 0, nullptr ).size( ) == 1 );
+
+  std::cout << "-------------- Results ------------------\n";
+  std::cout << "Token: " << entry.token << "\n";
+
+  assert( tm.tryDetokenize( vault, "not a token", entry ) == Result::NOT_FOUND );
+  assert( tm.tryTokenize( "undefined", value, entry ) == Result::NO_VAULT );
+}
+
 static void duplicatePass( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
   token::api::TokenEntry tokEntry;
 
@@ -125,79 +162,1669 @@ static void duplicateDurable( token::api::TokenManager &tm, const std::string &v
   }
 }
 
+static void packed( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  using token::api::Result;
+  using token::api::TokenManager;
+
+  token::api::TokenEntry entry;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* Tokens a numeric vault can not hold are never found, and never stored */
+  assert( tm.tryDetokenize( vault, "not a token", entry ) == Result::NOT_FOUND );
+  assert( tm.tryDetokenize( vault, "1234567890123456789", entry ) == Result::NOT_FOUND );
+  assert( tm.query( vault, { "not a token" }, { }, { }, "token", true, 0, 0, nullptr ).empty( ) );
+
+  entry.token = "4111-1111";
+
+  try {
+    tm.tokenize( vault, value, &entry );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  entry.token = "4111-1111";
+
+  assert( tm.tryTokenize( vault, value, entry ) == Result::INVALID );
+
+  /* Removal by hash reads and deletes the row by its hash, the token being unknown */
+  auto fresh   = value.substr( 0, 6 ) + "999999" + value.substr( 12 );
+  auto stored  = tm.tokenize( vault, fresh, nullptr );
+  auto removed = storage->remove( storage->getVault( vault )->table, stored.hmac );
+
+  assert( removed.token == stored.token );
+  assert( tm.tryDetokenize( vault, stored.token, entry ) == Result::NOT_FOUND );
+
+  /* Generated date tokens are all digits; vaultless ones keep the separators */
+  size_t format = TokenManager::DATE_FORMAT | TokenManager::NUMERIC_TOKENS;
+
+  tm.createVault( "numeric_date", "ENCKEY!!!", "MACKEY!!!", format, 10, false );
+
+  auto date = tm.tokenize( "numeric_date", "12/31/1999", nullptr );
+
+  assert( date.token.size( ) == 8 );
+  assert( tm.detokenize( "numeric_date", date.token ).value == "12/31/1999" );
+
+  tm.remove( "numeric_date", date.token );
+
+  try {
+    tm.createVault( "numeric_ff1", "FPEKEY!!!", "MACKEY!!!", format | TokenManager::FF1_MODE, 10, false );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+}
+
+static void bulk( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::BulkTokenizer::Options options;
+  std::stringstream                  input;
+  std::stringstream                  output;
+  std::string                        line;
+  std::vector< std::string >         lines;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  options.fields    = { { "card", vault } };
+  options.batchSize = 2;
+  options.workers   = 2;
+
+  input << "id,card\n"
+        << "1," << value << "\n"
+        << "2,\"" << value << "\"\r\n"
+        << "3,\n";
+
+  auto stats = token::api::BulkTokenizer( tm, options ).run( input, output );
+  auto token = tm.tokenize( vault, value, nullptr ).token;
+
+  while ( std::getline( output, line ) ) {
+    lines.push_back( line );
+  }
+
+  std::cout << "------------ Bulk Tokenization ----------\n";
+  std::cout << output.str( );
+
+  assert( stats.records == 3 );
+  assert( stats.values == 2 );
+  assert( lines.size( ) == 4 );
+  assert( lines[ 0 ] == "id,card" );
+  assert( lines[ 1 ] == "1," + token );
+  assert( lines[ 2 ] == "2," + token );
+  assert( lines[ 3 ] == "3," );
+
+  /* NDJSON: the value is now in the vault, found by the batch lookup then by the batch owner */
+  options.format = token::api::BulkTokenizer::NDJSON_FORMAT;
+  options.fields = { { "/card/number", vault } };
+
+  input.str( "" );
+  input.clear( );
+  output.str( "" );
+  output.clear( );
+  lines.clear( );
+
+  input << "{\"id\":1,\"card\":{\"number\":\"" << value << "\"}}\n"
+        << "{\"id\":2,\"card\":{\"number\":\"" << value << "\"}}\n"
+        << "{\"id\":3}\n";
+
+  stats = token::api::BulkTokenizer( tm, options ).run( input, output );
+
+  while ( std::getline( output, line ) ) {
+    lines.push_back( line );
+  }
+
+  assert( stats.records == 3 );
+  assert( stats.values == 2 );
+  assert( stats.existing == 1 );
+  assert( stats.deduplicated == 1 );
+  assert( lines.size( ) == 3 );
+  assert( nlohmann::json::parse( lines[ 0 ] )[ "card" ][ "number" ] == token );
+  assert( nlohmann::json::parse( lines[ 1 ] )[ "card" ][ "number" ] == token );
+  assert( lines[ 2 ] == "{\"id\":3}" );
+
+  /* Regular files are memory mapped: headerless CSV, without a final new line */
+  char path[] = "/tmp/tokenbulkXXXXXX";
+  int  fd     = mkstemp( path );
+
+  assert( fd >= 0 );
+
+  auto content = "1," + value + "\n2," + value;
+
+  assert( write( fd, content.data( ), content.size( ) ) == static_cast< ssize_t >( content.size( ) ) );
+  close( fd );
+
+  options.format = token::api::BulkTokenizer::CSV_FORMAT;
+  options.header = false;
+  options.fields = { { "1", vault } };
+
+  output.str( "" );
+  output.clear( );
+  lines.clear( );
+
+  stats = token::api::BulkTokenizer( tm, options ).run( std::string( path ), output );
+
+  unlink( path );
+
+  while ( std::getline( output, line ) ) {
+    lines.push_back( line );
+  }
+
+  assert( stats.records == 2 );
+  assert( stats.values == 2 );
+  assert( stats.existing == 1 );
+  assert( stats.deduplicated == 1 );
+  assert( lines.size( ) == 2 );
+  assert( lines[ 0 ] == "1," + token );
+  assert( lines[ 1 ] == "2," + token );
+}
+
 bool doRemove = false;
 
-static void remove( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+static void reuse( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::TokenEntry entry;
+  token::api::TokenEntry result;
+
   std::cout << __PRETTY_FUNCTION__ << "\n";
 
-  if ( doRemove ) {
-    auto retEntries = tm.retrieve( vault, value );
+  for ( size_t num = 0; num < 2; ++num ) {
+    entry.token.clear( );
+    tm.tokenize( vault, value, entry );
 
-    for ( auto &&retEntry : retEntries ) {
-      auto remEntry = tm.remove( vault, retEntry.token );
+    assert( !entry.token.empty( ) );
+    assert( entry.value == value );
 
-      std::cout << "-------------- Removal ------------------\n";
-      std::cout << "Token: " << remEntry.token << "\n";
-      std::cout << "Value: " << remEntry.value << "\n";
+    assert( tm.detokenize( vault, entry.token, result ) );
+    assert( result.token == entry.token );
+    assert( result.value == value );
+  }
 
-      for ( auto &pair : remEntry.properties ) {
-        std::cout << pair.first << ": " << pair.second << "\n";
-      }
+  std::cout << "-------------- Reuse Entry --------------\n";
+  std::cout << "Token: " << entry.token << "\n";
+
+  assert( !tm.detokenize( vault, "no such token", result ) );
+  assert( result.token.empty( ) && result.value.empty( ) );
+}
+
+static void expire( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::ExpirationSweeper::Schedule schedule;
+  token::api::ExpirationSweeper           sweeper( storage );
+  token::api::TokenEntry                  entry;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  entry.expiration = dbcpp::DBTime( std::chrono::duration_cast< std::chrono::seconds >(
+    std::chrono::system_clock::now( ).time_since_epoch( ) - std::chrono::hours( 48 ) ) );
+
+  auto expired = tm.tokenize( vault, value, &entry );
+  auto current = tm.tokenize( vault, value, nullptr );
+
+  schedule.batchSize = 1;
+  schedule.rate      = 100;
+
+  auto purged = sweeper.sweep( vault, schedule );
+
+  std::cout << "-------------- Expiration ---------------\n";
+  std::cout << "Purged: " << purged << "\n";
+
+  assert( purged >= 1 );
+  assert( tm.detokenize( vault, expired.token ).token.empty( ) );
+  assert( tm.detokenize( vault, current.token ).token == current.token );
+
+  /* Background sweep: immediate, throttled to 2 batches of 2 rows a second, then every second */
+  std::vector< std::string > tokens;
+
+  for ( size_t num = 0; num < 3; ++num ) {
+    tokens.push_back( tm.tokenize( vault, value, &entry ).token );
+  }
+
+  /* Entries expired two days ago, the others never expire: only the throttling delay (a lower
+   * bound) is timed, and the sweeps are awaited with a deadline far beyond their schedule */
+  auto swept = [ & ]( size_t count ) {
+    auto deadline = std::chrono::steady_clock::now( ) + std::chrono::seconds( 60 );
+
+    while ( ( sweeper.purged( vault ) < count ) && ( std::chrono::steady_clock::now( ) < deadline ) ) {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
     }
+
+    return sweeper.purged( vault ) >= count;
+  };
+
+  schedule.interval  = std::chrono::seconds( 1 );
+  schedule.batchSize = 2;
+  schedule.rate      = 4;
+
+  auto started = std::chrono::steady_clock::now( );
+
+  sweeper.schedule( vault, schedule );
+  sweeper.start( );
+
+  assert( swept( 3 ) );
+  assert( std::chrono::steady_clock::now( ) - started >= std::chrono::milliseconds( 500 ) );
+
+  tokens.push_back( tm.tokenize( vault, value, &entry ).token );
+
+  assert( swept( 4 ) );
+
+  sweeper.stop( );
+
+  std::cout << "Purged in background: " << sweeper.purged( vault ) << "\n";
+
+  assert( sweeper.purged( ) >= purged + 4 );
+
+  for ( auto &token : tokens ) {
+    assert( tm.detokenize( vault, token ).token.empty( ) );
   }
+
+  assert( tm.detokenize( vault, current.token ).token == current.token );
 }
 
-template < class DB >
-static void run_tests( const std::string &uri ) {
-  token::api::TokenManager tm( std::make_shared< OpenSSLProvider >( ), std::make_shared< DB >( uri, 10 ) );
-  std::string              value         = "6044342464567232";
-  auto                     transactional = { remove, basic, duplicateFail, duplicatePass, remove };
-  auto                     durable       = { remove, basic, duplicateDurable, remove };
+static void groupCommit( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::core::TokenDB::GroupCommit options;
+  std::vector< std::thread >             threads;
+  std::vector< std::string >             values;
+  std::vector< std::string >             tokens( 16 );
 
-  tm.createVault( "transactional", "ENCKEY!!!", "MACKEY!!!", 7, 20, false );
-  tm.createVault( "durable", "ENCKEY!!!", "MACKEY!!!", 7, 20, true );
+  std::cout << __PRETTY_FUNCTION__ << "\n";
 
-  try {
-    std::cout << "==========================================================\n"
-              << uri << "\n"
-              << "==========================================================\n";
+  /* Fresh values: each one is inserted (twice concurrently, the loser is a duplicate) */
+  for ( size_t num = 0; num < tokens.size( ) / 2; ++num ) {
+    values.push_back( value.substr( 0, value.size( ) - 4 ) + std::to_string( 2000 + num ) );
+  }
 
-    for ( auto &method : transactional ) {
-      std::cout << "--------------------------------------------------------"
-                << "\n";
-      method( tm, "transactional", value );
-    }
+  options.enabled  = true;
+  options.maxBatch = 4;
+  storage->groupCommit( options );
 
-    for ( auto &method : durable ) {
-      std::cout << "--------------------------------------------------------"
-                << "\n";
-      method( tm, "durable", value );
-    }
-  } catch ( std::exception &ex ) {
-    std::cout << ex.what( ) << "\n";
+  for ( size_t num = 0; num < tokens.size( ); ++num ) {
+    threads.emplace_back( [ &, num ]( ) { tokens[ num ] = tm.tokenize( vault, values[ num / 2 ], nullptr ).token; } );
+  }
+
+  for ( auto &thread : threads ) {
+    thread.join( );
+  }
+
+  storage->groupCommit( token::api::core::TokenDB::GroupCommit( ) );
+
+  std::cout << "------------- Group Commit --------------\n";
+
+  auto table = storage->getVault( vault )->table;
+
+  for ( size_t num = 0; num < tokens.size( ); num += 2 ) {
+    token::api::TokenEntry row;
+
+    std::cout << "Token: " << tokens[ num ] << "\n";
+
+    assert( tokens[ num ] == tokens[ num + 1 ] );
+    assert( storage->get( table, tokens[ num ], row ) );
+    assert( tm.detokenize( vault, tokens[ num ] ).value == values[ num / 2 ] );
+
+    tm.remove( vault, tokens[ num ] );
+  }
+
+  /* Inserts close in time, from an idle vault: the minimum window coalesces them */
+  auto commits = storage->groupCommits( );
+
+  options.maxBatch  = 4;
+  options.minWindow = std::chrono::seconds( 5 );
+  storage->groupCommit( options );
+  threads.clear( );
+
+  for ( size_t num = 0; num < options.maxBatch; ++num ) {
+    threads.emplace_back( [ &, num ]( ) {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 10 * num ) );
+      tokens[ num ] = tm.tokenize( vault, value.substr( 0, value.size( ) - 4 ) + std::to_string( 3000 + num ), nullptr ).token;
+    } );
+  }
+
+  for ( auto &thread : threads ) {
+    thread.join( );
+  }
+
+  storage->groupCommit( token::api::core::TokenDB::GroupCommit( ) );
+
+  assert( storage->groupCommits( ) == commits + 1 );
+
+  for ( size_t num = 0; num < options.maxBatch; ++num ) {
+    tm.remove( vault, tokens[ num ] );
+  }
+}
+
+static void derived( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  std::vector< std::thread > threads;
+  std::vector< std::string > tokens( 8 );
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  for ( size_t num = 0; num < tokens.size( ); ++num ) {
+    threads.emplace_back( [ &, num ]( ) { tokens[ num ] = tm.tokenize( vault, value, nullptr ).token; } );
+  }
+
+  for ( auto &thread : threads ) {
+    thread.join( );
+  }
+
+  std::cout << "------------- Derived -------------------\n";
+  std::cout << "Token: " << tokens.front( ) << "\n";
+
+  for ( auto &token : tokens ) {
+    assert( token == tokens.front( ) );
+  }
+
+  /* The token depends only on the value: it is the same after a removal */
+  tm.remove( vault, tokens.front( ) );
+
+  assert( tm.tokenize( vault, value, nullptr ).token == tokens.front( ) );
+}
+
+static bool luhnValid( const std::string &value ) {
+  int  sum     = 0;
+  bool doubled = false;
+
+  for ( auto iter = value.rbegin( ); iter != value.rend( ); ++iter, doubled = !doubled ) {
+    int digit = ( *iter - '0' ) * ( doubled ? 2 : 1 );
+    sum += digit > 9 ? digit - 9 : digit;
+  }
+
+  return sum % 10 == 0;
+}
+
+static void permuted( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  std::set< std::string > tokens;
+  std::string             card = "4111111111111111";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  auto before = tm.keyspace( vault, card );
+
+  /* 6 free digits: 100,000 Luhn valid tokens per prefix and suffix, each generated once */
+  for ( int num = 0; num < 200; ++num ) {
+    auto entry = tm.tokenize( vault, card, nullptr );
+
+    assert( entry.token.substr( 0, 6 ) == card.substr( 0, 6 ) );
+    assert( entry.token.substr( 11 ) == card.substr( 11 ) );
+    assert( luhnValid( entry.token ) );
+    assert( tokens.insert( entry.token ).second );
+
+    tm.remove( vault, entry.token );
+  }
+
+  auto after = tm.keyspace( vault, card );
+
+  std::cout << "------------- Keyspace ------------------\n";
+  std::cout << "Used: " << after.used << " of " << after.size << "\n";
+
+  assert( after.size == 100000 );
+  assert( after.used >= before.used + 200 );
+
+  /* A supplied token could be generated later on: it is refused */
+  token::api::TokenEntry entry;
+
+  entry.token = "4111110000001111";
+
+  try {
+    tm.tokenize( vault, card, &entry );
     assert( false );
+  } catch ( token::exceptions::TokenGenerationError &ex ) {
+    std::cout << ex.what( ) << "\n";
   }
 }
 
-void log_init( void ) {
-  auto        sink    = std::make_shared< spdlog::sinks::stdout_color_sink_mt >( );
-  std::string names[] = {
-    "dbcpp::psql", "dbcpp::sqlite", "dbcpp::Pool", "dbcpp::Driver", "token::api::manager", "token::api::tokendb" };
+static void inventory( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::TokenInventory::Options options;
+  std::set< std::string >             tokens;
 
-  for ( auto &&name : names ) {
-    token::api::create_logger( name, { sink } )->set_level( spdlog::level::trace );
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  options.lowWater  = 4;
+  options.highWater = 32;
+  options.batchSize = 8;
+
+  auto inventory = std::make_shared< token::api::TokenInventory >( tm, options );
+
+  inventory->refill( vault, value );
+  tm.inventory( inventory );
+
+  for ( int num = 0; num < 16; ++num ) {
+    auto entry = tm.tokenize( vault, value, nullptr );
+
+    assert( entry.token.substr( 0, 6 ) == value.substr( 0, 6 ) );
+    assert( entry.token.substr( 12 ) == value.substr( 12 ) );
+    assert( luhnValid( entry.token ) );
+    assert( tokens.insert( entry.token ).second );
   }
+
+  tm.inventory( nullptr );
+
+  auto metrics = inventory->metrics( );
+
+  std::cout << "------------- Inventory -----------------\n";
+  std::cout << "Hits: " << metrics.hits << " Available: " << metrics.available << "\n";
+
+  assert( metrics.hits == 16 );
+  assert( metrics.available <= 32 - 16 );
 }
 
-int main( int argc, char *argv[] ) {
-  doRemove = argc == 1;
+static void compact( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::TokenEntries entries;
+  boost::string_view       property;
+  size_t                   count = 0;
 
-  log_init( );
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  auto expected = tm.query( vault, { }, { value }, { }, "token", true, 0, 0, nullptr );
+
+  tm.query( vault, { }, { value }, { }, "token", true, 0, 0, entries, &count );
+
+  assert( !expected.empty( ) );
+  assert( entries.size( ) == expected.size( ) );
+  assert( count == expected.size( ) );
+
+  /* Values are decrypted on first access */
+  assert( !entries[ 0 ].decrypted );
+  assert( entries.value( entries[ 0 ] ) == value );
+  assert( entries[ 0 ].decrypted );
+
+  entries.decrypt( 0, entries.size( ) );
+
+  for ( size_t num = 0; num < entries.size( ); ++num ) {
+    auto expanded = entries.expand( entries[ num ] );
+
+    assert( entries[ num ].token == expected[ num ].token );
+    assert( entries[ num ].value == value );
+    assert( expanded.hmac == expected[ num ].hmac );
+    assert( expanded.properties == expected[ num ].properties );
+    assert( entries.property( entries[ num ], "property", property ) );
+    assert( property == "value" );
+  }
+
+  entries.clear( );
+  assert( entries.empty( ) );
+
+  /* Decrypted across a pool, in the order of the rows */
+  tm.parallelDecrypt( std::make_shared< token::api::core::WorkPool >( 2 ), 1 );
+
+  auto parallel = tm.query( vault, { }, { value }, { }, "token", true, 0, 0, nullptr );
+
+  tm.parallelDecrypt( nullptr );
+
+  assert( parallel.size( ) == expected.size( ) );
+
+  for ( size_t num = 0; num < parallel.size( ); ++num ) {
+    assert( parallel[ num ].token == expected[ num ].token );
+    assert( parallel[ num ].value == value );
+  }
+
+  /* Several batches per key: rows under two keys, more than a minimum batch per worker */
+  std::map< std::string, std::string > tokens;
+  std::vector< std::string >           values;
+
+  for ( size_t num = 0; num < 300; ++num ) {
+    if ( num == 150 ) {
+      assert( tm.rekeyVault( vault, "ENCKEY2!!", false ) );
+    }
+
+    values.push_back( value.substr( 0, value.size( ) - 4 ) + std::to_string( 3000 + num ) );
+    tokens[ tm.tokenize( vault, values.back( ), nullptr ).token ] = values.back( );
+  }
+
+  assert( tm.rekeyVault( vault, "ENCKEY!!!", false ) );
+
+  tm.parallelDecrypt( std::make_shared< token::api::core::WorkPool >( 2 ), 1 );
+
+  auto rows = tm.query( vault, { }, values, { }, "token", true, 0, 0, nullptr );
+
+  tm.parallelDecrypt( nullptr );
+
+  assert( rows.size( ) == values.size( ) );
+
+  std::set< std::string > keys;
+
+  for ( auto &row : rows ) {
+    assert( tokens.count( row.token ) );
+    assert( row.value == tokens[ row.token ] );
+    keys.insert( row.encKey );
+  }
+
+  assert( keys.size( ) == 2 );
+
+  for ( auto &token : tokens ) {
+    tm.remove( vault, token.first );
+  }
+}
+
+static void lookups( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  token::api::TokenEntry entry;
+  std::string            token;
+  std::string            mask;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  auto expected = tm.tokenize( vault, value, nullptr );
+
+  assert( tm.lookup( vault, value, token ) );
+  assert( token == expected.token );
+  assert( !tm.lookup( vault, "0000000000000000", token ) );
+  assert( token.empty( ) );
+
+  assert( tm.mask( vault, expected.token, mask ) );
+  assert( mask == expected.mask );
+
+  /* Metadata lookups leave the encrypted value unread */
+  assert( tm.metadata( vault, expected.token, entry ) );
+  assert( entry.token == expected.token );
+  assert( entry.properties == expected.properties );
+  assert( ( entry.crypt.empty( ) ) && ( entry.value.empty( ) ) && ( entry.mask.empty( ) ) );
+
+  assert( !tm.mask( vault, "missing", mask ) );
+}
+
+static void asynchronous( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  std::vector< std::future< token::api::TokenEntry > > futures;
+  std::promise< token::api::Result >                   completed;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  auto expected = tm.tokenizeAsync( vault, value ).get( );
+
+  for ( int num = 0; num < 32; ++num ) {
+    futures.push_back( tm.detokenizeAsync( vault, expected.token ) );
+  }
+
+  for ( auto &future : futures ) {
+    auto entry = future.get( );
+
+    assert( entry.token == expected.token );
+    assert( entry.value == value );
+  }
+
+  tm.detokenizeAsync( vault, expected.token, [ & ]( token::api::Result result, token::api::TokenEntry &entry ) {
+    assert( entry.value == value );
+    completed.set_value( result );
+  } );
+
+  assert( completed.get_future( ).get( ) == token::api::Result::OK );
+
+  /* Completions chaining operations on a full queue: the workers run them in place */
+  std::atomic< int >                                                    remaining( 8 * 16 );
+  std::promise< void >                                                  chained;
+  std::function< void( token::api::Result, token::api::TokenEntry & ) > next;
+  token::api::core::TaskExecutor::Options                               options;
+  token::api::TokenManager                                              chaining( std::make_shared< OpenSSLProvider >( ), storage );
+
+  options.workers  = 2;
+  options.maxQueue = 1;
+  chaining.asyncExecutor( std::make_shared< token::api::core::TaskExecutor >( options ) );
+
+  next = [ & ]( token::api::Result result, token::api::TokenEntry &entry ) {
+    assert( ( result == token::api::Result::OK ) && ( entry.value == value ) );
+
+    auto left = --remaining;
+
+    if ( left == 0 ) {
+      chained.set_value( );
+    } else if ( left >= 8 ) {
+      chaining.detokenizeAsync( vault, expected.token, next );
+    }
+  };
+
+  for ( int num = 0; num < 8; ++num ) {
+    chaining.detokenizeAsync( vault, expected.token, next );
+  }
+
+  assert( chained.get_future( ).wait_for( std::chrono::seconds( 60 ) ) == std::future_status::ready );
+}
+
+static void concurrent( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  std::vector< std::thread > threads;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* More callers than connections: the pipelined storage multiplexes them */
+  for ( int num = 0; num < 16; ++num ) {
+    threads.emplace_back( [ &, num ]( ) {
+      for ( int op = 0; op < 16; ++op ) {
+        auto input = value.substr( 0, value.size( ) - 4 ) + std::to_string( 1000 + num * 16 + op );
+        auto entry = tm.tokenize( vault, input, nullptr );
+
+        assert( tm.tokenize( vault, input, nullptr ).token == entry.token );
+        assert( tm.detokenize( vault, entry.token ).value == input );
+
+        tm.remove( vault, entry.token );
+      }
+    } );
+  }
+
+  for ( auto &thread : threads ) {
+    thread.join( );
+  }
+}
+
+static void remove( token::api::TokenManager &tm, const std::string &vault, const std::string &value ) {
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  if ( doRemove ) {
+    auto retEntries = tm.retrieve( vault, value );
+
+    for ( auto &&retEntry : retEntries ) {
+      auto remEntry = tm.remove( vault, retEntry.token );
+
+      std::cout << "-------------- Removal ------------------\n";
+      std::cout << "Token: " << remEntry.token << "\n";
+      std::cout << "Value: " << remEntry.value << "\n";
+
+      for ( auto &pair : remEntry.properties ) {
+        std::cout << pair.first << ": " << pair.second << "\n";
+      }
+    }
+  }
+}
+
+static void vaultless( ) {
+  using Manager = token::api::TokenManager;
+
+  token::crypto::OpenSSLProvider::Options options;
+  char                                    directory[] = "/tmp/tokenkeysXXXXXX";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  assert( mkdtemp( directory ) != nullptr );
+
+  options.encKeyPath = directory;
+  options.macKeyPath = directory;
+
+  auto provider = std::make_shared< token::crypto::OpenSSLProvider >( options );
+
+  assert( provider->createFpeKey( "fpe", { } ) != nullptr );
+  assert( provider->createMacKey( "mac", { } ) != nullptr );
+
+  Manager tm( provider, storage );
+  struct {
+    std::string vault;
+    size_t      format;
+    std::string value;
+  } cases[] = {
+    { "ff1_f6l4", Manager::F6L4_FORMAT | Manager::FF1_MODE, "4111111111111111" },
+    { "ff3_f6l4", Manager::F6L4_FORMAT | Manager::FF3_1_MODE, "4111111111111111" },
+    { "ff1_l4_noluhn", Manager::L4_NOLUHN_FORMAT | Manager::FF1_MODE, "6044342464567232" },
+    { "ff3_fp_random", Manager::FP_RANDOM_FORMAT | Manager::FF3_1_MODE, "Ab3-cD5e-7F9g" },
+  };
+
+  for ( auto &test : cases ) {
+    tm.createVault( test.vault, "fpe", "mac", test.format, test.value.size( ), true );
+
+    auto entry = tm.tokenize( test.vault, test.value, nullptr );
+    auto value = tm.detokenize( test.vault, entry.token );
+
+    std::cout << test.vault << ": " << test.value << " -> " << entry.token << " (" << entry.mask << ")\n";
+
+    assert( entry.token != test.value );
+    assert( entry.token.size( ) == test.value.size( ) );
+    assert( entry.token == tm.tokenize( test.vault, test.value, nullptr ).token );
+    assert( value.value == test.value );
+
+    std::string mask;
+
+    assert( tm.mask( test.vault, entry.token, mask ) );
+    assert( mask == entry.mask );
+
+    for ( size_t num = 0; num < test.value.size( ); ++num ) {
+      assert( ( ::isdigit( entry.token[ num ] ) != 0 ) == ( ::isdigit( test.value[ num ] ) != 0 ) );
+      assert( ( ::isupper( entry.token[ num ] ) != 0 ) == ( ::isupper( test.value[ num ] ) != 0 ) );
+    }
+  }
+
+  assert( luhnValid( tm.tokenize( "ff1_f6l4", "4111111111111111", nullptr ).token ) );
+  assert( !luhnValid( tm.tokenize( "ff1_l4_noluhn", "6044342464567232", nullptr ).token ) );
+
+  /* Values of Luhn residue 5 have no token failing a Luhn check */
+  try {
+    tm.tokenize( "ff1_l4_noluhn", "6044342464567235", nullptr );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+  assert( tm.tokenize( "ff1_f6l4", "4111111111111111", nullptr ).token.substr( 0, 6 ) == "411111" );
+
+  /* Tokenization and detokenization are computed: no entry is stored without metadata */
+  token::api::TokenEntry entry;
+  token::api::TokenEntry back;
+  std::string            found;
+
+  auto token = tm.tokenize( "ff3_f6l4", "4111111111111111", nullptr ).token;
+
+  assert( !tm.metadata( "ff3_f6l4", token, back ) );
+  assert( tm.detokenize( "ff3_f6l4", token, back ) );
+  assert( back.value == "4111111111111111" );
+  assert( tm.lookup( "ff3_f6l4", "4111111111111111", found ) && ( found == token ) );
+
+  /* The metadata is stored with the token, and returned by value lookups */
+  entry.properties = { { "property", "value" } };
+
+  token        = tm.tokenize( "ff3_f6l4", "4111111111111111", &entry ).token;
+  auto entries = tm.retrieve( "ff3_f6l4", "4111111111111111" );
+
+  assert( entries.size( ) == 1 );
+  assert( entries[ 0 ].token == token );
+  assert( entries[ 0 ].value == "4111111111111111" );
+  assert( entries[ 0 ].properties == entry.properties );
+  assert( tm.metadata( "ff3_f6l4", token, back ) );
+
+  tm.remove( "ff3_f6l4", token );
+  tm.remove( "ff3_f6l4", token );
+
+  assert( tm.detokenize( "ff3_f6l4", token, back ) );
+
+  /* VAULTLESS_METADATA: detokenization returns the stored metadata, and refuses expired tokens */
+  tm.createVault( "ff1_metadata",
+                  "fpe",
+                  "mac",
+                  Manager::F6L4_FORMAT | Manager::FF1_MODE | Manager::VAULTLESS_METADATA,
+                  16,
+                  true );
+
+  token = tm.tokenize( "ff1_metadata", "4111111111111111", nullptr ).token;
+
+  assert( tm.detokenize( "ff1_metadata", token, back ) );
+  assert( back.value == "4111111111111111" );
+  assert( back.properties.empty( ) );
+
+  token = tm.tokenize( "ff1_metadata", "4111111111111111", &entry ).token;
+
+  assert( tm.detokenize( "ff1_metadata", token, back ) );
+  assert( back.value == "4111111111111111" );
+  assert( back.properties == entry.properties );
+
+  entry.properties = { };
+  entry.expiration = dbcpp::DBTime( std::chrono::duration_cast< std::chrono::seconds >(
+    std::chrono::system_clock::now( ).time_since_epoch( ) - std::chrono::seconds( 60 ) ) );
+  token = tm.tokenize( "ff1_metadata", "4111111111111111", &entry ).token;
+
+  assert( tm.tryDetokenize( "ff1_metadata", token, back ) == token::api::Result::NOT_FOUND );
+
+  tm.remove( "ff1_metadata", token );
+
+  /* VAULTLESS_REVOCATION: removed and never issued tokens are refused */
+  tm.createVault( "ff1_revocable",
+                  "fpe",
+                  "mac",
+                  Manager::F6L4_FORMAT | Manager::FF1_MODE | Manager::VAULTLESS_REVOCATION,
+                  16,
+                  true );
+
+  token = tm.tokenize( "ff1_f6l4", "4111111111111111", nullptr ).token;
+
+  assert( tm.tryDetokenize( "ff1_revocable", token, back ) == token::api::Result::NOT_FOUND );
+  assert( !tm.lookup( "ff1_revocable", "4111111111111111", found ) );
+
+  token = tm.tokenize( "ff1_revocable", "4111111111111111", nullptr ).token;
+
+  assert( tm.metadata( "ff1_revocable", token, back ) );
+  assert( tm.detokenize( "ff1_revocable", token, back ) );
+  assert( back.value == "4111111111111111" );
+  assert( tm.lookup( "ff1_revocable", "4111111111111111", found ) && ( found == token ) );
+  assert( tm.tokenize( "ff1_revocable", "4111111111111111", nullptr ).token == token );
+
+  tm.remove( "ff1_revocable", token );
+
+  assert( tm.tryDetokenize( "ff1_revocable", token, back ) == token::api::Result::NOT_FOUND );
+  assert( !tm.lookup( "ff1_revocable", "4111111111111111", found ) );
+
+  try {
+    tm.createVault( "metadata", "fpe", "mac", Manager::F6L4_FORMAT | Manager::VAULTLESS_METADATA, 16, true );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  for ( auto name : { "fpe", "mac" } ) {
+    unlink( ( std::string( directory ) + "/" + name ).c_str( ) );
+  }
+
+  rmdir( directory );
+}
+
+template < class DB >
+static void run_tests( const std::string &uri ) {
+  storage = std::make_shared< DB >( uri, 10 );
+
+  token::api::TokenManager tm( std::make_shared< OpenSSLProvider >( ), storage );
+  std::string              value         = "6044342464567232";
+  auto                     transactional = { remove, basic, duplicateFail, results, duplicatePass, expire, reuse, inventory, remove };
+  auto                     durable       = { remove, basic, compact, lookups, asynchronous, concurrent, duplicateDurable, bulk, groupCommit, remove };
+  auto                     deterministic = { remove, basic, duplicateDurable, derived, remove };
+  auto                     indexed       = { remove, basic, duplicateDurable, remove };
+  auto                     numeric       = { remove, basic, duplicateFail, expire, packed, remove };
+
+  tm.createVault( "transactional", "ENCKEY!!!", "MACKEY!!!", 7, 20, false );
+  tm.createVault( "durable", "ENCKEY!!!", "MACKEY!!!", 7, 20, true );
+  tm.createVault( "derived", "ENCKEY!!!", "MACKEY!!!", 7 | token::api::TokenManager::DERIVED_MODE, 20, true );
+  tm.createVault( "permuted", "ENCKEY!!!", "MACKEY!!!", 7 | token::api::TokenManager::PERMUTED_MODE, 20, false );
+  tm.createVault( "indexed", "ENCKEY!!!", "MACKEY!!!", 7 | token::api::TokenManager::HMAC_INDEX_16, 20, true );
+  tm.createVault( "numeric", "ENCKEY!!!", "MACKEY!!!", 7 | token::api::TokenManager::NUMERIC_TOKENS, 16, false );
+  storage->propertyNames( "durable", { "expiry", "property" } );
+
+  try {
+    storage->propertyNames( "durable", { "property" } );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  /* The property names are stored with the vault: another instance reads the properties */
+  {
+    token::api::TokenEntry   entry;
+    token::api::TokenEntries entries;
+    auto                     second = std::make_shared< token::api::core::TokenDB >( uri, 1 );
+    token::api::TokenManager other( std::make_shared< OpenSSLProvider >( ), second );
+    boost::string_view       property;
+
+    entry.properties = { { "property", "value" }, { "unnamed", "value" } };
+
+    auto token = tm.tokenize( "durable", value, &entry ).token;
+
+    assert( other.detokenize( "durable", token ).properties == entry.properties );
+
+    tm.remove( "durable", token );
+
+    /* Names appended by another instance: the dictionary is reloaded on the unknown index */
+    second->propertyNames( "durable", { "expiry", "property", "unnamed" } );
+
+    token = other.tokenize( "durable", value, &entry ).token;
+
+    assert( tm.detokenize( "durable", token ).properties == entry.properties );
+
+    tm.query( "durable", { token }, { }, { }, "token", true, 0, 0, entries, nullptr );
+
+    assert( ( entries.size( ) == 1 ) && ( entries.property( entries[ 0 ], "unnamed", property ) ) );
+    assert( property == "value" );
+
+    tm.remove( "durable", token );
+  }
+
+  try {
+    std::cout << "==========================================================\n"
+              << uri << "\n"
+              << "==========================================================\n";
+
+    for ( auto &method : transactional ) {
+      std::cout << "--------------------------------------------------------"
+                << "\n";
+      method( tm, "transactional", value );
+    }
+
+    for ( auto &method : durable ) {
+      std::cout << "--------------------------------------------------------"
+                << "\n";
+      method( tm, "durable", value );
+    }
+
+    for ( auto &method : deterministic ) {
+      std::cout << "--------------------------------------------------------"
+                << "\n";
+      method( tm, "derived", value );
+    }
+
+    for ( auto &method : indexed ) {
+      std::cout << "--------------------------------------------------------"
+                << "\n";
+      method( tm, "indexed", value );
+    }
+
+    for ( auto &method : numeric ) {
+      std::cout << "--------------------------------------------------------"
+                << "\n";
+      method( tm, "numeric", value );
+    }
+
+    std::cout << "--------------------------------------------------------"
+              << "\n";
+    permuted( tm, "permuted", value );
+
+    std::cout << "--------------------------------------------------------"
+              << "\n";
+    vaultless( );
+  } catch ( std::exception &ex ) {
+    std::cout << ex.what( ) << "\n";
+    assert( false );
+  }
+}
+
+static void opensslProvider( ) {
+  token::crypto::OpenSSLProvider::Options options;
+  char                                    directory[] = "/tmp/tokenkeysXXXXXX";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  assert( mkdtemp( directory ) != nullptr );
+
+  options.encKeyPath = directory;
+  options.macKeyPath = directory;
+
+  token::crypto::OpenSSLProvider provider( options );
+  std::string                    value = "4111111111111111";
+
+  for ( auto cipher : { "aes-256-gcm", "aes-256-cbc" } ) {
+    auto key = provider.createEncKey( cipher, { { "cipher", cipher } } );
+
+    assert( key != nullptr );
+    assert( provider.createEncKey( cipher, { } ) == nullptr );
+
+    auto crypt = key->encrypt( value );
+    auto plain = key->decrypt( crypt );
+
+    assert( crypt != key->encrypt( value ) );
+    assert( std::string( plain.begin( ), plain.end( ) ) == value );
+  }
+
+  auto mac = provider.createMacKey( "hmac", { } );
+
+  assert( mac != nullptr );
+  assert( mac->hash( value ) == token::crypto::OpenSSLProvider( options ).getMacKey( "hmac" )->hash( value ) );
+  assert( provider.getEncKey( "../hmac" ) == nullptr );
+
+  std::cout << "Acceleration: " << token::crypto::OpenSSLProvider::acceleration( ) << "\n";
+
+  for ( auto name : { "aes-256-gcm", "aes-256-cbc", "hmac" } ) {
+    unlink( ( std::string( directory ) + "/" + name ).c_str( ) );
+  }
+
+  rmdir( directory );
+}
+
+/**
+ * @brief Decode a hexadecimal string
+ * @param text hexadecimal digits
+ * @return bytes
+ */
+static token::crypto::bytea unhex( const std::string &text ) {
+  token::crypto::bytea rc;
+
+  for ( size_t num = 0; num + 1 < text.size( ); num += 2 ) {
+    rc.push_back( static_cast< uint8_t >( std::stoul( text.substr( num, 2 ), nullptr, 16 ) ) );
+  }
+
+  return rc;
+}
+
+/**
+ * @brief AES-GCM encrypt a value through the EVP interface (reference for the kernel)
+ * @param key key bytes (16 or 32)
+ * @param iv IV (12 bytes)
+ * @param plain plaintext
+ * @return ciphertext followed by the tag
+ */
+static token::crypto::bytea gcmReference( const token::crypto::bytea &key,
+                                          const token::crypto::bytea &iv,
+                                          const token::crypto::bytea &plain ) {
+  token::crypto::bytea rc( plain.size( ) + token::crypto::multibuffer::GCM_TAG_LENGTH );
+  auto                 ctx    = EVP_CIPHER_CTX_new( );
+  auto                 cipher = key.size( ) == 16 ? EVP_aes_128_gcm( ) : EVP_aes_256_gcm( );
+  int                  length = 0;
+
+  assert( EVP_EncryptInit_ex( ctx, cipher, nullptr, key.data( ), iv.data( ) ) == 1 );
+  assert( EVP_EncryptUpdate( ctx, rc.data( ), &length, plain.data( ), static_cast< int >( plain.size( ) ) ) == 1 );
+  assert( EVP_EncryptFinal_ex( ctx, rc.data( ) + length, &length ) == 1 );
+  assert( EVP_CIPHER_CTX_ctrl(
+            ctx, EVP_CTRL_GCM_GET_TAG, token::crypto::multibuffer::GCM_TAG_LENGTH, rc.data( ) + plain.size( ) ) == 1 );
+
+  EVP_CIPHER_CTX_free( ctx );
+
+  return rc;
+}
+
+static void multibufferKernels( ) {
+  namespace mb = token::crypto::multibuffer;
+  using token::crypto::bytea;
+  using token::crypto::bytes_view;
+
+  token::crypto::OpenSSLProvider::Options options;
+  char                                    directory[] = "/tmp/tokenkeysXXXXXX";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* Lengths around the SHA-256 padding (55/56) and block (64), and the AES block (16) boundaries */
+  std::vector< size_t > lengths = { 0, 1, 15, 16, 17, 31, 32, 33, 55, 56, 63, 64, 65, 119, 120, 128, 129 };
+  std::vector< size_t > counts  = { 1, 2, 8, 9 };
+
+  /* HMAC-SHA-256 known answers (RFC 4231 cases 1, 2 and 6: short, text and longer than block keys) */
+  struct {
+    bytea       key;
+    std::string message;
+    std::string mac;
+  } hmacs[] = {
+    { bytea( 20, 0x0b ), "Hi There", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+    { unhex( "4a656665" ),
+      "what do ya want for nothing?",
+      "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+    { bytea( 131, 0xaa ),
+      "Test Using Larger Than Block-Size Key - Hash Key First",
+      "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+  };
+
+  std::cout << "HMAC-SHA-256 kernel: " << ( mb::hmacSha256Supported( ) ? "yes" : "no" ) << "\n";
+
+  if ( mb::hmacSha256Supported( ) ) {
+    for ( auto &test : hmacs ) {
+      mb::HmacSha256 state;
+      bytea          mac( 32 );
+      const uint8_t *data[]   = { reinterpret_cast< const uint8_t * >( test.message.data( ) ) };
+      size_t         length[] = { test.message.size( ) };
+      uint8_t *      out[]    = { mac.data( ) };
+
+      mb::init( state, test.key.data( ), test.key.size( ) );
+      mb::hmacSha256( state, data, length, 1, out );
+
+      assert( mac == unhex( test.mac ) );
+    }
+
+    /* Every lane matches the single buffer HMAC, whatever the count and lengths */
+    mb::HmacSha256 state;
+    bytea          key = unhex( "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f" );
+
+    mb::init( state, key.data( ), key.size( ) );
+
+    for ( auto count : counts ) {
+      for ( size_t first = 0; first < lengths.size( ); first += count ) {
+        std::vector< bytea >           messages, macs( count, bytea( 32 ) );
+        std::vector< const uint8_t * > data;
+        std::vector< size_t >          sizes;
+        std::vector< uint8_t * >       out;
+
+        for ( size_t num = 0; num < count; ++num ) {
+          messages.emplace_back( lengths[ ( first + num ) % lengths.size( ) ], static_cast< uint8_t >( num ) );
+        }
+
+        for ( size_t num = 0; num < count; ++num ) {
+          data.push_back( messages[ num ].data( ) );
+          sizes.push_back( messages[ num ].size( ) );
+          out.push_back( macs[ num ].data( ) );
+        }
+
+        mb::hmacSha256( state, data.data( ), sizes.data( ), count, out.data( ) );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          bytea        expected( 32 );
+          unsigned int size = 0;
+
+          HMAC( EVP_sha256( ),
+                key.data( ),
+                static_cast< int >( key.size( ) ),
+                messages[ num ].data( ),
+                messages[ num ].size( ),
+                expected.data( ),
+                &size );
+
+          assert( macs[ num ] == expected );
+        }
+      }
+    }
+  }
+
+  /* AES-GCM known answers (GCM specification test cases 3 and 15: AES-128 and AES-256, no AAD) */
+  auto plain = unhex( "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255" );
+  auto iv    = unhex( "cafebabefacedbaddecaf888" );
+
+  struct {
+    bytea       key;
+    std::string crypt;
+    std::string tag;
+  } gcms[] = {
+    { unhex( "feffe9928665731c6d6a8f9467308308" ),
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { unhex( "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308" ),
+      "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+      "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+      "b094dac5d93471bdec1a502270e3cc6c" },
+  };
+
+  std::cout << "AES-GCM kernel: " << ( mb::aesGcmSupported( ) ? "yes" : "no" ) << "\n";
+
+  for ( auto &test : gcms ) {
+    auto expected = unhex( test.crypt + test.tag );
+
+    assert( gcmReference( test.key, iv, plain ) == expected );
+
+    mb::AesGcm state;
+
+    if ( !mb::init( state, test.key.data( ), test.key.size( ) ) ) {
+      continue;
+    }
+
+    bytea          crypt( plain.size( ) ), tag( mb::GCM_TAG_LENGTH ), back( plain.size( ) );
+    const uint8_t *data[]   = { plain.data( ) };
+    const uint8_t *crypts[] = { crypt.data( ) };
+    const uint8_t *ivs[]    = { iv.data( ) };
+    const uint8_t *tags[]   = { tag.data( ) };
+    size_t         length[] = { plain.size( ) };
+    uint8_t *      out[]    = { crypt.data( ) };
+    uint8_t *      outTag[] = { tag.data( ) };
+    uint8_t *      result[] = { back.data( ) };
+
+    mb::aesGcmEncrypt( state, data, length, ivs, 1, out, outTag );
+
+    assert( crypt == unhex( test.crypt ) );
+    assert( tag == unhex( test.tag ) );
+    assert( mb::aesGcmDecrypt( state, crypts, length, ivs, tags, 1, result ) );
+    assert( back == plain );
+
+    /* A tampered tag fails authentication */
+    tag[ 0 ] ^= 1;
+    assert( !mb::aesGcmDecrypt( state, crypts, length, ivs, tags, 1, result ) );
+  }
+
+  /* Every value of a batch matches the EVP encryption, and a single tampered tag fails the batch */
+  mb::AesGcm state;
+  bytea      key = unhex( "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f" );
+
+  if ( mb::init( state, key.data( ), key.size( ) ) ) {
+    for ( auto count : counts ) {
+      for ( size_t first = 0; first < lengths.size( ); first += count ) {
+        std::vector< bytea >           values, ivs, crypts, tags, backs;
+        std::vector< const uint8_t * > data, ivData, cryptData, tagData;
+        std::vector< uint8_t * >       out, tagOut, backOut;
+        std::vector< size_t >          sizes;
+
+        for ( size_t num = 0; num < count; ++num ) {
+          auto length = lengths[ ( first + num ) % lengths.size( ) ];
+
+          values.emplace_back( length, static_cast< uint8_t >( num + 1 ) );
+          ivs.emplace_back( mb::GCM_IV_LENGTH, static_cast< uint8_t >( first + num ) );
+          crypts.emplace_back( length );
+          backs.emplace_back( length );
+          tags.emplace_back( mb::GCM_TAG_LENGTH );
+        }
+
+        for ( size_t num = 0; num < count; ++num ) {
+          data.push_back( values[ num ].data( ) );
+          ivData.push_back( ivs[ num ].data( ) );
+          cryptData.push_back( crypts[ num ].data( ) );
+          tagData.push_back( tags[ num ].data( ) );
+          out.push_back( crypts[ num ].data( ) );
+          tagOut.push_back( tags[ num ].data( ) );
+          backOut.push_back( backs[ num ].data( ) );
+          sizes.push_back( values[ num ].size( ) );
+        }
+
+        mb::aesGcmEncrypt( state, data.data( ), sizes.data( ), ivData.data( ), count, out.data( ), tagOut.data( ) );
+
+        for ( size_t num = 0; num < count; ++num ) {
+          auto expected = gcmReference( key, ivs[ num ], values[ num ] );
+
+          assert( bytea( expected.begin( ), expected.begin( ) + sizes[ num ] ) == crypts[ num ] );
+          assert( bytea( expected.begin( ) + sizes[ num ], expected.end( ) ) == tags[ num ] );
+        }
+
+        assert( mb::aesGcmDecrypt(
+          state, cryptData.data( ), sizes.data( ), ivData.data( ), tagData.data( ), count, backOut.data( ) ) );
+        assert( backs == values );
+
+        tags[ count - 1 ][ mb::GCM_TAG_LENGTH - 1 ] ^= 0x80;
+        assert( !mb::aesGcmDecrypt(
+          state, cryptData.data( ), sizes.data( ), ivData.data( ), tagData.data( ), count, backOut.data( ) ) );
+      }
+    }
+  }
+
+  /* The provider batch overrides match the single value calls */
+  assert( mkdtemp( directory ) != nullptr );
+
+  options.encKeyPath = directory;
+  options.macKeyPath = directory;
+
+  token::crypto::OpenSSLProvider provider( options );
+  auto                           enc = provider.createEncKey( "aes-256-gcm", { { "cipher", "aes-256-gcm" } } );
+  auto                           mac = provider.createMacKey( "hmac", { } );
+
+  assert( ( enc != nullptr ) && ( mac != nullptr ) );
+
+  for ( auto count : counts ) {
+    std::vector< bytea >      values, crypts, macs, backs;
+    std::vector< bytes_view > inputs, sealed;
+
+    for ( size_t num = 0; num < count; ++num ) {
+      values.emplace_back( lengths[ ( num * 5 + count ) % lengths.size( ) ], static_cast< uint8_t >( 'a' + num ) );
+    }
+
+    for ( auto &value : values ) {
+      inputs.emplace_back( value );
+    }
+
+    mac->hashBatch( inputs, macs );
+    enc->encryptBatch( inputs, crypts );
+
+    assert( ( macs.size( ) == count ) && ( crypts.size( ) == count ) );
+
+    for ( size_t num = 0; num < count; ++num ) {
+      assert( macs[ num ] == mac->hash( values[ num ] ) );
+      assert( enc->decrypt( crypts[ num ] ) == values[ num ] );
+      sealed.emplace_back( crypts[ num ] );
+    }
+
+    enc->decryptBatch( sealed, backs );
+    assert( backs == values );
+
+    crypts[ count - 1 ].back( ) ^= 1;
+
+    try {
+      enc->decryptBatch( sealed, backs );
+      assert( false );
+    } catch ( token::exceptions::TokenCryptographyError &ex ) {
+      std::cout << ex.what( ) << "\n";
+    }
+  }
+
+  for ( auto name : { "aes-256-gcm", "hmac" } ) {
+    unlink( ( std::string( directory ) + "/" + name ).c_str( ) );
+  }
+
+  rmdir( directory );
+}
+
+static void schema( ) {
+  using token::api::core::Schema;
+
+  token::api::core::VaultInfo vault;
+  Schema::Options             options;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  vault.alias        = "schema";
+  vault.table        = "schema16_7_su";
+  vault.format       = 7;
+  vault.length       = 16;
+  vault.durable      = false;
+  options.partitions = 4;
+
+  /* Transactional vaults: hash partitions on the token keep the token unique */
+  options.partitioning = Schema::TOKEN_HASH;
+
+  auto statements = Schema::vault( Schema::POSTGRESQL, vault, options );
+  auto find       = [ &statements ]( const std::string &text ) {
+    return std::count_if( statements.begin( ), statements.end( ), [ &text ]( const std::string &sql ) {
+      return sql.find( text ) != std::string::npos;
+    } );
+  };
+
+  assert( find( "PARTITION BY HASH ( token )" ) == 1 );
+  assert( find( "PARTITION OF" ) == 4 );
+  assert( find( "USING HASH ( token )" ) == 1 );
+  assert( find( "( hmac )" ) == 1 );
+  assert( find( "( expiration )" ) == 1 );
+
+  /* Durable vaults keep the hmac unique: a token partitioning cannot */
+  vault.durable = true;
+
+  try {
+    Schema::vault( Schema::POSTGRESQL, vault, options );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  options.partitioning = Schema::UNPARTITIONED;
+  statements           = Schema::vault( Schema::SQLITE, vault, options );
+
+  assert( find( "PRIMARY KEY ( token )" ) == 1 );
+  assert( find( "UNIQUE ( hmac )" ) == 1 );
+  assert( find( "USING HASH" ) == 0 );
+
+  /* A truncated hmac is indexed in place of the hmac, and must stay unique in durable vaults */
+  vault.format = 7 | token::api::TokenManager::HMAC_INDEX_16;
+  statements   = Schema::vault( Schema::SQLITE, vault, options );
+
+  assert( vault.hmacPrefix( ) == 16 );
+  assert( vault.tokenFormat( ) == 7 );
+  assert( find( "hkey BLOB" ) == 1 );
+  assert( find( "UNIQUE ( hkey )" ) == 1 );
+  assert( find( "UNIQUE ( hmac )" ) == 0 );
+
+  vault.format = 7 | token::api::TokenManager::HMAC_INDEX_8;
+
+  try {
+    Schema::vault( Schema::SQLITE, vault, options );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  vault.durable = false;
+  statements    = Schema::vault( Schema::SQLITE, vault, options );
+
+  assert( find( "schema16_7_su_hkey_idx ON schema16_7_su ( hkey )" ) == 1 );
+
+  /* Numeric tokens are packed behind a leading 1, keeping their length and leading zeros */
+  vault.format = 7 | token::api::TokenManager::NUMERIC_TOKENS;
+  statements   = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( vault.tokenFormat( ) == 7 );
+  assert( find( "token BIGINT NOT NULL" ) == 1 );
+  assert( token::api::TokenEntry::pack( "0041" ) == 10041 );
+  assert( token::api::TokenEntry::unpack( 10041 ) == "0041" );
+  assert( token::api::TokenEntry::pack( "999999999999999999" ) == 1999999999999999999ULL );
+  assert( token::api::TokenEntry::pack( "4111-1111" ) == 0 );
+  assert( token::api::TokenEntry::pack( "1234567890123456789" ) == 0 );
+
+  /* Permuted tokens keep their unique constraint, unless the partitioning cannot keep it */
+  vault.format         = 7 | token::api::TokenManager::PERMUTED_MODE;
+  options.partitioning = Schema::UNPARTITIONED;
+  statements           = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( find( "UNIQUE ( token )" ) == 1 );
+  assert( find( "schema16_7_su_counters" ) == 1 );
+  assert( find( "creation_date TIMESTAMP" ) == 1 );
+
+  options.partitioning = Schema::CREATED_RANGE;
+  statements           = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( find( "PARTITION BY RANGE ( creation_date )" ) == 1 );
+  assert( find( "UNIQUE ( token )" ) == 0 );
+  assert( find( "USING HASH ( token )" ) == 1 );
+
+  vault.durable        = true;
+  options.partitioning = Schema::HMAC_HASH;
+  statements           = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( find( "PARTITION BY HASH ( hmac )" ) == 1 );
+  assert( find( "PRIMARY KEY ( token )" ) == 0 );
+  assert( find( "UNIQUE ( hmac )" ) == 1 );
+
+  options.partitioning = Schema::TOKEN_HASH;
+
+  try {
+    Schema::vault( Schema::POSTGRESQL, vault, options );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+
+  /* Vaultless metadata rows need one unique constraint, which a range partitioning cannot keep */
+  vault.format         = 7 | token::api::TokenManager::FF1_MODE;
+  vault.durable        = false;
+  options.partitioning = Schema::UNPARTITIONED;
+  statements           = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( find( "UNIQUE ( token )" ) == 1 );
+  assert( find( "UNIQUE ( hmac )" ) == 0 );
+
+  options.partitioning = Schema::HMAC_HASH;
+  statements           = Schema::vault( Schema::POSTGRESQL, vault, options );
+
+  assert( find( "UNIQUE ( token )" ) == 0 );
+  assert( find( "UNIQUE ( hmac )" ) == 1 );
+
+  options.partitioning = Schema::CREATED_RANGE;
+
+  try {
+    Schema::vault( Schema::POSTGRESQL, vault, options );
+    assert( false );
+  } catch ( token::exceptions::TokenRangeError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+}
+
+static void propertiesCodec( ) {
+  token::api::Properties properties;
+  std::string            value;
+  auto                   names = std::make_shared< const token::api::PropertyDictionary >(
+    std::vector< std::string >{ "property" } );
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* Rows written as CBOR are still read */
+  auto cbor = nlohmann::json::to_cbor( nlohmann::json{ std::map< std::string, std::string >{ { "a", "b" } } } );
+
+  properties.assign( cbor );
+  assert( ( properties.get( "a", value ) ) && ( value == "b" ) );
+  assert( properties == token::api::Properties( { { "a", "b" } } ) );
+
+  properties = { { "property", "value" }, { "other", std::string( 200, 'x' ) } };
+
+  auto plain = properties.encode( );
+  auto coded = properties.encode( names );
+
+  assert( coded.size( ) < plain.size( ) );
+
+  /* Single lookups read the stored form, the map decodes it */
+  properties.assign( coded, names );
+  assert( !properties.empty( ) );
+  assert( ( properties.get( "other", value ) ) && ( value.size( ) == 200 ) );
+  assert( !properties.get( "missing", value ) );
+  assert( properties.encode( names ) == coded );
+  assert( properties.size( ) == 2 );
+  assert( properties.at( "property" ) == "value" );
+
+  /* Concurrent readers of a shared entry decode it once */
+  properties.assign( coded, names );
+
+  {
+    const token::api::Properties &shared = properties;
+    std::vector< std::thread >    readers;
+
+    for ( int num = 0; num < 8; ++num ) {
+      readers.emplace_back( [ &shared ]( ) {
+        auto copy = shared;
+
+        assert( shared.at( "property" ) == "value" );
+        assert( copy.size( ) == 2 );
+      } );
+    }
+
+    for ( auto &reader : readers ) {
+      reader.join( );
+    }
+  }
+
+  properties.assign( token::api::Properties( ).encode( ) );
+  assert( properties.empty( ) );
+
+  /* A dictionary name can not be read without the dictionary */
+  properties.assign( coded );
+
+  try {
+    properties.size( );
+    assert( false );
+  } catch ( token::exceptions::TokenSQLError &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+}
+
+static void arena( ) {
+  using token::api::core::Arena;
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  /* Outside of a scope, arena buffers come from the heap */
+  assert( Arena::current( ) == nullptr );
+  token::api::core::ArenaString heap( 100, 'x' );
+
+  const char *data = nullptr;
+
+  {
+    Arena::Scope outer;
+
+    {
+      Arena::Scope                  inner;
+      token::api::core::ArenaString value( 100, '4' );
+
+      data = value.data( );
+      assert( Arena::current( ) != nullptr );
+      assert( Arena::current( )->used( ) >= 100 );
+    }
+
+    /* Nested scopes share the request region, which is only rewound by the outermost */
+    assert( Arena::current( )->used( ) >= 100 );
+  }
+
+  /* The region is wiped when the request ends */
+  assert( Arena::current( ) == nullptr );
+  assert( *data == '\0' );
+
+  Arena::Scope again;
+  assert( Arena::current( )->used( ) == 0 );
+}
+
+static void workPool( ) {
+  token::api::core::WorkPool pool( 4 );
+  std::vector< size_t >      results( 1000 );
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  pool.run( results.size( ), [ &results ]( size_t index ) { results[ index ] = index * 2; } );
+
+  for ( size_t num = 0; num < results.size( ); ++num ) {
+    assert( results[ num ] == num * 2 );
+  }
+
+  try {
+    pool.run( 10, []( size_t index ) {
+      if ( index == 3 ) {
+        throw std::runtime_error( "task failure" );
+      }
+    } );
+    assert( false );
+  } catch ( std::runtime_error &ex ) {
+    std::cout << ex.what( ) << "\n";
+  }
+}
+
+static void cryptoExecutor( ) {
+  token::crypto::OpenSSLProvider::Options   options;
+  token::crypto::SimulatedProvider::Options simulation;
+  token::crypto::ExecutorProvider::Options  execution;
+  char                                      directory[] = "/tmp/tokenkeysXXXXXX";
+  std::vector< std::thread >                threads;
+  std::string                               value = "4111111111111111";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  assert( mkdtemp( directory ) != nullptr );
+
+  options.encKeyPath  = directory;
+  options.macKeyPath  = directory;
+  simulation.latency  = std::chrono::milliseconds( 2 );
+  simulation.sessions = 2;
+  execution.workers   = 2;
+
+  auto local     = std::make_shared< token::crypto::OpenSSLProvider >( options );
+  auto simulated = std::make_shared< token::crypto::SimulatedProvider >( local, simulation );
+  auto executor  = std::make_shared< token::crypto::ExecutorProvider >( simulated, execution );
+  auto encKey    = executor->createEncKey( "enc", { } );
+  auto macKey    = executor->createMacKey( "mac", { } );
+  auto expected  = local->getMacKey( "mac" )->hash( value );
+  auto before    = simulated->roundTrips( );
+
+  for ( int num = 0; num < 8; ++num ) {
+    threads.emplace_back( [ & ]( ) {
+      for ( int op = 0; op < 16; ++op ) {
+        auto plain = encKey->decrypt( encKey->encrypt( value ) );
+
+        assert( macKey->hash( value ) == expected );
+        assert( std::string( plain.begin( ), plain.end( ) ) == value );
+      }
+    } );
+  }
+
+  for ( auto &thread : threads ) {
+    thread.join( );
+  }
+
+  /* Concurrent calls are coalesced: fewer round trips than the 384 operations */
+  std::cout << "Round trips: " << simulated->roundTrips( ) - before << "\n";
+  assert( simulated->roundTrips( ) - before < 8 * 16 * 3 );
+
+  for ( auto name : { "enc", "mac" } ) {
+    unlink( ( std::string( directory ) + "/" + name ).c_str( ) );
+  }
+
+  rmdir( directory );
+}
+
+static void legacyKeys( ) {
+  using bytea = token::crypto::bytea;
+
+  /* Byte sequence keys (no output sizes): one call per operation through every path */
+  struct CountingEncKey : token::crypto::interface::EncKey {
+    mutable int calls = 0;
+
+    bytea encrypt( const bytea data ) const override {
+      ++calls;
+      return bytea( data.rbegin( ), data.rend( ) );
+    }
+
+    bytea decrypt( const bytea data ) const override {
+      ++calls;
+      return bytea( data.rbegin( ), data.rend( ) );
+    }
+  };
+
+  struct CountingMacKey : token::crypto::interface::MacKey {
+    mutable int calls = 0;
+
+    bytea hash( const bytea &data ) const override {
+      ++calls;
+      return bytea( 32, static_cast< uint8_t >( data.size( ) ) );
+    }
+  };
+
+  auto                                     counting = std::make_shared< CountingEncKey >( );
+  auto                                     hashing  = std::make_shared< CountingMacKey >( );
+  token::crypto::EncKey                    encKey   = counting;
+  token::crypto::MacKey                    macKey   = hashing;
+  std::vector< token::crypto::bytes_view > inputs;
+  std::vector< bytea >                     outputs;
+  std::string                              value = "4111111111111111";
+
+  std::cout << __PRETTY_FUNCTION__ << "\n";
+
+  assert( encKey->decrypt( encKey->encrypt( value ) ) == bytea( value.begin( ), value.end( ) ) );
+  assert( counting->calls == 2 );
+
+  assert( macKey->hash( value ).size( ) == 32 );
+  assert( hashing->calls == 1 );
+
+  for ( int num = 0; num < 4; ++num ) {
+    inputs.emplace_back( reinterpret_cast< const uint8_t * >( value.data( ) ), value.size( ) );
+  }
+
+  encKey->encryptBatch( inputs, outputs );
+  macKey->hashBatch( inputs, outputs );
+  assert( counting->calls == 2 + 4 );
+  assert( hashing->calls == 1 + 4 );
+}
+
+void log_init( void ) {
+  auto        sink    = std::make_shared< spdlog::sinks::stdout_color_sink_mt >( );
+  std::string names[] = {
+    "dbcpp::psql", "dbcpp::sqlite", "dbcpp::Pool", "dbcpp::Driver", "token::api::manager", "token::api::tokendb" };
+
+  for ( auto &&name : names ) {
+    token::api::create_logger( name, { sink } )->set_level( spdlog::level::trace );
+  }
+}
+
+int main( int argc, char *argv[] ) {
+  doRemove = argc == 1;
+
+  log_init( );
+
+  opensslProvider( );
+  multibufferKernels( );
+  cryptoExecutor( );
+  legacyKeys( );
+  workPool( );
+  arena( );
+  schema( );
+  propertiesCodec( );
 
   run_tests< SQLiteDB >( SQLITE3URI );
   unlink( SQLITE3_DB );
 
   run_tests< PgSqlDB >( PSQLURI );
+#ifdef TOKENGOV_PG_PIPELINE
+  run_tests< PgSqlPipelineDB >( PSQLURI );
+#endif
 
   return 0;
 }
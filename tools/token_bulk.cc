@@ -0,0 +1,173 @@
+
+#include "token/api.hh"
+#include <boost/program_options.hpp>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+
+namespace po = boost::program_options;
+
+/**
+ * Cryptographic provider modules export this symbol, returning a heap allocated provider
+ */
+static const char PROVIDER_SYMBOL[] = "tokengov_provider";
+
+using provider_f = token::crypto::Provider *( * ) ( );
+
+/**
+ * @brief Load a cryptographic provider from a shared object
+ * @param path shared object path
+ * @return provider
+ */
+static std::shared_ptr< token::crypto::Provider > loadProvider( const std::string &path ) {
+  void *handle = dlopen( path.c_str( ), RTLD_NOW | RTLD_GLOBAL );
+
+  if ( handle == nullptr ) {
+    throw std::runtime_error( "Unable to load provider " + path + ": " + dlerror( ) );
+  }
+
+  auto create = reinterpret_cast< provider_f >( dlsym( handle, PROVIDER_SYMBOL ) );
+
+  if ( create == nullptr ) {
+    throw std::runtime_error( "Provider " + path + " does not export " + PROVIDER_SYMBOL );
+  }
+
+  return std::shared_ptr< token::crypto::Provider >( create( ) );
+}
+
+/**
+ * @brief Parse a field mapping (source=vault)
+ * @param mapping mapping text
+ * @return field mapping
+ */
+static token::api::BulkTokenizer::Field parseField( const std::string &mapping ) {
+  auto pos = mapping.rfind( '=' );
+
+  if ( ( pos == std::string::npos ) || ( pos == 0 ) || ( pos + 1 == mapping.size( ) ) ) {
+    throw std::runtime_error( "Invalid field mapping (expected source=vault): " + mapping );
+  }
+
+  return { mapping.substr( 0, pos ), mapping.substr( pos + 1 ) };
+}
+
+int main( int argc, char *argv[] ) {
+  token::api::BulkTokenizer::Options options;
+  po::options_description            general( "General options" );
+  po::options_description            encOptions( "Encryption provider options" );
+  po::options_description            macOptions( "HMAC provider options" );
+  po::variables_map                  vm;
+  std::vector< std::string >         mappings;
+  std::string                        providerPath;
+  std::string                        database;
+  std::string                        input;
+  std::string                        output;
+  std::string                        format;
+  size_t                             connections   = 0;
+  size_t                             cryptoWorkers = 0;
+
+  general.add_options( )                                                                           //
+    ( "help,h", "show this help" )                                                                 //
+    ( "provider,p",
+      po::value( &providerPath )->default_value( "openssl" ),
+      "cryptographic provider: openssl (built-in), or a provider module" ) //
+    ( "crypto-workers",
+      po::value( &cryptoWorkers )->default_value( 0 ),
+      "pipeline provider calls across this many workers (0: call the provider directly)" ) //
+    ( "database,d", po::value( &database ), "token database uri" )                                 //
+    ( "connections,c", po::value( &connections )->default_value( 8 ), "database connections" )     //
+    ( "input,i", po::value( &input )->default_value( "-" ), "input file (- for stdin)" )           //
+    ( "output,o", po::value( &output )->default_value( "-" ), "output file (- for stdout)" )       //
+    ( "format,f", po::value( &format )->default_value( "csv" ), "record format: csv or ndjson" )   //
+    ( "delimiter", po::value( &options.delimiter )->default_value( ',' ), "csv field delimiter" )  //
+    ( "no-header", "csv input has no header row; map columns by index" )                           //
+    ( "map,m", po::value( &mappings )->composing( ), "field mapping: column/JSON pointer=vault" )   //
+    ( "workers,w", po::value( &options.workers )->default_value( options.workers ), "worker threads" ) //
+    ( "batch", po::value( &options.batchSize )->default_value( options.batchSize ), "records per batch" ) //
+    ( "queue", po::value( &options.queueDepth )->default_value( options.queueDepth ), "batches per queue" ) //
+    ( "window",
+      po::value( &options.dedupeWindow )->default_value( options.dedupeWindow ),
+      "durable values remembered per vault" );
+
+  try {
+    po::store( po::command_line_parser( argc, argv ).options( general ).allow_unregistered( ).run( ), vm );
+    po::notify( vm );
+
+    std::shared_ptr< token::crypto::Provider > provider;
+
+    if ( providerPath == "openssl" ) {
+      provider = std::make_shared< token::crypto::OpenSSLProvider >( );
+    } else {
+      provider = loadProvider( providerPath );
+    }
+
+    provider->cmdArgs( encOptions, macOptions );
+
+    if ( cryptoWorkers ) {
+      token::crypto::ExecutorProvider::Options executorOptions;
+
+      executorOptions.workers = cryptoWorkers;
+      provider                = std::make_shared< token::crypto::ExecutorProvider >( provider, executorOptions );
+    }
+
+    po::options_description all;
+    all.add( general ).add( encOptions ).add( macOptions );
+
+    if ( vm.count( "help" ) ) {
+      std::cout << "Usage: " << argv[ 0 ] << " [options]\n" << all << "\n";
+      return 0;
+    }
+
+    vm.clear( );
+    po::store( po::parse_command_line( argc, argv, all ), vm );
+    po::notify( vm );
+
+    if ( database.empty( ) ) {
+      throw std::runtime_error( "No token database specified" );
+    }
+
+    if ( mappings.empty( ) ) {
+      throw std::runtime_error( "No field mappings specified" );
+    }
+
+    if ( format == "csv" ) {
+      options.format = token::api::BulkTokenizer::CSV_FORMAT;
+    } else if ( format == "ndjson" ) {
+      options.format = token::api::BulkTokenizer::NDJSON_FORMAT;
+    } else {
+      throw std::runtime_error( "Unknown record format: " + format );
+    }
+
+    options.header = vm.count( "no-header" ) == 0;
+
+    for ( auto &mapping : mappings ) {
+      options.fields.emplace_back( parseField( mapping ) );
+    }
+
+    auto                      storage = std::make_shared< token::api::core::TokenDB >( database, connections );
+    token::api::TokenManager  manager( provider, storage );
+    token::api::BulkTokenizer tokenizer( manager, options );
+    std::ofstream             file;
+    std::ostream *            out = &std::cout;
+
+    if ( output != "-" ) {
+      file.open( output, std::ios::binary | std::ios::trunc );
+
+      if ( !file ) {
+        throw std::runtime_error( "Unable to open output " + output );
+      }
+
+      out = &file;
+    }
+
+    auto stats = tokenizer.run( input, *out );
+
+    std::cerr << "records: " << stats.records << ", values: " << stats.values << ", created: " << stats.created
+              << ", existing: " << stats.existing << ", deduplicated: " << stats.deduplicated
+              << ", fallbacks: " << stats.fallbacks << ", derived: " << stats.derived << "\n";
+  } catch ( std::exception &ex ) {
+    std::cerr << argv[ 0 ] << ": " << ex.what( ) << "\n";
+    return 1;
+  }
+
+  return 0;
+}